@@ -54,7 +54,8 @@ unsigned int Buffer::expand( unsigned int count )
     }
     else
     {
-        mAllocation += count;
+        // Grow geometrically so that buffers built up a piece at a time aren't copied for every piece
+        mAllocation += (count > mAllocation)?count:mAllocation;
         unsigned char *newStorage = new unsigned char[mAllocation];
         if ( mStorage )
         {
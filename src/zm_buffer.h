@@ -128,6 +128,19 @@ public:
         tidy( 0 );
         return( oldHead );
     }
+    // Make room for count bytes to be written directly after the end of the buffer
+    unsigned char *space( unsigned int count )
+    {
+        expand( count );
+        return( mTail );
+    }
+    // Take in bytes that have been written directly after the end of the buffer
+    unsigned int grow( unsigned int count )
+    {
+        mTail += count;
+        mSize += count;
+        return( mSize );
+    }
     // Add bytes to the end of the buffer
     unsigned int append( const unsigned char *pStorage, unsigned int pSize )
     {
@@ -169,6 +182,16 @@ public:
         }
     }
 
+    // Exchange contents with another buffer, without copying
+    void swap( Buffer &buffer )
+    {
+        unsigned char *storage = mStorage; mStorage = buffer.mStorage; buffer.mStorage = storage;
+        unsigned int allocation = mAllocation; mAllocation = buffer.mAllocation; buffer.mAllocation = allocation;
+        unsigned int size = mSize; mSize = buffer.mSize; buffer.mSize = size;
+        unsigned char *head = mHead; mHead = buffer.mHead; buffer.mHead = head;
+        unsigned char *tail = mTail; mTail = buffer.mTail; buffer.mTail = tail;
+    }
+
     Buffer &operator=( const Buffer &buffer )
     {
         assign( buffer );
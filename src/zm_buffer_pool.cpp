@@ -0,0 +1,224 @@
+//
+// ZoneMinder Image Buffer Pool Implementation, $Date$, $Revision$
+// Copyright (C) 2001-2008 Philip Coombes
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#include "zm.h"
+#include "zm_buffer_pool.h"
+
+#include <string.h>
+
+#include "zm_mem_utils.h"
+
+#define HEADER_SIZE 16
+#define MAGIC_USED 0x5a4d4255
+#define MAGIC_FREE 0x5a4d4246
+
+// Kept just before each buffer, which keeps the buffer 16 byte aligned
+struct ImageBufferPool::Header
+{
+	uint32_t magic;
+	int32_t size_class;     // -1 if too big to pool
+	union
+	{
+		size_t size;        // Usable size, while in use
+		Header *next;       // While on a free list
+	};
+};
+
+struct ImageBufferPool::ThreadCache
+{
+	Header *lists[NUM_CLASSES];
+	unsigned int counts[NUM_CLASSES];
+	size_t bytes;
+	Scratch scratch[NUM_SCRATCH];
+};
+
+pthread_key_t ImageBufferPool::smKey;
+pthread_once_t ImageBufferPool::smKeyOnce = PTHREAD_ONCE_INIT;
+ImageBufferPool::Stats ImageBufferPool::smStats = { 0, 0, 0, 0, 0, 0, 0, 0 };
+__thread ImageBufferPool::ThreadCache *ImageBufferPool::smCache = NULL;
+__thread bool ImageBufferPool::smReleased = false;
+__thread ImageBufferPool::Scratch ImageBufferPool::smOrphanScratch[NUM_SCRATCH];
+
+void ImageBufferPool::makeKey()
+{
+	int result = pthread_key_create( &smKey, ImageBufferPool::destroy );
+	if ( result != 0 )
+	{
+		Fatal( "Unable to create image buffer pool thread key: %s", strerror(result) );
+	}
+}
+
+void ImageBufferPool::destroy( void *cache )
+{
+	ThreadCache *thread = (ThreadCache *)cache;
+
+	// Anything freed from here on, this thread's scratch buffers and anything
+	// freed by other thread destructors, goes straight back to the heap
+	smCache = NULL;
+	smReleased = true;
+
+	for ( int i = 0; i < NUM_SCRATCH; i++ )
+	{
+		if ( thread->scratch[i].buffer )
+			Free( thread->scratch[i].buffer );
+	}
+	for ( int i = 0; i < NUM_CLASSES; i++ )
+	{
+		while ( Header *header = thread->lists[i] )
+		{
+			thread->lists[i] = header->next;
+			__sync_sub_and_fetch( &smStats.cached, classSize( i ) );
+			__sync_add_and_fetch( &smStats.heap_frees, 1 );
+			zm_freealigned( header );
+		}
+	}
+	delete thread;
+}
+
+ImageBufferPool::ThreadCache *ImageBufferPool::threadCache()
+{
+	if ( !smCache && !smReleased )
+	{
+		pthread_once( &smKeyOnce, ImageBufferPool::makeKey );
+
+		smCache = new ThreadCache;
+		memset( smCache, 0, sizeof(*smCache) );
+		pthread_setspecific( smKey, smCache );
+	}
+	return( smCache );
+}
+
+int ImageBufferPool::sizeClass( size_t size )
+{
+	if ( size <= ((size_t)1<<MIN_CLASS_SHIFT) )
+		return( 0 );
+	if ( size > ((size_t)1<<MAX_CLASS_SHIFT) )
+		return( -1 );
+
+	// The power of two below the size, then which quarter of the way on to the next it falls in
+	int shift = (int)(sizeof(unsigned long)*8) - 1 - __builtin_clzl( (unsigned long)(size-1) );
+	int step = (int)((size - ((size_t)1<<shift) + ((size_t)1<<(shift-2)) - 1) >> (shift-2));
+	return( ((shift-MIN_CLASS_SHIFT)*CLASS_STEPS) + step );
+}
+
+size_t ImageBufferPool::classSize( int size_class )
+{
+	if ( size_class == 0 )
+		return( (size_t)1<<MIN_CLASS_SHIFT );
+
+	int shift = MIN_CLASS_SHIFT + ((size_class-1)/CLASS_STEPS);
+	int step = ((size_class-1)%CLASS_STEPS)+1;
+	return( ((size_t)1<<shift) + ((size_t)step<<(shift-2)) );
+}
+
+uint8_t *ImageBufferPool::Alloc( size_t size )
+{
+	int size_class = sizeClass( size );
+	size_t usable = size_class >= 0 ? classSize( size_class ) : size;
+
+	Header *header = NULL;
+	ThreadCache *cache = size_class >= 0 ? threadCache() : NULL;
+	if ( cache && cache->lists[size_class] )
+	{
+		header = cache->lists[size_class];
+		cache->lists[size_class] = header->next;
+		cache->counts[size_class]--;
+		cache->bytes -= usable;
+		__sync_sub_and_fetch( &smStats.cached, usable );
+		__sync_add_and_fetch( &smStats.hits, 1 );
+	}
+	else
+	{
+		header = (Header *)zm_mallocaligned( 16, HEADER_SIZE+usable );
+		if ( !header )
+			return( NULL );
+		header->size_class = size_class;
+		__sync_add_and_fetch( &smStats.heap_allocs, 1 );
+	}
+	header->magic = MAGIC_USED;
+	header->size = usable;
+
+	__sync_add_and_fetch( &smStats.allocs, 1 );
+	unsigned long in_use = __sync_add_and_fetch( &smStats.in_use, usable );
+	unsigned long peak = smStats.peak_in_use;
+	while ( in_use > peak )
+	{
+		unsigned long previous = __sync_val_compare_and_swap( &smStats.peak_in_use, peak, in_use );
+		if ( previous == peak )
+			break;
+		peak = previous;
+	}
+
+	return( (uint8_t *)header + HEADER_SIZE );
+}
+
+void ImageBufferPool::Free( uint8_t *buffer )
+{
+	Header *header = (Header *)(buffer - HEADER_SIZE);
+	if ( header->magic != MAGIC_USED )
+	{
+		Error( "Attempt to free image buffer %p that is %s", buffer, header->magic==MAGIC_FREE?"already free":"not from the buffer pool" );
+		return;
+	}
+
+	size_t usable = header->size;
+	__sync_add_and_fetch( &smStats.releases, 1 );
+	__sync_sub_and_fetch( &smStats.in_use, usable );
+
+	int size_class = header->size_class;
+	ThreadCache *cache = size_class >= 0 ? threadCache() : NULL;
+	if ( cache && cache->counts[size_class] < MAX_CACHED_PER_CLASS && cache->bytes+usable <= (size_t)MAX_CACHED_BYTES )
+	{
+		header->magic = MAGIC_FREE;
+		header->next = cache->lists[size_class];
+		cache->lists[size_class] = header;
+		cache->counts[size_class]++;
+		cache->bytes += usable;
+		__sync_add_and_fetch( &smStats.cached, usable );
+	}
+	else
+	{
+		header->magic = 0;
+		__sync_add_and_fetch( &smStats.heap_frees, 1 );
+		zm_freealigned( header );
+	}
+}
+
+void ImageBufferPool::GetStats( Stats &stats )
+{
+	__sync_synchronize();
+	stats = smStats;
+}
+
+void ImageBufferPool::LogStats( const char *label )
+{
+	Stats stats;
+	GetStats( stats );
+	Debug( 1, "%s: Image buffers - %lu allocations, %.1f%% reused, %lu from heap, %lu to heap, %luKB in use, %luKB peak, %luKB cached",
+		label, stats.allocs, stats.allocs?(100.0*stats.hits)/stats.allocs:0.0, stats.heap_allocs, stats.heap_frees,
+		stats.in_use/1024, stats.peak_in_use/1024, stats.cached/1024 );
+}
+
+ImageBufferPool::Scratch &ImageBufferPool::ThreadScratch( int which )
+{
+	ThreadCache *cache = threadCache();
+	if ( !cache )
+		return( smOrphanScratch[which] );
+	return( cache->scratch[which] );
+}
@@ -0,0 +1,96 @@
+//
+// ZoneMinder Image Buffer Pool Interface, $Date$, $Revision$
+// Copyright (C) 2001-2008 Philip Coombes
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef ZM_BUFFER_POOL_H
+#define ZM_BUFFER_POOL_H
+
+#include "zm.h"
+
+#include <pthread.h>
+
+//
+// Recycles the 16 byte aligned buffers that images allocate for themselves.
+// Requests are rounded up to one of four size classes per power of two and
+// freed buffers are kept on free lists belonging to the thread that freed
+// them, so the copies, scales, rotations and other temporary images made
+// for every frame reuse the buffers of the previous frame instead of going
+// back to the heap. Each thread keeps a limited number of buffers of each
+// class, and gives them all back to the heap when it exits. Threads can also
+// keep pool buffers as scratch space of their own between frames, which are
+// given back the same way.
+//
+class ImageBufferPool
+{
+public:
+	enum { MIN_CLASS_SHIFT=12 };                // Smallest class is 4KB
+	enum { MAX_CLASS_SHIFT=27 };                // Largest pooled buffer is 128MB
+	enum { CLASS_STEPS=4 };                     // Classes per power of two
+	enum { NUM_CLASSES=((MAX_CLASS_SHIFT-MIN_CLASS_SHIFT)*CLASS_STEPS)+1 };
+	enum { MAX_CACHED_PER_CLASS=8 };
+	enum { MAX_CACHED_BYTES=256*1024*1024 };    // Per thread
+
+	struct Stats
+	{
+		unsigned long allocs;       // Buffers handed out
+		unsigned long hits;         // Of which came from a free list
+		unsigned long releases;     // Buffers given back
+		unsigned long heap_allocs;  // Buffers taken from the heap
+		unsigned long heap_frees;   // Buffers given back to the heap
+		unsigned long in_use;       // Bytes held by images
+		unsigned long peak_in_use;
+		unsigned long cached;       // Bytes waiting on free lists
+	};
+
+	enum { SCRATCH_TRANSFORM, SCRATCH_EDGES, NUM_SCRATCH };
+
+	struct Scratch
+	{
+		uint8_t *buffer;            // From Alloc, or NULL
+		size_t allocation;
+	};
+
+private:
+	struct Header;
+	struct ThreadCache;
+
+	static pthread_key_t smKey;
+	static pthread_once_t smKeyOnce;
+	static Stats smStats;
+	static __thread ThreadCache *smCache;
+	static __thread bool smReleased;      // The thread's cache has been destroyed
+	static __thread Scratch smOrphanScratch[NUM_SCRATCH];    // Only used once it has
+
+private:
+	static void makeKey();
+	static void destroy( void *cache );
+	static ThreadCache *threadCache();
+	static int sizeClass( size_t size );
+	static size_t classSize( int size_class );
+
+public:
+	static uint8_t *Alloc( size_t size );
+	static void Free( uint8_t *buffer );
+	static void GetStats( Stats &stats );
+	static void LogStats( const char *label );
+	// The calling thread's scratch buffer of the given kind, owned by the caller
+	// until the thread exits when whatever it then holds is freed
+	static Scratch &ThreadScratch( int which );
+};
+
+#endif // ZM_BUFFER_POOL_H
@@ -34,7 +34,7 @@ Camera::Camera( int p_id, SourceType p_type, int p_width, int p_height, int p_co
     capture( p_capture )
 {
 	pixels = width * height;
-	imagesize = pixels * colours;
+	imagesize = ImageBufferSize(width, height, colours, subpixelorder);
 	
 	Debug(2,"New camera id: %d width: %d height: %d colours: %d subpixelorder: %d capture: %d",id,width,height,colours,subpixelorder,capture);
 	
@@ -74,10 +74,18 @@ public:
 
     bool CanCapture() const { return( capture ); }
     
+	// How many slots to add to the monitor's image ring for the camera to capture into ahead of the current one
+	virtual int CaptureBufferReserve() const { return( 0 ); }
+	// Offers the monitor's shared image ring to cameras that can capture straight into it
+	virtual void SetCaptureBuffers( uint8_t */*p_buffers*/, int /*p_count*/ ) { }
 	virtual int PrimeCapture() { return( 0 ); }
 	virtual int PreCapture()=0;
 	virtual int Capture( Image &image )=0;
 	virtual int PostCapture()=0;
+	// Gives when the last image was actually captured, if the camera knows better than the caller
+	virtual bool CaptureTime( struct timeval */*p_time*/ ) const { return( false ); }
+	// Anything the camera has to add to the periodic capture rate report, covering the time since the last one
+	virtual const char *CaptureReport() { return( NULL ); }
 };
 
 #endif // ZM_CAMERA_H
@@ -18,6 +18,7 @@
 //
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <sys/un.h>
@@ -48,6 +49,7 @@ bool Event::initialised = false;
 char Event::capture_file_format[PATH_MAX];
 char Event::analyse_file_format[PATH_MAX];
 char Event::general_file_format[PATH_MAX];
+const char *Event::index_file_name = "frames.idx";
 
 int Event::pre_alarm_count = 0;
 Event::PreAlarmData Event::pre_alarm_data[MAX_PRE_ALARM_FRAMES] = { { 0 } };
@@ -56,7 +58,8 @@ Event::Event( Monitor *p_monitor, struct timeval p_start_time, const std::string
     monitor( p_monitor ),
     start_time( p_start_time ),
     cause( p_cause ),
-    noteSetMap( p_noteSetMap )
+    noteSetMap( p_noteSetMap ),
+    index_fp( 0 )
 {
     if ( !initialised )
         Initialise();
@@ -161,10 +164,43 @@ Event::Event( Monitor *p_monitor, struct timeval p_start_time, const std::string
             Fatal( "Can't fopen %s: %s", id_file, strerror(errno));
     }
     last_db_frame = 0;
+
+    char index_file[PATH_MAX];
+    if ( snprintf( index_file, sizeof(index_file), "%s/%s", path, index_file_name ) >= (int)sizeof(index_file) )
+    {
+        Error( "Frame index path for event %d is too long, not writing an index", id );
+    }
+    else if ( (index_fp = fopen( index_file, "w" )) )
+    {
+        FrameIndexHeader header;
+        memset( &header, 0, sizeof(header) );
+        memcpy( header.magic, "ZMFI", sizeof(header.magic) );
+        header.version = INDEX_VERSION;
+        header.record_size = sizeof(FrameIndexRecord);
+        header.event_id = id;
+        header.start_sec = start_time.tv_sec;
+        header.start_usec = start_time.tv_usec;
+        if ( fwrite( &header, sizeof(header), 1, index_fp ) != 1 )
+        {
+            Error( "Can't write frame index header to %s: %s", index_file, strerror(errno) );
+            fclose( index_fp );
+            index_fp = 0;
+        }
+    }
+    else
+    {
+        Error( "Can't fopen %s: %s", index_file, strerror(errno) );
+    }
 }
 
 Event::~Event()
 {
+    if ( index_fp )
+    {
+        fclose( index_fp );
+        index_fp = 0;
+    }
+
     if ( frames > last_db_frame )
     {
         struct DeltaTimeval delta_time;
@@ -515,6 +551,7 @@ void Event::AddFramesInternal( int n_frames, int start_frame, Image **images, st
 
         Debug( 1, "Writing pre-capture frame %d", frames );
         WriteFrameImage( images[i], *(timestamps[i]), event_file );
+        WriteFrameIndex( frames, *(timestamps[i]), 0 );
 
         struct DeltaTimeval delta_time;
         DELTA_TIMEVAL( delta_time, *(timestamps[i]), start_time, DT_PREC_2 );
@@ -542,7 +579,28 @@ void Event::AddFramesInternal( int n_frames, int start_frame, Image **images, st
     }
 }
 
-void Event::AddFrame( Image *image, struct timeval timestamp, int score, Image *alarm_image )
+void Event::WriteFrameIndex( int frame_id, struct timeval timestamp, int score )
+{
+    if ( !index_fp )
+        return;
+
+    FrameIndexRecord record;
+    record.frame_id = frame_id;
+    record.score = score;
+    record.sec = timestamp.tv_sec;
+    record.usec = timestamp.tv_usec;
+    if ( fwrite( &record, sizeof(record), 1, index_fp ) != 1 )
+    {
+        Error( "Can't write frame index record for frame %d: %s", frame_id, strerror(errno) );
+        fclose( index_fp );
+        index_fp = 0;
+        return;
+    }
+    // Flushed every frame so events still being recorded can be streamed
+    fflush( index_fp );
+}
+
+void Event::AddFrame( Image *image, struct timeval timestamp, int score, const AlarmMask *alarm_masks, int n_alarm_masks )
 {
     if ( !timestamp.tv_sec )
     {
@@ -557,6 +615,7 @@ void Event::AddFrame( Image *image, struct timeval timestamp, int score, Image *
 
     Debug( 1, "Writing capture frame %d", frames );
     WriteFrameImage( image, timestamp, event_file );
+    WriteFrameIndex( frames, timestamp, score );
 
     struct DeltaTimeval delta_time;
     DELTA_TIMEVAL( delta_time, timestamp, start_time, DT_PREC_2 );
@@ -599,12 +658,17 @@ void Event::AddFrame( Image *image, struct timeval timestamp, int score, Image *
         if ( score > (int)max_score )
             max_score = score;
 
-        if ( alarm_image )
+        if ( n_alarm_masks )
         {
             snprintf( event_file, sizeof(event_file), analyse_file_format, path, frames );
 
+            // The analysis image is only put together now that it is being written
+            Image alarm_image( *image );
+            for ( int i = 0; i < n_alarm_masks; i++ )
+                alarm_image.Overlay( *alarm_masks[i].image, alarm_masks[i].x, alarm_masks[i].y );
+
             Debug( 1, "Writing analysis frame %d", frames );
-            WriteFrameImage( alarm_image, timestamp, event_file, true );
+            WriteFrameImage( &alarm_image, timestamp, event_file, true );
         }
     }
     
@@ -690,18 +754,13 @@ bool EventStream::loadInitialEventData( int monitor_id, time_t event_time )
         curr_frame_id = 1;
         if ( event_time >= event_data->start_time )
         {
-            for (unsigned int i = 0; i < event_data->frame_count; i++ )
+            int frame_id = frameIdForOffset( event_time-event_data->start_time );
+            if ( frame_id )
             {
-                //Info( "eft %d > et %d", event_data->frames[i].timestamp, event_time );
-                if ( event_data->frames[i].timestamp >= event_time )
-                {
-                    curr_frame_id = i+1;
-                    Debug( 3, "Set cst:%.2f", curr_stream_time );
-                    Debug( 3, "Set cfid:%d", curr_frame_id );
-                    break;
-                }
+                curr_frame_id = frame_id;
+                Debug( 3, "Set cst:%.2f", curr_stream_time );
+                Debug( 3, "Set cfid:%d", curr_frame_id );
             }
-            Debug( 3, "Skipping %ld frames", event_data->frame_count );
         }
     }
     return( true );
@@ -724,11 +783,106 @@ bool EventStream::loadInitialEventData( int init_event_id, int init_frame_id )
     return( true );
 }
 
+// Loads the frames of the current event from the index written alongside
+// its images. Returns false if there isn't a usable one.
+bool EventStream::loadFrameIndex()
+{
+    char index_file[PATH_MAX];
+    if ( snprintf( index_file, sizeof(index_file), "%s/%s", event_data->path, Event::index_file_name ) >= (int)sizeof(index_file) )
+    {
+        Error( "Frame index path for event %lu is too long, falling back to DB", event_data->event_id );
+        return( false );
+    }
+
+    int fd = open( index_file, O_RDONLY );
+    if ( fd < 0 )
+    {
+        Debug( 2, "No frame index %s, falling back to DB: %s", index_file, strerror(errno) );
+        return( false );
+    }
+
+    struct stat stat_buf;
+    if ( fstat( fd, &stat_buf ) < 0 || (size_t)stat_buf.st_size < sizeof(Event::FrameIndexHeader)+sizeof(Event::FrameIndexRecord) )
+    {
+        Debug( 2, "Frame index %s empty or unreadable, falling back to DB", index_file );
+        close( fd );
+        return( false );
+    }
+
+    void *index = mmap( NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( index == MAP_FAILED )
+    {
+        Error( "Can't mmap frame index %s: %s", index_file, strerror(errno) );
+        return( false );
+    }
+
+    const Event::FrameIndexHeader *header = (const Event::FrameIndexHeader *)index;
+    if ( memcmp( header->magic, "ZMFI", sizeof(header->magic) ) || header->version != Event::INDEX_VERSION || header->record_size != sizeof(Event::FrameIndexRecord) )
+    {
+        Warning( "Frame index %s has unexpected format, falling back to DB", index_file );
+        munmap( index, stat_buf.st_size );
+        return( false );
+    }
+
+    // A record may be part written if the event is still being recorded
+    int n_records = (stat_buf.st_size-sizeof(*header))/sizeof(Event::FrameIndexRecord);
+    const Event::FrameIndexRecord *records = (const Event::FrameIndexRecord *)(header+1);
+
+    double start_time = header->start_sec + (header->start_usec/1000000.0);
+    event_data->n_frames = n_records;
+    event_data->frame_count = records[n_records-1].frame_id;
+    event_data->frames = new FrameData[event_data->frame_count];
+
+    unsigned int last_id = 0;
+    double last_time = start_time;
+    for ( int i = 0; i < n_records; i++ )
+    {
+        unsigned int id = records[i].frame_id;
+        if ( id <= last_id || id > event_data->frame_count )
+            continue;
+        double frame_time = records[i].sec + (records[i].usec/1000000.0);
+        double frame_delta = (frame_time-last_time)/(id-last_id);
+        for ( unsigned int j = last_id+1; j <= id; j++ )
+        {
+            event_data->frames[j-1].timestamp = (time_t)(last_time + ((j-last_id)*frame_delta));
+            event_data->frames[j-1].offset = (time_t)(event_data->frames[j-1].timestamp-event_data->start_time);
+            event_data->frames[j-1].delta = j>1?frame_delta:0.0;
+            event_data->frames[j-1].in_db = (j == id);
+        }
+        last_id = id;
+        last_time = frame_time;
+    }
+    event_data->frame_count = last_id;
+    event_data->duration = last_time - (records[0].sec + (records[0].usec/1000000.0));
+
+    munmap( index, stat_buf.st_size );
+
+    Debug( 2, "Loaded %d frames from index %s", n_records, index_file );
+    return( true );
+}
+
+// Returns the id of the first frame at or after the given offset into the event, or 0 if there is none
+int EventStream::frameIdForOffset( double offset ) const
+{
+    unsigned int lo = 0;
+    unsigned int hi = event_data->frame_count;
+    while ( lo < hi )
+    {
+        unsigned int mid = lo+((hi-lo)/2);
+        if ( event_data->frames[mid].offset < offset )
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return( lo < event_data->frame_count?lo+1:0 );
+}
+
 bool EventStream::loadEventData( int event_id )
 {
     static char sql[ZM_SQL_MED_BUFSIZ];
 
-    snprintf( sql, sizeof(sql), "select M.Id, M.Name, E.Frames, unix_timestamp( StartTime ) as StartTimestamp, max(F.Delta)-min(F.Delta) as Duration from Events as E inner join Monitors as M on E.MonitorId = M.Id inner join Frames as F on E.Id = F.EventId where E.Id = %d group by E.Id", event_id );
+    snprintf( sql, sizeof(sql), "select M.Id, M.Name, E.Frames, unix_timestamp( StartTime ) as StartTimestamp from Events as E inner join Monitors as M on E.MonitorId = M.Id where E.Id = %d", event_id );
 
     if ( mysql_query( &dbconn, sql ) )
     {
@@ -777,70 +931,76 @@ bool EventStream::loadEventData( int event_id )
             snprintf( event_data->path, sizeof(event_data->path), "%s/%s/%ld/%ld", staticConfig.PATH_WEB.c_str(), config.dir_events, event_data->monitor_id, event_data->event_id );
     }
     event_data->frame_count = atoi(dbrow[2]);
-    event_data->duration = atof(dbrow[4]);
-
-    updateFrameRate( (double)event_data->frame_count/event_data->duration );
 
     mysql_free_result( result );
 
-    snprintf( sql, sizeof(sql), "select FrameId, unix_timestamp( `TimeStamp` ), Delta from Frames where EventId = %d order by FrameId asc", event_id );
-    if ( mysql_query( &dbconn, sql ) )
+    if ( !loadFrameIndex() )
     {
-        Error( "Can't run query: %s", mysql_error( &dbconn ) );
-        exit( mysql_errno( &dbconn ) );
-    }
+        // Older events, or ones whose index couldn't be written, only have their frames in the DB
+        snprintf( sql, sizeof(sql), "select FrameId, unix_timestamp( `TimeStamp` ), Delta from Frames where EventId = %d order by FrameId asc", event_id );
+        if ( mysql_query( &dbconn, sql ) )
+        {
+            Error( "Can't run query: %s", mysql_error( &dbconn ) );
+            exit( mysql_errno( &dbconn ) );
+        }
 
-    result = mysql_store_result( &dbconn );
-    if ( !result )
-    {
-        Error( "Can't use query result: %s", mysql_error( &dbconn ) );
-        exit( mysql_errno( &dbconn ) );
-    }
+        result = mysql_store_result( &dbconn );
+        if ( !result )
+        {
+            Error( "Can't use query result: %s", mysql_error( &dbconn ) );
+            exit( mysql_errno( &dbconn ) );
+        }
 
-    event_data->n_frames = mysql_num_rows( result );
+        event_data->n_frames = mysql_num_rows( result );
 
-    event_data->frames = new FrameData[event_data->frame_count];
-    int id, last_id = 0;
-    time_t timestamp, last_timestamp = event_data->start_time;
-    double delta, last_delta = 0.0;
-    while ( ( dbrow = mysql_fetch_row( result ) ) )
-    {
-        id = atoi(dbrow[0]);
-        timestamp = atoi(dbrow[1]);
-        delta = atof(dbrow[2]);
-        int id_diff = id - last_id;
-        double frame_delta = (delta-last_delta)/id_diff;
-        if ( id_diff > 1 )
+        event_data->frames = new FrameData[event_data->frame_count];
+        int id, last_id = 0;
+        time_t timestamp, last_timestamp = event_data->start_time;
+        double delta, last_delta = 0.0, first_delta = 0.0;
+        while ( ( dbrow = mysql_fetch_row( result ) ) )
         {
-            for ( int i = last_id+1; i < id; i++ )
+            id = atoi(dbrow[0]);
+            timestamp = atoi(dbrow[1]);
+            delta = atof(dbrow[2]);
+            if ( !last_id )
+                first_delta = delta;
+            int id_diff = id - last_id;
+            double frame_delta = (delta-last_delta)/id_diff;
+            if ( id_diff > 1 )
             {
-                event_data->frames[i-1].timestamp = (time_t)(last_timestamp + ((i-last_id)*frame_delta));
-                event_data->frames[i-1].offset = (time_t)(event_data->frames[i-1].timestamp-event_data->start_time);
-                event_data->frames[i-1].delta = frame_delta;
-                event_data->frames[i-1].in_db = false;
+                for ( int i = last_id+1; i < id; i++ )
+                {
+                    event_data->frames[i-1].timestamp = (time_t)(last_timestamp + ((i-last_id)*frame_delta));
+                    event_data->frames[i-1].offset = (time_t)(event_data->frames[i-1].timestamp-event_data->start_time);
+                    event_data->frames[i-1].delta = frame_delta;
+                    event_data->frames[i-1].in_db = false;
+                }
             }
+            event_data->frames[id-1].timestamp = timestamp;
+            event_data->frames[id-1].offset = (time_t)(event_data->frames[id-1].timestamp-event_data->start_time);
+            event_data->frames[id-1].delta = id>1?frame_delta:0.0;
+            event_data->frames[id-1].in_db = true;
+            last_id = id;
+            last_delta = delta;
+            last_timestamp = timestamp;
         }
-        event_data->frames[id-1].timestamp = timestamp;
-        event_data->frames[id-1].offset = (time_t)(event_data->frames[id-1].timestamp-event_data->start_time);
-        event_data->frames[id-1].delta = id>1?frame_delta:0.0;
-        event_data->frames[id-1].in_db = true;
-        last_id = id;
-        last_delta = delta;
-        last_timestamp = timestamp;
-    }
-    if ( mysql_errno( &dbconn ) )
-    {
-        Error( "Can't fetch row: %s", mysql_error( &dbconn ) );
-        exit( mysql_errno( &dbconn ) );
+        if ( mysql_errno( &dbconn ) )
+        {
+            Error( "Can't fetch row: %s", mysql_error( &dbconn ) );
+            exit( mysql_errno( &dbconn ) );
+        }
+        event_data->duration = last_delta-first_delta;
+
+        mysql_free_result( result );
     }
 
+    updateFrameRate( (double)event_data->frame_count/event_data->duration );
+
     //for ( int i = 0; i < 250; i++ )
     //{
         //Info( "%d -> %d @ %f (%d)", i+1, event_data->frames[i].timestamp, event_data->frames[i].delta, event_data->frames[i].in_db );
     //}
 
-    mysql_free_result( result );
-
     if ( forceEventChange || mode == MODE_ALL_GAPLESS )
     {
         if ( replay_rate > 0 )
@@ -1069,7 +1229,9 @@ void EventStream::processCommand( const CmdMsg *msg )
         case CMD_SEEK :
         {
             int offset = ((unsigned char)msg->msg_data[1]<<24)|((unsigned char)msg->msg_data[2]<<16)|((unsigned char)msg->msg_data[3]<<8)|(unsigned char)msg->msg_data[4];
-            curr_frame_id = (int)(event_data->frame_count*offset/event_data->duration);
+            curr_frame_id = frameIdForOffset( offset );
+            if ( !curr_frame_id )
+                curr_frame_id = event_data->frame_count;
             Debug( 1, "Got SEEK command, to %d (new cfid: %d)", offset, curr_frame_id );
             break;
         }
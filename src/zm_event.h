@@ -59,10 +59,43 @@ protected:
 protected:
 	static int		sd;
 
+protected:
+    // Index of the frames in an event, written to the event directory as
+    // they are recorded so streams can load and seek without the database
+	static const char	*index_file_name;
+    enum { INDEX_VERSION=1 };
+
+    struct FrameIndexHeader
+    {
+        char        magic[4];
+        uint32_t    version;
+        uint32_t    record_size;
+        uint32_t    event_id;
+        int64_t     start_sec;
+        int64_t     start_usec;
+    };
+
+    struct FrameIndexRecord
+    {
+        uint32_t    frame_id;
+        int32_t     score;      // As for AddFrame, negative for bulk frames
+        int64_t     sec;
+        int64_t     usec;
+    };
+
 public:
     typedef std::set<std::string> StringSet;
     typedef std::map<std::string,StringSet> StringSetMap;
 
+    // The alarm image of a zone and where it goes on a frame, only overlaid
+    // on a copy of the frame when the frame's analysis image is written
+    struct AlarmMask
+    {
+        const Image *image;
+        int x;              // Where the mask goes on the frame, as a Coord
+        int y;
+    };
+
 protected:
     typedef enum { NORMAL, BULK, ALARM } FrameType;
 
@@ -71,7 +104,8 @@ protected:
 		Image *image;
 		struct timeval timestamp;
 		unsigned int score;
-		Image *alarm_frame;
+		int n_alarm_masks;
+		AlarmMask *alarm_masks;	// Copies, as the zones' images change with each frame
 	};
 
 	static int pre_alarm_count;
@@ -92,6 +126,7 @@ protected:
 
 protected:
 	int				last_db_frame;
+	FILE			*index_fp;
 
 protected:
 	static void Initialise()
@@ -131,10 +166,11 @@ public:
     void updateNotes( const StringSetMap &stringSetMap );
 
 	void AddFrames( int n_frames, Image **images, struct timeval **timestamps );
-	void AddFrame( Image *image, struct timeval timestamp, int score=0, Image *alarm_frame=NULL );
+	void AddFrame( Image *image, struct timeval timestamp, int score=0, const AlarmMask *alarm_masks=NULL, int n_alarm_masks=0 );
 
 private:
 	void AddFramesInternal( int n_frames, int start_frame, Image **images, struct timeval **timestamps );
+	void WriteFrameIndex( int frame_id, struct timeval timestamp, int score );
 
 public:
     static const char *getSubPath( struct tm *time )
@@ -160,20 +196,28 @@ public:
 			for ( int i = 0; i < MAX_PRE_ALARM_FRAMES; i++ )
 			{
 				delete pre_alarm_data[i].image;
-				delete pre_alarm_data[i].alarm_frame;
+				for ( int j = 0; j < pre_alarm_data[i].n_alarm_masks; j++ )
+					delete pre_alarm_data[i].alarm_masks[j].image;
+				delete[] pre_alarm_data[i].alarm_masks;
 			}
 			memset( pre_alarm_data, 0, sizeof(pre_alarm_data) );
 		}
 		pre_alarm_count = 0;
 	}
-	static void AddPreAlarmFrame( Image *image, struct timeval timestamp, int score=0, Image *alarm_frame=NULL )
+	static void AddPreAlarmFrame( Image *image, struct timeval timestamp, int score=0, const AlarmMask *alarm_masks=NULL, int n_alarm_masks=0 )
 	{
 		pre_alarm_data[pre_alarm_count].image = new Image( *image );
 		pre_alarm_data[pre_alarm_count].timestamp = timestamp;
 		pre_alarm_data[pre_alarm_count].score = score;
-		if ( alarm_frame )
+		if ( n_alarm_masks )
 		{
-			pre_alarm_data[pre_alarm_count].alarm_frame = new Image( *alarm_frame );
+			pre_alarm_data[pre_alarm_count].n_alarm_masks = n_alarm_masks;
+			pre_alarm_data[pre_alarm_count].alarm_masks = new AlarmMask[n_alarm_masks];
+			for ( int i = 0; i < n_alarm_masks; i++ )
+			{
+				pre_alarm_data[pre_alarm_count].alarm_masks[i] = alarm_masks[i];
+				pre_alarm_data[pre_alarm_count].alarm_masks[i].image = new Image( *alarm_masks[i].image );
+			}
 		}
 		pre_alarm_count++;
 	}
@@ -181,7 +225,7 @@ public:
 	{
 		for ( int i = 0; i < pre_alarm_count; i++ )
 		{
-			AddFrame( pre_alarm_data[i].image, pre_alarm_data[i].timestamp, pre_alarm_data[i].score, pre_alarm_data[i].alarm_frame );
+			AddFrame( pre_alarm_data[i].image, pre_alarm_data[i].timestamp, pre_alarm_data[i].score, pre_alarm_data[i].alarm_masks, pre_alarm_data[i].n_alarm_masks );
 		}
 		EmptyPreAlarmFrames();
 	}
@@ -229,7 +273,9 @@ protected:
     EventData *event_data;
 
 protected:
+    bool loadFrameIndex();
     bool loadEventData( int event_id );
+    int frameIdForOffset( double offset ) const;
     bool loadInitialEventData( int init_event_id, int init_frame_id );
     bool loadInitialEventData( int monitor_id, time_t event_time );
 
@@ -21,6 +21,9 @@
 #include "zm_image.h"
 #include "zm_rgb.h"
 
+#include <unistd.h>
+#include <sys/time.h>
+
 #if HAVE_LIBAVCODEC || HAVE_LIBAVUTIL || HAVE_LIBSWSCALE
 
 #if HAVE_LIBAVUTIL
@@ -71,6 +74,75 @@ enum PixelFormat GetFFMPEGPixelFormat(unsigned int p_colours, unsigned p_subpixe
 }
 #endif // HAVE_LIBAVUTIL
 
+#if HAVE_LIBAVCODEC
+static int64_t DecodeClock() {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return ((int64_t)now.tv_sec*1000000)+now.tv_usec;
+}
+
+void SetDecoderThreads(AVCodecContext* p_codec_context) {
+	int threads = config.ffmpeg_decode_threads;
+	if(threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if(threads <= 0)
+			threads = 1;
+	}
+
+#ifdef FF_THREAD_FRAME
+	/* Slice threads add no delay but only help streams encoded with several slices,
+	   frame threads work with anything but hold back a frame for each thread */
+	p_codec_context->thread_type = strcmp(config.ffmpeg_decode_thread_type, "frame")==0?FF_THREAD_FRAME:FF_THREAD_SLICE;
+	p_codec_context->thread_count = threads;
+#else
+	if(threads > 1 && avcodec_thread_init(p_codec_context, threads) < 0) {
+		Warning("Unable to start %d decoder threads", threads);
+		return;
+	}
+#endif
+	Debug(2, "Using %d %s decoder threads", threads, config.ffmpeg_decode_thread_type);
+}
+
+DecodeTimer::DecodeTimer() : frames(0), total_latency(0.0), max_latency(0.0) {
+	report[0] = '\0';
+}
+
+/* Stamps the packet about to be decoded, the decoder hands the stamp back with the frame it produces */
+void DecodeTimer::PacketSent(AVCodecContext* p_codec_context) {
+	p_codec_context->reordered_opaque = DecodeClock();
+}
+
+/* Returns the latency in milliseconds of a completed frame */
+double DecodeTimer::FrameReceived(const AVFrame* p_frame) {
+	if(p_frame->reordered_opaque <= 0 || p_frame->reordered_opaque == (int64_t)AV_NOPTS_VALUE)
+		return 0.0;
+
+	double latency = (DecodeClock()-p_frame->reordered_opaque)/1000.0;
+	frames++;
+	total_latency += latency;
+	if(latency > max_latency)
+		max_latency = latency;
+	return latency;
+}
+
+/* Summarises the decoding since the last report */
+const char* DecodeTimer::Report(const AVCodecContext* p_codec_context) {
+	const char* thread_type = "";
+#ifdef FF_THREAD_FRAME
+	if(p_codec_context->thread_count > 1)
+		thread_type = (p_codec_context->active_thread_type == FF_THREAD_FRAME)?" frame":((p_codec_context->active_thread_type == FF_THREAD_SLICE)?" slice":" unused");
+#endif
+	if(frames) {
+		snprintf(report, sizeof(report), "decoding with %d%s threads at %.1f ms latency (%.1f ms max)", p_codec_context->thread_count, thread_type, total_latency/frames, max_latency);
+	} else {
+		snprintf(report, sizeof(report), "decoding with %d%s threads", p_codec_context->thread_count, thread_type);
+	}
+	frames = 0;
+	total_latency = max_latency = 0.0;
+	return report;
+}
+#endif // HAVE_LIBAVCODEC
+
 #if HAVE_LIBSWSCALE && HAVE_LIBAVUTIL
 SWScale::SWScale() : gotdefaults(false), swscale_ctx(NULL), input_avframe(NULL), output_avframe(NULL) {
 	Debug(4,"SWScale object created");
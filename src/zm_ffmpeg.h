@@ -103,6 +103,25 @@ enum PixelFormat GetFFMPEGPixelFormat(unsigned int p_colours, unsigned p_subpixe
 #endif // HAVE_LIBAVUTIL
 
 
+#if HAVE_LIBAVCODEC
+/* Applies the decoder threading options to a codec context before it is opened */
+void SetDecoderThreads(AVCodecContext* p_codec_context);
+
+/* Measures how long frames take to come out of a decoder, from their packet going in */
+class DecodeTimer {
+public:
+	DecodeTimer();
+	void PacketSent(AVCodecContext* p_codec_context);
+	double FrameReceived(const AVFrame* p_frame);
+	const char* Report(const AVCodecContext* p_codec_context);
+protected:
+	unsigned int frames;
+	double total_latency;
+	double max_latency;
+	char report[128];
+};
+#endif // HAVE_LIBAVCODEC
+
 /* SWScale wrapper class to make our life easier and reduce code reuse */
 #if HAVE_LIBSWSCALE && HAVE_LIBAVUTIL
 class SWScale {
@@ -38,6 +38,8 @@ FfmpegCamera::FfmpegCamera( int p_id, const std::string &p_path, int p_width, in
 	mCodec = NULL;
 	mRawFrame = NULL;
 	mFrame = NULL;
+	mConvertMethod = CONVERT_UNKNOWN;
+	fptr_convert_planes = NULL;
 	frameCount = 0;
 	
 #if HAVE_LIBSWSCALE    
@@ -50,6 +52,11 @@ FfmpegCamera::FfmpegCamera( int p_id, const std::string &p_path, int p_width, in
 	} else if(colours == ZM_COLOUR_RGB24) {
 		subpixelorder = ZM_SUBPIX_ORDER_RGB;
 		imagePixFormat = PIX_FMT_RGB24;
+	} else if(colours == ZM_COLOUR_GRAY8 && config.yuv420_image_buffer && (ImageBufferSize(width, height, colours, ZM_SUBPIX_ORDER_YUV420P) % 16) == 0) {
+		/* Keep the chroma planes, analysis only sees the luma */
+		subpixelorder = ZM_SUBPIX_ORDER_YUV420P;
+		imagePixFormat = PIX_FMT_YUV420P;
+		imagesize = ImageBufferSize(width, height, colours, subpixelorder);
 	} else if(colours == ZM_COLOUR_GRAY8) {
 		subpixelorder = ZM_SUBPIX_ORDER_NONE;
 		imagePixFormat = PIX_FMT_GRAY8;
@@ -150,6 +157,8 @@ int FfmpegCamera::PrimeCapture()
     if ( (mCodec = avcodec_find_decoder( mCodecContext->codec_id )) == NULL )
         Fatal( "Can't find codec for video stream from %s", mPath.c_str() );
 
+    SetDecoderThreads( mCodecContext );
+
     // Open the codec
 #if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(53, 7, 0)
     if ( avcodec_open( mCodecContext, mCodec ) < 0 )
@@ -194,6 +203,73 @@ int FfmpegCamera::PreCapture()
     return( 0 );
 }
 
+/* Decides how to get decoded frames into the image buffer. When the decoder
+   already produces frames of the right size only the layout may need changing,
+   which can be done much more cheaply than by a general purpose scaler. */
+FfmpegCamera::ConvertMethod FfmpegCamera::SelectConvertMethod()
+{
+	PixelFormat pixFormat = mCodecContext->pix_fmt;
+	bool sameSize = ( mCodecContext->width == (int)width && mCodecContext->height == (int)height );
+
+	if ( sameSize )
+	{
+		/* YUVJ420P only differs from YUV420P in the range of its values, which analysis doesn't care about */
+		if ( pixFormat == imagePixFormat || (imagePixFormat == PIX_FMT_YUV420P && pixFormat == PIX_FMT_YUVJ420P) )
+		{
+			Debug( 2, "Copying decoded frames for %s directly into images", mPath.c_str() );
+			return( CONVERT_COPY );
+		}
+
+		if ( imagePixFormat == PIX_FMT_GRAY8 )
+		{
+			switch ( pixFormat )
+			{
+				case PIX_FMT_YUV420P:
+				case PIX_FMT_YUVJ420P:
+				case PIX_FMT_YUV422P:
+				case PIX_FMT_YUVJ422P:
+				case PIX_FMT_YUV444P:
+				case PIX_FMT_YUVJ444P:
+				case PIX_FMT_YUV411P:
+				case PIX_FMT_NV12:
+				case PIX_FMT_NV21:
+					Debug( 2, "Taking the luma plane of decoded frames for %s", mPath.c_str() );
+					return( CONVERT_LUMA );
+				default:
+					break;
+			}
+		}
+
+		/* Our conversion is full range, which is what JPEG based streams use */
+		if ( pixFormat == PIX_FMT_YUVJ420P && (imagePixFormat == PIX_FMT_RGB24 || imagePixFormat == PIX_FMT_RGBA) )
+		{
+			if ( config.cpu_extensions && sseversion >= 35 )
+			{
+				fptr_convert_planes = (imagePixFormat == PIX_FMT_RGBA)?&ssse3_convert_yuv420p_planes_rgba:&ssse3_convert_yuv420p_planes_rgb;
+				Debug( 2, "Converting decoded frames for %s with SSSE3", mPath.c_str() );
+			}
+			else
+			{
+				fptr_convert_planes = (imagePixFormat == PIX_FMT_RGBA)?&zm_convert_yuv420p_planes_rgba:&zm_convert_yuv420p_planes_rgb;
+				Debug( 2, "Converting decoded frames for %s", mPath.c_str() );
+			}
+			return( CONVERT_PLANES );
+		}
+	}
+
+#if HAVE_LIBSWSCALE
+	/* Bicubic filtering is only worth its cost when the image is actually being scaled */
+	int flags = sameSize?SWS_FAST_BILINEAR:SWS_BICUBIC;
+	if ( config.cpu_extensions && sseversion >= 20 )
+		flags |= SWS_CPU_CAPS_SSE2;
+	mConvertContext = sws_getContext( mCodecContext->width, mCodecContext->height, pixFormat, width, height, imagePixFormat, flags, NULL, NULL, NULL );
+	if ( mConvertContext == NULL )
+		Fatal( "Unable to create conversion context for %s", mPath.c_str() );
+	Debug( 2, "Converting decoded frames for %s with swscale from %dx%d format %d", mPath.c_str(), mCodecContext->width, mCodecContext->height, pixFormat );
+#endif // HAVE_LIBSWSCALE
+	return( CONVERT_SWSCALE );
+}
+
 int FfmpegCamera::Capture( Image &image )
 {
 	AVPacket packet;
@@ -218,6 +294,7 @@ int FfmpegCamera::Capture( Image &image )
         Debug( 5, "Got packet from stream %d", packet.stream_index );
         if ( packet.stream_index == mVideoStreamId )
         {
+            mDecodeTimer.PacketSent( mCodecContext );
             if ( avcodec_decode_video2( mCodecContext, mRawFrame, &frameComplete, &packet ) < 0 )
                 Fatal( "Unable to decode frame at frame %d", frameCount );
 
@@ -225,26 +302,40 @@ int FfmpegCamera::Capture( Image &image )
 
             if ( frameComplete )
             {
-                Debug( 3, "Got frame %d", frameCount );
+                double latency = mDecodeTimer.FrameReceived( mRawFrame );
+                Debug( 3, "Got frame %d, %.1f ms after its packet", frameCount, latency );
 
 		avpicture_fill( (AVPicture *)mFrame, directbuffer, imagePixFormat, width, height);
-		
+
+		if ( mConvertMethod == CONVERT_UNKNOWN )
+			mConvertMethod = SelectConvertMethod();
+
+		switch ( mConvertMethod )
+		{
+			case CONVERT_COPY:
+				av_picture_copy( (AVPicture *)mFrame, (AVPicture *)mRawFrame, imagePixFormat, width, height );
+				break;
+			case CONVERT_LUMA:
+				/* Grayscale images are just the Y plane, whatever the chroma is */
+				if ( mRawFrame->linesize[0] == (int)width ) {
+					(*fptr_imgbufcpy)(directbuffer, mRawFrame->data[0], width*height);
+				} else {
+					for ( unsigned int y = 0; y < height; y++ )
+						memcpy(directbuffer+(y*width), mRawFrame->data[0]+(y*mRawFrame->linesize[0]), width);
+				}
+				break;
+			case CONVERT_PLANES:
+				(*fptr_convert_planes)(mRawFrame->data[0], mRawFrame->data[1], mRawFrame->data[2], mRawFrame->linesize[0], mRawFrame->linesize[1], directbuffer, width, height);
+				break;
+			default:
 #if HAVE_LIBSWSCALE
-		if(mConvertContext == NULL) {
-			if(config.cpu_extensions && sseversion >= 20) {
-				mConvertContext = sws_getContext( mCodecContext->width, mCodecContext->height, mCodecContext->pix_fmt, width, height, imagePixFormat, SWS_BICUBIC | SWS_CPU_CAPS_SSE2, NULL, NULL, NULL );
-			} else {
-				mConvertContext = sws_getContext( mCodecContext->width, mCodecContext->height, mCodecContext->pix_fmt, width, height, imagePixFormat, SWS_BICUBIC, NULL, NULL, NULL );
-			}
-			if(mConvertContext == NULL)
-				Fatal( "Unable to create conversion context for %s", mPath.c_str() );
-		}
-	
-		if ( sws_scale( mConvertContext, mRawFrame->data, mRawFrame->linesize, 0, mCodecContext->height, mFrame->data, mFrame->linesize ) < 0 )
-			Fatal( "Unable to convert raw format %u to target format %u at frame %d", mCodecContext->pix_fmt, imagePixFormat, frameCount );
+				if ( sws_scale( mConvertContext, mRawFrame->data, mRawFrame->linesize, 0, mCodecContext->height, mFrame->data, mFrame->linesize ) < 0 )
+					Fatal( "Unable to convert raw format %u to target format %u at frame %d", mCodecContext->pix_fmt, imagePixFormat, frameCount );
 #else // HAVE_LIBSWSCALE
-		Fatal( "You must compile ffmpeg with the --enable-swscale option to use ffmpeg cameras" );
+				Fatal( "You must compile ffmpeg with the --enable-swscale option to use ffmpeg cameras" );
 #endif // HAVE_LIBSWSCALE
+				break;
+		}
  
                 frameCount++;
             }
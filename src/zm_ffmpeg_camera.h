@@ -38,6 +38,10 @@ protected:
     int frameCount;    
 
 #if HAVE_LIBAVFORMAT
+    // How decoded frames are turned into images, chosen when the first frame arrives
+    typedef enum { CONVERT_UNKNOWN, CONVERT_SWSCALE, CONVERT_COPY, CONVERT_LUMA, CONVERT_PLANES } ConvertMethod;
+
+
     AVFormatContext     *mFormatContext;
     int                 mVideoStreamId;
     AVCodecContext      *mCodecContext;
@@ -45,12 +49,20 @@ protected:
     AVFrame             *mRawFrame; 
     AVFrame             *mFrame;
     PixelFormat         imagePixFormat;
+    DecodeTimer         mDecodeTimer;
+    ConvertMethod       mConvertMethod;
+    planes_convert_fptr_t fptr_convert_planes;
 #endif // HAVE_LIBAVFORMAT
 
 #if HAVE_LIBSWSCALE
 	struct SwsContext   *mConvertContext;
 #endif
 
+#if HAVE_LIBAVFORMAT
+protected:
+	ConvertMethod SelectConvertMethod();
+#endif // HAVE_LIBAVFORMAT
+
 public:
 	FfmpegCamera( int p_id, const std::string &path, int p_width, int p_height, int p_colours, int p_brightness, int p_contrast, int p_hue, int p_colour, bool p_capture );
 	~FfmpegCamera();
@@ -64,6 +76,9 @@ public:
 	int PreCapture();
 	int Capture( Image &image );
 	int PostCapture();
+#if HAVE_LIBAVFORMAT
+	const char *CaptureReport() { return( mCodecContext?mDecodeTimer.Report( mCodecContext ):NULL ); }
+#endif // HAVE_LIBAVFORMAT
 };
 
 #endif // ZM_FFMPEG_CAMERA_H
@@ -0,0 +1,474 @@
+//
+// ZoneMinder HTTP Capture Thread Implementation, $Date$, $Revision$
+// Copyright (C) 2001-2008 Philip Coombes
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#include "zm_http_capture.h"
+
+#include "zm_remote_camera_http.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+static long long msecsBetween( const struct timeval &from, const struct timeval &to )
+{
+    return( ((long long)(to.tv_sec-from.tv_sec)*1000)+((to.tv_usec-from.tv_usec)/1000) );
+}
+
+HttpCaptureThread::HttpCaptureThread() :
+    mCondition( mMutex ),
+    mStop( false )
+{
+    mEpollFd = epoll_create( MAX_EVENTS );
+    if ( mEpollFd < 0 )
+        Fatal( "Can't create epoll descriptor: %s", strerror(errno) );
+}
+
+HttpCaptureThread::~HttpCaptureThread()
+{
+    for ( std::list<Connection *>::iterator iter = mConnections.begin(); iter != mConnections.end(); iter++ )
+    {
+        Connection *connection = *iter;
+        for ( std::list<Receiver *>::iterator recIter = connection->receivers.begin(); recIter != connection->receivers.end(); recIter++ )
+            delete *recIter;
+        delete connection;
+    }
+    close( mEpollFd );
+}
+
+// Must be called with the mutex held
+bool HttpCaptureThread::isConnection( const Connection *connection ) const
+{
+    for ( std::list<Connection *>::const_iterator iter = mConnections.begin(); iter != mConnections.end(); iter++ )
+        if ( *iter == connection )
+            return( true );
+    return( false );
+}
+
+// Must be called with the mutex held
+bool HttpCaptureThread::isWaiting( const Connection *connection ) const
+{
+    for ( std::list<Receiver *>::const_iterator iter = connection->receivers.begin(); iter != connection->receivers.end(); iter++ )
+        if ( !(*iter)->count )
+            return( true );
+    return( false );
+}
+
+// Must be called with the mutex held
+HttpCaptureThread::Receiver *HttpCaptureThread::findReceiver( const RemoteCameraHttp *camera, Connection **connection ) const
+{
+    for ( std::list<Connection *>::const_iterator iter = mConnections.begin(); iter != mConnections.end(); iter++ )
+    {
+        for ( std::list<Receiver *>::const_iterator recIter = (*iter)->receivers.begin(); recIter != (*iter)->receivers.end(); recIter++ )
+        {
+            if ( (*recIter)->camera == camera )
+            {
+                if ( connection )
+                    *connection = *iter;
+                return( *recIter );
+            }
+        }
+    }
+    return( NULL );
+}
+
+void HttpCaptureThread::addCamera( RemoteCameraHttp *camera )
+{
+    Receiver *receiver = new Receiver;
+    receiver->camera = camera;
+    receiver->head = 0;
+    receiver->count = 0;
+    receiver->received = 0;
+    receiver->dropped = 0;
+    receiver->bytes = 0;
+
+    mMutex.lock();
+    // Cameras sending exactly the same request to the same place can share what comes back
+    for ( std::list<Connection *>::iterator iter = mConnections.begin(); iter != mConnections.end(); iter++ )
+    {
+        Connection *connection = *iter;
+        if ( connection->owner->host == camera->host && connection->owner->port == camera->port && connection->owner->request == camera->request )
+        {
+            Debug( 2, "Camera %d sharing connection to %s:%s%s with camera %d", camera->id, camera->host.c_str(), camera->port.c_str(), camera->path.c_str(), connection->owner->id );
+            connection->receivers.push_back( receiver );
+            mMutex.unlock();
+            return;
+        }
+    }
+
+    Connection *connection = new Connection;
+    connection->state = Connection::IDLE;
+    connection->owner = camera;
+    connection->receivers.push_back( receiver );
+    connection->address = NULL;
+    gettimeofday( &connection->retryTime, NULL );
+    connection->dataTime = connection->retryTime;
+    connection->backoff = MIN_BACKOFF;
+    connection->polling = false;
+    connection->reconnects = 0;
+    mConnections.push_back( connection );
+    Debug( 2, "Camera %d connecting to %s:%s%s", camera->id, camera->host.c_str(), camera->port.c_str(), camera->path.c_str() );
+    mMutex.unlock();
+}
+
+void HttpCaptureThread::removeCamera( RemoteCameraHttp *camera )
+{
+    mMutex.lock();
+    Connection *connection = NULL;
+    Receiver *receiver = findReceiver( camera, &connection );
+    if ( receiver )
+    {
+        connection->receivers.remove( receiver );
+        delete receiver;
+
+        if ( connection->owner == camera )
+        {
+            // The response is parsed by the owner, so the connection has to start again with another
+            disconnect( connection, false );
+            if ( connection->receivers.empty() )
+            {
+                mConnections.remove( connection );
+                delete connection;
+            }
+            else
+            {
+                connection->owner = connection->receivers.front()->camera;
+                Debug( 2, "Camera %d taking over connection to %s:%s%s", connection->owner->id, camera->host.c_str(), camera->port.c_str(), camera->path.c_str() );
+            }
+        }
+    }
+    mCondition.broadcast();
+    mMutex.unlock();
+}
+
+// Must be called with the mutex held
+void HttpCaptureThread::startConnect( Connection *connection )
+{
+    connection->address = connection->owner->hp;
+    connectNext( connection );
+}
+
+// Tries each address from the current one until a connection is made or under way, must be called with the mutex held
+void HttpCaptureThread::connectNext( Connection *connection )
+{
+    RemoteCameraHttp *camera = connection->owner;
+
+    for ( ; connection->address; connection->address = connection->address->ai_next )
+    {
+        const struct addrinfo *address = connection->address;
+        camera->sd = socket( address->ai_family, address->ai_socktype, address->ai_protocol );
+        if ( camera->sd < 0 )
+        {
+            Warning( "Can't create socket: %s", strerror(errno) );
+            continue;
+        }
+        fcntl( camera->sd, F_SETFL, fcntl( camera->sd, F_GETFL ) | O_NONBLOCK );
+
+        gettimeofday( &connection->dataTime, NULL );
+        if ( connect( camera->sd, address->ai_addr, address->ai_addrlen ) == 0 )
+        {
+            connected( connection );
+            return;
+        }
+        if ( errno == EINPROGRESS )
+        {
+            // Carry on with other cameras until this one either connects or fails
+            struct epoll_event event;
+            memset( &event, 0, sizeof(event) );
+            event.events = EPOLLOUT;
+            event.data.ptr = connection;
+            if ( epoll_ctl( mEpollFd, EPOLL_CTL_ADD, camera->sd, &event ) < 0 )
+            {
+                Error( "Can't add socket to epoll set: %s", strerror(errno) );
+                break;
+            }
+            Debug( 3, "Connecting to %s:%s, socket = %d", camera->host.c_str(), camera->port.c_str(), camera->sd );
+            connection->state = Connection::CONNECTING;
+            return;
+        }
+        Warning( "Can't connect to remote camera: %s", strerror(errno) );
+        close( camera->sd );
+        camera->sd = -1;
+    }
+
+    Error( "Unable to connect to the remote camera at %s:%s", camera->host.c_str(), camera->port.c_str() );
+    disconnect( connection, true );
+}
+
+// Must be called with the mutex held
+void HttpCaptureThread::connected( Connection *connection )
+{
+    RemoteCameraHttp *camera = connection->owner;
+
+    Debug( 3, "Connected to %s:%s, socket = %d", camera->host.c_str(), camera->port.c_str(), camera->sd );
+    camera->mode = RemoteCameraHttp::SINGLE_IMAGE;
+    camera->buffer.clear();
+    if ( camera->SendRequest() < 0 )
+    {
+        disconnect( connection, true );
+        return;
+    }
+
+    struct epoll_event event;
+    memset( &event, 0, sizeof(event) );
+    event.events = EPOLLIN;
+    event.data.ptr = connection;
+    int op = (connection->state == Connection::CONNECTING)?EPOLL_CTL_MOD:EPOLL_CTL_ADD;
+    if ( epoll_ctl( mEpollFd, op, camera->sd, &event ) < 0 )
+    {
+        Error( "Can't add socket to epoll set: %s", strerror(errno) );
+        disconnect( connection, true );
+        return;
+    }
+    connection->state = Connection::RECEIVING;
+    connection->address = NULL;
+    gettimeofday( &connection->dataTime, NULL );
+}
+
+// Must be called with the mutex held
+void HttpCaptureThread::disconnect( Connection *connection, bool retry )
+{
+    // Closing the socket takes it out of the epoll set too
+    if ( connection->owner->sd >= 0 )
+        connection->owner->Disconnect();
+    connection->state = Connection::IDLE;
+    connection->address = NULL;
+
+    gettimeofday( &connection->retryTime, NULL );
+    if ( retry )
+    {
+        Warning( "Lost connection to %s:%s%s, retrying in %d seconds", connection->owner->host.c_str(), connection->owner->port.c_str(), connection->owner->path.c_str(), connection->backoff );
+        connection->retryTime.tv_sec += connection->backoff;
+        connection->backoff *= 2;
+        if ( connection->backoff > MAX_BACKOFF )
+            connection->backoff = MAX_BACKOFF;
+        connection->reconnects++;
+    }
+}
+
+// Must be called with the mutex held
+void HttpCaptureThread::receive( Connection *connection )
+{
+    RemoteCameraHttp *camera = connection->owner;
+
+    gettimeofday( &connection->dataTime, NULL );
+    while ( true )
+    {
+        // The parser keeps its place in the camera, so can simply be resumed when more data arrives
+        int content_length = camera->ParseResponse();
+        if ( content_length == RemoteCameraHttp::READ_PENDING )
+            return;
+        if ( content_length <= 0 )
+        {
+            disconnect( connection, true );
+            return;
+        }
+        deliver( connection, content_length );
+        if ( camera->sd < 0 )
+        {
+            // Single image responses close the connection, the next is asked for once it is wanted
+            connection->state = Connection::IDLE;
+            connection->polling = true;
+            gettimeofday( &connection->retryTime, NULL );
+            return;
+        }
+    }
+}
+
+// Must be called with the mutex held
+void HttpCaptureThread::deliver( Connection *connection, int content_length )
+{
+    RemoteCameraHttp *camera = connection->owner;
+
+    connection->backoff = MIN_BACKOFF;
+    for ( std::list<Receiver *>::iterator iter = connection->receivers.begin(); iter != connection->receivers.end(); iter++ )
+    {
+        Receiver *receiver = *iter;
+        if ( receiver->count == FRAME_QUEUE_SIZE )
+        {
+            // Capturing has fallen behind, only the latest images are worth keeping
+            receiver->head = (receiver->head+1)%FRAME_QUEUE_SIZE;
+            receiver->count--;
+            receiver->dropped++;
+        }
+        int index = (receiver->head+receiver->count)%FRAME_QUEUE_SIZE;
+        receiver->frames[index].assign( camera->buffer.head(), content_length );
+        receiver->formats[index] = camera->format;
+        receiver->count++;
+        receiver->received++;
+        receiver->bytes += content_length;
+    }
+    camera->buffer.consume( content_length );
+    mCondition.broadcast();
+}
+
+// Must be called with the mutex held
+void HttpCaptureThread::checkTimers()
+{
+    struct timeval now;
+    gettimeofday( &now, NULL );
+
+    for ( std::list<Connection *>::iterator iter = mConnections.begin(); iter != mConnections.end(); iter++ )
+    {
+        Connection *connection = *iter;
+        if ( connection->state == Connection::IDLE )
+        {
+            if ( msecsBetween( connection->retryTime, now ) >= 0 && (!connection->polling || isWaiting( connection )) )
+                startConnect( connection );
+        }
+        else if ( msecsBetween( connection->dataTime, now ) > config.http_timeout )
+        {
+            Warning( "Timed out waiting for %s:%s%s", connection->owner->host.c_str(), connection->owner->port.c_str(), connection->owner->path.c_str() );
+            disconnect( connection, true );
+        }
+    }
+}
+
+int HttpCaptureThread::run()
+{
+    Debug( 2, "Starting HTTP capture thread" );
+
+    struct epoll_event events[MAX_EVENTS];
+    while ( !mStop )
+    {
+        mMutex.lock();
+        checkTimers();
+        mMutex.unlock();
+
+        // Wake regularly to make connection attempts and notice timeouts
+        int count = epoll_wait( mEpollFd, events, MAX_EVENTS, 100 );
+        if ( count < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            Error( "Epoll wait failed: %s", strerror(errno) );
+            break;
+        }
+
+        mMutex.lock();
+        for ( int i = 0; i < count; i++ )
+        {
+            Connection *connection = (Connection *)events[i].data.ptr;
+            // A camera may have been removed since the events were collected
+            if ( !isConnection( connection ) )
+                continue;
+            if ( connection->state == Connection::CONNECTING )
+            {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                if ( getsockopt( connection->owner->sd, SOL_SOCKET, SO_ERROR, &error, &length ) < 0 )
+                    error = errno;
+                if ( error )
+                {
+                    Warning( "Can't connect to remote camera: %s", strerror(error) );
+                    close( connection->owner->sd );
+                    connection->owner->sd = -1;
+                    connection->address = connection->address->ai_next;
+                    connectNext( connection );
+                }
+                else
+                {
+                    connected( connection );
+                }
+            }
+            else if ( connection->state == Connection::RECEIVING )
+            {
+                receive( connection );
+            }
+        }
+        mMutex.unlock();
+    }
+
+    // Don't leave any camera waiting for an image that will never come
+    mMutex.lock();
+    mStop = true;
+    for ( std::list<Connection *>::iterator iter = mConnections.begin(); iter != mConnections.end(); iter++ )
+        disconnect( *iter, false );
+    mCondition.broadcast();
+    mMutex.unlock();
+
+    Debug( 2, "HTTP capture thread exiting" );
+    return( 0 );
+}
+
+// Waits for the next image received for the camera, swapping it into the buffer given
+int HttpCaptureThread::getFrame( RemoteCameraHttp *camera, Buffer &buffer, int &format )
+{
+    struct timeval now, deadline;
+    gettimeofday( &deadline, NULL );
+    deadline.tv_sec += config.http_timeout/1000;
+    deadline.tv_usec += (config.http_timeout%1000)*1000;
+    if ( deadline.tv_usec >= 1000000 )
+    {
+        deadline.tv_sec++;
+        deadline.tv_usec -= 1000000;
+    }
+
+    mMutex.lock();
+    Connection *connection = NULL;
+    Receiver *receiver;
+    while ( (receiver = findReceiver( camera, &connection )) && !receiver->count )
+    {
+        gettimeofday( &now, NULL );
+        // Ask for the next single image now rather than when the capture thread next wakes
+        if ( connection->state == Connection::IDLE && connection->polling && msecsBetween( connection->retryTime, now ) >= 0 )
+            startConnect( connection );
+        long long remaining = msecsBetween( now, deadline );
+        if ( mStop || remaining <= 0 )
+        {
+            mMutex.unlock();
+            return( 0 );
+        }
+        mCondition.wait( remaining/1000.0 );
+    }
+    if ( !receiver )
+    {
+        mMutex.unlock();
+        return( 0 );
+    }
+    // The camera's old buffer goes back into the queue to be filled again
+    buffer.swap( receiver->frames[receiver->head] );
+    format = receiver->formats[receiver->head];
+    receiver->head = (receiver->head+1)%FRAME_QUEUE_SIZE;
+    receiver->count--;
+    mMutex.unlock();
+
+    return( buffer.size() );
+}
+
+// Summarises what has been received for the camera since the last report
+void HttpCaptureThread::getReport( const RemoteCameraHttp *camera, char *report, size_t size )
+{
+    mMutex.lock();
+    Connection *connection = NULL;
+    Receiver *receiver = findReceiver( camera, &connection );
+    if ( receiver )
+    {
+        snprintf( report, size, "received %lu images (%llu kB), %lu dropped, %lu reconnects", receiver->received, receiver->bytes/1024, receiver->dropped, connection->reconnects );
+        receiver->received = 0;
+        receiver->dropped = 0;
+        receiver->bytes = 0;
+    }
+    else
+    {
+        report[0] = '\0';
+    }
+    mMutex.unlock();
+}
@@ -0,0 +1,109 @@
+//
+// ZoneMinder HTTP Capture Thread Interface, $Date$, $Revision$
+// Copyright (C) 2001-2008 Philip Coombes
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef ZM_HTTP_CAPTURE_H
+#define ZM_HTTP_CAPTURE_H
+
+#include "zm.h"
+#include "zm_buffer.h"
+#include "zm_thread.h"
+
+#include <list>
+#include <sys/time.h>
+
+class RemoteCameraHttp;
+
+//
+// Receives from all the HTTP cameras of a capture daemon on one thread,
+// waiting on their sockets together with epoll rather than on each in turn.
+// Complete images are queued for each camera to pick up when it captures.
+// Cameras asking for the same URL share one connection, and a connection
+// that fails is retried after a delay that grows while it keeps failing.
+//
+class HttpCaptureThread : public Thread
+{
+public:
+    enum { FRAME_QUEUE_SIZE=4 };        // Images held for each camera before the oldest is dropped
+    enum { MAX_EVENTS=64 };
+    enum { MIN_BACKOFF=1, MAX_BACKOFF=30 };     // Seconds between connection attempts
+
+private:
+    struct Receiver
+    {
+        RemoteCameraHttp *camera;
+        Buffer frames[FRAME_QUEUE_SIZE];
+        int formats[FRAME_QUEUE_SIZE];
+        int head;                       // Oldest queued image
+        int count;
+        // Since the last report
+        unsigned long received;
+        unsigned long dropped;
+        unsigned long long bytes;
+    };
+
+    struct Connection
+    {
+        enum { IDLE, CONNECTING, RECEIVING } state;
+        RemoteCameraHttp *owner;        // Camera whose request is sent and which parses the response
+        std::list<Receiver *> receivers;
+        const struct addrinfo *address; // Address being tried
+        struct timeval retryTime;
+        struct timeval dataTime;        // When data last arrived
+        int backoff;
+        bool polling;                   // Each image is asked for separately
+        unsigned long reconnects;
+    };
+
+private:
+    int mEpollFd;
+    std::list<Connection *> mConnections;
+
+    Mutex mMutex;
+    Condition mCondition;
+    bool mStop;
+
+private:
+    bool isConnection( const Connection *connection ) const;
+    bool isWaiting( const Connection *connection ) const;
+    Receiver *findReceiver( const RemoteCameraHttp *camera, Connection **connection=NULL ) const;
+    void startConnect( Connection *connection );
+    void connectNext( Connection *connection );
+    void connected( Connection *connection );
+    void disconnect( Connection *connection, bool retry );
+    void receive( Connection *connection );
+    void deliver( Connection *connection, int content_length );
+    void checkTimers();
+    int run();
+
+public:
+    HttpCaptureThread();
+    ~HttpCaptureThread();
+
+    void addCamera( RemoteCameraHttp *camera );
+    void removeCamera( RemoteCameraHttp *camera );
+    int getFrame( RemoteCameraHttp *camera, Buffer &buffer, int &format );
+    void getReport( const RemoteCameraHttp *camera, char *report, size_t size );
+
+    void stop()
+    {
+        mStop = true;
+    }
+};
+
+#endif // ZM_HTTP_CAPTURE_H
@@ -19,11 +19,13 @@
 #include "zm.h"
 #include "zm_font.h"
 #include "zm_image.h"
+#include "zm_jpeg_codec.h"
 #include "zm_utils.h"
 #include "zm_rgb.h"
 
 #include <sys/stat.h>
 #include <errno.h>
+#include <algorithm>
 
 bool Image::initialised = false;
 static unsigned char *y_table;
@@ -34,10 +36,6 @@ static short *g_u_table;
 static short *b_u_table;
 __attribute__((aligned(16))) static const uint8_t movemask[16] = {0,4,8,12,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
 
-jpeg_compress_struct *Image::jpg_ccinfo[101] = { 0 };
-jpeg_decompress_struct *Image::jpg_dcinfo = 0;
-struct zm_error_mgr Image::jpg_err;
-
 /* Pointer to blend function. */
 static blend_fptr_t fptr_blend;
 
@@ -50,13 +48,35 @@ static delta_fptr_t fptr_delta8_argb;
 static delta_fptr_t fptr_delta8_abgr;
 static delta_fptr_t fptr_delta8_gray8;
 
+/* Pointers to deinterlace functions */
+static deinterlace_linear_fptr_t fptr_deinterlace_linear;
+static deinterlace_blend_fptr_t fptr_deinterlace_blend;
+static deinterlace_blend_ratio_fptr_t fptr_deinterlace_blend_ratio;
+
 /* Pointers to deinterlace_4field functions */
+static deinterlace_4field_fptr_t fptr_deinterlace_4field_rgb;
+static deinterlace_4field_fptr_t fptr_deinterlace_4field_bgr;
 static deinterlace_4field_fptr_t fptr_deinterlace_4field_rgba;
 static deinterlace_4field_fptr_t fptr_deinterlace_4field_bgra;
 static deinterlace_4field_fptr_t fptr_deinterlace_4field_argb;
 static deinterlace_4field_fptr_t fptr_deinterlace_4field_abgr;
 static deinterlace_4field_fptr_t fptr_deinterlace_4field_gray8;
 
+/* Pointers to block transpose functions used for rotation */
+static transpose_fptr_t fptr_transpose_gray8;
+static transpose_fptr_t fptr_transpose_rgb;
+static transpose_fptr_t fptr_transpose_rgba;
+
+/* Pointer to the function counting pixels of another colour */
+static count_mismatches_fptr_t fptr_count_mismatches;
+
+/* Pointer to the edge detection function */
+static edges8_fptr_t fptr_edges8;
+
+/* Pointers to overlay functions */
+static overlay8_fptr_t fptr_overlay8;
+static overlay32_fptr_t fptr_overlay32;
+
 /* Pointer to image buffer memory copy function */
 imgbufcpy_fptr_t fptr_imgbufcpy;
 
@@ -104,7 +124,7 @@ Image::Image( int p_width, int p_height, int p_colours, int p_subpixelorder, uin
     pixels = width*height;
     colours = p_colours;
     subpixelorder = p_subpixelorder;
-    size = (width*height)*colours;
+    size = ImageBufferSize(width, height, colours, subpixelorder);
     buffer = 0;
     holdbuffer = 0;
     if ( p_buffer )
@@ -221,8 +241,23 @@ void Image::Initialise()
 		Debug(2,"Delta: CPU extensions disabled, using standard delta functions");
 	}
 	
+	/* Use SSE2 deinterlace functions? */
+	if(config.cpu_extensions && sseversion >= 20) {
+		fptr_deinterlace_linear = &sse2_deinterlace_linear;
+		fptr_deinterlace_blend = &sse2_deinterlace_blend;
+		fptr_deinterlace_blend_ratio = &sse2_deinterlace_blend_ratio;
+		Debug(2,"Deinterlace: Using SSE2 line functions");
+	} else {
+		fptr_deinterlace_linear = &std_deinterlace_linear;
+		fptr_deinterlace_blend = &std_deinterlace_blend;
+		fptr_deinterlace_blend_ratio = &std_deinterlace_blend_ratio;
+		Debug(2,"Deinterlace: Using standard line functions");
+	}
+	
 	/* Use SSSE3 deinterlace functions? */
 	if(config.cpu_extensions && sseversion >= 35) {
+		fptr_deinterlace_4field_rgb = &ssse3_deinterlace_4field_rgb;
+		fptr_deinterlace_4field_bgr = &ssse3_deinterlace_4field_bgr;
 		fptr_deinterlace_4field_rgba = &ssse3_deinterlace_4field_rgba;
 		fptr_deinterlace_4field_bgra = &ssse3_deinterlace_4field_bgra;
 		fptr_deinterlace_4field_argb = &ssse3_deinterlace_4field_argb;
@@ -230,6 +265,8 @@ void Image::Initialise()
 		fptr_deinterlace_4field_gray8 = &ssse3_deinterlace_4field_gray8;
 		Debug(2,"Deinterlace: Using SSSE3 delta functions");
 	} else {
+		fptr_deinterlace_4field_rgb = &std_deinterlace_4field_rgb;
+		fptr_deinterlace_4field_bgr = &std_deinterlace_4field_bgr;
 		fptr_deinterlace_4field_rgba = &std_deinterlace_4field_rgba;
 		fptr_deinterlace_4field_bgra = &std_deinterlace_4field_bgra;
 		fptr_deinterlace_4field_argb = &std_deinterlace_4field_argb;
@@ -247,6 +284,47 @@ void Image::Initialise()
 		Debug(2,"Image buffer copy: Using standard memcpy");
 	}
 	
+	/* Use SSE2 pixel count function? */
+	if(config.cpu_extensions && sseversion >= 20) {
+		fptr_count_mismatches = &sse2_count_mismatches;
+		Debug(2,"Pixel count: Using SSE2 count function");
+	} else {
+		fptr_count_mismatches = &std_count_mismatches;
+		Debug(2,"Pixel count: Using standard count function");
+	}
+	
+	/* Use SSE2 edge detection function? */
+	if(config.cpu_extensions && sseversion >= 20) {
+		fptr_edges8 = &sse2_edges8;
+		Debug(2,"Edges: Using SSE2 edge function");
+	} else {
+		fptr_edges8 = &std_edges8;
+		Debug(2,"Edges: Using standard edge function");
+	}
+	
+	/* Use SSE2 overlay functions? */
+	if(config.cpu_extensions && sseversion >= 20) {
+		fptr_overlay8 = &sse2_overlay8;
+		fptr_overlay32 = &sse2_overlay32;
+		Debug(2,"Overlay: Using SSE2 overlay functions");
+	} else {
+		fptr_overlay8 = &std_overlay8;
+		fptr_overlay32 = &std_overlay32;
+		Debug(2,"Overlay: Using standard overlay functions");
+	}
+	
+	/* Use SSE2 block transposes for rotation? */
+	fptr_transpose_rgb = &std_transpose8x8_rgb;
+	if(config.cpu_extensions && sseversion >= 20) {
+		fptr_transpose_gray8 = &sse2_transpose8x8_gray8;
+		fptr_transpose_rgba = &sse2_transpose8x8_rgba;
+		Debug(2,"Rotate: Using SSE2 transpose functions");
+	} else {
+		fptr_transpose_gray8 = &std_transpose8x8_gray8;
+		fptr_transpose_rgba = &std_transpose8x8_rgba;
+		Debug(2,"Rotate: Using standard transpose functions");
+	}
+	
 	/* Code below relocated from zm_local_camera */
 	Debug( 3, "Setting up static colour tables" );
 	
@@ -274,11 +352,11 @@ void Image::Initialise()
 			uv_table[c] = (127*(c-128))/112;
 	}
 
-	r_v_table = new short[255];
-	g_v_table = new short[255];
-	g_u_table = new short[255];
-	b_u_table = new short[255];
-	for ( int i = 0; i < 255; i++ )
+	r_v_table = new short[256];
+	g_v_table = new short[256];
+	g_u_table = new short[256];
+	b_u_table = new short[256];
+	for ( int i = 0; i < 256; i++ )
 	{
 		r_v_table[i] = (1402*(i-128))/1000;
 		g_u_table[i] = (344*(i-128))/1000;
@@ -304,7 +382,7 @@ uint8_t* Image::WriteBuffer(const unsigned int p_width, const unsigned int p_hei
 	}
 	
 	if(p_width != width || p_height != height || p_colours != colours || p_subpixelorder != subpixelorder) {
-		newsize = (p_width * p_height) * p_colours;
+		newsize = ImageBufferSize(p_width, p_height, p_colours, p_subpixelorder);
 		
 		if(buffer == NULL) {
 			AllocImgBuffer(newsize);
@@ -340,7 +418,9 @@ void Image::AssignDirect( const unsigned int p_width, const unsigned int p_heigh
 		return;
 	}
 	
-	if(buffer_size < (unsigned int)((p_width*p_height)*p_colours)) {
+	unsigned int new_size = ImageBufferSize(p_width, p_height, p_colours, p_subpixelorder);
+	
+	if(buffer_size < new_size) {
 		Error("Attempt to directly assign buffer from an undersized buffer of size: %zu",buffer_size);
 		return;
 	}
@@ -356,7 +436,7 @@ void Image::AssignDirect( const unsigned int p_width, const unsigned int p_heigh
 	}
 	
 	if(holdbuffer && buffer) {
-		if((unsigned int)((p_height*p_width)*p_colours) > allocation) {
+		if(new_size > allocation) {
 			Error("Held buffer is undersized for assigned buffer");
 			return;
 		} else {
@@ -365,7 +445,7 @@ void Image::AssignDirect( const unsigned int p_width, const unsigned int p_heigh
 			colours = p_colours;
 			subpixelorder = p_subpixelorder;
 			pixels = height*width;
-			size = pixels*colours;
+			size = new_size;
 			
 			/* Copy into the held buffer */
 			if(new_buffer != buffer)
@@ -383,7 +463,7 @@ void Image::AssignDirect( const unsigned int p_width, const unsigned int p_heigh
 		colours = p_colours;
 		subpixelorder = p_subpixelorder;
 		pixels = height*width;
-		size = pixels*colours;
+		size = new_size;
 	
 		allocation = buffer_size;
 		buffertype = p_buffertype;
@@ -393,7 +473,7 @@ void Image::AssignDirect( const unsigned int p_width, const unsigned int p_heigh
 }
 
 void Image::Assign(const unsigned int p_width, const unsigned int p_height, const unsigned int p_colours, const unsigned int p_subpixelorder, const uint8_t* new_buffer, const size_t buffer_size) {
-	unsigned int new_size = (p_width * p_height) * p_colours;
+	unsigned int new_size = ImageBufferSize(p_width, p_height, p_colours, p_subpixelorder);
   
 	if(new_buffer == NULL) {
 		Error("Attempt to assign buffer from a NULL pointer");
@@ -443,7 +523,7 @@ void Image::Assign(const unsigned int p_width, const unsigned int p_height, cons
 }
 
 void Image::Assign( const Image &image ) {
-	unsigned int new_size = (image.width * image.height) * image.colours;
+	unsigned int new_size = ImageBufferSize(image.width, image.height, image.colours, image.subpixelorder);
 	
 	if(image.buffer == NULL) {
 		Error("Attempt to assign image with an empty buffer");
@@ -481,101 +561,217 @@ void Image::Assign( const Image &image ) {
 		(*fptr_imgbufcpy)(buffer, image.buffer, size);
 }
 
-Image *Image::HighlightEdges( Rgb colour, unsigned int p_colours, unsigned int p_subpixelorder, const Box *limits )
+void Image::Assign( const ImageView &view ) {
+	if(view.Data() == NULL) {
+		Error("Attempt to assign from an empty image view");
+		return;
+	}
+	
+	if(view.Colours() != ZM_COLOUR_GRAY8 && view.Colours() != ZM_COLOUR_RGB24 && view.Colours() != ZM_COLOUR_RGB32) {
+		Error("Attempt to assign image view with unexpected colours per pixel: %d",view.Colours());
+		return;
+	}
+	
+	const unsigned int line_size = view.LineSize();
+	
+	if(buffer && view.Data() >= buffer && view.Data() < (buffer+allocation)) {
+		if(holdbuffer || buffertype != ZM_BUFTYPE_DONTFREE) {
+			/* A view of our own pixels is never bigger than the image, so its lines can be moved down in place */
+			for(unsigned int y = 0; y < view.Height(); y++)
+				memmove(buffer+(y*line_size), view.Line(y), line_size);
+			
+			width = view.Width();
+			height = view.Height();
+			pixels = width*height;
+			colours = view.Colours();
+			subpixelorder = view.SubpixelOrder();
+			size = pixels*colours;
+		} else {
+			/* Don't write over pixels that aren't ours */
+			size_t new_size = line_size*view.Height();
+			uint8_t *new_buffer = AllocBuffer(new_size);
+			for(unsigned int y = 0; y < view.Height(); y++)
+				memcpy(new_buffer+(y*line_size), view.Line(y), line_size);
+			AssignDirect(view.Width(), view.Height(), view.Colours(), view.SubpixelOrder(), new_buffer, new_size, ZM_BUFTYPE_ZM);
+		}
+		return;
+	}
+	
+	uint8_t *pdest = WriteBuffer(view.Width(), view.Height(), view.Colours(), view.SubpixelOrder());
+	if(pdest == NULL)
+		return;
+	
+	if(view.IsContiguous()) {
+		memcpy(pdest, view.Data(), line_size*view.Height());
+	} else {
+		for(unsigned int y = 0; y < view.Height(); y++)
+			memcpy(pdest+(y*line_size), view.Line(y), line_size);
+	}
+}
+
+void Image::Swap( Image &image ) {
+	if(&image == this)
+		return;
+	
+	if(holdbuffer || image.holdbuffer) {
+		/* Held buffers have to stay where they are, so only their contents can change places */
+		Image temp_image(*this);
+		Assign(image);
+		image.Assign(temp_image);
+		return;
+	}
+	
+	std::swap(width, image.width);
+	std::swap(height, image.height);
+	std::swap(pixels, image.pixels);
+	std::swap(colours, image.colours);
+	std::swap(size, image.size);
+	std::swap(subpixelorder, image.subpixelorder);
+	std::swap(allocation, image.allocation);
+	std::swap(buffer, image.buffer);
+	std::swap(buffertype, image.buffertype);
+}
+
+void Image::Take( Image &image ) {
+	if(&image == this)
+		return;
+	
+	if(holdbuffer || image.holdbuffer || image.buffertype == ZM_BUFTYPE_DONTFREE) {
+		/* Buffers that are held, or that the other image doesn't own, can only be copied */
+		Assign(image);
+		return;
+	}
+	
+	DumpImgBuffer();
+	
+	width = image.width;
+	height = image.height;
+	pixels = image.pixels;
+	colours = image.colours;
+	size = image.size;
+	subpixelorder = image.subpixelorder;
+	allocation = image.allocation;
+	buffer = image.buffer;
+	buffertype = image.buffertype;
+	
+	image.buffer = NULL;
+	image.allocation = 0;
+	image.width = image.height = image.colours = image.size = image.pixels = image.subpixelorder = 0;
+}
+
+/* The edge of a line found a pixel at a time, for the pixels at the sides of the image */
+static inline uint8_t EdgeAt( const uint8_t* above, const uint8_t* current, const uint8_t* below, unsigned int x, unsigned int width )
+{
+	if ( !current[x] )
+		return 0;
+	/* Neighbours outside the image count as set */
+	uint8_t left = x>0?current[x-1]:current[x];
+	uint8_t right = x<(width-1)?current[x+1]:current[x];
+	return (!left || !right || !above[x] || !below[x])?0xff:0;
+}
+
+/* Draws the edges of the non-black areas of the image, being the set pixels
+   with a clear pixel left, right, above or below them. The image returned
+   covers only the limits when they are given */
+void Image::HighlightEdges( Rgb colour, unsigned int p_colours, unsigned int p_subpixelorder, Image *high_image, const Box *limits ) const
 {
 	if ( colours != ZM_COLOUR_GRAY8 )
 	{
 		Panic( "Attempt to highlight image edges when colours = %d", colours );
 	}
 	
+	/* Edges are only drawn on the luma, so don't carry empty chroma planes around */
+	if ( p_subpixelorder == ZM_SUBPIX_ORDER_YUV420P )
+		p_subpixelorder = ZM_SUBPIX_ORDER_NONE;
+	
 	/* Convert the colour's RGBA subpixel order into the image's subpixel order */
 	colour = rgb_convert(colour,p_subpixelorder);
 	
-	/* Create a new image of the target format */
-	Image *high_image = new Image( width, height, p_colours, p_subpixelorder );
-	uint8_t* high_buff = high_image->WriteBuffer(width, height, p_colours, p_subpixelorder);
-	
-	/* Set image to all black */
-	high_image->Clear();
-
 	unsigned int lo_x = limits?limits->Lo().X():0;
 	unsigned int lo_y = limits?limits->Lo().Y():0;
 	unsigned int hi_x = limits?limits->Hi().X():width-1;
 	unsigned int hi_y = limits?limits->Hi().Y():height-1;
 	
-	if ( p_colours == ZM_COLOUR_GRAY8 )
+	if ( !(p_colours == ZM_COLOUR_GRAY8 || p_colours == ZM_COLOUR_RGB24 || p_colours == ZM_COLOUR_RGB32) )
 	{
-		for ( unsigned int y = lo_y; y <= hi_y; y++ )
-		{
-			const uint8_t* p = buffer + (y * width) + lo_x;
-			uint8_t* phigh = high_buff + (y * width) + lo_x;
-			for ( unsigned int x = lo_x; x <= hi_x; x++, p++, phigh++ )
-			{
-				bool edge = false;
-				if ( *p )
-				{
-					if ( !edge && x > 0 && !*(p-1) ) edge = true;
-					if ( !edge && x < (width-1) && !*(p+1) ) edge = true;
-					if ( !edge && y > 0 && !*(p-width) ) edge = true;
-					if ( !edge && y < (height-1) && !*(p+width) ) edge = true;
-				}
-				if ( edge )
-				{
-					*phigh = colour;
-				}
-			}
-		}
+		Error( "Attempt to highlight edges in unexpected colours %d", p_colours );
+		return;
+	}
+	
+	/* Make the target image the target format, covering only the limits. Its buffer is reused if big enough */
+	unsigned int high_width = (hi_x-lo_x)+1;
+	unsigned int high_height = (hi_y-lo_y)+1;
+	uint8_t* high_buff = high_image->WriteBuffer(high_width, high_height, p_colours, p_subpixelorder);
+	if ( !high_buff )
+		return;
+	
+	/* Set image to all black */
+	high_image->Clear();
+	
+	/* Grayscale edges are drawn straight into the image, colour ones through a line mask
+	   kept by the thread for the next image highlighted rather than allocated for each */
+	ImageBufferPool::Scratch &edge_scratch = ImageBufferPool::ThreadScratch(ImageBufferPool::SCRATCH_EDGES);
+	if ( p_colours != ZM_COLOUR_GRAY8 && edge_scratch.allocation < high_width ) {
+		DumpBuffer(edge_scratch.buffer, ZM_BUFTYPE_ZM);
+		edge_scratch.buffer = AllocBuffer(high_width);
+		edge_scratch.allocation = high_width;
 	}
-	else if ( p_colours == ZM_COLOUR_RGB24 )
+	uint8_t* edge_buffer = edge_scratch.buffer;
+	const uint8_t value = (p_colours == ZM_COLOUR_GRAY8)?(uint8_t)colour:0xff;
+	
+	/* The pixels within the sides of the image have all their neighbours, so can be done together */
+	unsigned int lo_inner_x = std::max( lo_x, 1U );
+	unsigned int hi_inner_x = std::min( hi_x, width-2 );
+	
+	for ( unsigned int y = lo_y; y <= hi_y; y++ )
 	{
-		for ( unsigned int y = lo_y; y <= hi_y; y++ )
+		/* Lines outside the image count as set, as the line itself stands in for them */
+		const uint8_t* p = buffer + (y * width);
+		const uint8_t* above = (y > 0)?(p - width):p;
+		const uint8_t* below = (y < (height-1))?(p + width):p;
+		uint8_t* edges = (p_colours == ZM_COLOUR_GRAY8)?(high_buff + ((y-lo_y) * high_width)):edge_buffer;
+		
+		if ( lo_x < lo_inner_x )
+			edges[0] = EdgeAt( above, p, below, lo_x, width ) & value;
+		if ( lo_inner_x <= hi_inner_x )
+			(*fptr_edges8)( above+lo_inner_x, p+lo_inner_x, below+lo_inner_x, edges+(lo_inner_x-lo_x), (hi_inner_x-lo_inner_x)+1, value );
+		if ( hi_x > hi_inner_x && hi_x >= lo_inner_x )
+			edges[hi_x-lo_x] = EdgeAt( above, p, below, hi_x, width ) & value;
+		
+		if ( p_colours == ZM_COLOUR_GRAY8 )
+			continue;
+		
+		/* Colour the pixels set in the mask, skipping over where there are none a few at a time */
+		uint8_t* phigh = high_buff + (((y-lo_y) * high_width) * p_colours);
+		for ( unsigned int x = 0; x < high_width; )
 		{
-			const uint8_t* p = buffer + (y * width) + lo_x;
-			uint8_t* phigh = high_buff + (((y * width) + lo_x) * 3);
-			for ( unsigned int x = lo_x; x <= hi_x; x++, p++, phigh += 3 )
+			uint64_t chunk = 0;
+			if ( (x+8) <= high_width )
+				memcpy( &chunk, edges+x, 8 );
+			if ( (x+8) <= high_width && !chunk )
 			{
-				bool edge = false;
-				if ( *p )
-				{
-					if ( !edge && x > 0 && !*(p-1) ) edge = true;
-					if ( !edge && x < (width-1) && !*(p+1) ) edge = true;
-					if ( !edge && y > 0 && !*(p-width) ) edge = true;
-					if ( !edge && y < (height-1) && !*(p+width) ) edge = true;
-				}
-				if ( edge )
-				{
-					RED_PTR_RGBA(phigh) = RED_VAL_RGBA(colour);
-					GREEN_PTR_RGBA(phigh) = GREEN_VAL_RGBA(colour);
-					BLUE_PTR_RGBA(phigh) = BLUE_VAL_RGBA(colour);
-				}
+				x += 8;
+				continue;
 			}
-		}
-	}
-	else if ( p_colours == ZM_COLOUR_RGB32 )
-	{
-		for ( unsigned int y = lo_y; y <= hi_y; y++ )
-		{
-			const uint8_t* p = buffer + (y * width) + lo_x;
-			Rgb* phigh = (Rgb*)(high_buff + (((y * width) + lo_x) * 4));
-			for ( unsigned int x = lo_x; x <= hi_x; x++, p++, phigh++ )
+			const unsigned int end_x = std::min( x+8, high_width );
+			for ( ; x < end_x; x++ )
 			{
-				bool edge = false;
-				if ( *p )
+				if ( !edges[x] )
+					continue;
+				if ( p_colours == ZM_COLOUR_RGB24 )
 				{
-					if ( !edge && x > 0 && !*(p-1) ) edge = true;
-					if ( !edge && x < (width-1) && !*(p+1) ) edge = true;
-					if ( !edge && y > 0 && !*(p-width) ) edge = true;
-					if ( !edge && y < (height-1) && !*(p+width) ) edge = true;
+					uint8_t* pixel = phigh + (x * 3);
+					RED_PTR_RGBA(pixel) = RED_VAL_RGBA(colour);
+					GREEN_PTR_RGBA(pixel) = GREEN_VAL_RGBA(colour);
+					BLUE_PTR_RGBA(pixel) = BLUE_VAL_RGBA(colour);
 				}
-				if ( edge )
+				else
 				{
-					*phigh = colour;
+					*((Rgb*)phigh + x) = colour;
 				}
 			}
 		}
 	}
-	
-	return( high_image );
 }
 
 bool Image::ReadRaw( const char *filename )
@@ -631,19 +827,124 @@ bool Image::WriteRaw( const char *filename ) const
 	return( true );
 }
 
-bool Image::ReadJpeg( const char *filename, unsigned int p_colours, unsigned int p_subpixelorder)
+/* Work out the libjpeg colour space matching an image's colours and subpixel order */
+static bool zm_jpeg_colour_space( unsigned int p_colours, unsigned int p_subpixelorder, J_COLOR_SPACE *colour_space, int *components )
 {
-	unsigned int new_width, new_height, new_colours, new_subpixelorder;
-	struct jpeg_decompress_struct *cinfo = jpg_dcinfo;
+	switch(p_colours) {
+	  case ZM_COLOUR_GRAY8:
+	  {
+	    if(p_subpixelorder == ZM_SUBPIX_ORDER_YUV420P) {
+	      /* Fed straight from the planes with jpeg_write_raw_data */
+	      *components = 3;
+	      *colour_space = JCS_YCbCr;
+	    } else {
+	      *components = 1;
+	      *colour_space = JCS_GRAYSCALE;
+	    }
+	    break;
+	  }
+	  case ZM_COLOUR_RGB32:
+	  {
+#ifdef JCS_EXTENSIONS
+	    *components = 4;
+	    if(p_subpixelorder == ZM_SUBPIX_ORDER_BGRA) {
+	      *colour_space = JCS_EXT_BGRX;
+	    } else if(p_subpixelorder == ZM_SUBPIX_ORDER_ARGB) {
+	      *colour_space = JCS_EXT_XRGB;
+	    } else if(p_subpixelorder == ZM_SUBPIX_ORDER_ABGR) {
+	      *colour_space = JCS_EXT_XBGR;
+	    } else {
+	      /* Assume RGBA */
+	      *colour_space = JCS_EXT_RGBX;
+	    }
+#else
+	    Error("libjpeg-turbo is required for JPEG encoding directly from RGB32 source");
+	    return(false);
+#endif
+	    break;
+	  }
+	  case ZM_COLOUR_RGB24:
+	  default:
+	  {
+	    *components = 3;
+	    if(p_subpixelorder == ZM_SUBPIX_ORDER_BGR) {
+#ifdef JCS_EXTENSIONS
+	      *colour_space = JCS_EXT_BGR;
+#else
+	      Error("libjpeg-turbo is required for JPEG encoding directly from BGR24 source");
+	      return(false);
+#endif
+	    } else {
+	      /* Assume RGB */
+	      *colour_space = JCS_RGB;
+	    }
+	    break;
+	  }
+	}
+	return(true);
+}
 
-	if ( !cinfo )
-	{
-		cinfo = jpg_dcinfo = new jpeg_decompress_struct;
-		cinfo->err = jpeg_std_error( &jpg_err.pub );
-		jpg_err.pub.error_exit = zm_jpeg_error_exit;
-		jpg_err.pub.emit_message = zm_jpeg_emit_message;
-		jpeg_create_decompress( cinfo );
+/* Select the decompression output colour space, falling back to RGB24 where libjpeg-turbo is not available */
+static void zm_jpeg_out_colour_space( jpeg_decompress_struct *cinfo, unsigned int p_colours, unsigned int p_subpixelorder, unsigned int *new_colours, unsigned int *new_subpixelorder )
+{
+	switch(p_colours) {
+	  case ZM_COLOUR_GRAY8:
+	  {
+	    cinfo->out_color_space = JCS_GRAYSCALE;
+	    *new_colours = ZM_COLOUR_GRAY8;
+	    *new_subpixelorder = ZM_SUBPIX_ORDER_NONE;
+	    break;
+	  }
+	  case ZM_COLOUR_RGB32:
+	  {
+#ifdef JCS_EXTENSIONS
+	    *new_colours = ZM_COLOUR_RGB32;
+	    if(p_subpixelorder == ZM_SUBPIX_ORDER_BGRA) {
+	      cinfo->out_color_space = JCS_EXT_BGRX;
+	      *new_subpixelorder = ZM_SUBPIX_ORDER_BGRA;
+	    } else if(p_subpixelorder == ZM_SUBPIX_ORDER_ARGB) {
+	      cinfo->out_color_space = JCS_EXT_XRGB;
+	      *new_subpixelorder = ZM_SUBPIX_ORDER_ARGB;
+	    } else if(p_subpixelorder == ZM_SUBPIX_ORDER_ABGR) {
+	      cinfo->out_color_space = JCS_EXT_XBGR;
+	      *new_subpixelorder = ZM_SUBPIX_ORDER_ABGR;
+	    } else {
+	      /* Assume RGBA */
+	      cinfo->out_color_space = JCS_EXT_RGBX;
+	      *new_subpixelorder = ZM_SUBPIX_ORDER_RGBA;
+	    }
+	    break;
+#else
+	    Warning("libjpeg-turbo is required for reading a JPEG directly into a RGB32 buffer, reading into a RGB24 buffer instead.");
+#endif
+	  }
+	  case ZM_COLOUR_RGB24:
+	  default:
+	  {
+	    *new_colours = ZM_COLOUR_RGB24;
+	    if(p_subpixelorder == ZM_SUBPIX_ORDER_BGR) {
+#ifdef JCS_EXTENSIONS
+	      cinfo->out_color_space = JCS_EXT_BGR;
+	      *new_subpixelorder = ZM_SUBPIX_ORDER_BGR;
+#else
+	      Warning("libjpeg-turbo is required for reading a JPEG directly into a BGR24 buffer, reading into a RGB24 buffer instead.");
+	      cinfo->out_color_space = JCS_RGB;
+	      *new_subpixelorder = ZM_SUBPIX_ORDER_RGB;
+#endif
+	    } else {
+	      /* Assume RGB */
+	      cinfo->out_color_space = JCS_RGB;
+	      *new_subpixelorder = ZM_SUBPIX_ORDER_RGB;
+	    }
+	    break;
+	  }
 	}
+}
+
+bool Image::ReadJpeg( const char *filename, unsigned int p_colours, unsigned int p_subpixelorder)
+{
+	unsigned int new_width, new_height, new_colours, new_subpixelorder;
+	JpegCodec *codec = JpegCodec::threadCodec();
 
 	FILE *infile;
 	if ( (infile = fopen( filename, "rb" )) == NULL )
@@ -652,7 +953,9 @@ bool Image::ReadJpeg( const char *filename, unsigned int p_colours, unsigned int
 		return( false );
 	}
 
-	if ( setjmp( jpg_err.setjmp_buffer ) )
+	struct jpeg_decompress_struct *cinfo = codec->getDecompressor();
+
+	if ( setjmp( codec->errorMgr()->setjmp_buffer ) )
 	{
 		jpeg_abort_decompress( cinfo );
 		fclose( infile );
@@ -685,65 +988,8 @@ bool Image::ReadJpeg( const char *filename, unsigned int p_colours, unsigned int
 		Debug(9,"Image dimensions differ. Old: %ux%u New: %ux%u",width,height,new_width,new_height);
 	}
 	
-	switch(p_colours) {
-	  case ZM_COLOUR_GRAY8:
-	  {
-	    cinfo->out_color_space = JCS_GRAYSCALE;
-	    new_colours = ZM_COLOUR_GRAY8;
-	    new_subpixelorder = ZM_SUBPIX_ORDER_NONE;
-	    break;
-	  }
-	  case ZM_COLOUR_RGB32:
-	  {
-#ifdef JCS_EXTENSIONS
-	    new_colours = ZM_COLOUR_RGB32;
-	    if(p_subpixelorder == ZM_SUBPIX_ORDER_BGRA) {
-	      cinfo->out_color_space = JCS_EXT_BGRX;
-	      new_subpixelorder = ZM_SUBPIX_ORDER_BGRA;
-	    } else if(p_subpixelorder == ZM_SUBPIX_ORDER_ARGB) {
-	      cinfo->out_color_space = JCS_EXT_XRGB;
-	      new_subpixelorder = ZM_SUBPIX_ORDER_ARGB;
-	    } else if(p_subpixelorder == ZM_SUBPIX_ORDER_ABGR) {
-	      cinfo->out_color_space = JCS_EXT_XBGR;
-	      new_subpixelorder = ZM_SUBPIX_ORDER_ABGR;
-	    } else {
-	      /* Assume RGBA */
-	      cinfo->out_color_space = JCS_EXT_RGBX;
-	      new_subpixelorder = ZM_SUBPIX_ORDER_RGBA;
-	    }
-	    break;      
-#else
-	    Warning("libjpeg-turbo is required for reading a JPEG directly into a RGB32 buffer, reading into a RGB24 buffer instead.");
-#endif
-	  }
-	  case ZM_COLOUR_RGB24:
-	  default:
-	  {
-	    new_colours = ZM_COLOUR_RGB24;
-	    if(p_subpixelorder == ZM_SUBPIX_ORDER_BGR) {
-#ifdef JCS_EXTENSIONS      
-	      cinfo->out_color_space = JCS_EXT_BGR;    
-	      new_subpixelorder = ZM_SUBPIX_ORDER_BGR;
-#else
-	      Warning("libjpeg-turbo is required for reading a JPEG directly into a BGR24 buffer, reading into a RGB24 buffer instead.");      
-	      cinfo->out_color_space = JCS_RGB;    
-	      new_subpixelorder = ZM_SUBPIX_ORDER_RGB;
-#endif
-	    } else {
-	      /* Assume RGB */
-/*
-#ifdef JCS_EXTENSIONS
-	      cinfo->out_color_space = JCS_EXT_RGB;
-#else
-	      cinfo->out_color_space = JCS_RGB;
-#endif
-*/
-	      cinfo->out_color_space = JCS_RGB;
-	      new_subpixelorder = ZM_SUBPIX_ORDER_RGB;
-	    }
-	    break;
-	  }
-	}
+	zm_jpeg_out_colour_space( cinfo, p_colours, p_subpixelorder, &new_colours, &new_subpixelorder );
+	codec->setDecompressOptions( cinfo );
 	
 	if(WriteBuffer(new_width, new_height, new_colours, new_subpixelorder) == NULL) {
 		Error("Failed requesting writeable buffer for reading JPEG image.");
@@ -771,7 +1017,7 @@ bool Image::ReadJpeg( const char *filename, unsigned int p_colours, unsigned int
 
 bool Image::WriteJpeg( const char *filename, int quality_override ) const
 {
-	if ( config.colour_jpeg_files && colours == ZM_COLOUR_GRAY8 )
+	if ( config.colour_jpeg_files && colours == ZM_COLOUR_GRAY8 && !IsYUV420P() )
 	{
 		Image temp_image( *this );
 		temp_image.Colourise( ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB );
@@ -780,88 +1026,41 @@ bool Image::WriteJpeg( const char *filename, int quality_override ) const
 
 	int quality = quality_override?quality_override:config.jpeg_file_quality;
 
-	struct jpeg_compress_struct *cinfo = jpg_ccinfo[quality];
-
-	if ( !cinfo )
+	J_COLOR_SPACE colour_space;
+	int components;
+	if ( !zm_jpeg_colour_space( colours, subpixelorder, &colour_space, &components ) )
 	{
-		cinfo = jpg_ccinfo[quality] = new jpeg_compress_struct;
-		cinfo->err = jpeg_std_error( &jpg_err.pub );
-		jpg_err.pub.error_exit = zm_jpeg_error_exit;
-		jpg_err.pub.emit_message = zm_jpeg_emit_message;
-		jpeg_create_compress( cinfo );
+		return( false );
 	}
 
+	JpegCodec *codec = JpegCodec::threadCodec();
+
 	FILE *outfile;
 	if ( (outfile = fopen( filename, "wb" )) == NULL )
 	{
 		Error( "Can't open %s: %s", filename, strerror(errno) );
 		return( false );
 	}
+
+	struct jpeg_compress_struct *volatile cinfo = 0;
+	if ( setjmp( codec->errorMgr()->setjmp_buffer ) )
+	{
+		if ( cinfo )
+			jpeg_abort_compress( cinfo );
+		fclose( outfile );
+		return( false );
+	}
+
+	if ( !(cinfo = codec->getCompressor( colour_space, components, quality )) )
+	{
+		fclose( outfile );
+		return( false );
+	}
+
 	jpeg_stdio_dest( cinfo, outfile );
 
 	cinfo->image_width = width; 	/* image width and height, in pixels */
 	cinfo->image_height = height;
-	
-	switch(colours) {
-	  case ZM_COLOUR_GRAY8:
-	  {
-	    cinfo->input_components = 1;
-	    cinfo->in_color_space = JCS_GRAYSCALE;
-	    break;
-	  }
-	  case ZM_COLOUR_RGB32:
-	  {
-#ifdef JCS_EXTENSIONS
-	    cinfo->input_components = 4;
-	    if(subpixelorder == ZM_SUBPIX_ORDER_BGRA) {
-	      cinfo->in_color_space = JCS_EXT_BGRX;
-	    } else if(subpixelorder == ZM_SUBPIX_ORDER_ARGB) {
-	      cinfo->in_color_space = JCS_EXT_XRGB;
-	    } else if(subpixelorder == ZM_SUBPIX_ORDER_ABGR) {
-	      cinfo->in_color_space = JCS_EXT_XBGR;
-	    } else {
-	      /* Assume RGBA */
-	      cinfo->in_color_space = JCS_EXT_RGBX;
-	    }  
-#else
-	    Error("libjpeg-turbo is required for JPEG encoding directly from RGB32 source");
-	    jpeg_abort_compress( cinfo );
-	    fclose(outfile);
-	    return(false);
-#endif
-	    break;
-	  }
-	  case ZM_COLOUR_RGB24:
-	  default:
-	  {
-	    cinfo->input_components = 3;
-	    if(subpixelorder == ZM_SUBPIX_ORDER_BGR) {
-#ifdef JCS_EXTENSIONS   
-	      cinfo->in_color_space = JCS_EXT_BGR;
-#else
-	      Error("libjpeg-turbo is required for JPEG encoding directly from BGR24 source");
-	      jpeg_abort_compress( cinfo );
-	      fclose(outfile);
-	      return(false);                                                                                  
-#endif
-	    } else {
-	      /* Assume RGB */
-/*
-#ifdef JCS_EXTENSIONS
-	      cinfo->out_color_space = JCS_EXT_RGB;
-#else
-	      cinfo->out_color_space = JCS_RGB;
-#endif
-*/
-	      cinfo->in_color_space = JCS_RGB;
-	    }
-	    break;
-	  }
-	}
-	
-	jpeg_set_defaults( cinfo );
-	jpeg_set_quality( cinfo, quality, false );
-	cinfo->dct_method = JDCT_FASTEST;
 
 	jpeg_start_compress( cinfo, TRUE );
 	if ( config.add_jpeg_comments && text[0] )
@@ -869,12 +1068,19 @@ bool Image::WriteJpeg( const char *filename, int quality_override ) const
 		jpeg_write_marker( cinfo, JPEG_COM, (const JOCTET *)text, strlen(text) );
 	}
 
-	JSAMPROW row_pointer;	/* pointer to a single row */
-	int row_stride = cinfo->image_width * colours; /* physical row width in buffer */
-	while ( cinfo->next_scanline < cinfo->image_height )
+	if ( IsYUV420P() )
+	{
+		WriteJpegRaw( codec, cinfo );
+	}
+	else
 	{
-		row_pointer = &buffer[cinfo->next_scanline * row_stride];
-		jpeg_write_scanlines( cinfo, &row_pointer, 1 );
+		JSAMPROW row_pointer;	/* pointer to a single row */
+		int row_stride = cinfo->image_width * colours; /* physical row width in buffer */
+		while ( cinfo->next_scanline < cinfo->image_height )
+		{
+			row_pointer = &buffer[cinfo->next_scanline * row_stride];
+			jpeg_write_scanlines( cinfo, &row_pointer, 1 );
+		}
 	}
 
 	jpeg_finish_compress( cinfo );
@@ -884,21 +1090,58 @@ bool Image::WriteJpeg( const char *filename, int quality_override ) const
 	return( true );
 }
 
-bool Image::DecodeJpeg( const JOCTET *inbuffer, int inbuffer_size, unsigned int p_colours, unsigned int p_subpixelorder)
+/* Compress the luma and chroma planes of a YUV420P image directly, saving
+   the colour conversion and downsampling libjpeg would otherwise do */
+void Image::WriteJpegRaw( JpegCodec *codec, jpeg_compress_struct *cinfo ) const
 {
-	unsigned int new_width, new_height, new_colours, new_subpixelorder;
-	struct jpeg_decompress_struct *cinfo = jpg_dcinfo;
+	unsigned int c_width = (width+1)>>1;
+	unsigned int c_height = (height+1)>>1;
+	const uint8_t *y_plane = buffer;
+	const uint8_t *u_plane = buffer+pixels;
+	const uint8_t *v_plane = u_plane+(c_width*c_height);
+
+	/* libjpeg reads each row out to a whole number of 8 pixel blocks. That only
+	   runs into the following row or plane, except for the last row of the V
+	   plane which is copied to a scratch row so the end of the buffer isn't overrun */
+	unsigned int c_padded = (c_width+7)&~7;
+	uint8_t *v_last = codec->getScratch( c_padded );
+	memcpy( v_last, v_plane+((c_height-1)*c_width), c_width );
+	memset( v_last+c_width, 0, c_padded-c_width );
+
+	JSAMPROW y_rows[16];
+	JSAMPROW u_rows[8];
+	JSAMPROW v_rows[8];
+	JSAMPARRAY planes[3] = { y_rows, u_rows, v_rows };
 
-	if ( !cinfo )
+	while ( cinfo->next_scanline < cinfo->image_height )
 	{
-		cinfo = jpg_dcinfo = new jpeg_decompress_struct;
-		cinfo->err = jpeg_std_error( &jpg_err.pub );
-		jpg_err.pub.error_exit = zm_jpeg_error_exit;
-		jpg_err.pub.emit_message = zm_jpeg_emit_message;
-		jpeg_create_decompress( cinfo );
+		/* Rows past the bottom of the image repeat the last one */
+		for ( unsigned int i = 0; i < 16; i++ )
+		{
+			unsigned int y = cinfo->next_scanline+i;
+			if ( y >= height )
+				y = height-1;
+			y_rows[i] = (JSAMPROW)&y_plane[y*width];
+		}
+		for ( unsigned int i = 0; i < 8; i++ )
+		{
+			unsigned int y = (cinfo->next_scanline>>1)+i;
+			if ( y >= c_height )
+				y = c_height-1;
+			u_rows[i] = (JSAMPROW)&u_plane[y*c_width];
+			v_rows[i] = (y == c_height-1)?v_last:(JSAMPROW)&v_plane[y*c_width];
+		}
+		jpeg_write_raw_data( cinfo, planes, 16 );
 	}
+}
 
-	if ( setjmp( jpg_err.setjmp_buffer ) )
+bool Image::DecodeJpeg( const JOCTET *inbuffer, int inbuffer_size, unsigned int p_colours, unsigned int p_subpixelorder)
+{
+	unsigned int new_width, new_height, new_colours, new_subpixelorder;
+	JpegCodec *codec = JpegCodec::threadCodec();
+	struct jpeg_decompress_struct *cinfo = codec->getDecompressor();
+
+	if ( setjmp( codec->errorMgr()->setjmp_buffer ) )
 	{
 		jpeg_abort_decompress( cinfo );
 		return( false );
@@ -929,65 +1172,8 @@ bool Image::DecodeJpeg( const JOCTET *inbuffer, int inbuffer_size, unsigned int
 		Debug(9,"Image dimensions differ. Old: %ux%u New: %ux%u",width,height,new_width,new_height);
 	}
 	
-	switch(p_colours) {
-	  case ZM_COLOUR_GRAY8:
-	  {
-	    cinfo->out_color_space = JCS_GRAYSCALE;
-	    new_colours = ZM_COLOUR_GRAY8;
-	    new_subpixelorder = ZM_SUBPIX_ORDER_NONE;
-	    break;
-	  }
-	  case ZM_COLOUR_RGB32:
-	  {
-#ifdef JCS_EXTENSIONS
-	    new_colours = ZM_COLOUR_RGB32;
-	    if(p_subpixelorder == ZM_SUBPIX_ORDER_BGRA) {
-	      cinfo->out_color_space = JCS_EXT_BGRX;
-	      new_subpixelorder = ZM_SUBPIX_ORDER_BGRA;
-	    } else if(p_subpixelorder == ZM_SUBPIX_ORDER_ARGB) {
-	      cinfo->out_color_space = JCS_EXT_XRGB;
-	      new_subpixelorder = ZM_SUBPIX_ORDER_ARGB;
-	    } else if(p_subpixelorder == ZM_SUBPIX_ORDER_ABGR) {
-	      cinfo->out_color_space = JCS_EXT_XBGR;
-	      new_subpixelorder = ZM_SUBPIX_ORDER_ABGR;
-	    } else {
-	      /* Assume RGBA */
-	      cinfo->out_color_space = JCS_EXT_RGBX;
-	      new_subpixelorder = ZM_SUBPIX_ORDER_RGBA;
-	    }
-	    break;      
-#else
-	    Warning("libjpeg-turbo is required for reading a JPEG directly into a RGB32 buffer, reading into a RGB24 buffer instead.");
-#endif
-	  }
-	  case ZM_COLOUR_RGB24:
-	  default:
-	  {
-	    new_colours = ZM_COLOUR_RGB24;
-	    if(p_subpixelorder == ZM_SUBPIX_ORDER_BGR) {
-#ifdef JCS_EXTENSIONS      
-	      cinfo->out_color_space = JCS_EXT_BGR;    
-	      new_subpixelorder = ZM_SUBPIX_ORDER_BGR;
-#else
-	      Warning("libjpeg-turbo is required for reading a JPEG directly into a BGR24 buffer, reading into a RGB24 buffer instead.");      
-	      cinfo->out_color_space = JCS_RGB;    
-	      new_subpixelorder = ZM_SUBPIX_ORDER_RGB;
-#endif
-	    } else {
-	      /* Assume RGB */
-/*
-#ifdef JCS_EXTENSIONS
-	      cinfo->out_color_space = JCS_EXT_RGB;
-#else
-	      cinfo->out_color_space = JCS_RGB;
-#endif
-*/
-	      cinfo->out_color_space = JCS_RGB;
-	      new_subpixelorder = ZM_SUBPIX_ORDER_RGB;
-	    }
-	    break;
-	  }
-	}
+	zm_jpeg_out_colour_space( cinfo, p_colours, p_subpixelorder, &new_colours, &new_subpixelorder );
+	codec->setDecompressOptions( cinfo );
 	
 	if(WriteBuffer(new_width, new_height, new_colours, new_subpixelorder) == NULL) {
 		Error("Failed requesting writeable buffer for reading JPEG image.");
@@ -1012,7 +1198,7 @@ bool Image::DecodeJpeg( const JOCTET *inbuffer, int inbuffer_size, unsigned int
 
 bool Image::EncodeJpeg( JOCTET *outbuffer, int *outbuffer_size, int quality_override ) const
 {
-	if ( config.colour_jpeg_files && colours == ZM_COLOUR_GRAY8 )
+	if ( config.colour_jpeg_files && colours == ZM_COLOUR_GRAY8 && !IsYUV420P() )
 	{
 		Image temp_image( *this );
 		temp_image.Colourise(ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB );
@@ -1021,15 +1207,26 @@ bool Image::EncodeJpeg( JOCTET *outbuffer, int *outbuffer_size, int quality_over
 
 	int quality = quality_override?quality_override:config.jpeg_stream_quality;
 
-	struct jpeg_compress_struct *cinfo = jpg_ccinfo[quality];
+	J_COLOR_SPACE colour_space;
+	int components;
+	if ( !zm_jpeg_colour_space( colours, subpixelorder, &colour_space, &components ) )
+	{
+		return( false );
+	}
+
+	JpegCodec *codec = JpegCodec::threadCodec();
 
-	if ( !cinfo )
+	struct jpeg_compress_struct *volatile cinfo = 0;
+	if ( setjmp( codec->errorMgr()->setjmp_buffer ) )
 	{
-		cinfo = jpg_ccinfo[quality] = new jpeg_compress_struct;
-		cinfo->err = jpeg_std_error( &jpg_err.pub );
-		jpg_err.pub.error_exit = zm_jpeg_error_exit;
-		jpg_err.pub.emit_message = zm_jpeg_emit_message;
-		jpeg_create_compress( cinfo );
+		if ( cinfo )
+			jpeg_abort_compress( cinfo );
+		return( false );
+	}
+
+	if ( !(cinfo = codec->getCompressor( colour_space, components, quality )) )
+	{
+		return( false );
 	}
 
 	zm_jpeg_mem_dest( cinfo, outbuffer, outbuffer_size );
@@ -1037,73 +1234,21 @@ bool Image::EncodeJpeg( JOCTET *outbuffer, int *outbuffer_size, int quality_over
 	cinfo->image_width = width; 	/* image width and height, in pixels */
 	cinfo->image_height = height;
 
-	switch(colours) {
-	  case ZM_COLOUR_GRAY8:
-	  {
-	    cinfo->input_components = 1;
-	    cinfo->in_color_space = JCS_GRAYSCALE;
-	    break;
-	  }
-	  case ZM_COLOUR_RGB32:
-	  {
-#ifdef JCS_EXTENSIONS
-	    cinfo->input_components = 4;
-	    if(subpixelorder == ZM_SUBPIX_ORDER_BGRA) {
-	      cinfo->in_color_space = JCS_EXT_BGRX;
-	    } else if(subpixelorder == ZM_SUBPIX_ORDER_ARGB) {
-	      cinfo->in_color_space = JCS_EXT_XRGB;
-	    } else if(subpixelorder == ZM_SUBPIX_ORDER_ABGR) {
-	      cinfo->in_color_space = JCS_EXT_XBGR;
-	    } else {
-	      /* Assume RGBA */
-	      cinfo->in_color_space = JCS_EXT_RGBX;
-	    } 
-#else
-	    Error("libjpeg-turbo is required for JPEG encoding directly from RGB32 source");
-	    jpeg_abort_compress( cinfo );
-	    return(false);
-#endif
-	    break;
-	  }
-	  case ZM_COLOUR_RGB24:
-	  default:
-	  {
-	    cinfo->input_components = 3;
-	    if(subpixelorder == ZM_SUBPIX_ORDER_BGR) {
-#ifdef JCS_EXTENSIONS   
-	      cinfo->in_color_space = JCS_EXT_BGR;
-#else
-	      Error("libjpeg-turbo is required for JPEG encoding directly from BGR24 source");
-	      jpeg_abort_compress( cinfo );
-	      return(false);                                                                                  
-#endif
-	    } else {
-	      /* Assume RGB */
-/*
-#ifdef JCS_EXTENSIONS
-	      cinfo->out_color_space = JCS_EXT_RGB;
-#else
-	      cinfo->out_color_space = JCS_RGB;
-#endif
-*/
-	      cinfo->in_color_space = JCS_RGB;
-	    }
-	    break;
-	  }
-	}
-	
-	jpeg_set_defaults( cinfo );
-	jpeg_set_quality( cinfo, quality, false );
-	cinfo->dct_method = JDCT_FASTEST;
-
 	jpeg_start_compress( cinfo, TRUE );
 
-	JSAMPROW row_pointer;	/* pointer to a single row */
-	int row_stride = cinfo->image_width * colours; /* physical row width in buffer */
-	while ( cinfo->next_scanline < cinfo->image_height )
+	if ( IsYUV420P() )
+	{
+		WriteJpegRaw( codec, cinfo );
+	}
+	else
 	{
-		row_pointer = &buffer[cinfo->next_scanline * row_stride];
-		jpeg_write_scanlines( cinfo, &row_pointer, 1 );
+		JSAMPROW row_pointer;	/* pointer to a single row */
+		int row_stride = cinfo->image_width * colours; /* physical row width in buffer */
+		while ( cinfo->next_scanline < cinfo->image_height )
+		{
+			row_pointer = &buffer[cinfo->next_scanline * row_stride];
+			jpeg_write_scanlines( cinfo, &row_pointer, 1 );
+		}
 	}
 
 	jpeg_finish_compress( cinfo );
@@ -1143,6 +1288,8 @@ bool Image::Zip( Bytef *outbuffer, unsigned long *outbuffer_size, int compressio
 
 bool Image::Crop( unsigned int lo_x, unsigned int lo_y, unsigned int hi_x, unsigned int hi_y )
 {
+	DropChroma();
+
 	unsigned int new_width = (hi_x-lo_x)+1;
 	unsigned int new_height = (hi_y-lo_y)+1;
 
@@ -1162,18 +1309,8 @@ bool Image::Crop( unsigned int lo_x, unsigned int lo_y, unsigned int hi_x, unsig
 		return( true );
 	}
 
-	unsigned int new_size = new_width*new_height*colours;
-	uint8_t *new_buffer = AllocBuffer(new_size);
-	
-	unsigned int new_stride = new_width*colours;
-	for ( unsigned int y = lo_y, ny = 0; y <= hi_y; y++, ny++ )
-	{
-		unsigned char *pbuf = &buffer[((y*width)+lo_x)*colours];
-		unsigned char *pnbuf = &new_buffer[(ny*new_width)*colours];
-		memcpy( pnbuf, pbuf, new_stride );
-	}
-
-	AssignDirect(new_width, new_height, colours, subpixelorder, new_buffer, new_size, ZM_BUFTYPE_ZM);
+	/* Our own buffer is cropped in place */
+	Assign( ImageView( *this, Box( lo_x, lo_y, hi_x, hi_y ) ) );
 
 	return( true );
 }
@@ -1183,249 +1320,130 @@ bool Image::Crop( const Box &limits )
     return( Crop( limits.LoX(), limits.LoY(), limits.HiX(), limits.HiY() ) );
 }
 
-/* Far from complete */
-/* Need to implement all possible of overlays possible */
-void Image::Overlay( const Image &image )
+/* The bytes of an RGB32 pixel holding its colour rather than its alpha, as an Rgb loaded from memory */
+static Rgb ColourBytesMask( unsigned int p_subpixelorder )
 {
-	if ( !(width == image.width && height == image.height) )
-	{
-		Panic( "Attempt to overlay different sized images, expected %dx%d, got %dx%d", width, height, image.width, image.height );
+	Rgb mask;
+	uint8_t* pmask = (uint8_t*)&mask;
+	if ( p_subpixelorder == ZM_SUBPIX_ORDER_RGBA || p_subpixelorder == ZM_SUBPIX_ORDER_BGRA ) {
+		/* RGBA\BGRA subpixel order - Alpha byte is last */
+		pmask[0] = pmask[1] = pmask[2] = 0xff;
+		pmask[3] = 0;
+	} else {
+		/* ABGR\ARGB subpixel order - Alpha byte is first */
+		pmask[0] = 0;
+		pmask[1] = pmask[2] = pmask[3] = 0xff;
 	}
-	
+	return mask;
+}
+
+/* Copies the pixels of an area of image that aren't black onto the area at x,y of this one, converting this image to the format of image first if it is grayscale */
+void Image::OverlayArea( const Image &image, unsigned int src_x, unsigned int src_y, unsigned int x, unsigned int y, unsigned int area_width, unsigned int area_height )
+{
 	if( colours == image.colours && subpixelorder != image.subpixelorder ) {
 		Warning("Attempt to overlay images of same format but with different subpixel order.");
 	}
 	
-	/* Grayscale ontop of grayscale - complete */
-	if ( colours == ZM_COLOUR_GRAY8 && image.colours == ZM_COLOUR_GRAY8 ) {
-		const uint8_t* const max_ptr = buffer+size;
-		const uint8_t* psrc = image.buffer;
-		uint8_t* pdest = buffer;
-		
-		while( pdest < max_ptr )
-		{
-			if ( *psrc )
-			{
-				*pdest = *psrc;
-			}
-			pdest++;
-			psrc++;
-		}
+	if ( (colours == ZM_COLOUR_RGB24 && image.colours == ZM_COLOUR_RGB32) || (colours == ZM_COLOUR_RGB32 && image.colours == ZM_COLOUR_RGB24) ) {
+		/* TO BE DONE */
+		Error("Overlay of RGB%d ontop of RGB%d is not supported.", image.colours*8, colours*8);
+		return;
+	}
 	
-	/* RGB24 ontop of grayscale - convert to same format first - complete */
-	} else if ( colours == ZM_COLOUR_GRAY8 && image.colours == ZM_COLOUR_RGB24 ) {
+	/* Colour ontop of grayscale - convert to the same format first */
+	if ( colours == ZM_COLOUR_GRAY8 && image.colours != ZM_COLOUR_GRAY8 ) {
 		Colourise(image.colours, image.subpixelorder);
-		
-		const uint8_t* const max_ptr = buffer+size;
-		const uint8_t* psrc = image.buffer;
-		uint8_t* pdest = buffer;
-		
-		while( pdest < max_ptr )
-		{
-			if ( RED_PTR_RGBA(psrc) || GREEN_PTR_RGBA(psrc) || BLUE_PTR_RGBA(psrc) )
-			{
-				RED_PTR_RGBA(pdest) = RED_PTR_RGBA(psrc);
-				GREEN_PTR_RGBA(pdest) = GREEN_PTR_RGBA(psrc);
-				BLUE_PTR_RGBA(pdest) = BLUE_PTR_RGBA(psrc);
-			}
-			pdest += 3;
-			psrc += 3;
-		}
+	}
 	
-	/* RGB32 ontop of grayscale - convert to same format first - complete */
-	} else if( colours == ZM_COLOUR_GRAY8 && image.colours == ZM_COLOUR_RGB32 ) {
-		Colourise(image.colours, image.subpixelorder);
-		
-		const Rgb* const max_ptr = (Rgb*)(buffer+size);
-		const Rgb* prsrc = (Rgb*)image.buffer; 
-		Rgb* prdest = (Rgb*)buffer;
-		
-		if(subpixelorder == ZM_SUBPIX_ORDER_RGBA || subpixelorder == ZM_SUBPIX_ORDER_BGRA) {
-			/* RGB\BGR\RGBA\BGRA subpixel order - Alpha byte is last */
-			while (prdest < max_ptr) {
-				if ( RED_PTR_RGBA(prsrc) || GREEN_PTR_RGBA(prsrc) || BLUE_PTR_RGBA(prsrc) )
-				{
-					*prdest = *prsrc;
-				}
-				prdest++;
-				prsrc++;
-			}
-		} else {
-			/* ABGR\ARGB subpixel order - Alpha byte is first */
-			while (prdest < max_ptr) {
-				if ( RED_PTR_ABGR(prsrc) || GREEN_PTR_ABGR(prsrc) || BLUE_PTR_ABGR(prsrc) )
-				{
-					*prdest = *prsrc;
-				}
-				prdest++;
-				prsrc++;
-			}
-		}
+	/* Lines spanning the whole width of both images are overlaid in one go */
+	unsigned int line_pixels = area_width;
+	unsigned int n_lines = area_height;
+	if ( line_pixels == width && line_pixels == image.width ) {
+		line_pixels *= n_lines;
+		n_lines = 1;
+	}
 	
-	/* Grayscale ontop of RGB24 - complete */
-	} else if ( colours == ZM_COLOUR_RGB24 && image.colours == ZM_COLOUR_GRAY8 ) {
-		const uint8_t* const max_ptr = buffer+size;
-		const uint8_t* psrc = image.buffer;
-		uint8_t* pdest = buffer;
-		
-		while( pdest < max_ptr )
-		{
-			if ( *psrc )
-			{
-				RED_PTR_RGBA(pdest) = GREEN_PTR_RGBA(pdest) = BLUE_PTR_RGBA(pdest) = *psrc;
-			}
-			pdest += 3;
-			psrc++;
-		}
+	/* The format is picked once, each line then being overlaid by the function for it */
+	unsigned int src_offset = (src_y*image.width)+src_x;
+	unsigned int offset = (y*width)+x;
+	if ( colours == ZM_COLOUR_GRAY8 ) {
+		/* Grayscale ontop of grayscale - complete */
+		for ( unsigned int line = 0; line < n_lines; line++, src_offset += image.width, offset += width )
+			(*fptr_overlay8)(image.buffer+src_offset, buffer+offset, line_pixels);
 	
-	/* RGB24 ontop of RGB24 - not complete. need to take care of different subpixel orders */
 	} else if ( colours == ZM_COLOUR_RGB24 && image.colours == ZM_COLOUR_RGB24 ) {
-		const uint8_t* const max_ptr = buffer+size;
-		const uint8_t* psrc = image.buffer;
-		uint8_t* pdest = buffer;
-		
-		while( pdest < max_ptr )
-		{
-			if ( RED_PTR_RGBA(psrc) || GREEN_PTR_RGBA(psrc) || BLUE_PTR_RGBA(psrc) )
-			{
-				RED_PTR_RGBA(pdest) = RED_PTR_RGBA(psrc);
-				GREEN_PTR_RGBA(pdest) = GREEN_PTR_RGBA(psrc);
-				BLUE_PTR_RGBA(pdest) = BLUE_PTR_RGBA(psrc);
-			}
-			pdest += 3;
-			psrc += 3;
-		} 
-	
-	/* RGB32 ontop of RGB24 - TO BE DONE */
-	} else if ( colours == ZM_COLOUR_RGB24 && image.colours == ZM_COLOUR_RGB32 ) {
-		Error("Overlay of RGB32 ontop of RGB24 is not supported.");
-	
-	/* Grayscale ontop of RGB32 - complete */
-	} else if ( colours == ZM_COLOUR_RGB32 && image.colours == ZM_COLOUR_GRAY8 ) {
-		const Rgb* const max_ptr = (Rgb*)(buffer+size);
-		Rgb* prdest = (Rgb*)buffer;
-		const uint8_t* psrc = image.buffer;
-		
-		if(subpixelorder == ZM_SUBPIX_ORDER_RGBA || subpixelorder == ZM_SUBPIX_ORDER_BGRA) {
-			/* RGBA\BGRA subpixel order - Alpha byte is last */
-			while (prdest < max_ptr) {
-				if ( *psrc )
-				{
-					RED_PTR_RGBA(prdest) = GREEN_PTR_RGBA(prdest) = BLUE_PTR_RGBA(prdest) = *psrc;
-				}
-				prdest++;
-				psrc++;
-			}
-		} else {
-			/* ABGR\ARGB subpixel order - Alpha byte is first */
-			while (prdest < max_ptr) {
-				if ( *psrc )
-				{
-					RED_PTR_ABGR(prdest) = GREEN_PTR_ABGR(prdest) = BLUE_PTR_ABGR(prdest) = *psrc;
-				}
-				prdest++;
-				psrc++;
-			}
-		}
+		/* RGB24 ontop of RGB24 - not complete. need to take care of different subpixel orders */
+		for ( unsigned int line = 0; line < n_lines; line++, src_offset += image.width, offset += width )
+			std_overlay24(image.buffer+(src_offset*3), buffer+(offset*3), line_pixels);
 	
-	/* RGB24 ontop of RGB32 - TO BE DONE */
-	} else if ( colours == ZM_COLOUR_RGB32 && image.colours == ZM_COLOUR_RGB24 ) {
-		Error("Overlay of RGB24 ontop of RGB32 is not supported.");
-	
-	/* RGB32 ontop of RGB32 - not complete. need to take care of different subpixel orders */
 	} else if ( colours == ZM_COLOUR_RGB32 && image.colours == ZM_COLOUR_RGB32 ) {
-		const Rgb* const max_ptr = (Rgb*)(buffer+size);
-		Rgb* prdest = (Rgb*)buffer;
-		const Rgb* prsrc = (Rgb*)image.buffer; 
-		
-		if(image.subpixelorder == ZM_SUBPIX_ORDER_RGBA || image.subpixelorder == ZM_SUBPIX_ORDER_BGRA) {
-			/* RGB\BGR\RGBA\BGRA subpixel order - Alpha byte is last */
-			while (prdest < max_ptr) {
-				if ( RED_PTR_RGBA(prsrc) || GREEN_PTR_RGBA(prsrc) || BLUE_PTR_RGBA(prsrc) )
-				{
-					*prdest = *prsrc;
+		/* RGB32 ontop of RGB32 - not complete. need to take care of different subpixel orders */
+		const Rgb colour_mask = ColourBytesMask(image.subpixelorder);
+		for ( unsigned int line = 0; line < n_lines; line++, src_offset += image.width, offset += width )
+			(*fptr_overlay32)(image.buffer+(src_offset<<2), buffer+(offset<<2), line_pixels, colour_mask);
+	
+	} else if ( colours == ZM_COLOUR_RGB24 ) {
+		/* Grayscale ontop of RGB24 - complete */
+		for ( unsigned int line = 0; line < n_lines; line++, src_offset += image.width, offset += width ) {
+			const uint8_t* psrc = image.buffer+src_offset;
+			const uint8_t* const max_ptr = psrc+line_pixels;
+			for ( uint8_t* pdest = buffer+(offset*3); psrc < max_ptr; psrc++, pdest += 3 ) {
+				if ( *psrc ) {
+					RED_PTR_RGBA(pdest) = GREEN_PTR_RGBA(pdest) = BLUE_PTR_RGBA(pdest) = *psrc;
 				}
-				prdest++;
-				prsrc++;
 			}
-		} else {
-			/* ABGR\ARGB subpixel order - Alpha byte is first */
-			while (prdest < max_ptr) {
-				if ( RED_PTR_ABGR(prsrc) || GREEN_PTR_ABGR(prsrc) || BLUE_PTR_ABGR(prsrc) )
-				{
-					*prdest = *prsrc;
+		}
+	
+	} else if ( colours == ZM_COLOUR_RGB32 ) {
+		/* Grayscale ontop of RGB32 - complete */
+		/* The first colour byte of each pixel, after the alpha byte for ABGR\ARGB subpixel order */
+		const unsigned int first = (subpixelorder == ZM_SUBPIX_ORDER_RGBA || subpixelorder == ZM_SUBPIX_ORDER_BGRA)?0:1;
+		for ( unsigned int line = 0; line < n_lines; line++, src_offset += image.width, offset += width ) {
+			const uint8_t* psrc = image.buffer+src_offset;
+			const uint8_t* const max_ptr = psrc+line_pixels;
+			for ( uint8_t* pdest = buffer+(offset<<2)+first; psrc < max_ptr; psrc++, pdest += 4 ) {
+				if ( *psrc ) {
+					pdest[0] = pdest[1] = pdest[2] = *psrc;
 				}
-				prdest++;
-				prsrc++;
 			}
 		}
 	}
 	
 }
 
-/* RGB32 compatible: complete */
+/* Copies the pixels of an image that aren't black onto this one. Only the
+   area within limits is looked at when given, otherwise the whole image is */
+void Image::Overlay( const Image &image, const Box *limits )
+{
+	if ( !(width == image.width && height == image.height) )
+	{
+		Panic( "Attempt to overlay different sized images, expected %dx%d, got %dx%d", width, height, image.width, image.height );
+	}
+	
+	int lo_x = limits?std::max( limits->LoX(), 0 ):0;
+	int lo_y = limits?std::max( limits->LoY(), 0 ):0;
+	int hi_x = limits?std::min( limits->HiX(), (int)width-1 ):width-1;
+	int hi_y = limits?std::min( limits->HiY(), (int)height-1 ):height-1;
+	if ( lo_x > hi_x || lo_y > hi_y )
+		return;
+	
+	OverlayArea( image, lo_x, lo_y, lo_x, lo_y, (hi_x-lo_x)+1, (hi_y-lo_y)+1 );
+}
+
+/* As above, for a smaller image placed with its top left corner at x,y */
 void Image::Overlay( const Image &image, unsigned int x, unsigned int y )
 {
-	if ( !(width < image.width || height < image.height) )
+	if ( width < image.width || height < image.height )
     {
         Panic( "Attempt to overlay image too big for destination, %dx%d > %dx%d", image.width, image.height, width, height );
     }
 
-	if ( !(width < (x+image.width) || height < (y+image.height)) )
+	if ( width < (x+image.width) || height < (y+image.height) )
     {
         Panic( "Attempt to overlay image outside of destination bounds, %dx%d @ %dx%d > %dx%d", image.width, image.height, x, y, width, height );
     }
 
-	if ( !(colours == image.colours) )
-    {
-        Panic( "Attempt to partial overlay differently coloured images, expected %d, got %d", colours, image.colours );
-    }
-
-	unsigned int lo_x = x;
-	unsigned int lo_y = y;
-	unsigned int hi_x = (x+image.width)-1;
-	unsigned int hi_y = (y+image.height-1);
-	if ( colours == ZM_COLOUR_GRAY8 )
-	{
-		const uint8_t *psrc = image.buffer;
-		for ( unsigned int y = lo_y; y <= hi_y; y++ )
-		{
-			uint8_t *pdest = &buffer[(y*width)+lo_x];
-			for ( unsigned int x = lo_x; x <= hi_x; x++ )
-			{
-				*pdest++ = *psrc++;
-			}
-		}
-	}
-	else if ( colours == ZM_COLOUR_RGB24 )
-	{
-		const uint8_t *psrc = image.buffer;
-		for ( unsigned int y = lo_y; y <= hi_y; y++ )
-		{
-			uint8_t *pdest = &buffer[colours*((y*width)+lo_x)];
-			for ( unsigned int x = lo_x; x <= hi_x; x++ )
-			{
-				*pdest++ = *psrc++;
-				*pdest++ = *psrc++;
-				*pdest++ = *psrc++;
-			}
-		}
-	}
-	else if ( colours == ZM_COLOUR_RGB32 )
-	{
-		const Rgb *psrc = (Rgb*)(image.buffer);
-		for ( unsigned int y = lo_y; y <= hi_y; y++ )
-		{
-			Rgb *pdest = (Rgb*)&buffer[((y*width)+lo_x)<<2];
-			for ( unsigned int x = lo_x; x <= hi_x; x++ )
-			{
-				*pdest++ = *psrc++;
-			}
-		}
-	} else {
-		Error("Overlay called with unexpected colours: %d", colours);
-	}
-	
+	OverlayArea( image, 0, 0, x, y, image.width, image.height );
 }
 
 void Image::Blend( const Image &image, int transparency )
@@ -1435,7 +1453,6 @@ void Image::Blend( const Image &image, int transparency )
 	unsigned long long executetime;
 	unsigned long milpixels;
 #endif
-	uint8_t* new_buffer;
 	
 	if ( !(width == image.width && height == image.height && colours == image.colours && subpixelorder == image.subpixelorder) )
 	{
@@ -1445,14 +1462,12 @@ void Image::Blend( const Image &image, int transparency )
 	if(transparency <= 0)
 		return;
 	
-	new_buffer = AllocBuffer(size);
-	
 #ifdef ZM_IMAGE_PROFILING
 	clock_gettime(CLOCK_THREAD_CPUTIME_ID,&start);
 #endif
 	
-	/* Do the blending */
-	(*fptr_blend)(buffer, image.buffer, new_buffer, size, transparency);
+	/* Do the blending. Each byte is read before it is written so the image can be blended in place, rather than into a new buffer each time */
+	(*fptr_blend)(buffer, image.buffer, buffer, size, transparency);
 	
 #ifdef ZM_IMAGE_PROFILING
 	clock_gettime(CLOCK_THREAD_CPUTIME_ID,&end);
@@ -1462,8 +1477,6 @@ void Image::Blend( const Image &image, int transparency )
 	milpixels = (unsigned long)((long double)size)/((((long double)executetime)/1000));
 	Debug(5, "Blend: %u colours blended in %llu nanoseconds, %lu million colours/s\n",size,executetime,milpixels);
 #endif
-	
-	AssignDirect( width, height, colours, subpixelorder, new_buffer, size, ZM_BUFTYPE_ZM);
 }
 
 Image *Image::Merge( unsigned int n_images, Image *images[] )
@@ -1484,19 +1497,24 @@ Image *Image::Merge( unsigned int n_images, Image *images[] )
 
 	Image *result = new Image( width, height, images[0]->colours, images[0]->subpixelorder);
 	unsigned int size = result->size;
-	for ( unsigned int i = 0; i < size; i++ )
+
+	/* Each image is added a line at a time into the totals, so that they are read through once rather than all at once */
+	const unsigned int line_bytes = width*colours;
+	unsigned int *totals = new unsigned int[line_bytes];
+	for ( unsigned int offset = 0; offset < size; offset += line_bytes )
 	{
-		unsigned int total = 0;
-		uint8_t *pdest = result->buffer;
+		memset( totals, 0, line_bytes*sizeof(*totals) );
 		for ( unsigned int j = 0; j < n_images; j++ )
 		{
-			uint8_t *psrc = images[j]->buffer;
-			total += *psrc;
-			psrc++;
+			const uint8_t *psrc = images[j]->buffer+offset;
+			for ( unsigned int i = 0; i < line_bytes; i++ )
+				totals[i] += psrc[i];
 		}
-		*pdest = total/n_images;
-		pdest++;
+		uint8_t *pdest = result->buffer+offset;
+		for ( unsigned int i = 0; i < line_bytes; i++ )
+			pdest[i] = totals[i]/n_images;
 	}
+	delete[] totals;
 	return( result );
 }
 
@@ -1552,26 +1570,35 @@ Image *Image::Highlight( unsigned int n_images, Image *images[], const Rgb thres
 
 	Image *result = new Image( width, height, images[0]->colours, images[0]->subpixelorder );
 	unsigned int size = result->size;
-	for ( unsigned int c = 0; c < colours; c++ )
+
+	/* A byte differs when it is at least the threshold of its colour away from the reference colour.
+	   Both are looked up per byte position in a line, so the images are counted a line at a time */
+	const unsigned int line_bytes = width*colours;
+	uint8_t *refs = new uint8_t[line_bytes];
+	uint8_t *thresholds = new uint8_t[line_bytes];
+	unsigned int *counts = new unsigned int[line_bytes];
+	for ( unsigned int i = 0; i < line_bytes; i++ )
+	{
+		unsigned int c = i%colours;
+		refs[i] = RGB_VAL(ref_colour,c);
+		thresholds[i] = RGB_VAL(threshold,c);
+	}
+	for ( unsigned int offset = 0; offset < size; offset += line_bytes )
 	{
-		for ( unsigned int i = 0; i < size; i++ )
+		memset( counts, 0, line_bytes*sizeof(*counts) );
+		for ( unsigned int j = 0; j < n_images; j++ )
 		{
-			unsigned int count = 0;
-			uint8_t *pdest = result->buffer+c;
-			for ( unsigned int j = 0; j < n_images; j++ )
-			{
-				uint8_t *psrc = images[j]->buffer+c;
-
-				if ( (unsigned)abs((*psrc)-RGB_VAL(ref_colour,c)) >= RGB_VAL(threshold,c) )
-				{
-					count++;
-				}
-				psrc += colours;
-			}
-			*pdest = (count*255)/n_images;
-			pdest += 3;
+			const uint8_t *psrc = images[j]->buffer+offset;
+			for ( unsigned int i = 0; i < line_bytes; i++ )
+				counts[i] += (unsigned int)abs((int)psrc[i]-(int)refs[i]) >= thresholds[i];
 		}
+		uint8_t *pdest = result->buffer+offset;
+		for ( unsigned int i = 0; i < line_bytes; i++ )
+			pdest[i] = (counts[i]*255)/n_images;
 	}
+	delete[] refs;
+	delete[] thresholds;
+	delete[] counts;
 	return( result );
 }
 
@@ -1673,159 +1700,289 @@ const Coord Image::centreCoord( const char *text ) const
     return( Coord( x, y ) );
 }
 
-/* RGB32 compatible: complete */
-void Image::Annotate( const char *p_text, const Coord &coord, const Rgb fg_colour, const Rgb bg_colour )
+/* The font's glyphs rendered in the colour format of an image, so that a row of a character is copied rather than drawn a bit at a time */
+struct AnnotationGlyphs
 {
-	strncpy( text, p_text, sizeof(text) );
-
-    unsigned int index = 0;
-    unsigned int line_no = 0;
-    unsigned int text_len = strlen( text );
-    unsigned int line_len = 0;
-    const char *line = text;
-
-    const uint8_t fg_r_col = RED_VAL_RGBA(fg_colour);
-    const uint8_t fg_g_col = GREEN_VAL_RGBA(fg_colour);
-    const uint8_t fg_b_col = BLUE_VAL_RGBA(fg_colour);
-    const uint8_t fg_bw_col = fg_colour & 0xff;
-    const Rgb fg_rgb_col = rgb_convert(fg_colour,subpixelorder);
-    const bool fg_trans = (fg_colour == RGB_TRANSPARENT);
-    
-    const uint8_t bg_r_col = RED_VAL_RGBA(bg_colour);
-    const uint8_t bg_g_col = GREEN_VAL_RGBA(bg_colour);
-    const uint8_t bg_b_col = BLUE_VAL_RGBA(bg_colour);
-    const uint8_t bg_bw_col = bg_colour & 0xff;
-    const Rgb bg_rgb_col = rgb_convert(bg_colour,subpixelorder);
-    const bool bg_trans = (bg_colour == RGB_TRANSPARENT);
+	unsigned int colours;
+	unsigned int subpixelorder;
+	Rgb fg_colour;
+	Rgb bg_colour;
+	uint8_t fg_pixel[4];
+	uint8_t bg_pixel[4];
+	bool rendered[256];
+	uint8_t pixels[256*Image::CHAR_HEIGHT*Image::CHAR_WIDTH*4];
+	uint8_t mask[256*Image::CHAR_HEIGHT*Image::CHAR_WIDTH*4];    /* 0xff where a colour is drawn, 0 where it is transparent */
+};
+
+/* Annotated text already rendered, copied onto any following image with the same text, position and format */
+struct AnnotationLabel
+{
+	struct Line
+	{
+		unsigned int x;
+		unsigned int y;
+		unsigned int rows;
+		unsigned int row_bytes;
+		size_t offset;
+	};
+
+	AnnotationLabel() : x(0), y(0), width(0), height(0), colours(0), subpixelorder(0), fg_colour(0), bg_colour(0), opaque(false)
+	{
+	}
 
-    while ( (index < text_len) && (line_len = strcspn( line, "\n" )) )
-    {
+	std::string text;
+	int x;
+	int y;
+	unsigned int width;
+	unsigned int height;
+	unsigned int colours;
+	unsigned int subpixelorder;
+	Rgb fg_colour;
+	Rgb bg_colour;
+	bool opaque;
+	std::vector<Line> lines;
+	std::vector<uint8_t> pixels;
+	std::vector<uint8_t> mask;
+};
+
+/* A few labels are kept, for the processes that annotate images from more than one monitor */
+enum { ANNOTATION_CACHE_SIZE=4 };
+static __thread AnnotationGlyphs* annotation_glyphs = NULL;
+static __thread AnnotationLabel* annotation_labels = NULL;
+static __thread unsigned int annotation_next = 0;
+
+static void SetGlyphPixel( uint8_t *pixel, const Rgb colour, const unsigned int colours, const unsigned int subpixelorder )
+{
+	if ( colours == ZM_COLOUR_GRAY8 )
+	{
+		pixel[0] = colour & 0xff;
+	}
+	else if ( colours == ZM_COLOUR_RGB24 )
+	{
+		RED_PTR_RGBA(pixel) = RED_VAL_RGBA(colour);
+		GREEN_PTR_RGBA(pixel) = GREEN_VAL_RGBA(colour);
+		BLUE_PTR_RGBA(pixel) = BLUE_VAL_RGBA(colour);
+	}
+	else
+	{
+		const Rgb rgb_col = rgb_convert(colour,subpixelorder);
+		memcpy( pixel, &rgb_col, sizeof(rgb_col) );
+	}
+}
 
-        unsigned int line_width = line_len * CHAR_WIDTH;
+static AnnotationGlyphs* GetAnnotationGlyphs( const unsigned int colours, const unsigned int subpixelorder, const Rgb fg_colour, const Rgb bg_colour )
+{
+	if ( !annotation_glyphs )
+	{
+		annotation_glyphs = new AnnotationGlyphs;
+		annotation_glyphs->colours = 0;
+	}
 
-        unsigned int lo_line_x = coord.X();
-        unsigned int lo_line_y = coord.Y() + (line_no * LINE_HEIGHT);
+	AnnotationGlyphs *glyphs = annotation_glyphs;
+	if ( glyphs->colours != colours || glyphs->subpixelorder != subpixelorder || glyphs->fg_colour != fg_colour || glyphs->bg_colour != bg_colour )
+	{
+		glyphs->colours = colours;
+		glyphs->subpixelorder = subpixelorder;
+		glyphs->fg_colour = fg_colour;
+		glyphs->bg_colour = bg_colour;
+		SetGlyphPixel( glyphs->fg_pixel, fg_colour, colours, subpixelorder );
+		SetGlyphPixel( glyphs->bg_pixel, bg_colour, colours, subpixelorder );
+		memset( glyphs->rendered, 0, sizeof(glyphs->rendered) );
+	}
+	return( glyphs );
+}
 
-        unsigned int min_line_x = 0;
-        unsigned int max_line_x = width - line_width;
-        unsigned  int min_line_y = 0;
-        unsigned int max_line_y = height - LINE_HEIGHT;
+/* Glyphs are rendered the first time they are used */
+static void RenderGlyph( AnnotationGlyphs *glyphs, const unsigned char ch )
+{
+	const unsigned int colours = glyphs->colours;
+	const size_t glyph_bytes = Image::CHAR_HEIGHT*Image::CHAR_WIDTH*colours;
+	const uint8_t fg_mask = (glyphs->fg_colour == RGB_TRANSPARENT)?0:0xff;
+	const uint8_t bg_mask = (glyphs->bg_colour == RGB_TRANSPARENT)?0:0xff;
+
+	uint8_t *pixel = glyphs->pixels + (ch * glyph_bytes);
+	uint8_t *mask = glyphs->mask + (ch * glyph_bytes);
+	for ( unsigned int r = 0; r < Image::CHAR_HEIGHT; r++ )
+	{
+		const int f = fontdata[(ch * Image::CHAR_HEIGHT) + r];
+		for ( unsigned int i = 0; i < Image::CHAR_WIDTH; i++, pixel += colours, mask += colours )
+		{
+			if ( f & (0x80 >> i) )
+			{
+				memcpy( pixel, glyphs->fg_pixel, colours );
+				memset( mask, fg_mask, colours );
+			}
+			else
+			{
+				memcpy( pixel, glyphs->bg_pixel, colours );
+				memset( mask, bg_mask, colours );
+			}
+		}
+	}
+	glyphs->rendered[ch] = true;
+}
 
-        if ( lo_line_x > max_line_x )
-            lo_line_x = max_line_x;
-        if ( lo_line_x < min_line_x )
-            lo_line_x = min_line_x;
-        if ( lo_line_y > max_line_y )
-            lo_line_y = max_line_y;
-        if ( lo_line_y < min_line_y )
-            lo_line_y = min_line_y;
+/* Lays out the text as Annotate always has, one clipped line after another, but into the label rather than an image */
+static void RenderLabel( AnnotationLabel *label, const char *text, const Coord &coord, const unsigned int width, const unsigned int height, const unsigned int colours, const unsigned int subpixelorder, const Rgb fg_colour, const Rgb bg_colour )
+{
+	AnnotationGlyphs *glyphs = GetAnnotationGlyphs( colours, subpixelorder, fg_colour, bg_colour );
+	const unsigned int glyph_row_bytes = Image::CHAR_WIDTH*colours;
+	const size_t glyph_bytes = Image::CHAR_HEIGHT*glyph_row_bytes;
+
+	label->text = text;
+	label->x = coord.X();
+	label->y = coord.Y();
+	label->width = width;
+	label->height = height;
+	label->colours = colours;
+	label->subpixelorder = subpixelorder;
+	label->fg_colour = fg_colour;
+	label->bg_colour = bg_colour;
+	label->opaque = (fg_colour != RGB_TRANSPARENT && bg_colour != RGB_TRANSPARENT);
+	label->lines.clear();
+	label->pixels.clear();
+	label->mask.clear();
+
+	unsigned int index = 0;
+	unsigned int line_no = 0;
+	unsigned int text_len = strlen( text );
+	unsigned int line_len = 0;
+	const char *line = text;
+
+	while ( (index < text_len) && (line_len = strcspn( line, "\n" )) )
+	{
+		unsigned int line_width = line_len * Image::CHAR_WIDTH;
+
+		unsigned int lo_line_x = coord.X();
+		unsigned int lo_line_y = coord.Y() + (line_no * Image::LINE_HEIGHT);
+
+		unsigned int min_line_x = 0;
+		unsigned int max_line_x = width - line_width;
+		unsigned int min_line_y = 0;
+		unsigned int max_line_y = height - Image::LINE_HEIGHT;
+
+		if ( lo_line_x > max_line_x )
+			lo_line_x = max_line_x;
+		if ( lo_line_x < min_line_x )
+			lo_line_x = min_line_x;
+		if ( lo_line_y > max_line_y )
+			lo_line_y = max_line_y;
+		if ( lo_line_y < min_line_y )
+			lo_line_y = min_line_y;
+
+		unsigned int hi_line_x = lo_line_x + line_width;
+		unsigned int hi_line_y = lo_line_y + Image::LINE_HEIGHT;
+
+		// Clip anything that runs off the right of the screen
+		if ( hi_line_x > width )
+			hi_line_x = width;
+		if ( hi_line_y > height )
+			hi_line_y = height;
+
+		if ( hi_line_x > lo_line_x && hi_line_y > lo_line_y )
+		{
+			AnnotationLabel::Line label_line;
+			label_line.x = lo_line_x;
+			label_line.y = lo_line_y;
+			label_line.rows = hi_line_y - lo_line_y;
+			if ( label_line.rows > Image::CHAR_HEIGHT )
+				label_line.rows = Image::CHAR_HEIGHT;
+			label_line.row_bytes = (hi_line_x - lo_line_x) * colours;
+			label_line.offset = label->pixels.size();
+			label->lines.push_back( label_line );
+
+			const size_t line_bytes = label_line.rows * label_line.row_bytes;
+			label->pixels.resize( label_line.offset + line_bytes );
+			if ( !label->opaque )
+				label->mask.resize( label_line.offset + line_bytes );
+
+			for ( unsigned int c = 0, x = 0; x < label_line.row_bytes; c++, x += glyph_row_bytes )
+			{
+				const unsigned char ch = line[c];
+				if ( !glyphs->rendered[ch] )
+					RenderGlyph( glyphs, ch );
+
+				const unsigned int bytes = std::min( glyph_row_bytes, label_line.row_bytes - x );
+				const uint8_t *glyph_pixel = glyphs->pixels + (ch * glyph_bytes);
+				const uint8_t *glyph_mask = glyphs->mask + (ch * glyph_bytes);
+				for ( unsigned int r = 0; r < label_line.rows; r++, glyph_pixel += glyph_row_bytes, glyph_mask += glyph_row_bytes )
+				{
+					const size_t offset = label_line.offset + (r * label_line.row_bytes) + x;
+					memcpy( &label->pixels[offset], glyph_pixel, bytes );
+					if ( !label->opaque )
+						memcpy( &label->mask[offset], glyph_mask, bytes );
+				}
+			}
+		}
 
-        unsigned int hi_line_x = lo_line_x + line_width;
-        unsigned int hi_line_y = lo_line_y + LINE_HEIGHT;
+		index += line_len;
+		while ( text[index] == '\n' )
+		{
+			index++;
+		}
+		line = text+index;
+		line_no++;
+	}
+}
 
-        // Clip anything that runs off the right of the screen
-        if ( hi_line_x > width )
-            hi_line_x = width;
-        if ( hi_line_y > height )
-            hi_line_y = height;
+/* RGB32 compatible: complete */
+void Image::Annotate( const char *p_text, const Coord &coord, const Rgb fg_colour, const Rgb bg_colour )
+{
+	strncpy( text, p_text, sizeof(text) );
 
-        if ( colours == ZM_COLOUR_GRAY8 )
-        {
-            unsigned char *ptr = &buffer[(lo_line_y*width)+lo_line_x];
-            for ( unsigned int y = lo_line_y, r = 0; y < hi_line_y && r < CHAR_HEIGHT; y++, r++, ptr += width )
-            {
-                unsigned char *temp_ptr = ptr;
-                for ( unsigned int x = lo_line_x, c = 0; x < hi_line_x && c < line_len; c++ )
-                {
-                    int f = fontdata[(line[c] * CHAR_HEIGHT) + r];
-                    for ( unsigned int i = 0; i < CHAR_WIDTH && x < hi_line_x; i++, x++, temp_ptr++ )
-                    {
-                        if ( f & (0x80 >> i) )
-                        {
-                            if ( !fg_trans )
-                                *temp_ptr = fg_bw_col;
-                        }
-                        else if ( !bg_trans )
-                        {
-                            *temp_ptr = bg_bw_col;
-                        }
-                    }
-                }
-            }
-        }
-        else if ( colours == ZM_COLOUR_RGB24 )
-        {
-            unsigned int wc = width * colours;
-
-            unsigned char *ptr = &buffer[((lo_line_y*width)+lo_line_x)*colours];
-            for ( unsigned int y = lo_line_y, r = 0; y < hi_line_y && r < CHAR_HEIGHT; y++, r++, ptr += wc )
-            {
-                unsigned char *temp_ptr = ptr;
-                for ( unsigned int x = lo_line_x, c = 0; x < hi_line_x && c < line_len; c++ )
-                {
-                    int f = fontdata[(line[c] * CHAR_HEIGHT) + r];
-                    for ( unsigned int i = 0; i < CHAR_WIDTH && x < hi_line_x; i++, x++, temp_ptr += colours )
-                    {
-                        if ( f & (0x80 >> i) )
-                        {
-                            if ( !fg_trans )
-                            {
-					            RED_PTR_RGBA(temp_ptr) = fg_r_col;
-					            GREEN_PTR_RGBA(temp_ptr) = fg_g_col;
-					            BLUE_PTR_RGBA(temp_ptr) = fg_b_col;
-                            }
-                        }
-                        else if ( !bg_trans )
-                        {
-					        RED_PTR_RGBA(temp_ptr) = bg_r_col;
-					        GREEN_PTR_RGBA(temp_ptr) = bg_g_col;
-					        BLUE_PTR_RGBA(temp_ptr) = bg_b_col;
-                        }
-                    }
-                }
-            }
-        } 
-        else if ( colours == ZM_COLOUR_RGB32 )
+	if ( colours != ZM_COLOUR_GRAY8 && colours != ZM_COLOUR_RGB24 && colours != ZM_COLOUR_RGB32 )
 	{
-            unsigned int wc = width * colours;
-
-            uint8_t *ptr = &buffer[((lo_line_y*width)+lo_line_x)<<2];
-            for ( unsigned int y = lo_line_y, r = 0; y < hi_line_y && r < CHAR_HEIGHT; y++, r++, ptr += wc )
-            {
-                Rgb* temp_ptr = (Rgb*)ptr;
-                for ( unsigned int x = lo_line_x, c = 0; x < hi_line_x && c < line_len; c++ )
-                {
-                    int f = fontdata[(line[c] * CHAR_HEIGHT) + r];
-                    for ( unsigned int i = 0; i < CHAR_WIDTH && x < hi_line_x; i++, x++, temp_ptr++ )
-                    {
-                        if ( f & (0x80 >> i) )
-                        {
-                            if ( !fg_trans )
-                            {
-				*temp_ptr = fg_rgb_col;
-                            }
-                        }
-                        else if ( !bg_trans )
-                        {
-			    *temp_ptr = bg_rgb_col;
-                        }
-                    }
-                }
-            } 
-	
-	} else {
 		Panic("Annontate called with unexpected colours: %d",colours);
 		return;
 	}
-	
-        index += line_len;
-        while ( text[index] == '\n' )
-        {
-            index++;
-        }
-        line = text+index;
-        line_no++;
-    }
+
+	/* Timestamps only change once a second, so the text has usually been rendered for an earlier image */
+	if ( !annotation_labels )
+		annotation_labels = new AnnotationLabel[ANNOTATION_CACHE_SIZE];
+
+	AnnotationLabel *label = NULL;
+	for ( unsigned int i = 0; i < ANNOTATION_CACHE_SIZE; i++ )
+	{
+		AnnotationLabel *cached = &annotation_labels[i];
+		if ( cached->x == coord.X() && cached->y == coord.Y() && cached->width == width && cached->height == height
+			&& cached->colours == colours && cached->subpixelorder == subpixelorder
+			&& cached->fg_colour == fg_colour && cached->bg_colour == bg_colour && cached->text == text )
+		{
+			label = cached;
+			break;
+		}
+	}
+	if ( !label )
+	{
+		label = &annotation_labels[annotation_next];
+		annotation_next = (annotation_next + 1) % ANNOTATION_CACHE_SIZE;
+		RenderLabel( label, text, coord, width, height, colours, subpixelorder, fg_colour, bg_colour );
+	}
+
+	const unsigned int wc = width * colours;
+	for ( std::vector<AnnotationLabel::Line>::const_iterator line = label->lines.begin(); line != label->lines.end(); line++ )
+	{
+		uint8_t *ptr = &buffer[((line->y*width)+line->x)*colours];
+		const uint8_t *pixel = &label->pixels[line->offset];
+		if ( label->opaque )
+		{
+			for ( unsigned int r = 0; r < line->rows; r++, ptr += wc, pixel += line->row_bytes )
+			{
+				memcpy( ptr, pixel, line->row_bytes );
+			}
+		}
+		else
+		{
+			const uint8_t *mask = &label->mask[line->offset];
+			for ( unsigned int r = 0; r < line->rows; r++, ptr += wc, pixel += line->row_bytes, mask += line->row_bytes )
+			{
+				for ( unsigned int i = 0; i < line->row_bytes; i++ )
+				{
+					ptr[i] = (pixel[i] & mask[i]) | (ptr[i] & ~mask[i]);
+				}
+			}
+		}
+	}
 }
 
 void Image::Timestamp( const char *label, const time_t when, const Coord &coord )
@@ -1854,7 +2011,32 @@ void Image::Colourise(const unsigned int p_reqcolours, const unsigned int p_reqs
 		return;
 	}
 	
-	if ( p_reqcolours == ZM_COLOUR_RGB32 ) {
+	if ( IsYUV420P() && (p_reqcolours == ZM_COLOUR_RGB32 || p_reqcolours == ZM_COLOUR_RGB24) ) {
+		/* Real colour is available from the chroma planes */
+		uint8_t *new_buffer = AllocBuffer(pixels*p_reqcolours);
+		
+		if ( p_reqcolours == ZM_COLOUR_RGB32 ) {
+			zm_convert_yuv420p_rgba(buffer, new_buffer, width, height);
+			if ( p_reqsubpixelorder != ZM_SUBPIX_ORDER_RGBA ) {
+				Rgb* pdest = (Rgb*)new_buffer;
+				for(unsigned int i=0;i<pixels;i++) {
+					pdest[i] = rgb_convert(pdest[i],p_reqsubpixelorder);
+				}
+			}
+		} else {
+			zm_convert_yuv420p_rgb(buffer, new_buffer, width, height);
+			if ( p_reqsubpixelorder == ZM_SUBPIX_ORDER_BGR ) {
+				uint8_t *pdest = new_buffer;
+				for(unsigned int i=0;i<pixels;i++, pdest += 3) {
+					uint8_t r = pdest[0];
+					pdest[0] = pdest[2];
+					pdest[2] = r;
+				}
+			}
+		}
+		
+		AssignDirect( width, height, p_reqcolours, p_reqsubpixelorder, new_buffer, pixels*p_reqcolours, ZM_BUFTYPE_ZM);
+	} else if ( p_reqcolours == ZM_COLOUR_RGB32 ) {
 		/* RGB32 */
 		Rgb* new_buffer = (Rgb*)AllocBuffer(pixels*sizeof(Rgb));
 		
@@ -1944,7 +2126,60 @@ void Image::DeColourise()
 	}
 }
 
+/* Forget the chroma planes, leaving a plain grayscale image. Used before
+   operations that only know how to deal with the luma */
+void Image::DropChroma()
+{
+	if ( !IsYUV420P() )
+		return;
+	
+	subpixelorder = ZM_SUBPIX_ORDER_NONE;
+	size = pixels;
+}
+
 /* RGB32 compatible: complete */
+/* Counts the pixels that differ from pixel in any of the bytes selected by mask, skipping the lines from skip_lo_y up to skip_hi_y. Counting stops once more than limit have been found */
+unsigned int Image::CountMismatches( const uint8_t *pixel, const uint8_t *mask, unsigned int limit, unsigned int skip_lo_y, unsigned int skip_hi_y ) const
+{
+	if ( !(colours == ZM_COLOUR_GRAY8 || colours == ZM_COLOUR_RGB24 || colours == ZM_COLOUR_RGB32 ) )
+	{
+		Panic( "Attempt to count pixels of image with unexpected colours %d", colours );
+	}
+	
+	/* 48 bytes hold a whole number of pixels in every format */
+	__attribute__((aligned(16))) uint8_t pattern[48];
+	__attribute__((aligned(16))) uint8_t ignore[48];
+	for ( unsigned int i = 0; i < sizeof(pattern); i++ )
+	{
+		pattern[i] = pixel[i%colours];
+		ignore[i] = ~mask[i%colours];
+	}
+	
+	if ( skip_hi_y > height )
+		skip_hi_y = height;
+	if ( skip_lo_y > skip_hi_y )
+		skip_lo_y = skip_hi_y;
+	
+	const unsigned long row_bytes = width * colours;
+	const uint8_t *spans[2] = { buffer, buffer + (skip_hi_y * row_bytes) };
+	const unsigned long span_bytes[2] = { skip_lo_y * row_bytes, (height - skip_hi_y) * row_bytes };
+	
+	/* Counted a block at a time, so that an image with plenty of other colours is given up on early */
+	const unsigned long block_bytes = 48*1024;
+	unsigned long mismatches = 0;
+	for ( unsigned int s = 0; s < 2; s++ )
+	{
+		for ( unsigned long offset = 0; offset < span_bytes[s]; offset += block_bytes )
+		{
+			const unsigned long bytes = std::min( block_bytes, span_bytes[s] - offset );
+			mismatches += (*fptr_count_mismatches)( spans[s] + offset, bytes, pattern, ignore, colours );
+			if ( mismatches > limit )
+				return( mismatches );
+		}
+	}
+	return( mismatches );
+}
+
 void Image::Fill( Rgb colour, const Box *limits )
 {
 	if ( !(colours == ZM_COLOUR_GRAY8 || colours == ZM_COLOUR_RGB24 || colours == ZM_COLOUR_RGB32 ) )
@@ -1969,6 +2204,11 @@ void Image::Fill( Rgb colour, const Box *limits )
 				*p = colour;
 			}
 		}
+		if ( IsYUV420P() && !limits )
+		{
+			/* Otherwise the previous picture's colours would show through */
+			memset( buffer+pixels, 128, size-pixels );
+		}
 	}
 	else if ( colours == ZM_COLOUR_RGB24 )
 	{
@@ -2068,91 +2308,68 @@ void Image::Outline( Rgb colour, const Polygon &polygon )
 	{
 		Panic( "Attempt to outline image with unexpected colours %d", colours );
 	}
-    
-	/* Convert the colour's RGBA subpixel order into the image's subpixel order */
-	colour = rgb_convert(colour,subpixelorder);
-	
-	int n_coords = polygon.getNumCoords();
-	for ( int j = 0, i = n_coords-1; j < n_coords; i = j++ )
-	{
-		const Coord &p1 = polygon.getCoord( i );
-		const Coord &p2 = polygon.getCoord( j );
 
-		int x1 = p1.X();
-		int x2 = p2.X();
-		int y1 = p1.Y();
-		int y2 = p2.Y();
+	Fill( colour, 1, polygon.OutlineSpans() );
+}
+
+/* RGB32 compatible: complete */
+void Image::Fill( Rgb colour, int density, const Polygon &polygon )
+{
+	Fill( colour, density, polygon.FillSpans() );
+}
+
+void Image::Fill( Rgb colour, const Polygon &polygon )
+{
+	Fill( colour, 1, polygon.FillSpans() );
+}
 
-		double dx = x2 - x1;
-		double dy = y2 - y1;
+/* RGB32 compatible: complete */
+/* Fills every density'th pixel of every density'th line of the spans, clipped to the image */
+void Image::Fill( Rgb colour, int density, const SpanList &spans )
+{
+	if ( !(colours == ZM_COLOUR_GRAY8 || colours == ZM_COLOUR_RGB24 || colours == ZM_COLOUR_RGB32 ) )
+	{
+		Panic( "Attempt to fill image with unexpected colours %d", colours );
+	}
+	if ( density < 1 )
+		density = 1;
 
-		double grad;
+	/* Convert the colour's RGBA subpixel order into the image's subpixel order */
+	colour = rgb_convert(colour,subpixelorder);
 
-		Debug( 9, "dx: %.2lf, dy: %.2lf", dx, dy );
-		if ( fabs(dx) <= fabs(dy) )
+	int lo_y = std::max( spans.LoY(), 0 );
+	int hi_y = std::min( spans.HiY(), (int)height-1 );
+	for ( int y = lo_y; y <= hi_y; y++ )
+	{
+		if ( y%density )
+			continue;
+		for ( const SpanList::Span *span = spans.Begin( y ); span != spans.End( y ); span++ )
 		{
-			Debug( 9, "dx <= dy" );
-			if ( y1 != y2 )
-				grad = dx/dy;
-			else
-				grad = width;
+			int lo_x = std::max( span->lo_x, 0 );
+			int hi_x = std::min( span->hi_x, (int)width-1 );
+			if ( lo_x > hi_x )
+				continue;
+			/* Start from the first pixel of the span on the density grid */
+			lo_x += (density-(lo_x%density))%density;
 
-			double x;
-			int y, yinc = (y1<y2)?1:-1;
-			grad *= yinc;
 			if ( colours == ZM_COLOUR_GRAY8 )
 			{
-				Debug( 9, "x1:%d, x2:%d, y1:%d, y2:%d, gr:%.2f", x1, x2, y1, y2, grad );
-				for ( x = x1, y = y1; y != y2; y += yinc, x += grad )
-				{
-					Debug( 9, "x:%.2f, y:%d", x, y );
-					buffer[(y*width)+int(round(x))] = colour;
-				}
-			}
-			else if ( colours == ZM_COLOUR_RGB24 )
-			{
-				for ( x = x1, y = y1; y != y2; y += yinc, x += grad )
-				{
-					unsigned char *p = &buffer[colours*((y*width)+int(round(x)))];
-					RED_PTR_RGBA(p) = RED_VAL_RGBA(colour);
-					GREEN_PTR_RGBA(p) = GREEN_VAL_RGBA(colour);
-					BLUE_PTR_RGBA(p) = BLUE_VAL_RGBA(colour);
-				}
-			}
-			else if ( colours == ZM_COLOUR_RGB32 )
-			{
-				for ( x = x1, y = y1; y != y2; y += yinc, x += grad )
+				uint8_t *p = &buffer[(y*width)+lo_x];
+				if ( density == 1 )
 				{
-					*(Rgb*)(buffer+(((y*width)+int(round(x)))<<2)) = colour;
+					memset( p, colour, (hi_x-lo_x)+1 );
 				}
-			}
-		}
-		else
-		{
-			Debug( 9, "dx > dy" );
-			if ( x1 != x2 )
-				grad = dy/dx;
-			else
-				grad = height;
-			Debug( 9, "grad: %.2lf", grad );
-
-			double y;
-			int x, xinc = (x1<x2)?1:-1;
-			grad *= xinc;
-			if ( colours == ZM_COLOUR_GRAY8 )
-			{
-				Debug( 9, "x1:%d, x2:%d, y1:%d, y2:%d, gr:%.2lf", x1, x2, y1, y2, grad );
-				for ( y = y1, x = x1; x != x2; x += xinc, y += grad )
+				else
 				{
-					Debug( 9, "x:%d, y:%.2f", x, y );
-					buffer[(int(round(y))*width)+x] = colour;
+					for ( int x = lo_x; x <= hi_x; x += density, p += density )
+						*p = colour;
 				}
 			}
 			else if ( colours == ZM_COLOUR_RGB24 )
 			{
-				for ( y = y1, x = x1; x != x2; x += xinc, y += grad )
+				uint8_t *p = &buffer[colours*((y*width)+lo_x)];
+				for ( int x = lo_x; x <= hi_x; x += density, p += 3*density )
 				{
-					unsigned char *p = &buffer[colours*((int(round(y))*width)+x)];
 					RED_PTR_RGBA(p) = RED_VAL_RGBA(colour);
 					GREEN_PTR_RGBA(p) = GREEN_VAL_RGBA(colour);
 					BLUE_PTR_RGBA(p) = BLUE_VAL_RGBA(colour);
@@ -2160,409 +2377,303 @@ void Image::Outline( Rgb colour, const Polygon &polygon )
 			}
 			else if ( colours == ZM_COLOUR_RGB32 )
 			{
-				for ( y = y1, x = x1; x != x2; x += xinc, y += grad )
-				{
-					*(Rgb*)(buffer+(((int(round(y))*width)+x)<<2)) = colour;
-				}
+				/* Fast, copies the entire pixel in a single pass */
+				Rgb *p = (Rgb*)&buffer[((y*width)+lo_x)<<2];
+				for ( int x = lo_x; x <= hi_x; x += density, p += density )
+					*p = colour;
 			}
-			
 		}
 	}
 }
 
-/* RGB32 compatible: complete */
-void Image::Fill( Rgb colour, int density, const Polygon &polygon )
+void Image::Fill( Rgb colour, const SpanList &spans )
 {
-	if ( !(colours == ZM_COLOUR_GRAY8 || colours == ZM_COLOUR_RGB24 || colours == ZM_COLOUR_RGB32 ) )
-	{
-		Panic( "Attempt to fill image with unexpected colours %d", colours );
-	}
-	
-	/* Convert the colour's RGBA subpixel order into the image's subpixel order */
-	colour = rgb_convert(colour,subpixelorder);
-
-	int n_coords = polygon.getNumCoords();
-	int n_global_edges = 0;
-	Edge global_edges[n_coords];
-	for ( int j = 0, i = n_coords-1; j < n_coords; i = j++ )
-	{
-		const Coord &p1 = polygon.getCoord( i );
-		const Coord &p2 = polygon.getCoord( j );
-
-		int x1 = p1.X();
-		int x2 = p2.X();
-		int y1 = p1.Y();
-		int y2 = p2.Y();
-
-		Debug( 9, "x1:%d,y1:%d x2:%d,y2:%d", x1, y1, x2, y2 );
-		if ( y1 == y2 )
-			continue;
-
-		double dx = x2 - x1;
-		double dy = y2 - y1;
-
-		global_edges[n_global_edges].min_y = y1<y2?y1:y2;
-		global_edges[n_global_edges].max_y = y1<y2?y2:y1;
-		global_edges[n_global_edges].min_x = y1<y2?x1:x2;
-		global_edges[n_global_edges]._1_m = dx/dy;
-		n_global_edges++;
-	}
-	qsort( global_edges, n_global_edges, sizeof(*global_edges), Edge::CompareYX );
-
-#ifndef ZM_DBG_OFF
-	if ( logLevel() >= Logger::DEBUG9 )
-	{
-		for ( int i = 0; i < n_global_edges; i++ )
-		{
-			Debug( 9, "%d: min_y: %d, max_y:%d, min_x:%.2f, 1/m:%.2f", i, global_edges[i].min_y, global_edges[i].max_y, global_edges[i].min_x, global_edges[i]._1_m );
-		}
-	}
-#endif
+	Fill( colour, 1, spans );
+}
 
-	int n_active_edges = 0;
-	Edge active_edges[n_global_edges];
-	int y = global_edges[0].min_y;
-	do 
+/* Transpose a block of rows by cols pixels, a negative stride mirrors the block as well */
+static inline void zm_transpose_block( const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride, unsigned int rows, unsigned int cols, unsigned int bpp )
+{
+	for ( unsigned int i = 0; i < rows; i++, src += src_stride )
 	{
-		for ( int i = 0; i < n_global_edges; i++ )
-		{
-			if ( global_edges[i].min_y == y )
-			{
-				Debug( 9, "Moving global edge" );
-				active_edges[n_active_edges++] = global_edges[i];
-				if ( i < (n_global_edges-1) )
-				{
-					//memcpy( &global_edges[i], &global_edges[i+1], sizeof(*global_edges)*(n_global_edges-i) );
-					memmove( &global_edges[i], &global_edges[i+1], sizeof(*global_edges)*(n_global_edges-i) );
-					i--;
-				}
-				n_global_edges--;
-			}
-			else
-			{
-				break;
-			}
-		}
-		qsort( active_edges, n_active_edges, sizeof(*active_edges), Edge::CompareX );
-#ifndef ZM_DBG_OFF
-	    if ( logLevel() >= Logger::DEBUG9 )
+		const uint8_t* s_ptr = src;
+		uint8_t* d_ptr = dst+(i*bpp);
+		if ( bpp == ZM_COLOUR_GRAY8 )
 		{
-			for ( int i = 0; i < n_active_edges; i++ )
-			{
-				Debug( 9, "%d - %d: min_y: %d, max_y:%d, min_x:%.2f, 1/m:%.2f", y, i, active_edges[i].min_y, active_edges[i].max_y, active_edges[i].min_x, active_edges[i]._1_m );
-			}
+			for ( unsigned int k = 0; k < cols; k++, s_ptr++, d_ptr += dst_stride )
+				*d_ptr = *s_ptr;
 		}
-#endif
-		if ( !(y%density) )
+		else if ( bpp == ZM_COLOUR_RGB32 )
 		{
-			//Debug( 9, "%d", y );
-			for ( int i = 0; i < n_active_edges; )
-			{
-				int lo_x = int(round(active_edges[i++].min_x));
-				int hi_x = int(round(active_edges[i++].min_x));
-				if( colours == ZM_COLOUR_GRAY8 ) {
-					unsigned char *p = &buffer[(y*width)+lo_x];
-					for ( int x = lo_x; x <= hi_x; x++, p++)
-					{
-						if ( !(x%density) )
-						{
-							//Debug( 9, " %d", x );
-							*p = colour;
-						}
-					}
-				} else if( colours == ZM_COLOUR_RGB24 ) {
-					unsigned char *p = &buffer[colours*((y*width)+lo_x)];
-					for ( int x = lo_x; x <= hi_x; x++, p += 3)
-					{
-						if ( !(x%density) )
-						{  
-							RED_PTR_RGBA(p) = RED_VAL_RGBA(colour);
-							GREEN_PTR_RGBA(p) = GREEN_VAL_RGBA(colour);
-							BLUE_PTR_RGBA(p) = BLUE_VAL_RGBA(colour);
-						}
-					}
-				} else if( colours == ZM_COLOUR_RGB32 ) {
-					Rgb *p = (Rgb*)&buffer[((y*width)+lo_x)<<2];
-					for ( int x = lo_x; x <= hi_x; x++, p++)
-					{
-						if ( !(x%density) )
-						{
-							/* Fast, copies the entire pixel in a single pass */
-							*p = colour;
-						}
-					}
-				}
-			}
+			for ( unsigned int k = 0; k < cols; k++, s_ptr += 4, d_ptr += dst_stride )
+				*(Rgb*)d_ptr = *(const Rgb*)s_ptr;
 		}
-		y++;
-		for ( int i = n_active_edges-1; i >= 0; i-- )
+		else /* Assume RGB24 */
 		{
-			if ( y >= active_edges[i].max_y ) // Or >= as per sheets
-			{
-				Debug( 9, "Deleting active_edge" );
-				if ( i < (n_active_edges-1) )
-				{
-					//memcpy( &active_edges[i], &active_edges[i+1], sizeof(*active_edges)*(n_active_edges-i) );
-					memmove( &active_edges[i], &active_edges[i+1], sizeof(*active_edges)*(n_active_edges-i) );
-				}
-				n_active_edges--;
-			}
-			else
+			for ( unsigned int k = 0; k < cols; k++, s_ptr += 3, d_ptr += dst_stride )
 			{
-				active_edges[i].min_x += active_edges[i]._1_m;
+				d_ptr[0] = s_ptr[0];
+				d_ptr[1] = s_ptr[1];
+				d_ptr[2] = s_ptr[2];
 			}
 		}
-	} while ( n_global_edges || n_active_edges );
+	}
 }
 
-void Image::Fill( Rgb colour, const Polygon &polygon )
-{
-	Fill( colour, 1, polygon );
+/* Scratch space for rotations that can't be done in place, kept by the thread for the next frame rather than allocated for each */
+static uint8_t* TransformBuffer(size_t p_bufsize) {
+	ImageBufferPool::Scratch &transform = ImageBufferPool::ThreadScratch(ImageBufferPool::SCRATCH_TRANSFORM);
+	if(transform.allocation < p_bufsize) {
+		DumpBuffer(transform.buffer, ZM_BUFTYPE_ZM);
+		transform.buffer = AllocBuffer(p_bufsize);
+		transform.allocation = p_bufsize;
+	}
+	return transform.buffer;
 }
 
-/* RGB32 compatible: complete */
-void Image::Rotate( int angle )
+/* Takes the transformed image from the scratch buffer, by swapping buffers if the image owns its own */
+void Image::UseTransformBuffer( unsigned int p_width, unsigned int p_height )
 {
-	
-	angle %= 360;
-
-	if ( !angle )
+	ImageBufferPool::Scratch &transform = ImageBufferPool::ThreadScratch(ImageBufferPool::SCRATCH_TRANSFORM);
+	if ( !holdbuffer && buffertype == ZM_BUFTYPE_ZM )
 	{
-		return;
+		uint8_t* old_buffer = buffer;
+		size_t old_allocation = allocation;
+		buffer = transform.buffer;
+		allocation = transform.allocation;
+		transform.buffer = old_buffer;
+		transform.allocation = old_allocation;
 	}
-	if ( angle%90 )
+	else
 	{
-		return;
+		(*fptr_imgbufcpy)( buffer, transform.buffer, size );
 	}
-	
-	unsigned int new_height = height;
-	unsigned int new_width = width;
-	uint8_t* rotate_buffer = AllocBuffer(size);
+	width = p_width;
+	height = p_height;
+}
+
+/* Rotate by 90 or 270 degrees clockwise a block at a time, so that the lines being read from and written to stay in cache */
+static void zm_rotate_blocks( const uint8_t* src, uint8_t* dst, unsigned int p_width, unsigned int p_height, unsigned int bpp, int angle, transpose_fptr_t fptr_transpose )
+{
+	const unsigned int block = 8;
+	const ptrdiff_t src_line = p_width*bpp;
+	const ptrdiff_t dst_line = p_height*bpp;
 
-	switch( angle )
+	for ( unsigned int y = 0; y < p_height; y += block )
 	{
-		case 90 :
+		unsigned int rows = (p_height-y < block)?(p_height-y):block;
+		for ( unsigned int x = 0; x < p_width; x += block )
 		{
-			new_height = width;
-			new_width = height;
-
-			unsigned int line_bytes = new_width*colours;
-			unsigned char *s_ptr = buffer;
+			unsigned int cols = (p_width-x < block)?(p_width-x):block;
 
-			if ( colours == ZM_COLOUR_GRAY8 )
+			/* Both are a transpose, with the source lines taken bottom up for 90 and the result written bottom up for 270 */
+			const uint8_t* s_ptr;
+			uint8_t* d_ptr;
+			ptrdiff_t s_stride, d_stride;
+			if ( angle == 90 )
 			{
-				unsigned char *d_ptr;
-				for ( unsigned int i = new_width; i > 0; i-- )
-				{
-					d_ptr = rotate_buffer+(i-1);
-					for ( unsigned int j = new_height; j > 0; j-- )
-					{
-						*d_ptr = *s_ptr++;
-						d_ptr += line_bytes;
-					}
-				}
-			}
-			else if ( colours == ZM_COLOUR_RGB32 )
-			{
-				Rgb* s_rptr = (Rgb*)s_ptr;
-				Rgb* d_rptr;
-				for ( unsigned int i = new_width; i > 0; i-- )
-				{
-					d_rptr = (Rgb*)(rotate_buffer+((i-1)<<2));
-					for ( unsigned int j = new_height; j > 0; j-- )
-					{
-						*d_rptr = *s_rptr++;
-						d_rptr += new_width;
-					}
-				}
+				s_ptr = src+((y+rows-1)*src_line)+(x*bpp);
+				s_stride = -src_line;
+				d_ptr = dst+(x*dst_line)+((p_height-y-rows)*bpp);
+				d_stride = dst_line;
 			}
-			else /* Assume RGB24 */
+			else
 			{
-				unsigned char *d_ptr;
-				for ( unsigned int i = new_width; i > 0; i-- )
-				{
-					d_ptr = rotate_buffer+((i-1)*3);
-					for ( unsigned int j = new_height; j > 0; j-- )
-					{
-						*d_ptr = *s_ptr++;
-						*(d_ptr+1) = *s_ptr++;
-						*(d_ptr+2) = *s_ptr++;
-						d_ptr += line_bytes;
-					}
-				}
+				s_ptr = src+(y*src_line)+(x*bpp);
+				s_stride = src_line;
+				d_ptr = dst+((p_width-1-x)*dst_line)+(y*bpp);
+				d_stride = -dst_line;
 			}
-			break;
+
+			if ( rows == block && cols == block )
+				(*fptr_transpose)( s_ptr, s_stride, d_ptr, d_stride );
+			else
+				zm_transpose_block( s_ptr, s_stride, d_ptr, d_stride, rows, cols, bpp );
 		}
-		case 180 :
-		{
-			unsigned char *s_ptr = buffer+size;
-			unsigned char *d_ptr = rotate_buffer;
+	}
+}
 
-			if ( colours == ZM_COLOUR_GRAY8 )
-			{
-				while( s_ptr > buffer )
-				{
-					s_ptr--;
-					*d_ptr++ = *s_ptr;
-				}
-			}
-			else if ( colours == ZM_COLOUR_RGB32 )
-			{
-				Rgb* s_rptr = (Rgb*)s_ptr;
-				Rgb* d_rptr = (Rgb*)d_ptr;
-				while( s_rptr > (Rgb*)buffer )
-				{
-					s_rptr--;
-					*d_rptr++ = *s_rptr;
-				}
-			}
-			else /* Assume RGB24 */
-			{
-				while( s_ptr > buffer )
-				{
-					s_ptr -= 3;
-					*d_ptr++ = *s_ptr;
-					*d_ptr++ = *(s_ptr+1);
-					*d_ptr++ = *(s_ptr+2);
-				}
-			}
-			break;
+/* Reverse the order of count pixels in place */
+static void zm_reverse_pixels( uint8_t* p_buffer, unsigned int count, unsigned int bpp )
+{
+	if ( !count )
+		return;
+
+	if ( bpp == ZM_COLOUR_GRAY8 )
+	{
+		uint8_t* head = p_buffer;
+		uint8_t* tail = p_buffer+count-1;
+		while ( head < tail )
+		{
+			uint8_t temp = *head;
+			*head++ = *tail;
+			*tail-- = temp;
 		}
-		case 270 :
+	}
+	else if ( bpp == ZM_COLOUR_RGB32 )
+	{
+		Rgb* head = (Rgb*)p_buffer;
+		Rgb* tail = head+count-1;
+		while ( head < tail )
 		{
-			new_height = width;
-			new_width = height;
-
-			unsigned int line_bytes = new_width*colours;
-			unsigned char *s_ptr = buffer+size;
+			Rgb temp = *head;
+			*head++ = *tail;
+			*tail-- = temp;
+		}
+	}
+	else /* Assume RGB24 */
+	{
+		uint8_t* head = p_buffer;
+		uint8_t* tail = p_buffer+((count-1)*3);
+		while ( head < tail )
+		{
+			uint8_t temp[3] = { head[0], head[1], head[2] };
+			head[0] = tail[0];
+			head[1] = tail[1];
+			head[2] = tail[2];
+			tail[0] = temp[0];
+			tail[1] = temp[1];
+			tail[2] = temp[2];
+			head += 3;
+			tail -= 3;
+		}
+	}
+}
 
-			if ( colours == ZM_COLOUR_GRAY8 )
-			{
-				unsigned char *d_ptr;
-				for ( unsigned int i = new_width; i > 0; i-- )
-				{
-					d_ptr = rotate_buffer+(i-1);
-					for ( unsigned int j = new_height; j > 0; j-- )
-					{
-						s_ptr--;
-						*d_ptr = *s_ptr;
-						d_ptr += line_bytes;
-					}
-				}
-			}
-			else if ( colours == ZM_COLOUR_RGB32 )
-			{
-				Rgb* s_rptr = (Rgb*)s_ptr;
-				Rgb* d_rptr;
-				for ( unsigned int i = new_width; i > 0; i-- )
-				{
-					d_rptr = (Rgb*)(rotate_buffer+((i-1)<<2));
-					for ( unsigned int j = new_height; j > 0; j-- )
-					{
-						s_rptr--;
-						*d_rptr = *s_rptr;
-						d_rptr += new_width;
-					}
-				}
-			}
-			else /* Assume RGB24 */
-			{
-				unsigned char *d_ptr;
-				for ( unsigned int i = new_width; i > 0; i-- )
-				{
-					d_ptr = rotate_buffer+((i-1)*3);
-					for ( unsigned int j = new_height; j > 0; j-- )
-					{
-						*(d_ptr+2) = *(--s_ptr);
-						*(d_ptr+1) = *(--s_ptr);
-						*d_ptr = *(--s_ptr);
-						d_ptr += line_bytes;
-					}
-				}
-			}
-			break;
+/* Turn lines of line_bytes upside down in place */
+static void zm_reverse_lines( uint8_t* p_buffer, unsigned int line_bytes, unsigned int lines )
+{
+	uint8_t temp[4096];
+	uint8_t* top = p_buffer;
+	uint8_t* bottom = p_buffer+((lines-1)*line_bytes);
+	while ( top < bottom )
+	{
+		for ( unsigned int offset = 0; offset < line_bytes; offset += sizeof(temp) )
+		{
+			unsigned int count = (line_bytes-offset < sizeof(temp))?(line_bytes-offset):sizeof(temp);
+			memcpy( temp, top+offset, count );
+			memcpy( top+offset, bottom+offset, count );
+			memcpy( bottom+offset, temp, count );
 		}
+		top += line_bytes;
+		bottom -= line_bytes;
 	}
- 
-	AssignDirect( new_width, new_height, colours, subpixelorder, rotate_buffer, size, ZM_BUFTYPE_ZM);
-	
 }
 
 /* RGB32 compatible: complete */
-void Image::Flip( bool leftright )
+void Image::Rotate( int angle )
 {
-	uint8_t* flip_buffer = AllocBuffer(size);
 	
-	unsigned int line_bytes = width*colours;
-	unsigned int line_bytes2 = 2*line_bytes;
-	if ( leftright )
+	angle %= 360;
+
+	if ( !angle )
 	{
-		// Horizontal flip, left to right
-		unsigned char *s_ptr = buffer+line_bytes;
-		unsigned char *d_ptr = flip_buffer;
-		unsigned char *max_d_ptr = flip_buffer + size;
+		return;
+	}
+	if ( angle%90 )
+	{
+		return;
+	}
+
+	if ( IsYUV420P() )
+	{
+		/* Each plane is rotated on its own so the chroma survives, the layout and size are unchanged */
+		unsigned int c_width = (width+1)>>1;
+		unsigned int c_height = (height+1)>>1;
+		unsigned int c_size = c_width*c_height;
 
-		if ( colours == ZM_COLOUR_GRAY8 )
+		if ( angle == 180 )
 		{
-			while( d_ptr < max_d_ptr )
-			{
-				for ( unsigned int j = 0; j < width; j++ )
-				{
-					s_ptr--;
-					*d_ptr++ = *s_ptr;
-				}
-				s_ptr += line_bytes2;
-			}
+			zm_reverse_pixels( buffer, pixels, 1 );
+			zm_reverse_pixels( buffer+pixels, c_size, 1 );
+			zm_reverse_pixels( buffer+pixels+c_size, c_size, 1 );
+			return;
 		}
-		else if ( colours == ZM_COLOUR_RGB32 )
+
+		uint8_t* rotate_buffer = TransformBuffer(size);
+		zm_rotate_blocks( buffer, rotate_buffer, width, height, 1, angle, fptr_transpose_gray8 );
+		zm_rotate_blocks( buffer+pixels, rotate_buffer+pixels, c_width, c_height, 1, angle, fptr_transpose_gray8 );
+		zm_rotate_blocks( buffer+pixels+c_size, rotate_buffer+pixels+c_size, c_width, c_height, 1, angle, fptr_transpose_gray8 );
+		UseTransformBuffer( height, width );
+		return;
+	}
+
+	if ( angle == 180 )
+	{
+		/* Turning the image upside down is the same as reversing the order of all of its pixels */
+		zm_reverse_pixels( buffer, pixels, colours );
+		return;
+	}
+
+	transpose_fptr_t fptr_transpose;
+	if ( colours == ZM_COLOUR_GRAY8 )
+		fptr_transpose = fptr_transpose_gray8;
+	else if ( colours == ZM_COLOUR_RGB32 )
+		fptr_transpose = fptr_transpose_rgba;
+	else /* Assume RGB24 */
+		fptr_transpose = fptr_transpose_rgb;
+
+	uint8_t* rotate_buffer = TransformBuffer(size);
+	zm_rotate_blocks( buffer, rotate_buffer, width, height, colours, angle, fptr_transpose );
+	UseTransformBuffer( height, width );
+}
+
+/* RGB32 compatible: complete */
+void Image::Flip( bool leftright )
+{
+	if ( IsYUV420P() )
+	{
+		unsigned int c_width = (width+1)>>1;
+		unsigned int c_height = (height+1)>>1;
+		unsigned int c_size = c_width*c_height;
+
+		if ( leftright )
 		{
-			Rgb* s_rptr = (Rgb*)s_ptr;
-			Rgb* d_rptr = (Rgb*)flip_buffer;
-			Rgb* max_d_rptr = (Rgb*)max_d_ptr;
-			while( d_rptr < max_d_rptr )
+			for ( unsigned int y = 0; y < height; y++ )
+				zm_reverse_pixels( buffer+(y*width), width, 1 );
+			for ( unsigned int y = 0; y < c_height; y++ )
 			{
-				for ( unsigned int j = 0; j < width; j++ )
-				{
-					s_rptr--;
-					*d_rptr++ = *s_rptr;
-				}
-				s_rptr += width * 2;
+				zm_reverse_pixels( buffer+pixels+(y*c_width), c_width, 1 );
+				zm_reverse_pixels( buffer+pixels+c_size+(y*c_width), c_width, 1 );
 			}
 		}
-		else /* Assume RGB24 */
+		else
 		{
-			while( d_ptr < max_d_ptr )
-			{
-				for ( unsigned int j = 0; j < width; j++ )
-				{
-					s_ptr -= 3;
-					*d_ptr++ = *s_ptr;
-					*d_ptr++ = *(s_ptr+1);
-					*d_ptr++ = *(s_ptr+2);
-				}
-				s_ptr += line_bytes2;
-			}
-		}		
+			zm_reverse_lines( buffer, width, height );
+			zm_reverse_lines( buffer+pixels, c_width, c_height );
+			zm_reverse_lines( buffer+pixels+c_size, c_width, c_height );
+		}
+		return;
+	}
+
+	/* Both flips are done in place, so the buffer is never replaced */
+	unsigned int line_bytes = width*colours;
+	if ( leftright )
+	{
+		// Horizontal flip, left to right
+		for ( unsigned int y = 0; y < height; y++ )
+			zm_reverse_pixels( buffer+(y*line_bytes), width, colours );
 	}
 	else
 	{
 		// Vertical flip, top to bottom
-		unsigned char *s_ptr = buffer+(height*line_bytes);
-		unsigned char *d_ptr = flip_buffer;
-
-		while( s_ptr > buffer )
-		{
-			s_ptr -= line_bytes;
-			memcpy( d_ptr, s_ptr, line_bytes );
-			d_ptr += line_bytes;
-		}
+		zm_reverse_lines( buffer, line_bytes, height );
 	}
-	
-	AssignDirect( width, height, colours, subpixelorder, flip_buffer, size, ZM_BUFTYPE_ZM);
-	
 }
 
 void Image::Scale( unsigned int factor )
+{
+	if ( factor == ZM_SCALE_BASE )
+	{
+		return;
+	}
+
+	/* The view leaves out any chroma planes, so they are dropped */
+	Scale( ImageView( *this ), factor );
+}
+
+/* Replaces the image with a scaled copy of the view, which may be of the image itself */
+void Image::Scale( const ImageView &source, unsigned int factor )
 {
 	if ( !factor )
 	{
@@ -2571,43 +2682,54 @@ void Image::Scale( unsigned int factor )
 	}
 	if ( factor == ZM_SCALE_BASE )
 	{
+		Assign( source );
 		return;
 	}
 
-	unsigned int new_width = (width*factor)/ZM_SCALE_BASE;
-	unsigned int new_height = (height*factor)/ZM_SCALE_BASE;
+	const unsigned int src_width = source.Width();
+	const unsigned int src_height = source.Height();
+	const unsigned int src_colours = source.Colours();
+
+	/* The pixel counts below start part way in, which can give one more line or column than the factor alone */
+	unsigned int start = (factor > ZM_SCALE_BASE)?(ZM_SCALE_BASE/2):(factor/2);
+	unsigned int new_width = (start+(src_width*factor))/ZM_SCALE_BASE;
+	unsigned int new_height = (start+(src_height*factor))/ZM_SCALE_BASE;
+	if ( !new_width || !new_height )
+	{
+		Error( "Scaling %dx%d by %d leaves no image", src_width, src_height, factor );
+		return;
+	}
 	
-	size_t scale_buffer_size = new_width * new_height * colours;
+	size_t scale_buffer_size = new_width * new_height * src_colours;
 	
 	uint8_t* scale_buffer = AllocBuffer(scale_buffer_size);
 	
 	if ( factor > ZM_SCALE_BASE )
 	{
 		unsigned char *pd = scale_buffer;
-		unsigned int wc = width*colours;
-		unsigned int nwc = new_width*colours;
+		unsigned int nwc = new_width*src_colours;
 		unsigned int h_count = ZM_SCALE_BASE/2;
 		unsigned int last_h_index = 0;
 		unsigned int last_w_index = 0;
 		unsigned int h_index;
-		for ( unsigned int y = 0; y < height; y++ )
+		for ( unsigned int y = 0; y < src_height; y++ )
 		{
-			unsigned char *ps = &buffer[y*wc];
+			const uint8_t *ps = source.Line( y );
 			unsigned int w_count = ZM_SCALE_BASE/2;
 			unsigned int w_index;
 			last_w_index = 0;
-			for ( unsigned int x = 0; x < width; x++ )
+			for ( unsigned int x = 0; x < src_width; x++ )
 			{
 				w_count += factor;
 				w_index = w_count/ZM_SCALE_BASE;
 				for (unsigned int f = last_w_index; f < w_index; f++ )
 				{
-					for ( unsigned int c = 0; c < colours; c++ )
+					for ( unsigned int c = 0; c < src_colours; c++ )
 					{
 						*pd++ = *(ps+c);
 					}
 				}
-				ps += colours;
+				ps += src_colours;
 				last_w_index = w_index;
 			}
 			h_count += factor;
@@ -2625,14 +2747,13 @@ void Image::Scale( unsigned int factor )
 	else
 	{
 		unsigned char *pd = scale_buffer;
-		unsigned int wc = width*colours;
 		unsigned int xstart = factor/2;
 		unsigned int ystart = factor/2;
 		unsigned int h_count = ystart;
 		unsigned int last_h_index = 0;
 		unsigned int last_w_index = 0;
 		unsigned int h_index;
-		for ( unsigned int y = 0; y < (unsigned int)height; y++ )
+		for ( unsigned int y = 0; y < (unsigned int)src_height; y++ )
 		{
 			h_count += factor;
 			h_index = h_count/ZM_SCALE_BASE;
@@ -2642,22 +2763,22 @@ void Image::Scale( unsigned int factor )
 				unsigned int w_index;
 				last_w_index = 0;
 
-				unsigned char *ps = &buffer[y*wc];
-				for ( unsigned int x = 0; x < (unsigned int)width; x++ )
+				const uint8_t *ps = source.Line( y );
+				for ( unsigned int x = 0; x < (unsigned int)src_width; x++ )
 				{
 					w_count += factor;
 					w_index = w_count/ZM_SCALE_BASE;
 					
 					if ( w_index > last_w_index )
 					{
-						for ( unsigned int c = 0; c < colours; c++ )
+						for ( unsigned int c = 0; c < src_colours; c++ )
 						{
 							*pd++ = *ps++;
 						}
 					}
 					else
 					{
-						ps += colours;
+						ps += src_colours;
 					}
 					last_w_index = w_index;
 				}
@@ -2668,7 +2789,7 @@ void Image::Scale( unsigned int factor )
         new_height = last_h_index;
 	}
 	
-	AssignDirect( new_width, new_height, colours, subpixelorder, scale_buffer, scale_buffer_size, ZM_BUFTYPE_ZM);
+	AssignDirect( new_width, new_height, src_colours, source.SubpixelOrder(), scale_buffer, scale_buffer_size, ZM_BUFTYPE_ZM);
 	
 }
 
@@ -2676,48 +2797,15 @@ void Image::Deinterlace_Discard()
 {
 	/* Simple deinterlacing. Copy the even lines into the odd lines */
 	
-	if ( colours == ZM_COLOUR_GRAY8 )
-	{
-		const uint8_t *psrc;
-		uint8_t *pdest;
-		for (unsigned int y = 0; y < (unsigned int)height; y += 2)
-		{
-			psrc = buffer + (y * width);
-			pdest = buffer + ((y+1) * width);
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				*pdest++ = *psrc++;
-			}
-		}
-	}
-	else if ( colours == ZM_COLOUR_RGB24 )
-	{
-		const uint8_t *psrc;
-		uint8_t *pdest;
-		for (unsigned int y = 0; y < (unsigned int)height; y += 2)
-		{
-			psrc = buffer + ((y * width) * 3);
-			pdest = buffer + (((y+1) * width) * 3);
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				*pdest++ = *psrc++;
-				*pdest++ = *psrc++;
-				*pdest++ = *psrc++;
-			}
-		}
+	if ( colours != ZM_COLOUR_GRAY8 && colours != ZM_COLOUR_RGB24 && colours != ZM_COLOUR_RGB32 ) {
+		Error("Deinterlace called with unexpected colours: %d", colours);
+		return;
 	}
-	else if ( colours == ZM_COLOUR_RGB32 )
+	
+	const unsigned int row_width = width * colours;
+	for (unsigned int y = 0; (y+1) < (unsigned int)height; y += 2)
 	{
-		const Rgb *psrc;
-		Rgb *pdest;
-		for (unsigned int y = 0; y < (unsigned int)height; y += 2)
-		{
-			psrc = (Rgb*)(buffer + ((y * width) << 2));
-			pdest = (Rgb*)(buffer + (((y+1) * width) << 2));
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				*pdest++ = *psrc++;
-			}
-		}
-	} else {
-		Error("Deinterlace called with unexpected colours: %d", colours);
+		memcpy(buffer + ((y+1) * row_width), buffer + (y * row_width), row_width);
 	}
 	
 }
@@ -2726,75 +2814,18 @@ void Image::Deinterlace_Linear()
 {
 	/* Simple deinterlacing. The odd lines are average of the line above and line below */
 	
-	const uint8_t *pbelow, *pabove;
-	uint8_t *pcurrent;
-	
-	if ( colours == ZM_COLOUR_GRAY8 )
-	{
-		for (unsigned int y = 1; y < (unsigned int)(height-1); y += 2)
-		{
-			pabove = buffer + ((y-1) * width);
-			pbelow = buffer + ((y+1) * width);
-			pcurrent = buffer + (y * width);
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				*pcurrent++ = (*pabove++ + *pbelow++) >> 1;
-			}
-		}
-		/* Special case for the last line */
-		pcurrent = buffer + ((height-1) * width);
-		pabove = buffer + ((height-2) * width);
-		for (unsigned int x = 0; x < (unsigned int)width; x++) {
-			*pcurrent++ = *pabove++;
-		}
-	}
-	else if ( colours == ZM_COLOUR_RGB24 )
-	{
-		for (unsigned int y = 1; y < (unsigned int)(height-1); y += 2)
-		{
-			pabove = buffer + (((y-1) * width) * 3);
-			pbelow = buffer + (((y+1) * width) * 3);
-			pcurrent = buffer + ((y * width) * 3);
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				*pcurrent++ = (*pabove++ + *pbelow++) >> 1;
-				*pcurrent++ = (*pabove++ + *pbelow++) >> 1;
-				*pcurrent++ = (*pabove++ + *pbelow++) >> 1;
-			}
-		}
-		/* Special case for the last line */
-		pcurrent = buffer + (((height-1) * width) * 3);
-		pabove = buffer + (((height-2) * width) * 3);
-		for (unsigned int x = 0; x < (unsigned int)width; x++) {
-			*pcurrent++ = *pabove++;
-			*pcurrent++ = *pabove++;
-			*pcurrent++ = *pabove++;
-		}
+	if ( colours != ZM_COLOUR_GRAY8 && colours != ZM_COLOUR_RGB24 && colours != ZM_COLOUR_RGB32 ) {
+		Error("Deinterlace called with unexpected colours: %d", colours);
+		return;
 	}
-	else if ( colours == ZM_COLOUR_RGB32 )
+	
+	const unsigned int row_width = width * colours;
+	for (unsigned int y = 1; y < (unsigned int)(height-1); y += 2)
 	{
-		for (unsigned int y = 1; y < (unsigned int)(height-1); y += 2)
-		{
-			pabove = buffer + (((y-1) * width) << 2);
-			pbelow = buffer + (((y+1) * width) << 2);
-			pcurrent = buffer + ((y * width) << 2);
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				*pcurrent++ = (*pabove++ + *pbelow++) >> 1;
-				*pcurrent++ = (*pabove++ + *pbelow++) >> 1;
-				*pcurrent++ = (*pabove++ + *pbelow++) >> 1;
-				*pcurrent++ = (*pabove++ + *pbelow++) >> 1;
-			}
-		}
-		/* Special case for the last line */
-		pcurrent = buffer + (((height-1) * width) << 2);
-		pabove = buffer + (((height-2) * width) << 2);
-		for (unsigned int x = 0; x < (unsigned int)width; x++) {
-			*pcurrent++ = *pabove++;
-			*pcurrent++ = *pabove++;
-			*pcurrent++ = *pabove++;  
-			*pcurrent++ = *pabove++;
-		}
-	} else {
-		Error("Deinterlace called with unexpected colours: %d", colours);
+		(*fptr_deinterlace_linear)(buffer + ((y-1) * row_width), buffer + ((y+1) * row_width), buffer + (y * row_width), row_width);
 	}
+	/* Special case for the last line */
+	memcpy(buffer + ((height-1) * row_width), buffer + ((height-2) * row_width), row_width);
 	
 }
 
@@ -2802,55 +2833,15 @@ void Image::Deinterlace_Blend()
 {
 	/* Simple deinterlacing. Blend the fields together. 50% blend */
 	
-	uint8_t *pabove, *pcurrent;
-	
-	if ( colours == ZM_COLOUR_GRAY8 )
-	{
-		for (unsigned int y = 1; y < (unsigned int)height; y += 2)
-		{
-			pabove = buffer + ((y-1) * width);
-			pcurrent = buffer + (y * width);
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				*pabove = (*pabove + *pcurrent) >> 1;
-				*pcurrent++ = *pabove++;
-			}
-		}
-	}
-	else if ( colours == ZM_COLOUR_RGB24 )
-	{
-		for (unsigned int y = 1; y < (unsigned int)height; y += 2)
-		{
-			pabove = buffer + (((y-1) * width) * 3);
-			pcurrent = buffer + ((y * width) * 3);
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				*pabove = (*pabove + *pcurrent) >> 1;
-				*pcurrent++ = *pabove++;
-				*pabove = (*pabove + *pcurrent) >> 1;
-				*pcurrent++ = *pabove++;
-				*pabove = (*pabove + *pcurrent) >> 1;
-				*pcurrent++ = *pabove++;
-			}
-		}
+	if ( colours != ZM_COLOUR_GRAY8 && colours != ZM_COLOUR_RGB24 && colours != ZM_COLOUR_RGB32 ) {
+		Error("Deinterlace called with unexpected colours: %d", colours);
+		return;
 	}
-	else if ( colours == ZM_COLOUR_RGB32 )
+	
+	const unsigned int row_width = width * colours;
+	for (unsigned int y = 1; y < (unsigned int)height; y += 2)
 	{
-		for (unsigned int y = 1; y < (unsigned int)height; y += 2)
-		{
-			pabove = buffer + (((y-1) * width) << 2);
-			pcurrent = buffer + ((y * width) << 2);
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				*pabove = (*pabove + *pcurrent) >> 1;
-				*pcurrent++ = *pabove++;
-				*pabove = (*pabove + *pcurrent) >> 1;
-				*pcurrent++ = *pabove++;
-				*pabove = (*pabove + *pcurrent) >> 1;
-				*pcurrent++ = *pabove++;
-				*pabove = (*pabove + *pcurrent) >> 1;
-				*pcurrent++ = *pabove++;
-			}
-		}
-	} else {
-		Error("Deinterlace called with unexpected colours: %d", colours);
+		(*fptr_deinterlace_blend)(buffer + ((y-1) * row_width), buffer + (y * row_width), row_width);
 	}
 	
 }
@@ -2863,76 +2854,19 @@ void Image::Deinterlace_Blend_CustomRatio(int divider)
 	/* 3 = 12.% blending  */
 	/* 4 = 6.25% blending */
 	
-	uint8_t *pabove, *pcurrent;
-	uint8_t subpix1, subpix2;
-	
 	if ( divider < 1 || divider > 4 ) {
 		Error("Deinterlace called with invalid blend ratio");
 	}
 	
-	if ( colours == ZM_COLOUR_GRAY8 )
-	{
-		for (unsigned int y = 1; y < (unsigned int)height; y += 2)
-		{
-			pabove = buffer + ((y-1) * width);
-			pcurrent = buffer + (y * width);
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				subpix1 = ((*pabove - *pcurrent)>>divider) + *pcurrent;
-				subpix2 = ((*pcurrent - *pabove)>>divider) + *pabove;
-				*pcurrent++ = subpix1;
-				*pabove++ = subpix2;
-			}
-		}
-	}
-	else if ( colours == ZM_COLOUR_RGB24 )
-	{
-		for (unsigned int y = 1; y < (unsigned int)height; y += 2)
-		{
-			pabove = buffer + (((y-1) * width) * 3);
-			pcurrent = buffer + ((y * width) * 3);
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				subpix1 = ((*pabove - *pcurrent)>>divider) + *pcurrent;
-				subpix2 = ((*pcurrent - *pabove)>>divider) + *pabove;
-				*pcurrent++ = subpix1;
-				*pabove++ = subpix2;
-				subpix1 = ((*pabove - *pcurrent)>>divider) + *pcurrent;
-				subpix2 = ((*pcurrent - *pabove)>>divider) + *pabove;
-				*pcurrent++ = subpix1;
-				*pabove++ = subpix2;
-				subpix1 = ((*pabove - *pcurrent)>>divider) + *pcurrent;
-				subpix2 = ((*pcurrent - *pabove)>>divider) + *pabove;
-				*pcurrent++ = subpix1;
-				*pabove++ = subpix2;
-			}
-		}
+	if ( colours != ZM_COLOUR_GRAY8 && colours != ZM_COLOUR_RGB24 && colours != ZM_COLOUR_RGB32 ) {
+		Error("Deinterlace called with unexpected colours: %d", colours);
+		return;
 	}
-	else if ( colours == ZM_COLOUR_RGB32 )
+	
+	const unsigned int row_width = width * colours;
+	for (unsigned int y = 1; y < (unsigned int)height; y += 2)
 	{
-		for (unsigned int y = 1; y < (unsigned int)height; y += 2)
-		{
-			pabove = buffer + (((y-1) * width) << 2);
-			pcurrent = buffer + ((y * width) << 2);
-			for (unsigned int x = 0; x < (unsigned int)width; x++) {
-				subpix1 = ((*pabove - *pcurrent)>>divider) + *pcurrent;
-				subpix2 = ((*pcurrent - *pabove)>>divider) + *pabove;
-				*pcurrent++ = subpix1;
-				*pabove++ = subpix2;
-				subpix1 = ((*pabove - *pcurrent)>>divider) + *pcurrent;
-				subpix2 = ((*pcurrent - *pabove)>>divider) + *pabove;
-				*pcurrent++ = subpix1;
-				*pabove++ = subpix2;
-				subpix1 = ((*pabove - *pcurrent)>>divider) + *pcurrent;
-				subpix2 = ((*pcurrent - *pabove)>>divider) + *pabove;
-				*pcurrent++ = subpix1;
-				*pabove++ = subpix2;
-				subpix1 = ((*pabove - *pcurrent)>>divider) + *pcurrent;
-				subpix2 = ((*pcurrent - *pabove)>>divider) + *pabove;
-				*pcurrent++ = subpix1;
-				*pabove++ = subpix2;
-			}
-		}
-	} else {
-		Error("Deinterlace called with unexpected colours: %d", colours);
+		(*fptr_deinterlace_blend_ratio)(buffer + ((y-1) * row_width), buffer + (y * row_width), row_width, divider);
 	}
 	
 }
@@ -2950,10 +2884,10 @@ void Image::Deinterlace_4Field(const Image* next_image, unsigned int threshold)
 	  {
 	    if(subpixelorder == ZM_SUBPIX_ORDER_BGR) {
 	      /* BGR subpixel order */
-	      std_deinterlace_4field_bgr(buffer, next_image->buffer, threshold, width, height);
+	      (*fptr_deinterlace_4field_bgr)(buffer, next_image->buffer, threshold, width, height);
 	    } else {
 	      /* Assume RGB subpixel order */
-	      std_deinterlace_4field_rgb(buffer, next_image->buffer, threshold, width, height);
+	      (*fptr_deinterlace_4field_rgb)(buffer, next_image->buffer, threshold, width, height);
 	    }
 	    break;
 	  }
@@ -4117,7 +4051,7 @@ void ssse3_convert_yuyv_gray8(const uint8_t* col1, uint8_t* result, unsigned lon
 
 /* YUYV to RGB24 - relocated from zm_local_camera.cpp */
 __attribute__((noinline)) void zm_convert_yuyv_rgb(const uint8_t* col1, uint8_t* result, unsigned long count) {
-	unsigned int r,g,b;
+	int r,g,b;
 	unsigned int y1,y2,u,v;
 	for(unsigned int i=0; i < count; i += 2, col1 += 4, result += 6) {
 		y1 = col1[0];
@@ -4144,88 +4078,959 @@ __attribute__((noinline)) void zm_convert_yuyv_rgb(const uint8_t* col1, uint8_t*
 	
 }
 
-/* YUYV to RGBA - modified the one above */
-__attribute__((noinline)) void zm_convert_yuyv_rgba(const uint8_t* col1, uint8_t* result, unsigned long count) {
-	unsigned int r,g,b;
-	unsigned int y1,y2,u,v;
-	for(unsigned int i=0; i < count; i += 2, col1 += 4, result += 8) {
-		y1 = col1[0];
-		u = col1[1];
-		y2 = col1[2];
-		v = col1[3];
-
-		r = y1 + r_v_table[v];
-		g = y1 - (g_u_table[u]+g_v_table[v]);
-		b = y1 + b_u_table[u];
-		
-		result[0] = r<0?0:(r>255?255:r);
-		result[1] = g<0?0:(g>255?255:g);
-		result[2] = b<0?0:(b>255?255:b);
-		
-		r = y2 + r_v_table[v];
-		g = y2 - (g_u_table[u]+g_v_table[v]);
-		b = y2 + b_u_table[u];
+/* YUYV to RGBA - modified the one above */
+__attribute__((noinline)) void zm_convert_yuyv_rgba(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	int r,g,b;
+	unsigned int y1,y2,u,v;
+	for(unsigned int i=0; i < count; i += 2, col1 += 4, result += 8) {
+		y1 = col1[0];
+		u = col1[1];
+		y2 = col1[2];
+		v = col1[3];
+
+		r = y1 + r_v_table[v];
+		g = y1 - (g_u_table[u]+g_v_table[v]);
+		b = y1 + b_u_table[u];
+		
+		result[0] = r<0?0:(r>255?255:r);
+		result[1] = g<0?0:(g>255?255:g);
+		result[2] = b<0?0:(b>255?255:b);
+		
+		r = y2 + r_v_table[v];
+		g = y2 - (g_u_table[u]+g_v_table[v]);
+		b = y2 + b_u_table[u];
+
+		result[4] = r<0?0:(r>255?255:r);
+		result[5] = g<0?0:(g>255?255:g);
+		result[6] = b<0?0:(b>255?255:b);
+	}
+	
+}
+
+/* RGB555 to RGB24 - relocated from zm_local_camera.cpp */
+__attribute__((noinline)) void zm_convert_rgb555_rgb(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	unsigned int r,g,b;  
+	for(unsigned int i=0; i < count; i++, col1 += 2, result += 3) {  
+		b = ((*col1)<<3)&0xf8;
+		g = (((*(col1+1))<<6)|((*col1)>>2))&0xf8;
+		r = ((*(col1+1))<<1)&0xf8;
+		result[0] = r;
+		result[1] = g;
+		result[2] = b;
+	}
+}
+
+/* RGB555 to RGBA - modified the one above */
+__attribute__((noinline)) void zm_convert_rgb555_rgba(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	unsigned int r,g,b;  
+	for(unsigned int i=0; i < count; i++, col1 += 2, result += 4) {  
+		b = ((*col1)<<3)&0xf8;
+		g = (((*(col1+1))<<6)|((*col1)>>2))&0xf8;
+		r = ((*(col1+1))<<1)&0xf8;
+		result[0] = r;
+		result[1] = g;
+		result[2] = b;
+	}
+}
+
+/* RGB565 to RGB24 - relocated from zm_local_camera.cpp */
+__attribute__((noinline)) void zm_convert_rgb565_rgb(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	unsigned int r,g,b;  
+	for(unsigned int i=0; i < count; i++, col1 += 2, result += 3) {  
+		b = ((*col1)<<3)&0xf8;
+		g = (((*(col1+1))<<5)|((*col1)>>3))&0xfc;
+		r = (*(col1+1))&0xf8;
+		result[0] = r;
+		result[1] = g;
+		result[2] = b;
+	}
+}
+
+/* RGB565 to RGBA - modified the one above */
+__attribute__((noinline)) void zm_convert_rgb565_rgba(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	unsigned int r,g,b;  
+	for(unsigned int i=0; i < count; i++, col1 += 2, result += 4) {  
+		b = ((*col1)<<3)&0xf8;
+		g = (((*(col1+1))<<5)|((*col1)>>3))&0xfc;
+		r = (*(col1+1))&0xf8;
+		result[0] = r;
+		result[1] = g;
+		result[2] = b;
+	}
+}
+
+/* YUV420P (I420) to RGB24 from separate planes, the strides are the distance between lines of each plane */
+__attribute__((noinline)) void zm_convert_yuv420p_planes_rgb(const uint8_t* py, const uint8_t* pu, const uint8_t* pv, unsigned int y_stride, unsigned int c_stride, uint8_t* result, unsigned int width, unsigned int height) {
+	int r,g,b,y;
+	unsigned int u,v;
+	for(unsigned int j=0; j < height; j++, py += y_stride) {
+		const uint8_t* prowu = pu + ((j>>1)*c_stride);
+		const uint8_t* prowv = pv + ((j>>1)*c_stride);
+		for(unsigned int i=0; i < width; i++, result += 3) {
+			y = py[i];
+			u = prowu[i>>1];
+			v = prowv[i>>1];
+			
+			r = y + r_v_table[v];
+			g = y - (g_u_table[u]+g_v_table[v]);
+			b = y + b_u_table[u];
+			
+			result[0] = r<0?0:(r>255?255:r);
+			result[1] = g<0?0:(g>255?255:g);
+			result[2] = b<0?0:(b>255?255:b);
+		}
+	}
+}
+
+/* YUV420P (I420) to RGBA from separate planes - modified the one above */
+__attribute__((noinline)) void zm_convert_yuv420p_planes_rgba(const uint8_t* py, const uint8_t* pu, const uint8_t* pv, unsigned int y_stride, unsigned int c_stride, uint8_t* result, unsigned int width, unsigned int height) {
+	int r,g,b,y;
+	unsigned int u,v;
+	for(unsigned int j=0; j < height; j++, py += y_stride) {
+		const uint8_t* prowu = pu + ((j>>1)*c_stride);
+		const uint8_t* prowv = pv + ((j>>1)*c_stride);
+		for(unsigned int i=0; i < width; i++, result += 4) {
+			y = py[i];
+			u = prowu[i>>1];
+			v = prowv[i>>1];
+			
+			r = y + r_v_table[v];
+			g = y - (g_u_table[u]+g_v_table[v]);
+			b = y + b_u_table[u];
+			
+			result[0] = r<0?0:(r>255?255:r);
+			result[1] = g<0?0:(g>255?255:g);
+			result[2] = b<0?0:(b>255?255:b);
+			result[3] = 0;
+		}
+	}
+}
+
+/* YUV420P (I420) to RGB24 */
+void zm_convert_yuv420p_rgb(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height) {
+	const unsigned int c_width = (width+1)>>1;
+	const uint8_t* pu = col1 + (width*height);
+	zm_convert_yuv420p_planes_rgb(col1, pu, pu + (c_width*((height+1)>>1)), width, c_width, result, width, height);
+}
+
+/* YUV420P (I420) to RGBA */
+void zm_convert_yuv420p_rgba(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height) {
+	const unsigned int c_width = (width+1)>>1;
+	const uint8_t* pu = col1 + (width*height);
+	zm_convert_yuv420p_planes_rgba(col1, pu, pu + (c_width*((height+1)>>1)), width, c_width, result, width, height);
+}
+
+/* Packed 4:2:2 to planar 4:2:0, averaging the chroma of each pair of lines.
+   yoffset/uoffset/voffset give the position of the components in each 4 byte macropixel */
+static inline void zm_convert_packed422_yuv420p(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height, int yoffset, int uoffset, int voffset) {
+	const unsigned int c_width = (width+1)>>1;
+	const unsigned int c_height = (height+1)>>1;
+	const unsigned int stride = c_width<<2;
+	uint8_t* py = result;
+	uint8_t* pu = result + (width*height);
+	uint8_t* pv = pu + (c_width*c_height);
+	
+	for(unsigned int j=0; j < height; j++) {
+		const uint8_t* psrc = col1 + (j*stride);
+		for(unsigned int i=0; i < width; i++) {
+			*py++ = psrc[((i>>1)<<2)+((i&1)<<1)+yoffset];
+		}
+		if(!(j&1)) {
+			/* The last line of an odd height image has nothing to pair with */
+			const uint8_t* pnext = (j+1 < height)?psrc+stride:psrc;
+			for(unsigned int i=0; i < c_width; i++, psrc += 4, pnext += 4) {
+				*pu++ = (psrc[uoffset]+pnext[uoffset]+1)>>1;
+				*pv++ = (psrc[voffset]+pnext[voffset]+1)>>1;
+			}
+		}
+	}
+}
+
+/* YUYV to YUV420P */
+__attribute__((noinline)) void zm_convert_yuyv_yuv420p(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height) {
+	zm_convert_packed422_yuv420p(col1, result, width, height, 0, 1, 3);
+}
+
+/* UYVY to YUV420P */
+__attribute__((noinline)) void zm_convert_uyvy_yuv420p(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height) {
+	zm_convert_packed422_yuv420p(col1, result, width, height, 1, 0, 2);
+}
+
+/* Converts a single pixel, used for what is left over by the SIMD functions */
+static inline void zm_convert_yuv_rgb_pixel(int y, unsigned int u, unsigned int v, uint8_t* result) {
+	int r = y + r_v_table[v];
+	int g = y - (g_u_table[u]+g_v_table[v]);
+	int b = y + b_u_table[u];
+
+	result[0] = r<0?0:(r>255?255:r);
+	result[1] = g<0?0:(g>255?255:g);
+	result[2] = b<0?0:(b>255?255:b);
+}
+
+/* UYVY to RGB24 */
+__attribute__((noinline)) void zm_convert_uyvy_rgb(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	for(unsigned int i=0; i < count; i += 2, col1 += 4, result += 6) {
+		zm_convert_yuv_rgb_pixel(col1[1], col1[0], col1[2], result);
+		zm_convert_yuv_rgb_pixel(col1[3], col1[0], col1[2], result+3);
+	}
+}
+
+/* UYVY to RGBA */
+__attribute__((noinline)) void zm_convert_uyvy_rgba(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	for(unsigned int i=0; i < count; i += 2, col1 += 4, result += 8) {
+		zm_convert_yuv_rgb_pixel(col1[1], col1[0], col1[2], result);
+		zm_convert_yuv_rgb_pixel(col1[3], col1[0], col1[2], result+4);
+	}
+}
+
+/* Converts a UYVY image into grayscale by extracting the Y channel */
+__attribute__((noinline)) void std_convert_uyvy_gray8(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	const uint8_t* const max_ptr = result + count;
+
+	while(result < max_ptr) {
+		*result++ = col1[1];
+		col1 += 2;
+	}
+}
+
+/* YUV420P and NV12 to grayscale, the Y plane is already a grayscale image */
+__attribute__((noinline)) void zm_convert_yuv420p_gray8(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	memcpy(result, col1, count);
+}
+
+/* NV12 (Y plane followed by interleaved UV plane) to RGB24 */
+__attribute__((noinline)) void zm_convert_nv12_rgb(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height) {
+	const unsigned int c_stride = ((width+1)>>1)<<1;
+	const uint8_t* puv = col1 + (width*height);
+	for(unsigned int j=0; j < height; j++) {
+		const uint8_t* prowuv = puv + ((j>>1)*c_stride);
+		for(unsigned int i=0; i < width; i++, col1++, result += 3) {
+			zm_convert_yuv_rgb_pixel(*col1, prowuv[(i>>1)<<1], prowuv[((i>>1)<<1)+1], result);
+		}
+	}
+}
+
+/* NV12 to RGBA */
+__attribute__((noinline)) void zm_convert_nv12_rgba(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height) {
+	const unsigned int c_stride = ((width+1)>>1)<<1;
+	const uint8_t* puv = col1 + (width*height);
+	for(unsigned int j=0; j < height; j++) {
+		const uint8_t* prowuv = puv + ((j>>1)*c_stride);
+		for(unsigned int i=0; i < width; i++, col1++, result += 4) {
+			zm_convert_yuv_rgb_pixel(*col1, prowuv[(i>>1)<<1], prowuv[((i>>1)<<1)+1], result);
+		}
+	}
+}
+
+/* SSSE3 colour conversions, 8 pixels at a time.
+   The YUV->RGB ones use the same coefficients as the tables above in 2.14 fixed point with pmulhrsw,
+   so can differ from the standard functions by a level or two in the rounding.
+   They all share these register assignments:
+   XMM0 - Y, then G
+   XMM1 - U
+   XMM2 - V
+   XMM3 - R
+   XMM4 - B
+   XMM5 - 128 in each word
+   XMM6 - General purpose
+   XMM7 - zero */
+__attribute__((aligned(16))) static const int16_t yuv_c128[8] = {128,128,128,128,128,128,128,128};
+__attribute__((aligned(16))) static const int16_t yuv_crv[8] = {22970,22970,22970,22970,22970,22970,22970,22970};
+__attribute__((aligned(16))) static const int16_t yuv_cgu[8] = {5636,5636,5636,5636,5636,5636,5636,5636};
+__attribute__((aligned(16))) static const int16_t yuv_cgv[8] = {11698,11698,11698,11698,11698,11698,11698,11698};
+__attribute__((aligned(16))) static const int16_t yuv_cbu[8] = {29032,29032,29032,29032,29032,29032,29032,29032};
+__attribute__((aligned(16))) static const uint8_t rgba_rgb_mask[16] = {0,1,2,4,5,6,8,9,10,12,13,14,0xFF,0xFF,0xFF,0xFF};
+
+/* Y, U and V shuffle masks for 8 pixels of packed 4:2:2 */
+__attribute__((aligned(16))) static const uint8_t yuyv_masks[48] = {
+	0,0xFF,2,0xFF,4,0xFF,6,0xFF,8,0xFF,10,0xFF,12,0xFF,14,0xFF,
+	1,0xFF,1,0xFF,5,0xFF,5,0xFF,9,0xFF,9,0xFF,13,0xFF,13,0xFF,
+	3,0xFF,3,0xFF,7,0xFF,7,0xFF,11,0xFF,11,0xFF,15,0xFF,15,0xFF};
+__attribute__((aligned(16))) static const uint8_t uyvy_masks[48] = {
+	1,0xFF,3,0xFF,5,0xFF,7,0xFF,9,0xFF,11,0xFF,13,0xFF,15,0xFF,
+	0,0xFF,0,0xFF,4,0xFF,4,0xFF,8,0xFF,8,0xFF,12,0xFF,12,0xFF,
+	2,0xFF,2,0xFF,6,0xFF,6,0xFF,10,0xFF,10,0xFF,14,0xFF,14,0xFF};
+
+/* Chroma shuffle masks for 8 pixels of planar and semi planar 4:2:0 */
+__attribute__((aligned(16))) static const uint8_t yuv420p_chroma_mask[16] = {0,0xFF,0,0xFF,1,0xFF,1,0xFF,2,0xFF,2,0xFF,3,0xFF,3,0xFF};
+__attribute__((aligned(16))) static const uint8_t nv12_chroma_masks[32] = {
+	0,0xFF,0,0xFF,2,0xFF,2,0xFF,4,0xFF,4,0xFF,6,0xFF,6,0xFF,
+	1,0xFF,1,0xFF,3,0xFF,3,0xFF,5,0xFF,5,0xFF,7,0xFF,7,0xFF};
+
+/* Shift counts and green mask for 16 bit RGB */
+struct rgb16_format {
+	uint64_t rshift[2];
+	uint64_t gshift[2];
+	uint16_t gmask[8];
+	uint16_t bmask[8];
+};
+__attribute__((aligned(16))) static const rgb16_format rgb555_format = {{7,0},{2,0},{0xF8,0xF8,0xF8,0xF8,0xF8,0xF8,0xF8,0xF8},{0xF8,0xF8,0xF8,0xF8,0xF8,0xF8,0xF8,0xF8}};
+__attribute__((aligned(16))) static const rgb16_format rgb565_format = {{8,0},{3,0},{0xFC,0xFC,0xFC,0xFC,0xFC,0xFC,0xFC,0xFC},{0xF8,0xF8,0xF8,0xF8,0xF8,0xF8,0xF8,0xF8}};
+
+#define ZM_SSSE3_YUV_CONSTANTS \
+	[c128] "m" (*yuv_c128), [crv] "m" (*yuv_crv), [cgu] "m" (*yuv_cgu), [cgv] "m" (*yuv_cgv), [cbu] "m" (*yuv_cbu), [rgbmask] "m" (*rgba_rgb_mask)
+
+#define ZM_SSSE3_CLOBBERS \
+	"%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7", "cc", "memory"
+
+/* Y, U and V words in XMM0-2 to R, G and B words in XMM3, XMM0 and XMM4 */
+#define ZM_SSSE3_YUV_RGB \
+	"psubw %%xmm5, %%xmm1\n\t" \
+	"psubw %%xmm5, %%xmm2\n\t" \
+	"psllw $0x1, %%xmm1\n\t" \
+	"psllw $0x1, %%xmm2\n\t" \
+	"movdqa %%xmm2, %%xmm3\n\t" \
+	"pmulhrsw %[crv], %%xmm3\n\t" \
+	"paddw %%xmm0, %%xmm3\n\t" \
+	"movdqa %%xmm1, %%xmm4\n\t" \
+	"pmulhrsw %[cbu], %%xmm4\n\t" \
+	"paddw %%xmm0, %%xmm4\n\t" \
+	"pmulhrsw %[cgu], %%xmm1\n\t" \
+	"pmulhrsw %[cgv], %%xmm2\n\t" \
+	"paddw %%xmm2, %%xmm1\n\t" \
+	"psubw %%xmm1, %%xmm0\n\t"
+
+/* R, G and B words in XMM3, XMM0 and XMM4 to saturated RGBX pixels in XMM3 (first four) and XMM0 */
+#define ZM_SSSE3_PACK_RGBX \
+	"packuswb %%xmm3, %%xmm3\n\t" \
+	"packuswb %%xmm0, %%xmm0\n\t" \
+	"packuswb %%xmm4, %%xmm4\n\t" \
+	"punpcklbw %%xmm0, %%xmm3\n\t" \
+	"punpcklbw %%xmm7, %%xmm4\n\t" \
+	"movdqa %%xmm3, %%xmm0\n\t" \
+	"punpcklwd %%xmm4, %%xmm3\n\t" \
+	"punpckhwd %%xmm4, %%xmm0\n\t"
+
+#define ZM_SSSE3_STORE_RGBA \
+	"movdqu %%xmm3, (%[dst])\n\t" \
+	"movdqu %%xmm0, 0x10(%[dst])\n\t"
+
+#define ZM_SSSE3_STORE_RGB \
+	"pshufb %[rgbmask], %%xmm3\n\t" \
+	"pshufb %[rgbmask], %%xmm0\n\t" \
+	"movq %%xmm3, (%[dst])\n\t" \
+	"psrldq $0x8, %%xmm3\n\t" \
+	"movd %%xmm3, 0x8(%[dst])\n\t" \
+	"movq %%xmm0, 0xC(%[dst])\n\t" \
+	"psrldq $0x8, %%xmm0\n\t" \
+	"movd %%xmm0, 0x14(%[dst])\n\t"
+
+/* Y, U and V of 8 pixels of packed 4:2:2 from src into XMM0-2 */
+#define ZM_SSSE3_LOAD_PACKED422 \
+	"movdqu (%[src]), %%xmm0\n\t" \
+	"movdqa %%xmm0, %%xmm1\n\t" \
+	"movdqa %%xmm0, %%xmm2\n\t" \
+	"pshufb (%[masks]), %%xmm0\n\t" \
+	"pshufb 0x10(%[masks]), %%xmm1\n\t" \
+	"pshufb 0x20(%[masks]), %%xmm2\n\t" \
+	"add $0x10, %[src]\n\t"
+
+/* Y, U and V of 8 pixels of planar 4:2:0 from py, pu and pv into XMM0-2 */
+#define ZM_SSSE3_LOAD_YUV420P \
+	"movq (%[py]), %%xmm0\n\t" \
+	"punpcklbw %%xmm7, %%xmm0\n\t" \
+	"movd (%[pu]), %%xmm1\n\t" \
+	"pshufb %[cmask], %%xmm1\n\t" \
+	"movd (%[pv]), %%xmm2\n\t" \
+	"pshufb %[cmask], %%xmm2\n\t" \
+	"add $0x8, %[py]\n\t" \
+	"add $0x4, %[pu]\n\t" \
+	"add $0x4, %[pv]\n\t"
+
+/* Y, U and V of 8 pixels of semi planar 4:2:0 from py and puv into XMM0-2 */
+#define ZM_SSSE3_LOAD_NV12 \
+	"movq (%[py]), %%xmm0\n\t" \
+	"punpcklbw %%xmm7, %%xmm0\n\t" \
+	"movq (%[puv]), %%xmm1\n\t" \
+	"movdqa %%xmm1, %%xmm2\n\t" \
+	"pshufb %[umask], %%xmm1\n\t" \
+	"pshufb %[vmask], %%xmm2\n\t" \
+	"add $0x8, %[py]\n\t" \
+	"add $0x8, %[puv]\n\t"
+
+/* R, G and B of 8 pixels of 16 bit RGB from src into XMM3, XMM0 and XMM4 */
+#define ZM_SSSE3_LOAD_RGB16 \
+	"movdqu (%[src]), %%xmm4\n\t" \
+	"movdqa %%xmm4, %%xmm3\n\t" \
+	"movdqa %%xmm4, %%xmm0\n\t" \
+	"psrlw (%[fmt]), %%xmm3\n\t" \
+	"pand 0x30(%[fmt]), %%xmm3\n\t" \
+	"psrlw 0x10(%[fmt]), %%xmm0\n\t" \
+	"pand 0x20(%[fmt]), %%xmm0\n\t" \
+	"psllw $0x3, %%xmm4\n\t" \
+	"pand 0x30(%[fmt]), %%xmm4\n\t" \
+	"add $0x10, %[src]\n\t"
+
+/* Packed 4:2:2 to RGB24, count must be a multiple of 8 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("ssse3")))
+#endif
+static void ssse3_convert_packed422_rgb(const uint8_t* col1, uint8_t* result, unsigned long count, const uint8_t* masks) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	const uint8_t* const max_ptr = col1 + (count<<1);
+	if(!count)
+		return;
+
+	__asm__ __volatile__ (
+	"movdqa %[c128], %%xmm5\n\t"
+	"pxor %%xmm7, %%xmm7\n\t"
+	"1:\n\t"
+	ZM_SSSE3_LOAD_PACKED422
+	ZM_SSSE3_YUV_RGB
+	ZM_SSSE3_PACK_RGBX
+	ZM_SSSE3_STORE_RGB
+	"add $0x18, %[dst]\n\t"
+	"cmp %[end], %[src]\n\t"
+	"jb 1b\n\t"
+	: [src] "+r" (col1), [dst] "+r" (result)
+	: [end] "m" (max_ptr), [masks] "r" (masks), ZM_SSSE3_YUV_CONSTANTS
+	: ZM_SSSE3_CLOBBERS
+	);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* Packed 4:2:2 to RGBA, count must be a multiple of 8 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("ssse3")))
+#endif
+static void ssse3_convert_packed422_rgba(const uint8_t* col1, uint8_t* result, unsigned long count, const uint8_t* masks) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	const uint8_t* const max_ptr = col1 + (count<<1);
+	if(!count)
+		return;
+
+	__asm__ __volatile__ (
+	"movdqa %[c128], %%xmm5\n\t"
+	"pxor %%xmm7, %%xmm7\n\t"
+	"1:\n\t"
+	ZM_SSSE3_LOAD_PACKED422
+	ZM_SSSE3_YUV_RGB
+	ZM_SSSE3_PACK_RGBX
+	ZM_SSSE3_STORE_RGBA
+	"add $0x20, %[dst]\n\t"
+	"cmp %[end], %[src]\n\t"
+	"jb 1b\n\t"
+	: [src] "+r" (col1), [dst] "+r" (result)
+	: [end] "m" (max_ptr), [masks] "r" (masks), ZM_SSSE3_YUV_CONSTANTS
+	: ZM_SSSE3_CLOBBERS
+	);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* One row of planar 4:2:0 to RGB24, width must be a multiple of 8 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("ssse3")))
+#endif
+static void ssse3_convert_yuv420p_rgb_row(const uint8_t* py, const uint8_t* pu, const uint8_t* pv, uint8_t* result, unsigned int width) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	const uint8_t* const max_ptr = py + width;
+	if(!width)
+		return;
+
+	__asm__ __volatile__ (
+	"movdqa %[c128], %%xmm5\n\t"
+	"pxor %%xmm7, %%xmm7\n\t"
+	"1:\n\t"
+	ZM_SSSE3_LOAD_YUV420P
+	ZM_SSSE3_YUV_RGB
+	ZM_SSSE3_PACK_RGBX
+	ZM_SSSE3_STORE_RGB
+	"add $0x18, %[dst]\n\t"
+	"cmp %[end], %[py]\n\t"
+	"jb 1b\n\t"
+	: [py] "+r" (py), [pu] "+r" (pu), [pv] "+r" (pv), [dst] "+r" (result)
+	: [end] "m" (max_ptr), [cmask] "m" (*yuv420p_chroma_mask), ZM_SSSE3_YUV_CONSTANTS
+	: ZM_SSSE3_CLOBBERS
+	);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* One row of planar 4:2:0 to RGBA, width must be a multiple of 8 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("ssse3")))
+#endif
+static void ssse3_convert_yuv420p_rgba_row(const uint8_t* py, const uint8_t* pu, const uint8_t* pv, uint8_t* result, unsigned int width) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	const uint8_t* const max_ptr = py + width;
+	if(!width)
+		return;
+
+	__asm__ __volatile__ (
+	"movdqa %[c128], %%xmm5\n\t"
+	"pxor %%xmm7, %%xmm7\n\t"
+	"1:\n\t"
+	ZM_SSSE3_LOAD_YUV420P
+	ZM_SSSE3_YUV_RGB
+	ZM_SSSE3_PACK_RGBX
+	ZM_SSSE3_STORE_RGBA
+	"add $0x20, %[dst]\n\t"
+	"cmp %[end], %[py]\n\t"
+	"jb 1b\n\t"
+	: [py] "+r" (py), [pu] "+r" (pu), [pv] "+r" (pv), [dst] "+r" (result)
+	: [end] "m" (max_ptr), [cmask] "m" (*yuv420p_chroma_mask), ZM_SSSE3_YUV_CONSTANTS
+	: ZM_SSSE3_CLOBBERS
+	);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* One row of semi planar 4:2:0 to RGB24, width must be a multiple of 8 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("ssse3")))
+#endif
+static void ssse3_convert_nv12_rgb_row(const uint8_t* py, const uint8_t* puv, uint8_t* result, unsigned int width) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	const uint8_t* const max_ptr = py + width;
+	if(!width)
+		return;
+
+	__asm__ __volatile__ (
+	"movdqa %[c128], %%xmm5\n\t"
+	"pxor %%xmm7, %%xmm7\n\t"
+	"1:\n\t"
+	ZM_SSSE3_LOAD_NV12
+	ZM_SSSE3_YUV_RGB
+	ZM_SSSE3_PACK_RGBX
+	ZM_SSSE3_STORE_RGB
+	"add $0x18, %[dst]\n\t"
+	"cmp %[end], %[py]\n\t"
+	"jb 1b\n\t"
+	: [py] "+r" (py), [puv] "+r" (puv), [dst] "+r" (result)
+	: [end] "m" (max_ptr), [umask] "m" (*nv12_chroma_masks), [vmask] "m" (*(nv12_chroma_masks+16)), ZM_SSSE3_YUV_CONSTANTS
+	: ZM_SSSE3_CLOBBERS
+	);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* One row of semi planar 4:2:0 to RGBA, width must be a multiple of 8 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("ssse3")))
+#endif
+static void ssse3_convert_nv12_rgba_row(const uint8_t* py, const uint8_t* puv, uint8_t* result, unsigned int width) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	const uint8_t* const max_ptr = py + width;
+	if(!width)
+		return;
+
+	__asm__ __volatile__ (
+	"movdqa %[c128], %%xmm5\n\t"
+	"pxor %%xmm7, %%xmm7\n\t"
+	"1:\n\t"
+	ZM_SSSE3_LOAD_NV12
+	ZM_SSSE3_YUV_RGB
+	ZM_SSSE3_PACK_RGBX
+	ZM_SSSE3_STORE_RGBA
+	"add $0x20, %[dst]\n\t"
+	"cmp %[end], %[py]\n\t"
+	"jb 1b\n\t"
+	: [py] "+r" (py), [puv] "+r" (puv), [dst] "+r" (result)
+	: [end] "m" (max_ptr), [umask] "m" (*nv12_chroma_masks), [vmask] "m" (*(nv12_chroma_masks+16)), ZM_SSSE3_YUV_CONSTANTS
+	: ZM_SSSE3_CLOBBERS
+	);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* 16 bit RGB to RGB24, count must be a multiple of 8 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("ssse3")))
+#endif
+static void ssse3_convert_rgb16_rgb(const uint8_t* col1, uint8_t* result, unsigned long count, const rgb16_format* format) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	const uint8_t* const max_ptr = col1 + (count<<1);
+	if(!count)
+		return;
+
+	__asm__ __volatile__ (
+	"pxor %%xmm7, %%xmm7\n\t"
+	"1:\n\t"
+	ZM_SSSE3_LOAD_RGB16
+	ZM_SSSE3_PACK_RGBX
+	ZM_SSSE3_STORE_RGB
+	"add $0x18, %[dst]\n\t"
+	"cmp %[end], %[src]\n\t"
+	"jb 1b\n\t"
+	: [src] "+r" (col1), [dst] "+r" (result)
+	: [end] "m" (max_ptr), [fmt] "r" (format), [rgbmask] "m" (*rgba_rgb_mask)
+	: ZM_SSSE3_CLOBBERS
+	);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* 16 bit RGB to RGBA, count must be a multiple of 8 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("ssse3")))
+#endif
+static void ssse3_convert_rgb16_rgba(const uint8_t* col1, uint8_t* result, unsigned long count, const rgb16_format* format) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	const uint8_t* const max_ptr = col1 + (count<<1);
+	if(!count)
+		return;
+
+	__asm__ __volatile__ (
+	"pxor %%xmm7, %%xmm7\n\t"
+	"1:\n\t"
+	ZM_SSSE3_LOAD_RGB16
+	ZM_SSSE3_PACK_RGBX
+	ZM_SSSE3_STORE_RGBA
+	"add $0x20, %[dst]\n\t"
+	"cmp %[end], %[src]\n\t"
+	"jb 1b\n\t"
+	: [src] "+r" (col1), [dst] "+r" (result)
+	: [end] "m" (max_ptr), [fmt] "r" (format)
+	: ZM_SSSE3_CLOBBERS
+	);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* YUYV to RGB24 SSSE3 */
+void ssse3_convert_yuyv_rgb(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	const unsigned long simd_count = count & ~7UL;
+	ssse3_convert_packed422_rgb(col1, result, simd_count, yuyv_masks);
+	zm_convert_yuyv_rgb(col1+(simd_count<<1), result+(simd_count*3), count-simd_count);
+}
+
+/* YUYV to RGBA SSSE3 */
+void ssse3_convert_yuyv_rgba(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	const unsigned long simd_count = count & ~7UL;
+	ssse3_convert_packed422_rgba(col1, result, simd_count, yuyv_masks);
+	zm_convert_yuyv_rgba(col1+(simd_count<<1), result+(simd_count<<2), count-simd_count);
+}
+
+/* UYVY to RGB24 SSSE3 */
+void ssse3_convert_uyvy_rgb(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	const unsigned long simd_count = count & ~7UL;
+	ssse3_convert_packed422_rgb(col1, result, simd_count, uyvy_masks);
+	zm_convert_uyvy_rgb(col1+(simd_count<<1), result+(simd_count*3), count-simd_count);
+}
+
+/* UYVY to RGBA SSSE3 */
+void ssse3_convert_uyvy_rgba(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	const unsigned long simd_count = count & ~7UL;
+	ssse3_convert_packed422_rgba(col1, result, simd_count, uyvy_masks);
+	zm_convert_uyvy_rgba(col1+(simd_count<<1), result+(simd_count<<2), count-simd_count);
+}
+
+/* RGB555 to RGB24 SSSE3 */
+void ssse3_convert_rgb555_rgb(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	const unsigned long simd_count = count & ~7UL;
+	ssse3_convert_rgb16_rgb(col1, result, simd_count, &rgb555_format);
+	zm_convert_rgb555_rgb(col1+(simd_count<<1), result+(simd_count*3), count-simd_count);
+}
+
+/* RGB555 to RGBA SSSE3 */
+void ssse3_convert_rgb555_rgba(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	const unsigned long simd_count = count & ~7UL;
+	ssse3_convert_rgb16_rgba(col1, result, simd_count, &rgb555_format);
+	zm_convert_rgb555_rgba(col1+(simd_count<<1), result+(simd_count<<2), count-simd_count);
+}
+
+/* RGB565 to RGB24 SSSE3 */
+void ssse3_convert_rgb565_rgb(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	const unsigned long simd_count = count & ~7UL;
+	ssse3_convert_rgb16_rgb(col1, result, simd_count, &rgb565_format);
+	zm_convert_rgb565_rgb(col1+(simd_count<<1), result+(simd_count*3), count-simd_count);
+}
+
+/* RGB565 to RGBA SSSE3 */
+void ssse3_convert_rgb565_rgba(const uint8_t* col1, uint8_t* result, unsigned long count) {
+	const unsigned long simd_count = count & ~7UL;
+	ssse3_convert_rgb16_rgba(col1, result, simd_count, &rgb565_format);
+	zm_convert_rgb565_rgba(col1+(simd_count<<1), result+(simd_count<<2), count-simd_count);
+}
+
+/* YUV420P to RGB24 SSSE3 from separate planes */
+void ssse3_convert_yuv420p_planes_rgb(const uint8_t* py, const uint8_t* pu, const uint8_t* pv, unsigned int y_stride, unsigned int c_stride, uint8_t* result, unsigned int width, unsigned int height) {
+	const unsigned int simd_width = width & ~7U;
+	for(unsigned int j=0; j < height; j++, py += y_stride, result += (width*3)) {
+		const uint8_t* prowu = pu + ((j>>1)*c_stride);
+		const uint8_t* prowv = pv + ((j>>1)*c_stride);
+		ssse3_convert_yuv420p_rgb_row(py, prowu, prowv, result, simd_width);
+		for(unsigned int i=simd_width; i < width; i++) {
+			zm_convert_yuv_rgb_pixel(py[i], prowu[i>>1], prowv[i>>1], result+(i*3));
+		}
+	}
+}
+
+/* YUV420P to RGBA SSSE3 from separate planes */
+void ssse3_convert_yuv420p_planes_rgba(const uint8_t* py, const uint8_t* pu, const uint8_t* pv, unsigned int y_stride, unsigned int c_stride, uint8_t* result, unsigned int width, unsigned int height) {
+	const unsigned int simd_width = width & ~7U;
+	for(unsigned int j=0; j < height; j++, py += y_stride, result += (width<<2)) {
+		const uint8_t* prowu = pu + ((j>>1)*c_stride);
+		const uint8_t* prowv = pv + ((j>>1)*c_stride);
+		ssse3_convert_yuv420p_rgba_row(py, prowu, prowv, result, simd_width);
+		for(unsigned int i=simd_width; i < width; i++) {
+			zm_convert_yuv_rgb_pixel(py[i], prowu[i>>1], prowv[i>>1], result+(i<<2));
+			result[(i<<2)+3] = 0;
+		}
+	}
+}
+
+/* YUV420P to RGB24 SSSE3 */
+void ssse3_convert_yuv420p_rgb(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height) {
+	const unsigned int c_width = (width+1)>>1;
+	const uint8_t* pu = col1 + (width*height);
+	ssse3_convert_yuv420p_planes_rgb(col1, pu, pu + (c_width*((height+1)>>1)), width, c_width, result, width, height);
+}
+
+/* YUV420P to RGBA SSSE3 */
+void ssse3_convert_yuv420p_rgba(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height) {
+	const unsigned int c_width = (width+1)>>1;
+	const uint8_t* pu = col1 + (width*height);
+	ssse3_convert_yuv420p_planes_rgba(col1, pu, pu + (c_width*((height+1)>>1)), width, c_width, result, width, height);
+}
+
+/* NV12 to RGB24 SSSE3 */
+void ssse3_convert_nv12_rgb(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height) {
+	const unsigned int simd_width = width & ~7U;
+	const unsigned int c_stride = ((width+1)>>1)<<1;
+	const uint8_t* puv = col1 + (width*height);
+	for(unsigned int j=0; j < height; j++, col1 += width, result += (width*3)) {
+		const uint8_t* prowuv = puv + ((j>>1)*c_stride);
+		ssse3_convert_nv12_rgb_row(col1, prowuv, result, simd_width);
+		for(unsigned int i=simd_width; i < width; i++) {
+			zm_convert_yuv_rgb_pixel(col1[i], prowuv[(i>>1)<<1], prowuv[((i>>1)<<1)+1], result+(i*3));
+		}
+	}
+}
+
+/* NV12 to RGBA SSSE3 */
+void ssse3_convert_nv12_rgba(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height) {
+	const unsigned int simd_width = width & ~7U;
+	const unsigned int c_stride = ((width+1)>>1)<<1;
+	const uint8_t* puv = col1 + (width*height);
+	for(unsigned int j=0; j < height; j++, col1 += width, result += (width<<2)) {
+		const uint8_t* prowuv = puv + ((j>>1)*c_stride);
+		ssse3_convert_nv12_rgba_row(col1, prowuv, result, simd_width);
+		for(unsigned int i=simd_width; i < width; i++) {
+			zm_convert_yuv_rgb_pixel(col1[i], prowuv[(i>>1)<<1], prowuv[((i>>1)<<1)+1], result+(i<<2));
+		}
+	}
+}
+
+/* Converts a UYVY image into grayscale by extracting the Y channel, 16 pixels at a time */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("ssse3")))
+#endif
+void ssse3_convert_uyvy_gray8(const uint8_t* col1, uint8_t* result, unsigned long count) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	unsigned long blocks = count & ~15UL;
+	
+	if(blocks) {
+		const uint8_t* src = col1;
+		uint8_t* dst = result;
+		const uint8_t* const max_ptr = result + blocks;
+		
+		__asm__ __volatile__ (
+		"1:\n\t"
+		"movdqu (%[src]), %%xmm0\n\t"
+		"movdqu 0x10(%[src]), %%xmm1\n\t"
+		"psrlw $0x8, %%xmm0\n\t"
+		"psrlw $0x8, %%xmm1\n\t"
+		"packuswb %%xmm1, %%xmm0\n\t"
+		"movdqu %%xmm0, (%[dst])\n\t"
+		"add $0x20, %[src]\n\t"
+		"add $0x10, %[dst]\n\t"
+		"cmp %[end], %[dst]\n\t"
+		"jb 1b\n\t"
+		: [src] "+r" (src), [dst] "+r" (dst)
+		: [end] "m" (max_ptr)
+		: "%xmm0", "%xmm1", "cc", "memory"
+		);
+	}
+	
+	/* The pixels past the last whole block */
+	std_convert_uyvy_gray8(col1+(blocks<<1), result+blocks, count & 15);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/************************************************* DEINTERLACE FUNCTIONS *************************************************/
 
-		result[4] = r<0?0:(r>255?255:r);
-		result[5] = g<0?0:(g>255?255:g);
-		result[6] = b<0?0:(b>255?255:b);
-	}
+/* Line functions used by the linear and blend deinterlacers */
+__attribute__((noinline)) void std_deinterlace_linear(const uint8_t* above, const uint8_t* below, uint8_t* result, unsigned long count)
+{
+	const uint8_t* const max_ptr = result + count;
 	
+	while(result < max_ptr) {
+		*result++ = (*above++ + *below++) >> 1;
+	}
 }
 
-/* RGB555 to RGB24 - relocated from zm_local_camera.cpp */
-__attribute__((noinline)) void zm_convert_rgb555_rgb(const uint8_t* col1, uint8_t* result, unsigned long count) {
-	unsigned int r,g,b;  
-	for(unsigned int i=0; i < count; i++, col1 += 2, result += 3) {  
-		b = ((*col1)<<3)&0xf8;
-		g = (((*(col1+1))<<6)|((*col1)>>2))&0xf8;
-		r = ((*(col1+1))<<1)&0xf8;
-		result[0] = r;
-		result[1] = g;
-		result[2] = b;
+__attribute__((noinline)) void std_deinterlace_blend(uint8_t* above, uint8_t* current, unsigned long count)
+{
+	const uint8_t* const max_ptr = current + count;
+	
+	while(current < max_ptr) {
+		*above = (*above + *current) >> 1;
+		*current++ = *above++;
 	}
 }
 
-/* RGB555 to RGBA - modified the one above */
-__attribute__((noinline)) void zm_convert_rgb555_rgba(const uint8_t* col1, uint8_t* result, unsigned long count) {
-	unsigned int r,g,b;  
-	for(unsigned int i=0; i < count; i++, col1 += 2, result += 4) {  
-		b = ((*col1)<<3)&0xf8;
-		g = (((*(col1+1))<<6)|((*col1)>>2))&0xf8;
-		r = ((*(col1+1))<<1)&0xf8;
-		result[0] = r;
-		result[1] = g;
-		result[2] = b;
+__attribute__((noinline)) void std_deinterlace_blend_ratio(uint8_t* above, uint8_t* current, unsigned long count, int divider)
+{
+	const uint8_t* const max_ptr = current + count;
+	uint8_t subpix1, subpix2;
+	
+	while(current < max_ptr) {
+		subpix1 = ((*above - *current)>>divider) + *current;
+		subpix2 = ((*current - *above)>>divider) + *above;
+		*current++ = subpix1;
+		*above++ = subpix2;
 	}
 }
 
-/* RGB565 to RGB24 - relocated from zm_local_camera.cpp */
-__attribute__((noinline)) void zm_convert_rgb565_rgb(const uint8_t* col1, uint8_t* result, unsigned long count) {
-	unsigned int r,g,b;  
-	for(unsigned int i=0; i < count; i++, col1 += 2, result += 3) {  
-		b = ((*col1)<<3)&0xf8;
-		g = (((*(col1+1))<<5)|((*col1)>>3))&0xfc;
-		r = (*(col1+1))&0xf8;
-		result[0] = r;
-		result[1] = g;
-		result[2] = b;
-	}
+/* SSE2 line functions. pavgb rounds up, so the lost bit is taken off again to give the same results as the standard functions */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_deinterlace_linear(const uint8_t* above, const uint8_t* below, uint8_t* result, unsigned long count) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	const uint8_t* const max_ptr = result + (count & ~15);
+	
+	if(result < max_ptr) {
+		__asm__ __volatile__ (
+		"pcmpeqb %%xmm7, %%xmm7\n\t"
+		"psrlw $0xF, %%xmm7\n\t"
+		"packuswb %%xmm7, %%xmm7\n\t"                      // 0x01 in every byte
+		"1:\n\t"
+		"movdqu (%[above]), %%xmm0\n\t"
+		"movdqu (%[below]), %%xmm1\n\t"
+		"movdqa %%xmm0, %%xmm2\n\t"
+		"pxor %%xmm1, %%xmm2\n\t"
+		"pand %%xmm7, %%xmm2\n\t"                          // Bits lost by halving the sum
+		"pavgb %%xmm1, %%xmm0\n\t"
+		"psubb %%xmm2, %%xmm0\n\t"                         // Round down instead of up
+		"movdqu %%xmm0, (%[result])\n\t"
+		"add $0x10, %[above]\n\t"
+		"add $0x10, %[below]\n\t"
+		"add $0x10, %[result]\n\t"
+		"cmp %[end], %[result]\n\t"
+		"jb 1b\n\t"
+		: [above] "+r" (above), [below] "+r" (below), [result] "+r" (result)
+		: [end] "m" (max_ptr)
+		: "%xmm0", "%xmm1", "%xmm2", "%xmm7", "cc", "memory"
+		);
+	}
+	
+	/* Remaining bytes */
+	std_deinterlace_linear(above, below, result, count & 15);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
 }
 
-/* RGB565 to RGBA - modified the one above */
-__attribute__((noinline)) void zm_convert_rgb565_rgba(const uint8_t* col1, uint8_t* result, unsigned long count) {
-	unsigned int r,g,b;  
-	for(unsigned int i=0; i < count; i++, col1 += 2, result += 4) {  
-		b = ((*col1)<<3)&0xf8;
-		g = (((*(col1+1))<<5)|((*col1)>>3))&0xfc;
-		r = (*(col1+1))&0xf8;
-		result[0] = r;
-		result[1] = g;
-		result[2] = b;
-	}
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_deinterlace_blend(uint8_t* above, uint8_t* current, unsigned long count) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	const uint8_t* const max_ptr = current + (count & ~15);
+	
+	if(current < max_ptr) {
+		__asm__ __volatile__ (
+		"pcmpeqb %%xmm7, %%xmm7\n\t"
+		"psrlw $0xF, %%xmm7\n\t"
+		"packuswb %%xmm7, %%xmm7\n\t"                      // 0x01 in every byte
+		"1:\n\t"
+		"movdqu (%[above]), %%xmm0\n\t"
+		"movdqu (%[current]), %%xmm1\n\t"
+		"movdqa %%xmm0, %%xmm2\n\t"
+		"pxor %%xmm1, %%xmm2\n\t"
+		"pand %%xmm7, %%xmm2\n\t"                          // Bits lost by halving the sum
+		"pavgb %%xmm1, %%xmm0\n\t"
+		"psubb %%xmm2, %%xmm0\n\t"                         // Round down instead of up
+		"movdqu %%xmm0, (%[above])\n\t"
+		"movdqu %%xmm0, (%[current])\n\t"
+		"add $0x10, %[above]\n\t"
+		"add $0x10, %[current]\n\t"
+		"cmp %[end], %[current]\n\t"
+		"jb 1b\n\t"
+		: [above] "+r" (above), [current] "+r" (current)
+		: [end] "m" (max_ptr)
+		: "%xmm0", "%xmm1", "%xmm2", "%xmm7", "cc", "memory"
+		);
+	}
+	
+	/* Remaining bytes */
+	std_deinterlace_blend(above, current, count & 15);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
 }
 
-/************************************************* DEINTERLACE FUNCTIONS *************************************************/
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_deinterlace_blend_ratio(uint8_t* above, uint8_t* current, unsigned long count, int divider) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	const uint8_t* const max_ptr = current + (count & ~15);
+	
+	if(current < max_ptr) {
+		/* The differences are shifted as signed words, like the standard function does with ints */
+		__asm__ __volatile__ (
+		"movd %[divider], %%xmm6\n\t"
+		"pxor %%xmm7, %%xmm7\n\t"
+		"1:\n\t"
+		"movdqu (%[above]), %%xmm0\n\t"
+		"movdqu (%[current]), %%xmm1\n\t"
+		"movdqa %%xmm0, %%xmm2\n\t"
+		"movdqa %%xmm1, %%xmm3\n\t"
+		"punpcklbw %%xmm7, %%xmm2\n\t"                     // pabove pixels 0-7
+		"punpcklbw %%xmm7, %%xmm3\n\t"                     // pcurrent pixels 0-7
+		"punpckhbw %%xmm7, %%xmm0\n\t"                     // pabove pixels 8-15
+		"punpckhbw %%xmm7, %%xmm1\n\t"                     // pcurrent pixels 8-15
+		"movdqa %%xmm2, %%xmm4\n\t"
+		"psubw %%xmm3, %%xmm4\n\t"
+		"psraw %%xmm6, %%xmm4\n\t"
+		"paddw %%xmm3, %%xmm4\n\t"                         // New pcurrent pixels 0-7
+		"movdqa %%xmm3, %%xmm5\n\t"
+		"psubw %%xmm2, %%xmm5\n\t"
+		"psraw %%xmm6, %%xmm5\n\t"
+		"paddw %%xmm2, %%xmm5\n\t"                         // New pabove pixels 0-7
+		"movdqa %%xmm0, %%xmm2\n\t"
+		"psubw %%xmm1, %%xmm2\n\t"
+		"psraw %%xmm6, %%xmm2\n\t"
+		"paddw %%xmm1, %%xmm2\n\t"                         // New pcurrent pixels 8-15
+		"movdqa %%xmm1, %%xmm3\n\t"
+		"psubw %%xmm0, %%xmm3\n\t"
+		"psraw %%xmm6, %%xmm3\n\t"
+		"paddw %%xmm0, %%xmm3\n\t"                         // New pabove pixels 8-15
+		"packuswb %%xmm2, %%xmm4\n\t"
+		"packuswb %%xmm3, %%xmm5\n\t"
+		"movdqu %%xmm4, (%[current])\n\t"
+		"movdqu %%xmm5, (%[above])\n\t"
+		"add $0x10, %[above]\n\t"
+		"add $0x10, %[current]\n\t"
+		"cmp %[end], %[current]\n\t"
+		"jb 1b\n\t"
+		: [above] "+r" (above), [current] "+r" (current)
+		: [end] "m" (max_ptr), [divider] "m" (divider)
+		: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7", "cc", "memory"
+		);
+	}
+	
+	/* Remaining bytes */
+	std_deinterlace_blend_ratio(above, current, count & 15, divider);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
 
 /* Grayscale */
 __attribute__((noinline)) void std_deinterlace_4field_gray8(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height)
@@ -4687,6 +5492,253 @@ __attribute__((noinline)) void std_deinterlace_4field_abgr(uint8_t* col1, uint8_
 	}
 }
 
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+/* Shuffle masks gathering one channel of 16 packed 24bit pixels from three registers, red then green then blue */
+__attribute__((aligned(16))) static const uint8_t deinterlace_gather_rgb[144] = {
+		0,3,6,9,12,15,128,128,128,128,128,128,128,128,128,128,
+		128,128,128,128,128,128,2,5,8,11,14,128,128,128,128,128,
+		128,128,128,128,128,128,128,128,128,128,128,1,4,7,10,13,
+		1,4,7,10,13,128,128,128,128,128,128,128,128,128,128,128,
+		128,128,128,128,128,0,3,6,9,12,15,128,128,128,128,128,
+		128,128,128,128,128,128,128,128,128,128,128,2,5,8,11,14,
+		2,5,8,11,14,128,128,128,128,128,128,128,128,128,128,128,
+		128,128,128,128,128,1,4,7,10,13,128,128,128,128,128,128,
+		128,128,128,128,128,128,128,128,128,128,0,3,6,9,12,15};
+__attribute__((aligned(16))) static const uint8_t deinterlace_gather_bgr[144] = {
+		2,5,8,11,14,128,128,128,128,128,128,128,128,128,128,128,
+		128,128,128,128,128,1,4,7,10,13,128,128,128,128,128,128,
+		128,128,128,128,128,128,128,128,128,128,0,3,6,9,12,15,
+		1,4,7,10,13,128,128,128,128,128,128,128,128,128,128,128,
+		128,128,128,128,128,0,3,6,9,12,15,128,128,128,128,128,
+		128,128,128,128,128,128,128,128,128,128,128,2,5,8,11,14,
+		0,3,6,9,12,15,128,128,128,128,128,128,128,128,128,128,
+		128,128,128,128,128,128,2,5,8,11,14,128,128,128,128,128,
+		128,128,128,128,128,128,128,128,128,128,128,1,4,7,10,13};
+/* Shuffle masks spreading a mask of 16 pixels over their 48 bytes */
+__attribute__((aligned(16))) static const uint8_t deinterlace_spread_24[48] = {
+		0,0,0,1,1,1,2,2,2,3,3,3,4,4,4,5,
+		5,5,6,6,6,7,7,7,8,8,8,9,9,9,10,10,
+		10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15};
+
+/* Weighted delta ((2r + 5g + b) >> 3) of 16 packed 24bit pixels, as 16 words */
+static inline void ssse3_deinterlace_delta24(const uint8_t* col1, const uint8_t* col2, const uint8_t* gather, uint16_t* result) {
+	__asm__ __volatile__ (
+	"movdqu (%0), %%xmm0\n\t"
+	"movdqu 0x10(%0), %%xmm1\n\t"
+	"movdqu 0x20(%0), %%xmm2\n\t"
+	"movdqu (%1), %%xmm3\n\t"
+	"movdqu 0x10(%1), %%xmm4\n\t"
+	"movdqu 0x20(%1), %%xmm5\n\t"
+	/* Absolute differences */
+	"movdqa %%xmm0, %%xmm6\n\t"
+	"pmaxub %%xmm3, %%xmm0\n\t"
+	"pminub %%xmm6, %%xmm3\n\t"
+	"psubb %%xmm3, %%xmm0\n\t"
+	"movdqa %%xmm1, %%xmm6\n\t"
+	"pmaxub %%xmm4, %%xmm1\n\t"
+	"pminub %%xmm6, %%xmm4\n\t"
+	"psubb %%xmm4, %%xmm1\n\t"
+	"movdqa %%xmm2, %%xmm6\n\t"
+	"pmaxub %%xmm5, %%xmm2\n\t"
+	"pminub %%xmm6, %%xmm5\n\t"
+	"psubb %%xmm5, %%xmm2\n\t"
+	/* Gather the red differences into xmm3 */
+	"movdqa %%xmm0, %%xmm3\n\t"
+	"pshufb (%2), %%xmm3\n\t"
+	"movdqa %%xmm1, %%xmm6\n\t"
+	"pshufb 0x10(%2), %%xmm6\n\t"
+	"por %%xmm6, %%xmm3\n\t"
+	"movdqa %%xmm2, %%xmm6\n\t"
+	"pshufb 0x20(%2), %%xmm6\n\t"
+	"por %%xmm6, %%xmm3\n\t"
+	/* Gather the green differences into xmm4 */
+	"movdqa %%xmm0, %%xmm4\n\t"
+	"pshufb 0x30(%2), %%xmm4\n\t"
+	"movdqa %%xmm1, %%xmm6\n\t"
+	"pshufb 0x40(%2), %%xmm6\n\t"
+	"por %%xmm6, %%xmm4\n\t"
+	"movdqa %%xmm2, %%xmm6\n\t"
+	"pshufb 0x50(%2), %%xmm6\n\t"
+	"por %%xmm6, %%xmm4\n\t"
+	/* Gather the blue differences into xmm5 */
+	"movdqa %%xmm0, %%xmm5\n\t"
+	"pshufb 0x60(%2), %%xmm5\n\t"
+	"movdqa %%xmm1, %%xmm6\n\t"
+	"pshufb 0x70(%2), %%xmm6\n\t"
+	"por %%xmm6, %%xmm5\n\t"
+	"movdqa %%xmm2, %%xmm6\n\t"
+	"pshufb 0x80(%2), %%xmm6\n\t"
+	"por %%xmm6, %%xmm5\n\t"
+	/* Pixels 0-7 */
+	"pxor %%xmm7, %%xmm7\n\t"
+	"movdqa %%xmm3, %%xmm0\n\t"
+	"punpcklbw %%xmm7, %%xmm0\n\t"
+	"psllw $0x1, %%xmm0\n\t"                           // 2r
+	"movdqa %%xmm4, %%xmm1\n\t"
+	"punpcklbw %%xmm7, %%xmm1\n\t"
+	"movdqa %%xmm1, %%xmm2\n\t"
+	"psllw $0x2, %%xmm2\n\t"
+	"paddw %%xmm2, %%xmm1\n\t"                         // 5g
+	"paddw %%xmm1, %%xmm0\n\t"
+	"movdqa %%xmm5, %%xmm1\n\t"
+	"punpcklbw %%xmm7, %%xmm1\n\t"
+	"paddw %%xmm1, %%xmm0\n\t"                         // + b
+	"psrlw $0x3, %%xmm0\n\t"
+	"movdqa %%xmm0, (%3)\n\t"
+	/* Pixels 8-15 */
+	"punpckhbw %%xmm7, %%xmm3\n\t"
+	"psllw $0x1, %%xmm3\n\t"
+	"punpckhbw %%xmm7, %%xmm4\n\t"
+	"movdqa %%xmm4, %%xmm2\n\t"
+	"psllw $0x2, %%xmm2\n\t"
+	"paddw %%xmm2, %%xmm4\n\t"
+	"paddw %%xmm4, %%xmm3\n\t"
+	"punpckhbw %%xmm7, %%xmm5\n\t"
+	"paddw %%xmm5, %%xmm3\n\t"
+	"psrlw $0x3, %%xmm3\n\t"
+	"movdqa %%xmm3, 0x10(%3)\n\t"
+	:
+	: "r" (col1), "r" (col2), "r" (gather), "r" (result)
+	: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7", "memory"
+	);
+}
+#endif
+
+/* Packed 24bit SSSE3. Unlike the 32bit ones this gives the same results as the standard functions */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("ssse3")))
+#endif
+static void ssse3_deinterlace_4field_packed24(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height, const uint8_t* gather, unsigned int r_index, unsigned int b_index) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	__attribute__((aligned(16))) uint16_t deltas[32];
+	const unsigned long row_width = width*3;
+	const unsigned long block_width = row_width - (row_width % 48);
+	/* The comparison is a signed greater than, so a threshold of 0 becomes -1 and matches everything */
+	const uint32_t threshold_word = ((threshold > 256 ? 256 : threshold) - 1) & 0xFFFF;
+	const uint32_t threshold_mask = threshold_word | (threshold_word << 16);
+	uint8_t *pabove, *pcurrent, *pbelow;
+	const uint8_t *pnabove, *pncurrent;
+	unsigned int r, g, b;
+	unsigned int delta1, delta2;
+	
+	for(unsigned int y = 1; y < height; y += 2) {
+		pabove = col1 + ((y-1) * row_width);
+		pnabove = col2 + ((y-1) * row_width);
+		pcurrent = pabove + row_width;
+		pncurrent = pnabove + row_width;
+		/* The last line has no line below, so the line above is used as it is */
+		pbelow = (y+1) < height ? (pcurrent + row_width) : pabove;
+		
+		for(unsigned long x = 0; x < block_width; x += 48) {
+			ssse3_deinterlace_delta24(pabove+x, pnabove+x, gather, deltas);
+			ssse3_deinterlace_delta24(pcurrent+x, pncurrent+x, gather, deltas+16);
+			
+			__asm__ __volatile__ (
+			"movdqa (%0), %%xmm0\n\t"
+			"paddw 0x20(%0), %%xmm0\n\t"
+			"psrlw $0x1, %%xmm0\n\t"                           // Average delta of pixels 0-7
+			"movdqa 0x10(%0), %%xmm1\n\t"
+			"paddw 0x30(%0), %%xmm1\n\t"
+			"psrlw $0x1, %%xmm1\n\t"                           // Average delta of pixels 8-15
+			"movd %5, %%xmm2\n\t"
+			"pshufd $0x0, %%xmm2, %%xmm2\n\t"
+			"pcmpgtw %%xmm2, %%xmm0\n\t"
+			"pcmpgtw %%xmm2, %%xmm1\n\t"
+			"packsswb %%xmm1, %%xmm0\n\t"                      // Pixels to replace
+			"pcmpeqb %%xmm7, %%xmm7\n\t"
+			"psrlw $0xF, %%xmm7\n\t"
+			"packuswb %%xmm7, %%xmm7\n\t"                      // 0x01 in every byte
+			
+			"movdqa %%xmm0, %%xmm1\n\t"
+			"pshufb (%1), %%xmm1\n\t"
+			"movdqu (%2), %%xmm2\n\t"
+			"movdqu (%3), %%xmm3\n\t"
+			"movdqa %%xmm2, %%xmm4\n\t"
+			"pxor %%xmm3, %%xmm4\n\t"
+			"pand %%xmm7, %%xmm4\n\t"
+			"pavgb %%xmm3, %%xmm2\n\t"
+			"psubb %%xmm4, %%xmm2\n\t"                         // Rounded down average of pabove and pbelow
+			"pand %%xmm1, %%xmm2\n\t"
+			"movdqu (%4), %%xmm5\n\t"
+			"pandn %%xmm5, %%xmm1\n\t"
+			"por %%xmm2, %%xmm1\n\t"
+			"movdqu %%xmm1, (%4)\n\t"
+			
+			"movdqa %%xmm0, %%xmm1\n\t"
+			"pshufb 0x10(%1), %%xmm1\n\t"
+			"movdqu 0x10(%2), %%xmm2\n\t"
+			"movdqu 0x10(%3), %%xmm3\n\t"
+			"movdqa %%xmm2, %%xmm4\n\t"
+			"pxor %%xmm3, %%xmm4\n\t"
+			"pand %%xmm7, %%xmm4\n\t"
+			"pavgb %%xmm3, %%xmm2\n\t"
+			"psubb %%xmm4, %%xmm2\n\t"
+			"pand %%xmm1, %%xmm2\n\t"
+			"movdqu 0x10(%4), %%xmm5\n\t"
+			"pandn %%xmm5, %%xmm1\n\t"
+			"por %%xmm2, %%xmm1\n\t"
+			"movdqu %%xmm1, 0x10(%4)\n\t"
+			
+			"movdqa %%xmm0, %%xmm1\n\t"
+			"pshufb 0x20(%1), %%xmm1\n\t"
+			"movdqu 0x20(%2), %%xmm2\n\t"
+			"movdqu 0x20(%3), %%xmm3\n\t"
+			"movdqa %%xmm2, %%xmm4\n\t"
+			"pxor %%xmm3, %%xmm4\n\t"
+			"pand %%xmm7, %%xmm4\n\t"
+			"pavgb %%xmm3, %%xmm2\n\t"
+			"psubb %%xmm4, %%xmm2\n\t"
+			"pand %%xmm1, %%xmm2\n\t"
+			"movdqu 0x20(%4), %%xmm5\n\t"
+			"pandn %%xmm5, %%xmm1\n\t"
+			"por %%xmm2, %%xmm1\n\t"
+			"movdqu %%xmm1, 0x20(%4)\n\t"
+			:
+			: "r" (deltas), "r" (deinterlace_spread_24), "r" (pabove+x), "r" (pbelow+x), "r" (pcurrent+x), "m" (threshold_mask)
+			: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm7", "memory"
+			);
+		}
+		
+		/* Remaining pixels */
+		for(unsigned long x = block_width; x < row_width; x += 3) {
+			r = abs(pnabove[x+r_index] - pabove[x+r_index]);
+			g = abs(pnabove[x+1] - pabove[x+1]);
+			b = abs(pnabove[x+b_index] - pabove[x+b_index]);
+			delta1 = (r + r + b + g + g + g + g + g)>>3;
+			r = abs(pncurrent[x+r_index] - pcurrent[x+r_index]);
+			g = abs(pncurrent[x+1] - pcurrent[x+1]);
+			b = abs(pncurrent[x+b_index] - pcurrent[x+b_index]);
+			delta2 = (r + r + b + g + g + g + g + g)>>3;
+			if(((delta1 + delta2) >> 1) >= threshold) {
+				pcurrent[x] = (pabove[x] + pbelow[x]) >> 1;
+				pcurrent[x+1] = (pabove[x+1] + pbelow[x+1]) >> 1;
+				pcurrent[x+2] = (pabove[x+2] + pbelow[x+2]) >> 1;
+			}
+		}
+	}
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* RGB SSSE3 */
+void ssse3_deinterlace_4field_rgb(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	ssse3_deinterlace_4field_packed24(col1, col2, threshold, width, height, deinterlace_gather_rgb, 0, 2);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* BGR SSSE3 */
+void ssse3_deinterlace_4field_bgr(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	ssse3_deinterlace_4field_packed24(col1, col2, threshold, width, height, deinterlace_gather_bgr, 2, 0);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
 /* Grayscale SSSE3 */
 #if defined(__i386__) || defined(__x86_64__)
 __attribute__((noinline,__target__("ssse3")))
@@ -5554,3 +6606,387 @@ void ssse3_deinterlace_4field_abgr(uint8_t* col1, uint8_t* col2, unsigned int th
 	Panic("SSE function called on a non x86\\x86-64 platform");
 #endif
 }
+
+/************************************************* TRANSPOSE FUNCTIONS *************************************************/
+
+/* Grayscale 8x8 block */
+void std_transpose8x8_gray8(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride) {
+	zm_transpose_block(src, src_stride, dst, dst_stride, 8, 8, ZM_COLOUR_GRAY8);
+}
+
+/* RGB24 8x8 block */
+void std_transpose8x8_rgb(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride) {
+	zm_transpose_block(src, src_stride, dst, dst_stride, 8, 8, ZM_COLOUR_RGB24);
+}
+
+/* RGB32 8x8 block */
+void std_transpose8x8_rgba(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride) {
+	zm_transpose_block(src, src_stride, dst, dst_stride, 8, 8, ZM_COLOUR_RGB32);
+}
+
+/* Grayscale 8x8 block SSE2, the bytes are interleaved a row, then two rows, then four rows at a time */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_transpose8x8_gray8(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+
+	__asm__ __volatile__ (
+	"movq (%0), %%xmm0\n\t"
+	"add %2, %0\n\t"
+	"movq (%0), %%xmm1\n\t"
+	"add %2, %0\n\t"
+	"movq (%0), %%xmm2\n\t"
+	"add %2, %0\n\t"
+	"movq (%0), %%xmm3\n\t"
+	"add %2, %0\n\t"
+	"movq (%0), %%xmm4\n\t"
+	"add %2, %0\n\t"
+	"movq (%0), %%xmm5\n\t"
+	"add %2, %0\n\t"
+	"movq (%0), %%xmm6\n\t"
+	"add %2, %0\n\t"
+	"movq (%0), %%xmm7\n\t"
+	"punpcklbw %%xmm1, %%xmm0\n\t"
+	"punpcklbw %%xmm3, %%xmm2\n\t"
+	"punpcklbw %%xmm5, %%xmm4\n\t"
+	"punpcklbw %%xmm7, %%xmm6\n\t"
+	"movdqa %%xmm0, %%xmm1\n\t"
+	"punpcklwd %%xmm2, %%xmm0\n\t"
+	"punpckhwd %%xmm2, %%xmm1\n\t"
+	"movdqa %%xmm4, %%xmm5\n\t"
+	"punpcklwd %%xmm6, %%xmm4\n\t"
+	"punpckhwd %%xmm6, %%xmm5\n\t"
+	"movdqa %%xmm0, %%xmm2\n\t"
+	"punpckldq %%xmm4, %%xmm0\n\t"
+	"punpckhdq %%xmm4, %%xmm2\n\t"
+	"movdqa %%xmm1, %%xmm3\n\t"
+	"punpckldq %%xmm5, %%xmm1\n\t"
+	"punpckhdq %%xmm5, %%xmm3\n\t"
+	"movq %%xmm0, (%1)\n\t"
+	"add %3, %1\n\t"
+	"movhps %%xmm0, (%1)\n\t"
+	"add %3, %1\n\t"
+	"movq %%xmm2, (%1)\n\t"
+	"add %3, %1\n\t"
+	"movhps %%xmm2, (%1)\n\t"
+	"add %3, %1\n\t"
+	"movq %%xmm1, (%1)\n\t"
+	"add %3, %1\n\t"
+	"movhps %%xmm1, (%1)\n\t"
+	"add %3, %1\n\t"
+	"movq %%xmm3, (%1)\n\t"
+	"add %3, %1\n\t"
+	"movhps %%xmm3, (%1)\n\t"
+	: "+r" (src), "+r" (dst)
+	: "r" (src_stride), "r" (dst_stride)
+	: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7", "cc", "memory"
+	);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* RGB32 8x8 block SSE2, as four 4x4 blocks of pixels */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_transpose8x8_rgba(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+
+	for(unsigned int i = 0; i < 8; i += 4) {
+		for(unsigned int k = 0; k < 8; k += 4) {
+			const uint8_t* s_ptr = src + (i*src_stride) + (k*4);
+			uint8_t* d_ptr = dst + (k*dst_stride) + (i*4);
+
+			__asm__ __volatile__ (
+			"movdqu (%0), %%xmm0\n\t"
+			"add %2, %0\n\t"
+			"movdqu (%0), %%xmm1\n\t"
+			"add %2, %0\n\t"
+			"movdqu (%0), %%xmm2\n\t"
+			"add %2, %0\n\t"
+			"movdqu (%0), %%xmm3\n\t"
+			"movdqa %%xmm0, %%xmm4\n\t"
+			"punpckldq %%xmm1, %%xmm0\n\t"
+			"punpckhdq %%xmm1, %%xmm4\n\t"
+			"movdqa %%xmm2, %%xmm5\n\t"
+			"punpckldq %%xmm3, %%xmm2\n\t"
+			"punpckhdq %%xmm3, %%xmm5\n\t"
+			"movdqa %%xmm0, %%xmm1\n\t"
+			"punpcklqdq %%xmm2, %%xmm0\n\t"
+			"punpckhqdq %%xmm2, %%xmm1\n\t"
+			"movdqa %%xmm4, %%xmm3\n\t"
+			"punpcklqdq %%xmm5, %%xmm4\n\t"
+			"punpckhqdq %%xmm5, %%xmm3\n\t"
+			"movdqu %%xmm0, (%1)\n\t"
+			"add %3, %1\n\t"
+			"movdqu %%xmm1, (%1)\n\t"
+			"add %3, %1\n\t"
+			"movdqu %%xmm4, (%1)\n\t"
+			"add %3, %1\n\t"
+			"movdqu %%xmm3, (%1)\n\t"
+			: "+r" (s_ptr), "+r" (d_ptr)
+			: "r" (src_stride), "r" (dst_stride)
+			: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "cc", "memory"
+			);
+		}
+	}
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/************************************************* COUNT FUNCTIONS *************************************************/
+
+/* Pixels differing from the pattern in any byte not ignored */
+__attribute__((noinline)) unsigned long std_count_mismatches(const uint8_t* src, unsigned long count, const uint8_t* pattern, const uint8_t* ignore, unsigned int colours) {
+	const uint8_t* const max_ptr = src + count;
+	unsigned long mismatches = 0;
+	
+	while(src < max_ptr) {
+		for(unsigned int i = 0; i < colours; i++) {
+			if((src[i] ^ pattern[i]) & ~ignore[i]) {
+				mismatches++;
+				break;
+			}
+		}
+		src += colours;
+	}
+	return mismatches;
+}
+
+/* SSE2 version, comparing 48 bytes at a time. The pattern and ignore masks must be 16 byte aligned */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+unsigned long sse2_count_mismatches(const uint8_t* src, unsigned long count, const uint8_t* pattern, const uint8_t* ignore, unsigned int colours) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	/* The bit of the first byte of each pixel in the 48 bytes */
+	const uint64_t pixel_bits = (colours == ZM_COLOUR_GRAY8)?0xFFFFFFFFFFFFULL:((colours == ZM_COLOUR_RGB24)?0x249249249249ULL:0x111111111111ULL);
+	const uint8_t* const max_ptr = src + (count - (count % 48));
+	unsigned long mismatches = 0;
+	uint32_t equal0, equal1, equal2;
+	uint64_t differ;
+	
+	while(src < max_ptr) {
+		__asm__ __volatile__ (
+		"movdqu (%3), %%xmm0\n\t"
+		"movdqu 0x10(%3), %%xmm1\n\t"
+		"movdqu 0x20(%3), %%xmm2\n\t"
+		"pcmpeqb (%4), %%xmm0\n\t"
+		"pcmpeqb 0x10(%4), %%xmm1\n\t"
+		"pcmpeqb 0x20(%4), %%xmm2\n\t"
+		"por (%5), %%xmm0\n\t"                            // Ignored bytes count as equal
+		"por 0x10(%5), %%xmm1\n\t"
+		"por 0x20(%5), %%xmm2\n\t"
+		"pmovmskb %%xmm0, %0\n\t"
+		"pmovmskb %%xmm1, %1\n\t"
+		"pmovmskb %%xmm2, %2\n\t"
+		: "=r" (equal0), "=r" (equal1), "=r" (equal2)
+		: "r" (src), "r" (pattern), "r" (ignore)
+		: "%xmm0", "%xmm1", "%xmm2", "memory"
+		);
+		
+		differ = ~((uint64_t)equal0 | ((uint64_t)equal1 << 16) | ((uint64_t)equal2 << 32)) & 0xFFFFFFFFFFFFULL;
+		if(differ) {
+			/* Fold the bytes of each pixel onto its first byte */
+			uint64_t folded = differ;
+			for(unsigned int i = 1; i < colours; i++)
+				folded |= differ >> i;
+			mismatches += __builtin_popcountll(folded & pixel_bits);
+		}
+		src += 48;
+	}
+	
+	/* Remaining pixels */
+	return mismatches + std_count_mismatches(src, count % 48, pattern, ignore, colours);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+	return 0;
+#endif
+}
+
+
+/************************************************* OVERLAY FUNCTIONS *************************************************/
+
+/* Grayscale: copy the bytes of src that aren't black */
+__attribute__((noinline)) void std_overlay8(const uint8_t* src, uint8_t* dest, unsigned long count) {
+	const uint8_t* const max_ptr = src + count;
+	
+	while(src < max_ptr) {
+		if(*src)
+			*dest = *src;
+		src++;
+		dest++;
+	}
+}
+
+/* RGB24: copy the pixels of src that aren't black */
+__attribute__((noinline)) void std_overlay24(const uint8_t* src, uint8_t* dest, unsigned long count) {
+	const uint8_t* const max_ptr = src + (count*3);
+	
+	while(src < max_ptr) {
+		if(src[0] || src[1] || src[2]) {
+			dest[0] = src[0];
+			dest[1] = src[1];
+			dest[2] = src[2];
+		}
+		src += 3;
+		dest += 3;
+	}
+}
+
+/* RGB32: copy the pixels of src with any of the bytes in colour_mask set */
+__attribute__((noinline)) void std_overlay32(const uint8_t* src, uint8_t* dest, unsigned long count, Rgb colour_mask) {
+	const Rgb* psrc = (const Rgb*)src;
+	Rgb* pdest = (Rgb*)dest;
+	const Rgb* const max_ptr = psrc + count;
+	
+	while(psrc < max_ptr) {
+		if(*psrc & colour_mask)
+			*pdest = *psrc;
+		psrc++;
+		pdest++;
+	}
+}
+
+/* Grayscale SSE2 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_overlay8(const uint8_t* src, uint8_t* dest, unsigned long count) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	unsigned long blocks = count & ~15UL;
+	
+	/* Lines of an area need not be aligned */
+	if(blocks) {
+		__asm__ __volatile__ (
+		"pxor %%xmm3, %%xmm3\n\t"
+		"1:\n\t"
+		"movdqu (%0), %%xmm0\n\t"
+		"movdqu (%1), %%xmm1\n\t"
+		"movdqa %%xmm0, %%xmm2\n\t"
+		"pcmpeqb %%xmm3, %%xmm2\n\t"
+		"pand %%xmm2, %%xmm1\n\t"
+		"por %%xmm0, %%xmm1\n\t"
+		"movdqu %%xmm1, (%1)\n\t"
+		"add $0x10, %0\n\t"
+		"add $0x10, %1\n\t"
+		"sub $0x10, %2\n\t"
+		"jnz 1b\n\t"
+		: "+r" (src), "+r" (dest), "+r" (blocks)
+		:
+		: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "cc", "memory"
+		);
+	}
+	
+	std_overlay8(src, dest, count & 15);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+/* RGB32 SSE2 */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_overlay32(const uint8_t* src, uint8_t* dest, unsigned long count, Rgb colour_mask) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	unsigned long blocks = count & ~3UL;
+	
+	if(blocks) {
+		__asm__ __volatile__ (
+		"movd %3, %%xmm3\n\t"
+		"pshufd $0x0, %%xmm3, %%xmm3\n\t"
+		"pxor %%xmm4, %%xmm4\n\t"
+		"1:\n\t"
+		"movdqu (%0), %%xmm0\n\t"
+		"movdqu (%1), %%xmm1\n\t"
+		"movdqa %%xmm0, %%xmm2\n\t"
+		"pand %%xmm3, %%xmm2\n\t"
+		"pcmpeqd %%xmm4, %%xmm2\n\t"
+		"pand %%xmm2, %%xmm1\n\t"
+		"pandn %%xmm0, %%xmm2\n\t"
+		"por %%xmm2, %%xmm1\n\t"
+		"movdqu %%xmm1, (%1)\n\t"
+		"add $0x10, %0\n\t"
+		"add $0x10, %1\n\t"
+		"sub $0x4, %2\n\t"
+		"jnz 1b\n\t"
+		: "+r" (src), "+r" (dest), "+r" (blocks)
+		: "r" (colour_mask)
+		: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "cc", "memory"
+		);
+	}
+	
+	std_overlay32(src, dest, count & 3, colour_mask);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
+
+
+/************************************************* EDGE FUNCTIONS *************************************************/
+
+/* Grayscale: set result to value where a set pixel of current has a clear one left, right, above or below it. current[-1] and current[count] are read */
+__attribute__((noinline)) void std_edges8(const uint8_t* above, const uint8_t* current, const uint8_t* below, uint8_t* result, unsigned long count, uint8_t value) {
+	for(unsigned long i = 0; i < count; i++) {
+		if(current[i] && !(current[i-1] && current[i+1] && above[i] && below[i]))
+			result[i] = value;
+		else
+			result[i] = 0;
+	}
+}
+
+/* Grayscale SSE2: the set pixels less their erosion, 16 at a time */
+#if defined(__i386__) || defined(__x86_64__)
+__attribute__((noinline,__target__("sse2")))
+#endif
+void sse2_edges8(const uint8_t* above, const uint8_t* current, const uint8_t* below, uint8_t* result, unsigned long count, uint8_t value) {
+#if ((defined(__i386__) || defined(__x86_64__) || defined(ZM_KEEP_SSE)) && !defined(ZM_STRIP_SSE))
+	unsigned long blocks = count & ~15UL;
+	uint32_t value4 = value * 0x01010101U;
+	
+	if(blocks) {
+		/* Count up to the ends of the blocks, so one register indexes all the lines */
+		const uint8_t* above_end = above + blocks;
+		const uint8_t* current_end = current + blocks;
+		const uint8_t* below_end = below + blocks;
+		uint8_t* result_end = result + blocks;
+		long index = -(long)blocks;
+		
+		__asm__ __volatile__ (
+		"movd %5, %%xmm6\n\t"
+		"pshufd $0x0, %%xmm6, %%xmm6\n\t"
+		"pxor %%xmm7, %%xmm7\n\t"
+		"1:\n\t"
+		"movdqu (%2,%0), %%xmm0\n\t"
+		"pcmpeqb %%xmm7, %%xmm0\n\t"
+		"movdqu -1(%2,%0), %%xmm1\n\t"
+		"pcmpeqb %%xmm7, %%xmm1\n\t"
+		"movdqu 1(%2,%0), %%xmm2\n\t"
+		"pcmpeqb %%xmm7, %%xmm2\n\t"
+		"por %%xmm2, %%xmm1\n\t"
+		"movdqu (%1,%0), %%xmm2\n\t"
+		"pcmpeqb %%xmm7, %%xmm2\n\t"
+		"por %%xmm2, %%xmm1\n\t"
+		"movdqu (%3,%0), %%xmm2\n\t"
+		"pcmpeqb %%xmm7, %%xmm2\n\t"
+		"por %%xmm2, %%xmm1\n\t"
+		"pandn %%xmm1, %%xmm0\n\t"
+		"pand %%xmm6, %%xmm0\n\t"
+		"movdqu %%xmm0, (%4,%0)\n\t"
+		"add $0x10, %0\n\t"
+		"jnz 1b\n\t"
+		: "+r" (index)
+		: "r" (above_end), "r" (current_end), "r" (below_end), "r" (result_end), "m" (value4)
+		: "%xmm0", "%xmm1", "%xmm2", "%xmm6", "%xmm7", "cc", "memory"
+		);
+	}
+	
+	std_edges8(above+blocks, current+blocks, below+blocks, result+blocks, count & 15, value);
+#else
+	Panic("SSE function called on a non x86\\x86-64 platform");
+#endif
+}
@@ -30,6 +30,7 @@ extern "C"
 #include "zm_box.h"
 #include "zm_poly.h"
 #include "zm_mem_utils.h"
+#include "zm_buffer_pool.h"
 #include "zm_utils.h"
 
 #include <errno.h>
@@ -47,14 +48,32 @@ extern "C"
 typedef void (*blend_fptr_t)(const uint8_t*, const uint8_t*, uint8_t*, unsigned long, double);
 typedef void (*delta_fptr_t)(const uint8_t*, const uint8_t*, uint8_t*, unsigned long);
 typedef void (*convert_fptr_t)(const uint8_t*, uint8_t*, unsigned long);
+typedef void (*planar_convert_fptr_t)(const uint8_t*, uint8_t*, unsigned int, unsigned int);
+typedef void (*planes_convert_fptr_t)(const uint8_t*, const uint8_t*, const uint8_t*, unsigned int, unsigned int, uint8_t*, unsigned int, unsigned int);
+typedef void (*deinterlace_linear_fptr_t)(const uint8_t*, const uint8_t*, uint8_t*, unsigned long);
+typedef void (*deinterlace_blend_fptr_t)(uint8_t*, uint8_t*, unsigned long);
+typedef void (*deinterlace_blend_ratio_fptr_t)(uint8_t*, uint8_t*, unsigned long, int);
 typedef void (*deinterlace_4field_fptr_t)(uint8_t*, uint8_t*, unsigned int, unsigned int, unsigned int);
+typedef unsigned long (*count_mismatches_fptr_t)(const uint8_t*, unsigned long, const uint8_t*, const uint8_t*, unsigned int);
+typedef void (*edges8_fptr_t)(const uint8_t*, const uint8_t*, const uint8_t*, uint8_t*, unsigned long, uint8_t);
+typedef void (*overlay8_fptr_t)(const uint8_t*, uint8_t*, unsigned long);
+typedef void (*overlay32_fptr_t)(const uint8_t*, uint8_t*, unsigned long, Rgb);
+typedef void (*transpose_fptr_t)(const uint8_t*, ptrdiff_t, uint8_t*, ptrdiff_t);
 typedef void* (*imgbufcpy_fptr_t)(void*, const void*, size_t);
 
 extern imgbufcpy_fptr_t fptr_imgbufcpy;
 
-/* Should be called from Image class functions */
+/* Size of the buffer needed to hold an image, including the chroma planes of YUV420P images */
+inline static unsigned int ImageBufferSize(unsigned int p_width, unsigned int p_height, unsigned int p_colours, unsigned int p_subpixelorder) {
+	if(p_subpixelorder == ZM_SUBPIX_ORDER_YUV420P)
+		return (p_width*p_height) + (2*((p_width+1)>>1)*((p_height+1)>>1));
+	
+	return (p_width*p_height)*p_colours;
+}
+
+/* Should be called from Image class functions. Buffers come from, and go back to, the image buffer pool */
 inline static uint8_t* AllocBuffer(size_t p_bufsize) {
-	uint8_t* buffer = (uint8_t*)zm_mallocaligned(16,p_bufsize);
+	uint8_t* buffer = ImageBufferPool::Alloc(p_bufsize);
 	if(buffer == NULL)
 		Fatal("Memory allocation failed: %s",strerror(errno));
 	
@@ -64,7 +83,7 @@ inline static uint8_t* AllocBuffer(size_t p_bufsize) {
 inline static void DumpBuffer(uint8_t* buffer, int buffertype) {
 	if (buffer && buffertype != ZM_BUFTYPE_DONTFREE) {
 		if(buffertype == ZM_BUFTYPE_ZM)
-			zm_freealigned(buffer);
+			ImageBufferPool::Free(buffer);
 		else if(buffertype == ZM_BUFTYPE_MALLOC)
 			free(buffer);
 		else if(buffertype == ZM_BUFTYPE_NEW)
@@ -76,6 +95,9 @@ inline static void DumpBuffer(uint8_t* buffer, int buffertype) {
 }
 
 
+class ImageView;
+class JpegCodec;
+
 //
 // This is image class, and represents a frame captured from a 
 // camera in raw form.
@@ -84,28 +106,6 @@ class Image
 {
 protected:
 
-	struct Edge
-	{
-		int min_y;
-		int max_y;
-		double min_x;
-		double _1_m;
-
-		static int CompareYX( const void *p1, const void *p2 )
-		{
-			const Edge *e1 = (const Edge *)p1, *e2 = (const Edge *)p2;
-			if ( e1->min_y == e2->min_y )
-				return( int(e1->min_x - e2->min_x) );
-			else
-				return( int(e1->min_y - e2->min_y) );
-		}
-		static int CompareX( const void *p1, const void *p2 )
-		{
-			const Edge *e1 = (const Edge *)p1, *e2 = (const Edge *)p2;
-			return( int(e1->min_x - e2->min_x) );
-		}
-	};
-	
 	inline void DumpImgBuffer() {
 		DumpBuffer(buffer,buffertype);
 		buffer = NULL;
@@ -121,6 +121,8 @@ protected:
 		allocation = p_bufsize;
 	}
 
+	void UseTransformBuffer( unsigned int p_width, unsigned int p_height );
+
 public:
 	enum { CHAR_HEIGHT=11, CHAR_WIDTH=6 };
 	enum { LINE_HEIGHT=CHAR_HEIGHT+0 };
@@ -131,9 +133,6 @@ protected:
 	static unsigned char *y_r_table;
 	static unsigned char *y_g_table;
 	static unsigned char *y_b_table;
-	static jpeg_compress_struct *jpg_ccinfo[101];
-	static jpeg_decompress_struct *jpg_dcinfo;
-	static struct zm_error_mgr jpg_err;
 
 protected:
 	unsigned int width;
@@ -150,6 +149,8 @@ protected:
 
 protected:
 	static void Initialise();
+	void WriteJpegRaw( JpegCodec *codec, jpeg_compress_struct *cinfo ) const;
+	void OverlayArea( const Image &image, unsigned int src_x, unsigned int src_y, unsigned int x, unsigned int y, unsigned int area_width, unsigned int area_height );
 
 public:
 	Image();
@@ -168,6 +169,9 @@ public:
 	/* Internal buffer should not be modified from functions outside of this class */
 	inline const uint8_t* Buffer() const { return( buffer ); }
 	inline const uint8_t* Buffer( unsigned int x, unsigned int y= 0 ) const { return( &buffer[colours*((y*width)+x)] ); }
+	/* YUV420P images carry chroma planes after the luma, which is otherwise used as a grayscale image */
+	inline bool IsYUV420P() const { return( subpixelorder == ZM_SUBPIX_ORDER_YUV420P ); }
+	void DropChroma();
 	/* Request writeable buffer */
 	uint8_t* WriteBuffer(const unsigned int p_width, const unsigned int p_height, const unsigned int p_colours, const unsigned int p_subpixelorder);
 	
@@ -184,6 +188,11 @@ public:
 	void Assign( unsigned int p_width, unsigned int p_height, unsigned int p_colours, unsigned int p_subpixelorder, const uint8_t* new_buffer, const size_t buffer_size);
 	void Assign( const Image &image );
 	void AssignDirect( const unsigned int p_width, const unsigned int p_height, const unsigned int p_colours, const unsigned int p_subpixelorder, uint8_t *new_buffer, const size_t buffer_size, const int p_buffertype);
+	void Assign( const ImageView &view );
+	/* Exchange pixels with another image, only copying them if either image holds its buffer */
+	void Swap( Image &image );
+	/* Take the pixels of another image, leaving it empty, or copy them if they can't be taken */
+	void Take( Image &image );
 
 	inline void CopyBuffer( const Image &image )
 	{
@@ -216,7 +225,7 @@ public:
 	bool Crop( unsigned int lo_x, unsigned int lo_y, unsigned int hi_x, unsigned int hi_y );
 	bool Crop( const Box &limits );
 
-	void Overlay( const Image &image );
+	void Overlay( const Image &image, const Box *limits=0 );
 	void Overlay( const Image &image, unsigned int x, unsigned int y );
 	void Blend( const Image &image, int transparency=12 );
 	static Image *Merge( unsigned int n_images, Image *images[] );
@@ -227,22 +236,26 @@ public:
 
 	const Coord centreCoord( const char *text ) const;
 	void Annotate( const char *p_text, const Coord &coord,  const Rgb fg_colour=RGB_WHITE, const Rgb bg_colour=RGB_BLACK );
-	Image *HighlightEdges( Rgb colour, unsigned int p_colours, unsigned int p_subpixelorder, const Box *limits=0 );
+	void HighlightEdges( Rgb colour, unsigned int p_colours, unsigned int p_subpixelorder, Image *high_image, const Box *limits=0 ) const;
 	//Image *HighlightEdges( Rgb colour, const Polygon &polygon );
 	void Timestamp( const char *label, const time_t when, const Coord &coord );
 	void Colourise(const unsigned int p_reqcolours, const unsigned int p_reqsubpixelorder);
 	void DeColourise();
 
 	void Clear() { memset( buffer, 0, size ); }
+	unsigned int CountMismatches( const uint8_t *pixel, const uint8_t *mask, unsigned int limit, unsigned int skip_lo_y=0, unsigned int skip_hi_y=0 ) const;
 	void Fill( Rgb colour, const Box *limits=0 );
 	void Fill( Rgb colour, int density, const Box *limits=0 );
 	void Outline( Rgb colour, const Polygon &polygon );
 	void Fill( Rgb colour, const Polygon &polygon );
 	void Fill( Rgb colour, int density, const Polygon &polygon );
+	void Fill( Rgb colour, const SpanList &spans );
+	void Fill( Rgb colour, int density, const SpanList &spans );
 
 	void Rotate( int angle );
 	void Flip( bool leftright );
 	void Scale( unsigned int factor );
+	void Scale( const ImageView &source, unsigned int factor );
 
 	void Deinterlace_Discard();
 	void Deinterlace_Linear();
@@ -252,6 +265,45 @@ public:
 	
 };
 
+//
+// Looks at the pixels of an image, or of a box within one, without owning
+// or copying them. The lines of a view are stride bytes apart, so a view of
+// part of an image keeps the stride of the whole image. A view of a YUV420P
+// image only covers its luma. Views must not outlive the pixels they look at.
+//
+class ImageView
+{
+protected:
+	const uint8_t *data;
+	unsigned int width;
+	unsigned int height;
+	unsigned int colours;
+	unsigned int subpixelorder;
+	unsigned int stride;
+
+public:
+	inline ImageView() : data( 0 ), width( 0 ), height( 0 ), colours( 0 ), subpixelorder( 0 ), stride( 0 ) { }
+	inline ImageView( const uint8_t *p_data, unsigned int p_width, unsigned int p_height, unsigned int p_colours, unsigned int p_subpixelorder, unsigned int p_stride ) : data( p_data ), width( p_width ), height( p_height ), colours( p_colours ), subpixelorder( p_subpixelorder ), stride( p_stride ) { }
+	explicit inline ImageView( const Image &image ) : data( image.Buffer() ), width( image.Width() ), height( image.Height() ), colours( image.Colours() ), subpixelorder( image.IsYUV420P()?ZM_SUBPIX_ORDER_NONE:image.SubpixelOrder() ), stride( image.Width()*image.Colours() ) { }
+	/* The box must lie within the image */
+	inline ImageView( const Image &image, const Box &limits ) : data( image.Buffer( limits.LoX(), limits.LoY() ) ), width( limits.Width() ), height( limits.Height() ), colours( image.Colours() ), subpixelorder( image.IsYUV420P()?ZM_SUBPIX_ORDER_NONE:image.SubpixelOrder() ), stride( image.Width()*image.Colours() ) { }
+
+	inline unsigned int Width() const { return( width ); }
+	inline unsigned int Height() const { return( height ); }
+	inline unsigned int Colours() const { return( colours ); }
+	inline unsigned int SubpixelOrder() const { return( subpixelorder ); }
+	inline unsigned int Stride() const { return( stride ); }
+	inline unsigned int LineSize() const { return( width*colours ); }
+	inline bool IsContiguous() const { return( stride == width*colours ); }
+
+	inline const uint8_t *Data() const { return( data ); }
+	inline const uint8_t *Line( unsigned int y ) const { return( data + (y*stride) ); }
+	inline const uint8_t *Pixel( unsigned int x, unsigned int y ) const { return( data + (y*stride) + (x*colours) ); }
+
+	/* The box is relative to the view and must lie within it */
+	inline ImageView Sub( const Box &limits ) const { return( ImageView( Pixel( limits.LoX(), limits.LoY() ), limits.Width(), limits.Height(), colours, subpixelorder, stride ) ); }
+};
+
 #endif // ZM_IMAGE_H
 
 /* Blend functions */
@@ -293,6 +345,41 @@ void zm_convert_rgb555_rgb(const uint8_t* col1, uint8_t* result, unsigned long c
 void zm_convert_rgb555_rgba(const uint8_t* col1, uint8_t* result, unsigned long count);
 void zm_convert_rgb565_rgb(const uint8_t* col1, uint8_t* result, unsigned long count);
 void zm_convert_rgb565_rgba(const uint8_t* col1, uint8_t* result, unsigned long count);
+void zm_convert_uyvy_rgb(const uint8_t* col1, uint8_t* result, unsigned long count);
+void zm_convert_uyvy_rgba(const uint8_t* col1, uint8_t* result, unsigned long count);
+void std_convert_uyvy_gray8(const uint8_t* col1, uint8_t* result, unsigned long count);
+void zm_convert_yuv420p_gray8(const uint8_t* col1, uint8_t* result, unsigned long count);
+void ssse3_convert_yuyv_rgb(const uint8_t* col1, uint8_t* result, unsigned long count);
+void ssse3_convert_yuyv_rgba(const uint8_t* col1, uint8_t* result, unsigned long count);
+void ssse3_convert_uyvy_rgb(const uint8_t* col1, uint8_t* result, unsigned long count);
+void ssse3_convert_uyvy_rgba(const uint8_t* col1, uint8_t* result, unsigned long count);
+void ssse3_convert_uyvy_gray8(const uint8_t* col1, uint8_t* result, unsigned long count);
+void ssse3_convert_rgb555_rgb(const uint8_t* col1, uint8_t* result, unsigned long count);
+void ssse3_convert_rgb555_rgba(const uint8_t* col1, uint8_t* result, unsigned long count);
+void ssse3_convert_rgb565_rgb(const uint8_t* col1, uint8_t* result, unsigned long count);
+void ssse3_convert_rgb565_rgba(const uint8_t* col1, uint8_t* result, unsigned long count);
+void zm_convert_yuv420p_rgb(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height);
+void zm_convert_yuv420p_rgba(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height);
+void zm_convert_nv12_rgb(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height);
+void zm_convert_nv12_rgba(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height);
+void ssse3_convert_yuv420p_rgb(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height);
+void ssse3_convert_yuv420p_rgba(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height);
+void zm_convert_yuv420p_planes_rgb(const uint8_t* py, const uint8_t* pu, const uint8_t* pv, unsigned int y_stride, unsigned int c_stride, uint8_t* result, unsigned int width, unsigned int height);
+void zm_convert_yuv420p_planes_rgba(const uint8_t* py, const uint8_t* pu, const uint8_t* pv, unsigned int y_stride, unsigned int c_stride, uint8_t* result, unsigned int width, unsigned int height);
+void ssse3_convert_yuv420p_planes_rgb(const uint8_t* py, const uint8_t* pu, const uint8_t* pv, unsigned int y_stride, unsigned int c_stride, uint8_t* result, unsigned int width, unsigned int height);
+void ssse3_convert_yuv420p_planes_rgba(const uint8_t* py, const uint8_t* pu, const uint8_t* pv, unsigned int y_stride, unsigned int c_stride, uint8_t* result, unsigned int width, unsigned int height);
+void ssse3_convert_nv12_rgb(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height);
+void ssse3_convert_nv12_rgba(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height);
+void zm_convert_yuyv_yuv420p(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height);
+void zm_convert_uyvy_yuv420p(const uint8_t* col1, uint8_t* result, unsigned int width, unsigned int height);
+
+/* Deinterlace line functions */
+void std_deinterlace_linear(const uint8_t* above, const uint8_t* below, uint8_t* result, unsigned long count);
+void std_deinterlace_blend(uint8_t* above, uint8_t* current, unsigned long count);
+void std_deinterlace_blend_ratio(uint8_t* above, uint8_t* current, unsigned long count, int divider);
+void sse2_deinterlace_linear(const uint8_t* above, const uint8_t* below, uint8_t* result, unsigned long count);
+void sse2_deinterlace_blend(uint8_t* above, uint8_t* current, unsigned long count);
+void sse2_deinterlace_blend_ratio(uint8_t* above, uint8_t* current, unsigned long count, int divider);
 
 /* Deinterlace_4Field functions */
 void std_deinterlace_4field_gray8(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
@@ -302,8 +389,32 @@ void std_deinterlace_4field_rgba(uint8_t* col1, uint8_t* col2, unsigned int thre
 void std_deinterlace_4field_bgra(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
 void std_deinterlace_4field_argb(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
 void std_deinterlace_4field_abgr(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
+void ssse3_deinterlace_4field_rgb(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
+void ssse3_deinterlace_4field_bgr(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
 void ssse3_deinterlace_4field_gray8(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
 void ssse3_deinterlace_4field_rgba(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
 void ssse3_deinterlace_4field_bgra(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
 void ssse3_deinterlace_4field_argb(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
 void ssse3_deinterlace_4field_abgr(uint8_t* col1, uint8_t* col2, unsigned int threshold, unsigned int width, unsigned int height);
+
+/* Pixel count functions */
+unsigned long std_count_mismatches(const uint8_t* src, unsigned long count, const uint8_t* pattern, const uint8_t* ignore, unsigned int colours);
+unsigned long sse2_count_mismatches(const uint8_t* src, unsigned long count, const uint8_t* pattern, const uint8_t* ignore, unsigned int colours);
+
+/* Edge functions */
+void std_edges8(const uint8_t* above, const uint8_t* current, const uint8_t* below, uint8_t* result, unsigned long count, uint8_t value);
+void sse2_edges8(const uint8_t* above, const uint8_t* current, const uint8_t* below, uint8_t* result, unsigned long count, uint8_t value);
+
+/* Overlay functions */
+void std_overlay8(const uint8_t* src, uint8_t* dest, unsigned long count);
+void std_overlay24(const uint8_t* src, uint8_t* dest, unsigned long count);
+void std_overlay32(const uint8_t* src, uint8_t* dest, unsigned long count, Rgb colour_mask);
+void sse2_overlay8(const uint8_t* src, uint8_t* dest, unsigned long count);
+void sse2_overlay32(const uint8_t* src, uint8_t* dest, unsigned long count, Rgb colour_mask);
+
+/* Transpose functions */
+void std_transpose8x8_gray8(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride);
+void std_transpose8x8_rgb(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride);
+void std_transpose8x8_rgba(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride);
+void sse2_transpose8x8_gray8(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride);
+void sse2_transpose8x8_rgba(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride);
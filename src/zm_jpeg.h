@@ -17,6 +17,9 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */  
 
+#ifndef ZM_JPEG_H
+#define ZM_JPEG_H
+
 #include <setjmp.h>
 
 #include "jinclude.h"
@@ -47,3 +50,5 @@ void zm_jpeg_mem_dest(j_compress_ptr cinfo, JOCTET *outbuffer, int *outbuffer_si
 
 void zm_use_std_huff_tables( j_decompress_ptr cinfo );
 }
+
+#endif // ZM_JPEG_H
@@ -0,0 +1,201 @@
+//
+// ZoneMinder Per-Thread JPEG Codec Implementation, $Date$, $Revision$
+// Copyright (C) 2001-2008 Philip Coombes
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#include "zm.h"
+#include "zm_jpeg_codec.h"
+
+#include <string.h>
+
+pthread_key_t JpegCodec::smKey;
+pthread_once_t JpegCodec::smKeyOnce = PTHREAD_ONCE_INIT;
+
+void JpegCodec::makeKey()
+{
+	int result = pthread_key_create( &smKey, JpegCodec::destroy );
+	if ( result != 0 )
+	{
+		Fatal( "Unable to create JPEG codec thread key: %s", strerror(result) );
+	}
+}
+
+void JpegCodec::destroy( void *codec )
+{
+	delete (JpegCodec *)codec;
+}
+
+JpegCodec *JpegCodec::threadCodec()
+{
+	pthread_once( &smKeyOnce, JpegCodec::makeKey );
+
+	JpegCodec *codec = (JpegCodec *)pthread_getspecific( smKey );
+	if ( !codec )
+	{
+		codec = new JpegCodec();
+		pthread_setspecific( smKey, codec );
+	}
+	return( codec );
+}
+
+JpegCodec::JpegCodec()
+{
+	memset( mCompressors, 0, sizeof(mCompressors) );
+	mDecompressor = 0;
+	mScratch = 0;
+	mScratchSize = 0;
+
+	jpeg_std_error( &mErr.pub );
+	mErr.pub.error_exit = zm_jpeg_error_exit;
+	mErr.pub.emit_message = zm_jpeg_emit_message;
+
+	mDctMethod = config.jpeg_fast_dct?JDCT_IFAST:JDCT_ISLOW;
+	mFastUpsampling = config.jpeg_fast_upsampling;
+	mFastDownsampling = config.jpeg_fast_downsampling;
+#if JPEG_LIB_VERSION < 70
+	if ( mFastDownsampling )
+	{
+		Warning( "libjpeg version 7 or later is required for fast downsampling, ignoring" );
+		mFastDownsampling = false;
+	}
+#endif
+	Debug( 3, "Created JPEG codec, dct method %d, fast upsampling %d, fast downsampling %d", mDctMethod, mFastUpsampling, mFastDownsampling );
+}
+
+JpegCodec::~JpegCodec()
+{
+	for ( int i = 0; i < CS_MAX; i++ )
+	{
+		for ( int j = 0; j <= MAX_QUALITY; j++ )
+		{
+			if ( mCompressors[i][j] )
+			{
+				jpeg_destroy_compress( mCompressors[i][j] );
+				delete mCompressors[i][j];
+			}
+		}
+	}
+	if ( mDecompressor )
+	{
+		jpeg_destroy_decompress( mDecompressor );
+		delete mDecompressor;
+	}
+	delete[] mScratch;
+}
+
+int JpegCodec::colourSpaceIndex( J_COLOR_SPACE colour_space )
+{
+	switch( colour_space )
+	{
+		case JCS_GRAYSCALE :
+			return( CS_GRAY8 );
+		case JCS_RGB :
+			return( CS_RGB );
+		case JCS_YCbCr :
+			return( CS_YCC );
+#ifdef JCS_EXTENSIONS
+		case JCS_EXT_BGR :
+			return( CS_BGR );
+		case JCS_EXT_RGBX :
+			return( CS_RGBX );
+		case JCS_EXT_BGRX :
+			return( CS_BGRX );
+		case JCS_EXT_XRGB :
+			return( CS_XRGB );
+		case JCS_EXT_XBGR :
+			return( CS_XBGR );
+#endif
+		default :
+			return( -1 );
+	}
+}
+
+jpeg_compress_struct *JpegCodec::getCompressor( J_COLOR_SPACE colour_space, int components, int quality )
+{
+	int cs_index = colourSpaceIndex( colour_space );
+	if ( cs_index < 0 )
+	{
+		Error( "Unsupported JPEG input colour space %d", colour_space );
+		return( 0 );
+	}
+	if ( quality < 1 )
+		quality = 1;
+	else if ( quality > MAX_QUALITY )
+		quality = MAX_QUALITY;
+
+	jpeg_compress_struct *cinfo = mCompressors[cs_index][quality];
+	if ( !cinfo )
+	{
+		cinfo = mCompressors[cs_index][quality] = new jpeg_compress_struct;
+		cinfo->err = &mErr.pub;
+		jpeg_create_compress( cinfo );
+
+		// The defaults depend on the input colour space so can only be set
+		// once it is known, after that they survive between images.
+		cinfo->in_color_space = colour_space;
+		cinfo->input_components = components;
+		jpeg_set_defaults( cinfo );
+		jpeg_set_quality( cinfo, quality, false );
+		cinfo->dct_method = mDctMethod;
+#if JPEG_LIB_VERSION >= 70
+		cinfo->do_fancy_downsampling = mFastDownsampling?FALSE:TRUE;
+#endif
+		if ( colour_space == JCS_YCbCr )
+		{
+			// Already subsampled planar input, skip colour conversion and downsampling
+			cinfo->raw_data_in = TRUE;
+			cinfo->comp_info[0].h_samp_factor = 2;
+			cinfo->comp_info[0].v_samp_factor = 2;
+			cinfo->comp_info[1].h_samp_factor = 1;
+			cinfo->comp_info[1].v_samp_factor = 1;
+			cinfo->comp_info[2].h_samp_factor = 1;
+			cinfo->comp_info[2].v_samp_factor = 1;
+		}
+		Debug( 4, "Created JPEG compressor for colour space %d, quality %d", colour_space, quality );
+	}
+	return( cinfo );
+}
+
+jpeg_decompress_struct *JpegCodec::getDecompressor()
+{
+	if ( !mDecompressor )
+	{
+		mDecompressor = new jpeg_decompress_struct;
+		mDecompressor->err = &mErr.pub;
+		jpeg_create_decompress( mDecompressor );
+	}
+	return( mDecompressor );
+}
+
+// Must be called after jpeg_read_header as that resets the decompression parameters
+void JpegCodec::setDecompressOptions( jpeg_decompress_struct *cinfo ) const
+{
+	cinfo->dct_method = mDctMethod;
+	if ( mFastUpsampling )
+		cinfo->do_fancy_upsampling = FALSE;
+}
+
+uint8_t *JpegCodec::getScratch( size_t size )
+{
+	if ( size > mScratchSize )
+	{
+		delete[] mScratch;
+		mScratch = new uint8_t[size];
+		mScratchSize = size;
+	}
+	return( mScratch );
+}
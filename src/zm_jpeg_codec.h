@@ -0,0 +1,86 @@
+//
+// ZoneMinder Per-Thread JPEG Codec Interface, $Date$, $Revision$
+// Copyright (C) 2001-2008 Philip Coombes
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef ZM_JPEG_CODEC_H
+#define ZM_JPEG_CODEC_H
+
+#include "zm.h"
+extern "C"
+{
+#include "zm_jpeg.h"
+}
+
+#include <pthread.h>
+
+//
+// Holds the libjpeg compress and decompress objects used by one thread.
+// libjpeg objects and the setjmp based error manager cannot be shared
+// between threads, so each thread that encodes or decodes images gets
+// its own codec, created on first use and destroyed when the thread exits.
+//
+// Compressors are kept 'warm', one per input colour space and quality,
+// so the defaults and quantisation tables are only set up once.
+//
+class JpegCodec
+{
+public:
+	enum { MAX_QUALITY=100 };
+	enum { CS_GRAY8, CS_RGB, CS_BGR, CS_RGBX, CS_BGRX, CS_XRGB, CS_XBGR, CS_YCC, CS_MAX };
+
+private:
+	static pthread_key_t smKey;
+	static pthread_once_t smKeyOnce;
+
+	struct zm_error_mgr mErr;
+	jpeg_compress_struct *mCompressors[CS_MAX][MAX_QUALITY+1];
+	jpeg_decompress_struct *mDecompressor;
+
+	uint8_t *mScratch;
+	size_t mScratchSize;
+
+	J_DCT_METHOD mDctMethod;
+	bool mFastUpsampling;
+	bool mFastDownsampling;
+
+private:
+	static void makeKey();
+	static void destroy( void *codec );
+	static int colourSpaceIndex( J_COLOR_SPACE colour_space );
+
+	JpegCodec();
+	JpegCodec( const JpegCodec & );
+
+public:
+	~JpegCodec();
+
+	static JpegCodec *threadCodec();
+
+	// Callers must setjmp() on this before using any of the objects below
+	inline struct zm_error_mgr *errorMgr() { return( &mErr ); }
+
+	// A JCS_YCbCr compressor takes raw 4:2:0 planes via jpeg_write_raw_data
+	jpeg_compress_struct *getCompressor( J_COLOR_SPACE colour_space, int components, int quality );
+	jpeg_decompress_struct *getDecompressor();
+	void setDecompressOptions( jpeg_decompress_struct *cinfo ) const;
+
+	// A buffer of at least size bytes for the caller's own use, kept until the next call
+	uint8_t *getScratch( size_t size );
+};
+
+#endif // ZM_JPEG_CODEC_H
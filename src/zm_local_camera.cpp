@@ -256,9 +256,9 @@ static PixelFormat getFfPixFormatFromV4lPalette( int v4l_version, int palette )
 #if ZM_HAS_V4L2
 static char palette_desc[32];
 /* Automatic format selection prefered formats */
-static const uint32_t prefered_rgb32_formats[] = {V4L2_PIX_FMT_BGR32, V4L2_PIX_FMT_RGB32, V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_JPEG, V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUV422P, V4L2_PIX_FMT_YUV420};
-static const uint32_t prefered_rgb24_formats[] = {V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_JPEG, V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUV422P, V4L2_PIX_FMT_YUV420};
-static const uint32_t prefered_gray8_formats[] = {V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_JPEG, V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUV422P, V4L2_PIX_FMT_YUV420};
+static const uint32_t prefered_rgb32_formats[] = {V4L2_PIX_FMT_BGR32, V4L2_PIX_FMT_RGB32, V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_JPEG, V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUV422P, V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12};
+static const uint32_t prefered_rgb24_formats[] = {V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_JPEG, V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUV422P, V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12};
+static const uint32_t prefered_gray8_formats[] = {V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_JPEG, V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUV422P, V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12};
 #endif
 
 
@@ -272,6 +272,7 @@ int LocalCamera::vid_fd = -1;
 int LocalCamera::v4l_version = 0;
 #if ZM_HAS_V4L2
 LocalCamera::V4L2Data LocalCamera::v4l2_data;
+LocalCaptureThread *LocalCamera::capture_thread = NULL;
 #endif // ZM_HAS_V4L2
 #if ZM_HAS_V4L1
 LocalCamera::V4L1Data LocalCamera::v4l1_data;
@@ -290,7 +291,11 @@ LocalCamera::LocalCamera( int p_id, const std::string &p_device, int p_channel,
     standard( p_standard ),
     palette( p_palette ),
     channel_index( 0 ),
-    extras ( p_extras )
+    extras ( p_extras ),
+    planar_conversion_fptr( NULL ),
+    ring_buffers( NULL ),
+    ring_count( 0 ),
+    ring_next( 0 )
 {
     // If we are the first, or only, input on this device then
     // do the initial opening etc
@@ -376,6 +381,9 @@ LocalCamera::LocalCamera( int p_id, const std::string &p_device, int p_channel,
 	/* V4L2 format matching */
 #if ZM_HAS_V4L2
 	if ( v4l_version == 2 ) {
+		/* Grayscale monitors can keep the colour of YUV sources, for the benefit of the JPEG encoder */
+		bool yuv420 = config.yuv420_image_buffer && colours == ZM_COLOUR_GRAY8 && !(width&1) && !(height&1) && (ImageBufferSize(width, height, colours, ZM_SUBPIX_ORDER_YUV420P) % 16) == 0;
+		
 		/* Try to find a match for the selected palette and target colourspace */
 		
 		/* RGB32 palette and 32bit target colourspace */
@@ -402,43 +410,61 @@ LocalCamera::LocalCamera( int p_id, const std::string &p_device, int p_channel,
 		} else if(palette == V4L2_PIX_FMT_GREY && colours == ZM_COLOUR_GRAY8) {
 			conversion_type = 0;
 			subpixelorder = ZM_SUBPIX_ORDER_NONE;
+			
+		/* YUV420 palette and grayscale target colourspace, keeping the chroma planes */
+		} else if(palette == V4L2_PIX_FMT_YUV420 && yuv420) {
+			conversion_type = 0;
+			subpixelorder = ZM_SUBPIX_ORDER_YUV420P;
+			
+		/* YUYV/UYVY palette and grayscale target colourspace, repacked to keep the chroma */
+		} else if((palette == V4L2_PIX_FMT_YUYV || palette == V4L2_PIX_FMT_UYVY) && yuv420) {
+			conversion_type = 4;
+			subpixelorder = ZM_SUBPIX_ORDER_YUV420P;
+			if(palette == V4L2_PIX_FMT_YUYV) {
+				planar_conversion_fptr = &zm_convert_yuyv_yuv420p;
+			} else {
+				planar_conversion_fptr = &zm_convert_uyvy_yuv420p;
+			}
+			Debug(2,"Using ZM packed YUV->YUV420P conversion");
 		/* Unable to find a solution for the selected palette and target colourspace. Conversion required. Notify the user of performance penalty */
 		} else {
 			if( capture )
 				Info("No direct match for the selected palette and target colorspace. Format conversion is required, performance penalty expected");
-#if HAVE_LIBSWSCALE
-			/* Try using swscale for the conversion */
-			conversion_type = 1; 
-			Debug(2,"Using swscale for image conversion");
-			if(colours == ZM_COLOUR_RGB32) {
-				subpixelorder = ZM_SUBPIX_ORDER_RGBA;
-				imagePixFormat = PIX_FMT_RGBA;
-			} else if(colours == ZM_COLOUR_RGB24) {
-				subpixelorder = ZM_SUBPIX_ORDER_RGB;
-				imagePixFormat = PIX_FMT_RGB24;
-			} else if(colours == ZM_COLOUR_GRAY8) {
-				subpixelorder = ZM_SUBPIX_ORDER_NONE;
-				imagePixFormat = PIX_FMT_GRAY8;
+			/* Our own conversions are a lot faster than swscale's, only use it for what they can't do */
+			if(palette == V4L2_PIX_FMT_YUYV || palette == V4L2_PIX_FMT_UYVY || palette == V4L2_PIX_FMT_YUV420 || palette == V4L2_PIX_FMT_NV12 ||
+			  ((palette == V4L2_PIX_FMT_RGB555 || palette == V4L2_PIX_FMT_RGB565) && colours != ZM_COLOUR_GRAY8)) {
+				conversion_type = 2;
 			} else {
-				Panic("Unexpected colours: %d",colours);
-			}
-			if( capture ) {
-				if(!sws_isSupportedInput(capturePixFormat)) {
-					Error("swscale does not support the used capture format: %c%c%c%c",(capturePixFormat)&0xff,((capturePixFormat>>8)&0xff),((capturePixFormat>>16)&0xff),((capturePixFormat>>24)&0xff));
-					conversion_type = 2; /* Try ZM format conversions */
+#if HAVE_LIBSWSCALE
+				/* Try using swscale for the conversion */
+				conversion_type = 1; 
+				Debug(2,"Using swscale for image conversion");
+				if(colours == ZM_COLOUR_RGB32) {
+					subpixelorder = ZM_SUBPIX_ORDER_RGBA;
+					imagePixFormat = PIX_FMT_RGBA;
+				} else if(colours == ZM_COLOUR_RGB24) {
+					subpixelorder = ZM_SUBPIX_ORDER_RGB;
+					imagePixFormat = PIX_FMT_RGB24;
+				} else if(colours == ZM_COLOUR_GRAY8) {
+					subpixelorder = ZM_SUBPIX_ORDER_NONE;
+					imagePixFormat = PIX_FMT_GRAY8;
+				} else {
+					Panic("Unexpected colours: %d",colours);
 				}
-				if(!sws_isSupportedOutput(imagePixFormat)) {
-					Error("swscale does not support the target format: %c%c%c%c",(imagePixFormat)&0xff,((imagePixFormat>>8)&0xff),((imagePixFormat>>16)&0xff),((imagePixFormat>>24)&0xff));
-					conversion_type = 2; /* Try ZM format conversions */
+				if( capture ) {
+					if(!sws_isSupportedInput(capturePixFormat)) {
+						Error("swscale does not support the used capture format: %c%c%c%c",(capturePixFormat)&0xff,((capturePixFormat>>8)&0xff),((capturePixFormat>>16)&0xff),((capturePixFormat>>24)&0xff));
+						conversion_type = 2; /* Try ZM format conversions */
+					}
+					if(!sws_isSupportedOutput(imagePixFormat)) {
+						Error("swscale does not support the target format: %c%c%c%c",(imagePixFormat)&0xff,((imagePixFormat>>8)&0xff),((imagePixFormat>>16)&0xff),((imagePixFormat>>24)&0xff));
+						conversion_type = 2; /* Try ZM format conversions */
+					}
 				}
-			}
 #else
-			/* Don't have swscale, see what we can do */
-			conversion_type = 2;
-#endif
-			/* Our YUYV->Grayscale conversion is a lot faster than swscale's */
-			if(colours == ZM_COLOUR_GRAY8 && palette == V4L2_PIX_FMT_YUYV) {
+				/* Don't have swscale, see what we can do */
 				conversion_type = 2;
+#endif
 			}
 			
 			/* JPEG */
@@ -449,6 +475,9 @@ LocalCamera::LocalCamera( int p_id, const std::string &p_device, int p_channel,
 			
 			if(conversion_type == 2) {
 				Debug(2,"Using ZM for image conversion");
+				const bool use_ssse3 = config.cpu_extensions && sseversion >= 35;
+				if(use_ssse3)
+					Debug(2,"Using SSSE3 format conversion where available");
 				if(palette == V4L2_PIX_FMT_RGB32 && colours == ZM_COLOUR_GRAY8) {
 					conversion_fptr = &std_convert_argb_gray8;
 					subpixelorder = ZM_SUBPIX_ORDER_NONE;
@@ -457,7 +486,7 @@ LocalCamera::LocalCamera( int p_id, const std::string &p_device, int p_channel,
 					subpixelorder = ZM_SUBPIX_ORDER_NONE;
 				} else if(palette == V4L2_PIX_FMT_YUYV && colours == ZM_COLOUR_GRAY8) {
 					/* Fast YUYV->Grayscale conversion by extracting the Y channel */
-					if(config.cpu_extensions && sseversion >= 35) {
+					if(use_ssse3) {
 						conversion_fptr = &ssse3_convert_yuyv_gray8;
 						Debug(2,"Using SSSE3 YUYV->grayscale fast conversion");
 					} else {
@@ -465,23 +494,53 @@ LocalCamera::LocalCamera( int p_id, const std::string &p_device, int p_channel,
 						Debug(2,"Using standard YUYV->grayscale fast conversion");
 					}
 					subpixelorder = ZM_SUBPIX_ORDER_NONE;
+				} else if(palette == V4L2_PIX_FMT_UYVY && colours == ZM_COLOUR_GRAY8) {
+					conversion_fptr = use_ssse3?&ssse3_convert_uyvy_gray8:&std_convert_uyvy_gray8;
+					subpixelorder = ZM_SUBPIX_ORDER_NONE;
+				} else if((palette == V4L2_PIX_FMT_YUV420 || palette == V4L2_PIX_FMT_NV12) && colours == ZM_COLOUR_GRAY8) {
+					/* The Y plane comes first and is already a grayscale image */
+					conversion_fptr = &zm_convert_yuv420p_gray8;
+					subpixelorder = ZM_SUBPIX_ORDER_NONE;
 				} else if(palette == V4L2_PIX_FMT_YUYV && colours == ZM_COLOUR_RGB24) {
-					conversion_fptr = &zm_convert_yuyv_rgb;
+					conversion_fptr = use_ssse3?&ssse3_convert_yuyv_rgb:&zm_convert_yuyv_rgb;
 					subpixelorder = ZM_SUBPIX_ORDER_RGB;
 				} else if(palette == V4L2_PIX_FMT_YUYV && colours == ZM_COLOUR_RGB32) {
-					conversion_fptr = &zm_convert_yuyv_rgba;
+					conversion_fptr = use_ssse3?&ssse3_convert_yuyv_rgba:&zm_convert_yuyv_rgba;
+					subpixelorder = ZM_SUBPIX_ORDER_RGBA;
+				} else if(palette == V4L2_PIX_FMT_UYVY && colours == ZM_COLOUR_RGB24) {
+					conversion_fptr = use_ssse3?&ssse3_convert_uyvy_rgb:&zm_convert_uyvy_rgb;
+					subpixelorder = ZM_SUBPIX_ORDER_RGB;
+				} else if(palette == V4L2_PIX_FMT_UYVY && colours == ZM_COLOUR_RGB32) {
+					conversion_fptr = use_ssse3?&ssse3_convert_uyvy_rgba:&zm_convert_uyvy_rgba;
 					subpixelorder = ZM_SUBPIX_ORDER_RGBA;
 				} else if(palette == V4L2_PIX_FMT_RGB555 && colours == ZM_COLOUR_RGB24) {
-					conversion_fptr = &zm_convert_rgb555_rgb;
+					conversion_fptr = use_ssse3?&ssse3_convert_rgb555_rgb:&zm_convert_rgb555_rgb;
 					subpixelorder = ZM_SUBPIX_ORDER_RGB;
 				} else if(palette == V4L2_PIX_FMT_RGB555 && colours == ZM_COLOUR_RGB32) {
-					conversion_fptr = &zm_convert_rgb555_rgba;
+					conversion_fptr = use_ssse3?&ssse3_convert_rgb555_rgba:&zm_convert_rgb555_rgba;
 					subpixelorder = ZM_SUBPIX_ORDER_RGBA;
 				} else if(palette == V4L2_PIX_FMT_RGB565 && colours == ZM_COLOUR_RGB24) {
-					conversion_fptr = &zm_convert_rgb565_rgb;
+					conversion_fptr = use_ssse3?&ssse3_convert_rgb565_rgb:&zm_convert_rgb565_rgb;
 					subpixelorder = ZM_SUBPIX_ORDER_RGB;
 				} else if(palette == V4L2_PIX_FMT_RGB565 && colours == ZM_COLOUR_RGB32) {
-					conversion_fptr = &zm_convert_rgb565_rgba;
+					conversion_fptr = use_ssse3?&ssse3_convert_rgb565_rgba:&zm_convert_rgb565_rgba;
+					subpixelorder = ZM_SUBPIX_ORDER_RGBA;
+				/* The planar formats need the image dimensions */
+				} else if(palette == V4L2_PIX_FMT_YUV420 && colours == ZM_COLOUR_RGB24) {
+					conversion_type = 4;
+					planar_conversion_fptr = use_ssse3?&ssse3_convert_yuv420p_rgb:&zm_convert_yuv420p_rgb;
+					subpixelorder = ZM_SUBPIX_ORDER_RGB;
+				} else if(palette == V4L2_PIX_FMT_YUV420 && colours == ZM_COLOUR_RGB32) {
+					conversion_type = 4;
+					planar_conversion_fptr = use_ssse3?&ssse3_convert_yuv420p_rgba:&zm_convert_yuv420p_rgba;
+					subpixelorder = ZM_SUBPIX_ORDER_RGBA;
+				} else if(palette == V4L2_PIX_FMT_NV12 && colours == ZM_COLOUR_RGB24) {
+					conversion_type = 4;
+					planar_conversion_fptr = use_ssse3?&ssse3_convert_nv12_rgb:&zm_convert_nv12_rgb;
+					subpixelorder = ZM_SUBPIX_ORDER_RGB;
+				} else if(palette == V4L2_PIX_FMT_NV12 && colours == ZM_COLOUR_RGB32) {
+					conversion_type = 4;
+					planar_conversion_fptr = use_ssse3?&ssse3_convert_nv12_rgba:&zm_convert_nv12_rgba;
 					subpixelorder = ZM_SUBPIX_ORDER_RGBA;
 				} else {
 					Fatal("Unable to find a suitable format conversion for the selected palette and target colorspace.");
@@ -578,22 +637,22 @@ LocalCamera::LocalCamera( int p_id, const std::string &p_device, int p_channel,
 					}
 					subpixelorder = ZM_SUBPIX_ORDER_NONE;
 				} else if((palette == VIDEO_PALETTE_YUYV || palette == VIDEO_PALETTE_YUV422) && colours == ZM_COLOUR_RGB24) {
-					conversion_fptr = &zm_convert_yuyv_rgb;
+					conversion_fptr = (config.cpu_extensions && sseversion >= 35)?&ssse3_convert_yuyv_rgb:&zm_convert_yuyv_rgb;
 					subpixelorder = ZM_SUBPIX_ORDER_RGB;
 				} else if((palette == VIDEO_PALETTE_YUYV || palette == VIDEO_PALETTE_YUV422) && colours == ZM_COLOUR_RGB32) {
-					conversion_fptr = &zm_convert_yuyv_rgba;
+					conversion_fptr = (config.cpu_extensions && sseversion >= 35)?&ssse3_convert_yuyv_rgba:&zm_convert_yuyv_rgba;
 					subpixelorder = ZM_SUBPIX_ORDER_RGBA;
 				} else if(palette == VIDEO_PALETTE_RGB555 && colours == ZM_COLOUR_RGB24) {
-					conversion_fptr = &zm_convert_rgb555_rgb;
+					conversion_fptr = (config.cpu_extensions && sseversion >= 35)?&ssse3_convert_rgb555_rgb:&zm_convert_rgb555_rgb;
 					subpixelorder = ZM_SUBPIX_ORDER_RGB;
 				} else if(palette == VIDEO_PALETTE_RGB555 && colours == ZM_COLOUR_RGB32) {
-					conversion_fptr = &zm_convert_rgb555_rgba;
+					conversion_fptr = (config.cpu_extensions && sseversion >= 35)?&ssse3_convert_rgb555_rgba:&zm_convert_rgb555_rgba;
 					subpixelorder = ZM_SUBPIX_ORDER_RGBA;
 				} else if(palette == VIDEO_PALETTE_RGB565 && colours == ZM_COLOUR_RGB24) {
-					conversion_fptr = &zm_convert_rgb565_rgb;
+					conversion_fptr = (config.cpu_extensions && sseversion >= 35)?&ssse3_convert_rgb565_rgb:&zm_convert_rgb565_rgb;
 					subpixelorder = ZM_SUBPIX_ORDER_RGB;
 				} else if(palette == VIDEO_PALETTE_RGB565 && colours == ZM_COLOUR_RGB32) {
-					conversion_fptr = &zm_convert_rgb565_rgba;
+					conversion_fptr = (config.cpu_extensions && sseversion >= 35)?&ssse3_convert_rgb565_rgba:&zm_convert_rgb565_rgba;
 					subpixelorder = ZM_SUBPIX_ORDER_RGBA;
 				} else {
 					Fatal("Unable to find a suitable format conversion for the selected palette and target colorspace.");
@@ -605,6 +664,9 @@ LocalCamera::LocalCamera( int p_id, const std::string &p_device, int p_channel,
 
 	last_camera = this;
 	Debug(3,"Selected subpixelorder: %d",subpixelorder);
+	
+	/* The chroma planes of YUV420P images make them bigger than the colours alone suggest */
+	imagesize = ImageBufferSize(width, height, colours, subpixelorder);
 
 #if HAVE_LIBSWSCALE
 	/* Initialize swscale stuff */
@@ -648,6 +710,102 @@ LocalCamera::~LocalCamera()
 #endif
 }
 
+// Every process attaching to the monitor must agree on the size of the ring,
+// so this can only depend on the configuration and not on what the driver does
+int LocalCamera::CaptureBufferReserve() const
+{
+#if ZM_HAS_V4L2
+    if ( config.v4l_userptr )
+        return( USERPTR_BUFFERS );
+#endif // ZM_HAS_V4L2
+    return( 0 );
+}
+
+void LocalCamera::SetCaptureBuffers( uint8_t *p_buffers, int p_count )
+{
+    ring_buffers = p_buffers;
+    ring_count = p_count;
+}
+
+#if ZM_HAS_V4L2
+// Have the driver capture straight into the monitor's shared image ring rather
+// than into its own buffers, which saves copying every frame. Only possible when
+// the captured format needs no conversion and there is just one input, so that
+// every frame belongs to this monitor. The buffers are queued here so that any
+// driver that rejects them can still fall back to memory mapped buffers.
+bool LocalCamera::InitialiseUserBuffers()
+{
+    if ( !config.v4l_userptr || !ring_buffers )
+        return( false );
+
+    if ( conversion_type != 0 || channel_count > 1 )
+    {
+        Debug( 2, "Not capturing directly into shared memory, conversion type %d, %d channels", conversion_type, channel_count );
+        return( false );
+    }
+
+    // Check the real driver image size, the one in v4l2_data may have been padded out
+    struct v4l2_format fmt;
+    memset( &fmt, 0, sizeof(fmt) );
+    fmt.type = v4l2_data.fmt.type;
+    if ( vidioctl( vid_fd, VIDIOC_G_FMT, &fmt ) < 0 )
+    {
+        Debug( 2, "Not capturing directly into shared memory, failed to get video format: %s", strerror(errno) );
+        return( false );
+    }
+    if ( fmt.fmt.pix.sizeimage > imagesize )
+    {
+        Debug( 2, "Not capturing directly into shared memory, driver image size %d exceeds monitor image size %d", fmt.fmt.pix.sizeimage, imagesize );
+        return( false );
+    }
+
+    // Queued slots are the ones just ahead of the write index. The monitor adds
+    // enough to the ring for them that they are never among the images readers use.
+    memset( &v4l2_data.reqbufs, 0, sizeof(v4l2_data.reqbufs) );
+    v4l2_data.reqbufs.count = CaptureBufferReserve();
+    v4l2_data.reqbufs.type = v4l2_data.fmt.type;
+    v4l2_data.reqbufs.memory = V4L2_MEMORY_USERPTR;
+
+    if ( vidioctl( vid_fd, VIDIOC_REQBUFS, &v4l2_data.reqbufs ) < 0 )
+    {
+        Info( "Video device does not support user pointer capture, using memory mapped buffers: %s", strerror(errno) );
+        return( false );
+    }
+
+    bool queued = ( v4l2_data.reqbufs.count >= 2 && v4l2_data.reqbufs.count <= (unsigned int)CaptureBufferReserve() );
+    for ( ring_next = 0; queued && ring_next < (int)v4l2_data.reqbufs.count; ring_next++ )
+    {
+        struct v4l2_buffer vid_buf;
+
+        memset( &vid_buf, 0, sizeof(vid_buf) );
+
+        vid_buf.type = v4l2_data.fmt.type;
+        vid_buf.memory = V4L2_MEMORY_USERPTR;
+        vid_buf.index = ring_next;
+        vid_buf.m.userptr = (unsigned long)&ring_buffers[ring_next*imagesize];
+        vid_buf.length = imagesize;
+
+        if ( vidioctl( vid_fd, VIDIOC_QBUF, &vid_buf ) < 0 )
+        {
+            Info( "Unable to queue shared memory buffer %d, using memory mapped buffers: %s", ring_next, strerror(errno) );
+            queued = false;
+        }
+    }
+    if ( !queued )
+    {
+        // Releasing the buffers also discards any that were queued
+        v4l2_data.reqbufs.count = 0;
+        if ( vidioctl( vid_fd, VIDIOC_REQBUFS, &v4l2_data.reqbufs ) < 0 )
+            Error( "Failed to release user pointer buffers: %s", strerror(errno) );
+        return( false );
+    }
+    ring_next %= ring_count;
+
+    Info( "Capturing directly into shared memory using %d buffers", v4l2_data.reqbufs.count );
+    return( true );
+}
+#endif // ZM_HAS_V4L2
+
 void LocalCamera::Initialise()
 {
 #if HAVE_LIBSWSCALE
@@ -778,67 +936,70 @@ void LocalCamera::Initialise()
 		}
 	}
 
-        Debug( 3, "Setting up request buffers" );
+        if ( !InitialiseUserBuffers() )
+        {
+            Debug( 3, "Setting up request buffers" );
        
-        memset( &v4l2_data.reqbufs, 0, sizeof(v4l2_data.reqbufs) );
-        if ( channel_count > 1 )
-            if ( config.v4l_multi_buffer )
-                v4l2_data.reqbufs.count = 2*channel_count;
+            memset( &v4l2_data.reqbufs, 0, sizeof(v4l2_data.reqbufs) );
+            if ( channel_count > 1 )
+                if ( config.v4l_multi_buffer )
+                    v4l2_data.reqbufs.count = 2*channel_count;
+                else
+                    v4l2_data.reqbufs.count = 1;
             else
-                v4l2_data.reqbufs.count = 1;
-        else
-            v4l2_data.reqbufs.count = 8;
-        v4l2_data.reqbufs.type = v4l2_data.fmt.type;
-        v4l2_data.reqbufs.memory = V4L2_MEMORY_MMAP;
+                v4l2_data.reqbufs.count = 8;
+            v4l2_data.reqbufs.type = v4l2_data.fmt.type;
+            v4l2_data.reqbufs.memory = V4L2_MEMORY_MMAP;
 
-        if ( vidioctl( vid_fd, VIDIOC_REQBUFS, &v4l2_data.reqbufs ) < 0 )
-        {
-            if ( errno == EINVAL )
-            {
-                Fatal( "Unable to initialise memory mapping, unsupported in device" );
-            }
-            else
+            if ( vidioctl( vid_fd, VIDIOC_REQBUFS, &v4l2_data.reqbufs ) < 0 )
             {
-                Fatal( "Unable to initialise memory mapping: %s", strerror(errno) );
+                if ( errno == EINVAL )
+                {
+                    Fatal( "Unable to initialise memory mapping, unsupported in device" );
+                }
+                else
+                {
+                    Fatal( "Unable to initialise memory mapping: %s", strerror(errno) );
+                }
             }
-        }
 
-        if ( v4l2_data.reqbufs.count < (config.v4l_multi_buffer?2:1) )
-            Fatal( "Insufficient buffer memory %d on video device", v4l2_data.reqbufs.count );
+            if ( v4l2_data.reqbufs.count < (config.v4l_multi_buffer?2:1) )
+                Fatal( "Insufficient buffer memory %d on video device", v4l2_data.reqbufs.count );
 
-        Debug( 3, "Setting up %d data buffers", v4l2_data.reqbufs.count );
+            Debug( 3, "Setting up %d data buffers", v4l2_data.reqbufs.count );
 
-        v4l2_data.buffers = new V4L2MappedBuffer[v4l2_data.reqbufs.count];
+            v4l2_data.buffers = new V4L2MappedBuffer[v4l2_data.reqbufs.count];
 #if HAVE_LIBSWSCALE
-        capturePictures = new AVFrame *[v4l2_data.reqbufs.count];
+            capturePictures = new AVFrame *[v4l2_data.reqbufs.count];
 #endif // HAVE_LIBSWSCALE
-        for ( unsigned int i = 0; i < v4l2_data.reqbufs.count; i++ )
-        {
-            struct v4l2_buffer vid_buf;
+            for ( unsigned int i = 0; i < v4l2_data.reqbufs.count; i++ )
+            {
+                struct v4l2_buffer vid_buf;
 
-            memset( &vid_buf, 0, sizeof(vid_buf) );
+                memset( &vid_buf, 0, sizeof(vid_buf) );
 
-            //vid_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            vid_buf.type = v4l2_data.fmt.type;
-            //vid_buf.memory = V4L2_MEMORY_MMAP;
-            vid_buf.memory = v4l2_data.reqbufs.memory;
-            vid_buf.index = i;
+                //vid_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+                vid_buf.type = v4l2_data.fmt.type;
+                //vid_buf.memory = V4L2_MEMORY_MMAP;
+                vid_buf.memory = v4l2_data.reqbufs.memory;
+                vid_buf.index = i;
 
-            if ( vidioctl( vid_fd, VIDIOC_QUERYBUF, &vid_buf ) < 0 )
-                Fatal( "Unable to query video buffer: %s", strerror(errno) );
+                if ( vidioctl( vid_fd, VIDIOC_QUERYBUF, &vid_buf ) < 0 )
+                    Fatal( "Unable to query video buffer: %s", strerror(errno) );
 
-            v4l2_data.buffers[i].length = vid_buf.length;
-            v4l2_data.buffers[i].start = mmap( NULL, vid_buf.length, PROT_READ|PROT_WRITE, MAP_SHARED, vid_fd, vid_buf.m.offset );
+                v4l2_data.buffers[i].length = vid_buf.length;
+                v4l2_data.buffers[i].start = mmap( NULL, vid_buf.length, PROT_READ|PROT_WRITE, MAP_SHARED, vid_fd, vid_buf.m.offset );
 
-            if ( v4l2_data.buffers[i].start == MAP_FAILED )
-                Fatal( "Can't map video buffer %d (%d bytes) to memory: %s(%d)", i, vid_buf.length, strerror(errno), errno );
+                if ( v4l2_data.buffers[i].start == MAP_FAILED )
+                    Fatal( "Can't map video buffer %d (%d bytes) to memory: %s(%d)", i, vid_buf.length, strerror(errno), errno );
 
 #if HAVE_LIBSWSCALE
-		capturePictures[i] = avcodec_alloc_frame();
-		if ( !capturePictures[i] )
-			Fatal( "Could not allocate picture" );
-		avpicture_fill( (AVPicture *)capturePictures[i], (uint8_t*)v4l2_data.buffers[i].start, capturePixFormat, v4l2_data.fmt.fmt.pix.width, v4l2_data.fmt.fmt.pix.height );
+			capturePictures[i] = avcodec_alloc_frame();
+			if ( !capturePictures[i] )
+				Fatal( "Could not allocate picture" );
+			avpicture_fill( (AVPicture *)capturePictures[i], (uint8_t*)v4l2_data.buffers[i].start, capturePixFormat, v4l2_data.fmt.fmt.pix.width, v4l2_data.fmt.fmt.pix.height );
 #endif // HAVE_LIBSWSCALE
+            }
         }
 
         Debug( 3, "Configuring video source" );
@@ -1049,6 +1210,15 @@ void LocalCamera::Terminate()
     if ( v4l_version == 2 )
     {
         Debug( 3, "Terminating video stream" );
+        if ( capture_thread )
+        {
+            Debug( 3, "Stopping capture thread" );
+            capture_thread->stop();
+            capture_thread->join();
+            delete capture_thread;
+            capture_thread = NULL;
+        }
+
         //enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
        // enum v4l2_buf_type type = v4l2_data.fmt.type;
         enum v4l2_buf_type type = (v4l2_buf_type)v4l2_data.fmt.type;
@@ -1056,7 +1226,8 @@ void LocalCamera::Terminate()
             Error( "Failed to stop capture stream: %s", strerror(errno) );
 
         Debug( 3, "Unmapping video buffers" );
-        for ( unsigned int i = 0; i < v4l2_data.reqbufs.count; i++ ) {
+        // User pointer buffers belong to the monitor's shared memory
+        for ( unsigned int i = 0; v4l2_data.reqbufs.memory == V4L2_MEMORY_MMAP && i < v4l2_data.reqbufs.count; i++ ) {
 #if HAVE_LIBSWSCALE
 			/* Free capture pictures */
 			av_free(capturePictures[i]);
@@ -1917,7 +2088,8 @@ int LocalCamera::PrimeCapture()
     if ( v4l_version == 2 )
     {
         Debug( 3, "Queueing buffers" );
-        for ( unsigned int frame = 0; frame < v4l2_data.reqbufs.count; frame++ )
+        // User pointer buffers have already been queued while initialising
+        for ( unsigned int frame = 0; v4l2_data.reqbufs.memory == V4L2_MEMORY_MMAP && frame < v4l2_data.reqbufs.count; frame++ )
         {
             struct v4l2_buffer vid_buf;
 
@@ -1938,6 +2110,10 @@ int LocalCamera::PrimeCapture()
         enum v4l2_buf_type type = (v4l2_buf_type)v4l2_data.fmt.type;
         if ( vidioctl( vid_fd, VIDIOC_STREAMON, &type ) < 0 )
             Fatal( "Failed to start capture stream: %s", strerror(errno) );
+
+        Debug( 3, "Starting capture thread" );
+        capture_thread = new LocalCaptureThread( vid_fd, v4l2_data.reqbufs, channel_count, channels, standards );
+        capture_thread->start();
     }
 #endif // ZM_HAS_V4L2
 #if ZM_HAS_V4L1
@@ -1972,52 +2148,27 @@ int LocalCamera::Capture( Image &image )
 	static int capture_frame = -1;
 	int buffer_bytesused = 0;
 	
-	int captures_per_frame = 1;
-	if ( channel_count > 1 )
-		captures_per_frame = config.captures_per_frame;
-	
-	
     // Do the capture, unless we are the second or subsequent camera on a channel, in which case just reuse the buffer
     if ( channel_prime )
     {
 #if ZM_HAS_V4L2
         if ( v4l_version == 2 )
         {
-            static struct v4l2_buffer vid_buf;
-
-            memset( &vid_buf, 0, sizeof(vid_buf) );
-
-            vid_buf.type = v4l2_data.fmt.type;
-            //vid_buf.memory = V4L2_MEMORY_MMAP;
-            vid_buf.memory = v4l2_data.reqbufs.memory;
-
-            Debug( 3, "Capturing %d frames", captures_per_frame );
-            while ( captures_per_frame )
+            // The capture thread has already done any input switching and discarded unsettled frames
+            v4l2_data.bufptr = capture_thread->getFrame( channel_index, v4l2_data.timestamp );
+            if ( !v4l2_data.bufptr )
             {
-                if ( vidioctl( vid_fd, VIDIOC_DQBUF, &vid_buf ) < 0 )
-                {
-                    if ( errno == EIO )
-                        Warning( "Capture failure, possible signal loss?: %s", strerror(errno) )
-                    else
-                        Error( "Unable to capture frame %d: %s", vid_buf.index, strerror(errno) )
-                    return( -1 );
-                }
-
-                v4l2_data.bufptr = &vid_buf;
-                capture_frame = v4l2_data.bufptr->index;
-                if ( --captures_per_frame )
-                {
-                    if ( vidioctl( vid_fd, VIDIOC_QBUF, &vid_buf ) < 0 )
-                    {
-                        Error( "Unable to requeue buffer %d: %s", vid_buf.index, strerror(errno) );
-                        return( -1 );
-                    }
-                }
+                Warning( "No frame captured from channel %d, possible signal loss?", channel );
+                return( -1 );
             }
+            capture_frame = v4l2_data.bufptr->index;
 
             Debug( 3, "Captured frame %d/%d from channel %d", capture_frame, v4l2_data.bufptr->sequence, channel );
 
-            buffer = (unsigned char *)v4l2_data.buffers[v4l2_data.bufptr->index].start;
+            if ( v4l2_data.reqbufs.memory == V4L2_MEMORY_USERPTR )
+                buffer = (unsigned char *)v4l2_data.bufptr->m.userptr;
+            else
+                buffer = (unsigned char *)v4l2_data.buffers[v4l2_data.bufptr->index].start;
             buffer_bytesused = v4l2_data.bufptr->bytesused;
 
             if((v4l2_data.fmt.fmt.pix.width * v4l2_data.fmt.fmt.pix.height) !=  (width * height)) {
@@ -2029,6 +2180,10 @@ int LocalCamera::Capture( Image &image )
 #if ZM_HAS_V4L1
         if ( v4l_version == 1 )
         {
+            int captures_per_frame = 1;
+            if ( channel_count > 1 )
+                captures_per_frame = config.captures_per_frame;
+
             Debug( 3, "Capturing %d frames", captures_per_frame );
             while ( captures_per_frame )
             {
@@ -2088,6 +2243,14 @@ int LocalCamera::Capture( Image &image )
 			/* JPEG decoding */
 			image.DecodeJpeg(buffer, buffer_bytesused, colours, subpixelorder);
 		}
+		else if(conversion_type == 4) {
+			
+			Debug( 9, "Calling the YUV420P conversion function" );
+			(*planar_conversion_fptr)(buffer, directbuffer, width, height);
+		}
+		
+	} else if ( buffer == image.Buffer() ) {
+		Debug( 3, "No format conversion performed. Image was captured in place" );
 		
 	} else {
 		Debug( 3, "No format conversion performed. Assigning the image" );
@@ -2100,6 +2263,18 @@ int LocalCamera::Capture( Image &image )
 	return( 0 );
 }
 
+bool LocalCamera::CaptureTime( struct timeval *p_time ) const
+{
+#if ZM_HAS_V4L2
+    if ( v4l_version == 2 && v4l2_data.timestamp.tv_sec )
+    {
+        *p_time = v4l2_data.timestamp;
+        return( true );
+    }
+#endif // ZM_HAS_V4L2
+    return( false );
+}
+
 int LocalCamera::PostCapture()
 {
     Debug( 2, "Post-capturing" );
@@ -2107,31 +2282,19 @@ int LocalCamera::PostCapture()
     if ( channel_count > 1 || channel_prime )
     {
 #if ZM_HAS_V4L2
-        if ( v4l_version == 2 )
+        // Input switching is done by the capture thread, just hand the buffer back
+        if ( v4l_version == 2 && channel_prime && v4l2_data.bufptr )
         {
-            if ( channel_count > 1 )
+            if ( v4l2_data.reqbufs.memory == V4L2_MEMORY_USERPTR )
             {
-                int next_channel = (channel_index+1)%channel_count;
-                Debug( 3, "Switching video source to %d", channels[next_channel] );
-                if ( vidioctl( vid_fd, VIDIOC_S_INPUT, &channels[next_channel] ) < 0 )
-                {
-                    Error( "Failed to set camera source %d: %s", channels[next_channel], strerror(errno) );
-                    return( -1 );
-                }
-
-                v4l2_std_id stdId = standards[next_channel];
-                if ( vidioctl( vid_fd, VIDIOC_S_STD, &stdId ) < 0 )
-                {
-                    Error( "Failed to set video format %d: %s", standards[next_channel], strerror(errno) );
-                    return( -1 );
-                }
+                // Hand the driver the slot the monitor will want after those already queued
+                v4l2_data.bufptr->m.userptr = (unsigned long)&ring_buffers[ring_next*imagesize];
+                v4l2_data.bufptr->length = imagesize;
+                ring_next = (ring_next+1)%ring_count;
             }
             Debug( 3, "Requeueing buffer %d", v4l2_data.bufptr->index );
-            if ( vidioctl( vid_fd, VIDIOC_QBUF, v4l2_data.bufptr ) < 0 )
-            {
-                Error( "Unable to requeue buffer %d: %s", v4l2_data.bufptr->index, strerror(errno) )
-                return( -1 );
-            }
+            capture_thread->releaseFrame( v4l2_data.bufptr );
+            v4l2_data.bufptr = NULL;
         }
 #endif // ZM_HAS_V4L2
 #if ZM_HAS_V4L1
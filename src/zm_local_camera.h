@@ -34,6 +34,7 @@
 #endif // HAVE_LINUX_VIDEODEV2_H
 
 #include "zm_ffmpeg.h"
+#include "zm_local_capture.h"
 
 //
 // Class representing 'local' cameras, i.e. those which are
@@ -42,6 +43,9 @@
 //
 class LocalCamera : public Camera
 {
+public:
+	enum { USERPTR_BUFFERS=8 }; // Shared memory slots queued with the driver when capturing directly into them
+
 protected:
 #if ZM_HAS_V4L2
     struct V4L2MappedBuffer
@@ -58,6 +62,7 @@ protected:
         v4l2_requestbuffers reqbufs;
         V4L2MappedBuffer    *buffers;
         v4l2_buffer         *bufptr;
+        struct timeval      timestamp;  // When the frame in bufptr was captured
     };
 #endif // ZM_HAS_V4L2
 
@@ -81,10 +86,18 @@ protected:
 	int channel_index;
 	unsigned int extras;
 	
-	unsigned int conversion_type; /* 0 = no conversion needed, 1 = use libswscale, 2 = zm internal conversion, 3 = jpeg decoding */
+	unsigned int conversion_type; /* 0 = no conversion needed, 1 = use libswscale, 2 = zm internal conversion, 3 = jpeg decoding, 4 = zm internal conversion to or from a planar format */
 	convert_fptr_t conversion_fptr; /* Pointer to conversion function used */
+	planar_convert_fptr_t planar_conversion_fptr; /* Pointer to the planar conversion function used */
+	
+	uint8_t *ring_buffers; /* Monitor shared image ring the driver may capture directly into */
+	int ring_count;
+	int ring_next; /* Next ring slot to hand to the driver */
 	
 	uint32_t AutoSelectFormat(int p_colours);
+#if ZM_HAS_V4L2
+	bool InitialiseUserBuffers();
+#endif // ZM_HAS_V4L2
 
 protected:
 	static int camera_count;
@@ -96,6 +109,7 @@ protected:
 
 #if ZM_HAS_V4L2
 	static V4L2Data         v4l2_data;
+	static LocalCaptureThread *capture_thread;
 #endif // ZM_HAS_V4L2
 #if ZM_HAS_V4L1
 	static V4L1Data         v4l1_data;
@@ -130,10 +144,13 @@ public:
 	int Colour( int p_colour=-1 );
 	int Contrast( int p_contrast=-1 );
 
+	int CaptureBufferReserve() const;
+	void SetCaptureBuffers( uint8_t *p_buffers, int p_count );
 	int PrimeCapture();
 	int PreCapture();
 	int Capture( Image &image );
 	int PostCapture();
+	bool CaptureTime( struct timeval *p_time ) const;
 
 	static bool GetCurrentSettings( const char *device, char *output, int version, bool verbose );
 };
@@ -0,0 +1,316 @@
+//
+// ZoneMinder Local Capture Thread Implementation, $Date$, $Revision$
+// Copyright (C) 2001-2008 Philip Coombes
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#include "zm_local_capture.h"
+
+#if ZM_HAS_V4L2
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+
+static int vidioctl( int fd, int request, void *arg )
+{
+    int result = -1;
+    do
+    {
+        result = ioctl( fd, request, arg );
+    } while ( result == -1 && errno == EINTR );
+    return( result );
+}
+
+static long long usecsBetween( const struct timeval &from, const struct timeval &to )
+{
+    return( ((long long)(to.tv_sec-from.tv_sec)*1000000)+(to.tv_usec-from.tv_usec) );
+}
+
+LocalCaptureThread::LocalCaptureThread( int fd, const v4l2_requestbuffers &request, int inputCount, const int *channels, const int *standards ) :
+    mFd( fd ),
+    mRequest( request ),
+    mQueued( request.count ),
+    mInputCount( inputCount ),
+    mInput( 0 ),
+    mDiscard( 0 ),
+    mSwitched( false ),
+    mCondition( mMutex ),
+    mStop( false )
+{
+    // All the buffers have been queued before streaming was started
+    mBuffers = new v4l2_buffer[mRequest.count];
+    mTimes = new struct timeval[mRequest.count];
+    for ( unsigned int i = 0; i < mRequest.count; i++ )
+    {
+        memset( &mBuffers[i], 0, sizeof(mBuffers[i]) );
+        mBuffers[i].type = mRequest.type;
+        mBuffers[i].memory = mRequest.memory;
+        mBuffers[i].index = i;
+    }
+
+    mInputs = new Input[mInputCount];
+    for ( int i = 0; i < mInputCount; i++ )
+    {
+        mInputs[i].channel = channels[i];
+        mInputs[i].standard = standards[i];
+        mInputs[i].switches = 0;
+        mInputs[i].settleTotal = 0.0;
+    }
+
+    // The first input has only just been selected so treat it as switched to
+    gettimeofday( &mSwitchTime, NULL );
+    if ( mInputCount > 1 )
+        mDiscard = config.captures_per_frame-1;
+}
+
+LocalCaptureThread::~LocalCaptureThread()
+{
+    delete[] mInputs;
+    delete[] mTimes;
+    delete[] mBuffers;
+}
+
+// Must be called with the mutex held
+void LocalCaptureThread::queueBuffer( v4l2_buffer *buffer )
+{
+    if ( vidioctl( mFd, VIDIOC_QBUF, buffer ) < 0 )
+    {
+        Error( "Unable to requeue buffer %d: %s", buffer->index, strerror(errno) );
+        return;
+    }
+    mQueued++;
+    mCondition.broadcast();
+}
+
+// Converts the driver's timestamp to wall clock time, if it has given one
+void LocalCaptureThread::captureTime( const v4l2_buffer &buffer, struct timeval &time ) const
+{
+    struct timeval now;
+    gettimeofday( &now, NULL );
+
+    if ( !buffer.timestamp.tv_sec && !buffer.timestamp.tv_usec )
+    {
+        time = now;
+        return;
+    }
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+    if ( (buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC )
+    {
+        struct timespec mono;
+        clock_gettime( CLOCK_MONOTONIC, &mono );
+        long long age = ((long long)(mono.tv_sec-buffer.timestamp.tv_sec)*1000000)+(mono.tv_nsec/1000)-buffer.timestamp.tv_usec;
+        if ( age < 0 )
+            age = 0;
+        long long usecs = ((long long)now.tv_sec*1000000)+now.tv_usec-age;
+        time.tv_sec = usecs/1000000;
+        time.tv_usec = usecs%1000000;
+        return;
+    }
+#endif // V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+    time = buffer.timestamp;
+}
+
+// Must be called with the mutex held
+void LocalCaptureThread::frameCaptured( int index )
+{
+    Input &input = mInputs[mInput];
+
+    if ( mInputCount > 1 )
+    {
+        // Frames completed before the switch are from the previous input, those just after may be torn
+        if ( usecsBetween( mSwitchTime, mTimes[index] ) < 0 || mDiscard > 0 )
+        {
+            if ( usecsBetween( mSwitchTime, mTimes[index] ) >= 0 )
+                mDiscard--;
+            Debug( 4, "Discarding buffer %d, input %d not yet settled", index, input.channel );
+            queueBuffer( &mBuffers[index] );
+            return;
+        }
+
+        if ( mSwitched )
+        {
+            double settle = usecsBetween( mSwitchTime, mTimes[index] )/1000.0;
+            Debug( 4, "Input %d settled %.1f ms after switching", input.channel, settle );
+            input.settleTotal += settle;
+            if ( ++input.switches >= SETTLE_REPORT_INTERVAL )
+            {
+                Info( "Input %d settles %.1f ms after switching, averaged over %d switches", input.channel, input.settleTotal/input.switches, input.switches );
+                input.switches = 0;
+                input.settleTotal = 0.0;
+            }
+        }
+
+        // Only the latest frame from each input is worth keeping
+        while ( !input.ready.empty() )
+        {
+            queueBuffer( &mBuffers[input.ready.front()] );
+            input.ready.pop_front();
+        }
+        input.ready.push_back( index );
+        mCondition.broadcast();
+
+        if ( !switchInput() )
+            mStop = true;
+    }
+    else
+    {
+        input.ready.push_back( index );
+        mCondition.broadcast();
+    }
+}
+
+// Must be called with the mutex held
+bool LocalCaptureThread::switchInput()
+{
+    mInput = (mInput+1)%mInputCount;
+    Input &input = mInputs[mInput];
+
+    Debug( 3, "Switching video source to %d", input.channel );
+    if ( vidioctl( mFd, VIDIOC_S_INPUT, &input.channel ) < 0 )
+    {
+        Error( "Failed to set camera source %d: %s", input.channel, strerror(errno) );
+        return( false );
+    }
+
+    v4l2_std_id stdId = input.standard;
+    if ( vidioctl( mFd, VIDIOC_S_STD, &stdId ) < 0 )
+    {
+        Error( "Failed to set video format %d: %s", input.standard, strerror(errno) );
+        return( false );
+    }
+
+    gettimeofday( &mSwitchTime, NULL );
+    mDiscard = config.captures_per_frame-1;
+    mSwitched = true;
+    return( true );
+}
+
+int LocalCaptureThread::run()
+{
+    Debug( 2, "Starting capture thread for %d inputs using %d buffers", mInputCount, mRequest.count );
+
+    while ( !mStop )
+    {
+        mMutex.lock();
+        // With every buffer held by the monitors there is nothing to wait for from the driver
+        while ( !mStop && !mQueued )
+            mCondition.wait( 1 );
+        mMutex.unlock();
+        if ( mStop )
+            break;
+
+        fd_set readFds;
+        FD_ZERO( &readFds );
+        FD_SET( mFd, &readFds );
+        struct timeval timeout = { 1, 0 };
+        int result = select( mFd+1, &readFds, NULL, NULL, &timeout );
+        if ( result < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            Error( "Select failed on video device: %s", strerror(errno) );
+            break;
+        }
+        if ( result == 0 )
+        {
+            Debug( 3, "Timed out waiting for frame from input %d", mInputs[mInput].channel );
+            continue;
+        }
+
+        v4l2_buffer buffer;
+        memset( &buffer, 0, sizeof(buffer) );
+        buffer.type = mRequest.type;
+        buffer.memory = mRequest.memory;
+
+        if ( vidioctl( mFd, VIDIOC_DQBUF, &buffer ) < 0 )
+        {
+            if ( errno == EAGAIN )
+                continue;
+            if ( errno == EIO )
+            {
+                Warning( "Capture failure, possible signal loss?: %s", strerror(errno) );
+                continue;
+            }
+            Error( "Unable to capture frame: %s", strerror(errno) );
+            break;
+        }
+
+        mMutex.lock();
+        mQueued--;
+        mBuffers[buffer.index] = buffer;
+        captureTime( buffer, mTimes[buffer.index] );
+        Debug( 4, "Captured buffer %d/%d from input %d", buffer.index, buffer.sequence, mInputs[mInput].channel );
+#ifdef V4L2_BUF_FLAG_ERROR
+        if ( buffer.flags & V4L2_BUF_FLAG_ERROR )
+        {
+            Debug( 3, "Buffer %d has been flagged as corrupt, requeueing", buffer.index );
+            queueBuffer( &mBuffers[buffer.index] );
+        }
+        else
+#endif // V4L2_BUF_FLAG_ERROR
+        {
+            frameCaptured( buffer.index );
+        }
+        mMutex.unlock();
+    }
+
+    // Don't leave any monitor waiting for a frame that will never come
+    mMutex.lock();
+    mStop = true;
+    mCondition.broadcast();
+    mMutex.unlock();
+
+    Debug( 2, "Capture thread exiting" );
+    return( 0 );
+}
+
+// Waits for the next frame captured from the given input, the buffer belongs to the caller until released
+v4l2_buffer *LocalCaptureThread::getFrame( int input, struct timeval &time )
+{
+    struct timeval now, deadline;
+    gettimeofday( &deadline, NULL );
+    deadline.tv_sec += FRAME_TIMEOUT;
+
+    mMutex.lock();
+    while ( mInputs[input].ready.empty() )
+    {
+        gettimeofday( &now, NULL );
+        if ( mStop || usecsBetween( now, deadline ) <= 0 )
+        {
+            mMutex.unlock();
+            return( NULL );
+        }
+        mCondition.wait( 1 );
+    }
+    int index = mInputs[input].ready.front();
+    mInputs[input].ready.pop_front();
+    time = mTimes[index];
+    mMutex.unlock();
+
+    return( &mBuffers[index] );
+}
+
+void LocalCaptureThread::releaseFrame( v4l2_buffer *buffer )
+{
+    mMutex.lock();
+    queueBuffer( buffer );
+    mMutex.unlock();
+}
+
+#endif // ZM_HAS_V4L2
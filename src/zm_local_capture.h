@@ -0,0 +1,95 @@
+//
+// ZoneMinder Local Capture Thread Interface, $Date$, $Revision$
+// Copyright (C) 2001-2008 Philip Coombes
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef ZM_LOCAL_CAPTURE_H
+#define ZM_LOCAL_CAPTURE_H
+
+#include "zm.h"
+
+#if ZM_HAS_V4L2
+
+#include "zm_thread.h"
+
+#include <deque>
+#include <sys/time.h>
+#include <linux/videodev2.h>
+
+//
+// Keeps the V4L2 queue of a capture device full, dequeueing each frame as
+// soon as the driver completes it and holding it for the monitor on the input
+// it was captured from. Where several inputs share one capture chip it also
+// switches between them, discarding frames until the new input has settled
+// and keeping track of how long that takes.
+//
+class LocalCaptureThread : public Thread
+{
+public:
+    enum { FRAME_TIMEOUT=5 };               // Seconds a monitor will wait for a frame
+    enum { SETTLE_REPORT_INTERVAL=100 };    // Input switches between settle time reports
+
+private:
+    struct Input
+    {
+        int channel;
+        int standard;
+        std::deque<int> ready;  // Buffers captured from this input, oldest first
+        int switches;
+        double settleTotal;     // Milliseconds
+    };
+
+private:
+    int mFd;
+    v4l2_requestbuffers mRequest;
+    v4l2_buffer *mBuffers;      // Indexed by buffer index, as last dequeued
+    struct timeval *mTimes;     // Wall clock capture time of each buffer
+    int mQueued;
+    Input *mInputs;
+    int mInputCount;
+    int mInput;                 // Input currently being captured from
+    int mDiscard;               // Captures still to be thrown away after a switch
+    struct timeval mSwitchTime;
+    bool mSwitched;
+
+    Mutex mMutex;
+    Condition mCondition;
+    bool mStop;
+
+private:
+    void queueBuffer( v4l2_buffer *buffer );
+    void captureTime( const v4l2_buffer &buffer, struct timeval &time ) const;
+    void frameCaptured( int index );
+    bool switchInput();
+    int run();
+
+public:
+    LocalCaptureThread( int fd, const v4l2_requestbuffers &request, int inputCount, const int *channels, const int *standards );
+    ~LocalCaptureThread();
+
+    v4l2_buffer *getFrame( int input, struct timeval &time );
+    void releaseFrame( v4l2_buffer *buffer );
+
+    void stop()
+    {
+        mStop = true;
+    }
+};
+
+#endif // ZM_HAS_V4L2
+
+#endif // ZM_LOCAL_CAPTURE_H
@@ -21,6 +21,7 @@
 #include <sys/stat.h>
 #include <arpa/inet.h>
 #include <glob.h>
+#include <algorithm>
 
 #include "zm.h"
 #include "zm_db.h"
@@ -324,6 +325,8 @@ Monitor::Monitor(
     alarm_ref_blend_perc( p_alarm_ref_blend_perc ),
     track_motion( p_track_motion ),
     signal_check_colour( p_signal_check_colour ),
+    signal_check_colours( 0 ),
+    signal_check_refresh( 0 ),
     delta_image( width, height, ZM_COLOUR_GRAY8, ZM_SUBPIX_ORDER_NONE ),
     ref_image( width, height, p_camera->Colours(), p_camera->SubpixelOrder() ),
     purpose( p_purpose ),
@@ -369,6 +372,11 @@ Monitor::Monitor(
 
     auto_resume_time = 0;
 
+    // The camera may be capturing into the slots just ahead of the current image, these are
+    // added to the ring so the images behind it that readers use are still all there
+    capture_buffer_reserve = camera->CaptureBufferReserve();
+    image_buffer_count += capture_buffer_reserve;
+
     if ( strcmp( config.event_close_mode, "time" ) == 0 )
         event_close_mode = CLOSE_TIME;
     else if ( strcmp( config.event_close_mode, "alarm" ) == 0 )
@@ -497,6 +505,10 @@ Monitor::Monitor(
         image_buffer[i].image = new Image( width, height, camera->Colours(), camera->SubpixelOrder(), &(shared_images[i*camera->ImageSize()]) );
         image_buffer[i].image->HoldBuffer(true); /* Don't release the internal buffer or replace it with another */
     }
+    if ( purpose == CAPTURE )
+    {
+        camera->SetCaptureBuffers( shared_images, image_buffer_count );
+    }
     if ( (deinterlacing & 0xff) == 4)
     {
         /* Four field motion adaptive deinterlacing in use */
@@ -655,11 +667,14 @@ int Monitor::GetImage( int index, int scale ) const
     if ( index != image_buffer_count )
     {
         Snapshot *snap = &image_buffer[index];
-        Image snap_image( *(snap->image) );
-
+        Image snap_image;
         if ( scale != ZM_SCALE_BASE )
         {
-            snap_image.Scale( scale );
+            snap_image.Scale( ImageView( *(snap->image) ), scale );
+        }
+        else
+        {
+            snap_image.Assign( *(snap->image) );
         }
 
         static char filename[PATH_MAX];
@@ -1063,78 +1078,112 @@ void Monitor::DumpImage( Image *dump_image ) const
 
 bool Monitor::CheckSignal( const Image *image )
 {
-    static bool static_undef = true;
-    /* RGB24 colors */
-    static uint8_t red_val;
-    static uint8_t green_val;
-    static uint8_t blue_val;
-    static uint8_t grayscale_val; /* 8bit grayscale color */  
-    static Rgb colour_val; /* RGB32 color */
-    static int usedsubpixorder;
+    if ( config.signal_check_points <= 0 )
+        return( true );
 
-    if ( config.signal_check_points > 0 )
+    const uint8_t *buffer = image->Buffer();
+    unsigned int pixels = image->Pixels();
+    unsigned int width = image->Width();
+    unsigned int height = image->Height();
+    unsigned int colours = image->Colours();
+
+    if ( colours != signal_check_colours )
     {
-        if ( static_undef )
+        // Lay the colour out as it will be in the images, so each point is compared the same way whatever the format
+        int usedsubpixorder = camera->SubpixelOrder();
+        memset( signal_check_pixel, 0, sizeof(signal_check_pixel) );
+        memset( signal_check_mask, 0, sizeof(signal_check_mask) );
+        if ( colours == ZM_COLOUR_GRAY8 )
+        {
+            signal_check_pixel[0] = signal_check_colour & 0xff; /* Clear all bytes but lowest byte */
+            signal_check_mask[0] = 0xff;
+        }
+        else if ( colours == ZM_COLOUR_RGB24 )
+        {
+            if ( usedsubpixorder == ZM_SUBPIX_ORDER_BGR )
+            {
+                RED_PTR_BGRA(signal_check_pixel) = RED_VAL_BGRA(signal_check_colour);
+                GREEN_PTR_BGRA(signal_check_pixel) = GREEN_VAL_BGRA(signal_check_colour);
+                BLUE_PTR_BGRA(signal_check_pixel) = BLUE_VAL_BGRA(signal_check_colour);
+            }
+            else
+            {
+                /* Assume RGB */
+                RED_PTR_RGBA(signal_check_pixel) = RED_VAL_BGRA(signal_check_colour);
+                GREEN_PTR_RGBA(signal_check_pixel) = GREEN_VAL_BGRA(signal_check_colour);
+                BLUE_PTR_RGBA(signal_check_pixel) = BLUE_VAL_BGRA(signal_check_colour);
+            }
+            memset( signal_check_mask, 0xff, ZM_COLOUR_RGB24 );
+        }
+        else if ( colours == ZM_COLOUR_RGB32 )
         {
-            static_undef = false;
-            usedsubpixorder = camera->SubpixelOrder();
-            colour_val = rgb_convert(signal_check_colour, ZM_SUBPIX_ORDER_BGR); /* HTML colour code is actually BGR in memory, we want RGB */
+            Rgb colour_val = rgb_convert(signal_check_colour, ZM_SUBPIX_ORDER_BGR); /* HTML colour code is actually BGR in memory, we want RGB */
             colour_val = rgb_convert(colour_val, usedsubpixorder);
-            red_val = RED_VAL_BGRA(signal_check_colour);
-            green_val = GREEN_VAL_BGRA(signal_check_colour);
-            blue_val = BLUE_VAL_BGRA(signal_check_colour);
-            grayscale_val = signal_check_colour & 0xff; /* Clear all bytes but lowest byte */
+            Rgb mask_val;
+            if ( usedsubpixorder == ZM_SUBPIX_ORDER_ARGB || usedsubpixorder == ZM_SUBPIX_ORDER_ABGR )
+                mask_val = ARGB_ABGR_ZEROALPHA(0xffffffff);
+            else
+                /* Assume RGBA or BGRA */
+                mask_val = RGBA_BGRA_ZEROALPHA(0xffffffff);
+            memcpy( signal_check_pixel, &colour_val, sizeof(colour_val) );
+            memcpy( signal_check_mask, &mask_val, sizeof(mask_val) );
         }
+        signal_check_colours = colours;
+        signal_check_refresh = 0;
+    }
 
-        const uint8_t *buffer = image->Buffer();
-        int pixels = image->Pixels();
-        int width = image->Width();
-        int colours = image->Colours();
+    // Avoid the rows with timestamp in
+    unsigned int skip_lo_y = 0;
+    unsigned int skip_hi_y = 0;
+    if ( config.timestamp_on_capture && label_format[0] )
+    {
+        int label_hi_y = label_coord.Y()+Image::LINE_HEIGHT;
+        skip_lo_y = label_coord.Y() > 0 ? label_coord.Y() : 0;
+        skip_hi_y = label_hi_y > 0 ? label_hi_y : 0;
+        if ( skip_hi_y > height )
+            skip_hi_y = height;
+        if ( skip_lo_y > skip_hi_y || (skip_lo_y == 0 && skip_hi_y == height) )
+            skip_lo_y = skip_hi_y = 0;
+    }
 
-        int index = 0;
+    if ( config.signal_check_tolerance > 0 )
+    {
+        // Compare the whole image, allowing for noise or a message on an otherwise plain image
+        unsigned int checked = pixels - ((skip_hi_y - skip_lo_y) * width);
+        unsigned int limit = (unsigned int)(((unsigned long long)checked * config.signal_check_tolerance) / 100);
+        return( image->CountMismatches( signal_check_pixel, signal_check_mask, limit, skip_lo_y, skip_hi_y ) > limit );
+    }
+
+    if ( signal_check_refresh-- <= 0 || signal_check_indexes.size() != (size_t)config.signal_check_points )
+    {
+        // The same points are sampled for a while rather than picking new ones for every image
+        signal_check_refresh = SIGNAL_CHECK_REFRESH;
+        signal_check_indexes.resize( config.signal_check_points );
         for ( int i = 0; i < config.signal_check_points; i++ )
         {
+            int index = 0;
             while( true )
             {
                 index = (int)(((long long)rand()*(long long)(pixels-1))/RAND_MAX);
-                if ( !config.timestamp_on_capture || !label_format[0] )
-                    break;
-                // Avoid sampling the rows with timestamp in
-                if ( index < (label_coord.Y()*width) || index >= (label_coord.Y()+Image::LINE_HEIGHT)*width )
+                if ( index < (int)(skip_lo_y*width) || index >= (int)(skip_hi_y*width) )
                     break;
             }
-            
-		if(colours == ZM_COLOUR_GRAY8) {
-			if ( *(buffer+index) != grayscale_val )
-				return true;
-			
-		} else if(colours == ZM_COLOUR_RGB24) {
-			const uint8_t *ptr = buffer+(index*colours);
-			
-			if ( usedsubpixorder == ZM_SUBPIX_ORDER_BGR) {
-				if ( (RED_PTR_BGRA(ptr) != red_val) || (GREEN_PTR_BGRA(ptr) != green_val) || (BLUE_PTR_BGRA(ptr) != blue_val) )
-					return true;
-			} else {
-				/* Assume RGB */
-				if ( (RED_PTR_RGBA(ptr) != red_val) || (GREEN_PTR_RGBA(ptr) != green_val) || (BLUE_PTR_RGBA(ptr) != blue_val) )
-					return true;
-			}
-			
-		} else if(colours == ZM_COLOUR_RGB32) {
-			if ( usedsubpixorder == ZM_SUBPIX_ORDER_ARGB || usedsubpixorder == ZM_SUBPIX_ORDER_ABGR) {
-				if ( ARGB_ABGR_ZEROALPHA(*(((const Rgb*)buffer)+index)) != ARGB_ABGR_ZEROALPHA(colour_val) )
-					return true;
-			} else {
-				/* Assume RGBA or BGRA */
-				if ( RGBA_BGRA_ZEROALPHA(*(((const Rgb*)buffer)+index)) != RGBA_BGRA_ZEROALPHA(colour_val) )
-					return true;
-			}
-		}
-        
+            signal_check_indexes[i] = index;
         }
-        return( false );
+        // In order through the image rather than all over it
+        std::sort( signal_check_indexes.begin(), signal_check_indexes.end() );
     }
-    return( true );
+
+    for ( std::vector<unsigned int>::const_iterator index = signal_check_indexes.begin(); index != signal_check_indexes.end(); index++ )
+    {
+        const uint8_t *ptr = buffer+((*index)*colours);
+        for ( unsigned int i = 0; i < colours; i++ )
+        {
+            if ( (ptr[i] ^ signal_check_pixel[i]) & signal_check_mask[i] )
+                return( true );
+        }
+    }
+    return( false );
 }
 
 bool Monitor::Analyse()
@@ -1151,6 +1200,7 @@ bool Monitor::Analyse()
     {
         fps = double(fps_report_interval)/(now.tv_sec-last_fps_time);
         Info( "%s: %d - Processing at %.2f fps", name, image_count, fps );
+        ImageBufferPool::LogStats( name );
         last_fps_time = now.tv_sec;
     }
 
@@ -1528,16 +1578,17 @@ bool Monitor::Analyse()
                     {
                         if ( config.create_analysis_images )
                         {
-                            bool got_anal_image = false;
-                            Image alarm_image( *snap_image );
+                            /* The zones' alarm images cover only where they alarmed, and are only
+                               overlaid on a copy of the frame if its analysis image gets written */
+                            std::vector<Event::AlarmMask> alarm_masks;
                             for( int i = 0; i < n_zones; i++ )
                             {
                                 if ( zones[i]->Alarmed() )
                                 {
                                     if ( zones[i]->AlarmImage() )
                                     {
-                                        alarm_image.Overlay( *(zones[i]->AlarmImage()) );
-                                        got_anal_image = true;
+                                        Event::AlarmMask alarm_mask = { zones[i]->AlarmImage(), zones[i]->AlarmImageOrigin().X(), zones[i]->AlarmImageOrigin().Y() };
+                                        alarm_masks.push_back( alarm_mask );
                                     }
                                     if ( config.record_event_stats && state == ALARM )
                                     {
@@ -1545,20 +1596,11 @@ bool Monitor::Analyse()
                                     }
                                 }
                             }
-                            if ( got_anal_image )
-                            {
-                                if ( state == PREALARM )
-                                    Event::AddPreAlarmFrame( snap_image, *timestamp, score, &alarm_image );
-                                else
-                                    event->AddFrame( snap_image, *timestamp, score, &alarm_image );
-                            }
+                            const Event::AlarmMask *first_mask = alarm_masks.empty()?NULL:&alarm_masks[0];
+                            if ( state == PREALARM )
+                                Event::AddPreAlarmFrame( snap_image, *timestamp, score, first_mask, alarm_masks.size() );
                             else
-                            {
-                                if ( state == PREALARM )
-                                    Event::AddPreAlarmFrame( snap_image, *timestamp, score );
-                                else
-                                    event->AddFrame( snap_image, *timestamp, score );
-                            }
+                                event->AddFrame( snap_image, *timestamp, score, first_mask, alarm_masks.size() );
                         }
                         else
                         {
@@ -2798,7 +2840,8 @@ int Monitor::Capture()
             return( -1 );
         }
 
-        if ( ((unsigned int)index == shared_data->last_read_index) && (function > MONITOR) )
+        // Anything being read in the slots the camera is capturing into ahead of this one is being overwritten too
+        if ( (shared_data->last_read_index < (unsigned int)image_buffer_count) && (MOD_ADD( (int)shared_data->last_read_index, -index, image_buffer_count ) <= capture_buffer_reserve) && (function > MONITOR) )
         {
             Warning( "Buffer overrun at index %d, image %d, slow down capture, speed up analysis or increase ring buffer size", index, image_count );
             time_t now = time(0);
@@ -2811,7 +2854,8 @@ int Monitor::Capture()
             }
         }
 
-        gettimeofday( image_buffer[index].timestamp, NULL );
+        if ( !camera->CaptureTime( image_buffer[index].timestamp ) )
+            gettimeofday( image_buffer[index].timestamp, NULL );
         if ( config.timestamp_on_capture )
         {
             TimestampImage( capture_image, image_buffer[index].timestamp );
@@ -2828,7 +2872,15 @@ int Monitor::Capture()
             fps = double(fps_report_interval)/(now-last_fps_time);
             //Info( "%d -> %d -> %d", fps_report_interval, now, last_fps_time );
             //Info( "%d -> %d -> %lf -> %lf", now-last_fps_time, fps_report_interval/(now-last_fps_time), double(fps_report_interval)/(now-last_fps_time), fps );
-            Info( "%s: %d - Capturing at %.2lf fps", name, image_count, fps );
+            const char *report = camera->CaptureReport();
+            if ( report )
+            {
+                Info( "%s: %d - Capturing at %.2lf fps, %s", name, image_count, fps, report );
+            }
+            else
+            {
+                Info( "%s: %d - Capturing at %.2lf fps", name, image_count, fps );
+            }
             last_fps_time = now;
         }
 
@@ -3337,6 +3389,93 @@ bool Monitor::DumpSettings( char *output, bool verbose )
     return( true );
 }
 
+void MonitorStream::freeSwapImage( SwapImage *swap_image )
+{
+    if ( swap_image->buffer )
+    {
+        temp_image_memory -= swap_image->buffer_size;
+        delete[] swap_image->buffer;
+        swap_image->buffer = 0;
+        swap_image->buffer_size = 0;
+    }
+}
+
+// Keeps an encoded copy of a streamed frame for replay. Frames are held in
+// memory up to the configured limit, beyond that the oldest ones are either
+// written out to the swap path, if there is one, or discarded.
+bool MonitorStream::storeSwapImage( int temp_index, Image *image, const char *swap_path )
+{
+    static unsigned char jpeg_buffer[ZM_MAX_IMAGE_SIZE];
+    int jpeg_buffer_size = 0;
+
+    SwapImage *swap_image = &temp_image_buffer[temp_index];
+    freeSwapImage( swap_image );
+    swap_image->valid = false;
+
+    if ( !image->EncodeJpeg( jpeg_buffer, &jpeg_buffer_size, config.jpeg_file_quality ) )
+    {
+        Error( "Unable to encode frame %d for replay", temp_index );
+        return( false );
+    }
+
+    size_t memory_limit = (size_t)config.stream_replay_memory*1024*1024;
+    for ( int i = 1; (temp_image_memory+jpeg_buffer_size) > memory_limit && i < temp_image_buffer_count; i++ )
+    {
+        int old_index = MOD_ADD( temp_index, i, temp_image_buffer_count );
+        SwapImage *old_image = &temp_image_buffer[old_index];
+        if ( !old_image->buffer )
+            continue;
+
+        if ( swap_path[0] )
+        {
+            snprintf( old_image->file_name, sizeof(old_image->file_name), "%s/zmswap-i%05d.jpg", swap_path, old_index );
+            FILE *fdj = NULL;
+            if ( !(fdj = fopen( old_image->file_name, "wb" )) || fwrite( old_image->buffer, old_image->buffer_size, 1, fdj ) != 1 )
+            {
+                Error( "Can't write swap image '%s': %s", old_image->file_name, strerror(errno) );
+                old_image->valid = false;
+            }
+            if ( fdj )
+                fclose( fdj );
+        }
+        else
+        {
+            Debug( 3, "Discarding replay frame %d", old_index );
+            old_image->valid = false;
+        }
+        freeSwapImage( old_image );
+    }
+
+    if ( (temp_image_memory+jpeg_buffer_size) > memory_limit )
+    {
+        // Can only happen if the limit is smaller than a single frame
+        if ( !swap_path[0] )
+        {
+            Warning( "Replay memory limit of %dMB too small to hold a frame", config.stream_replay_memory );
+            return( false );
+        }
+        snprintf( swap_image->file_name, sizeof(swap_image->file_name), "%s/zmswap-i%05d.jpg", swap_path, temp_index );
+        FILE *fdj = NULL;
+        if ( !(fdj = fopen( swap_image->file_name, "wb" )) || fwrite( jpeg_buffer, jpeg_buffer_size, 1, fdj ) != 1 )
+        {
+            Error( "Can't write swap image '%s': %s", swap_image->file_name, strerror(errno) );
+            if ( fdj )
+                fclose( fdj );
+            return( false );
+        }
+        fclose( fdj );
+    }
+    else
+    {
+        swap_image->buffer = new uint8_t[jpeg_buffer_size];
+        memcpy( swap_image->buffer, jpeg_buffer, jpeg_buffer_size );
+        swap_image->buffer_size = jpeg_buffer_size;
+        temp_image_memory += jpeg_buffer_size;
+    }
+    swap_image->valid = true;
+    return( true );
+}
+
 bool MonitorStream::checkSwapPath( const char *path, bool create_path )
 {
     uid_t uid = getuid();
@@ -3626,6 +3765,11 @@ void MonitorStream::processCommand( const CmdMsg *msg )
         bool paused;
         bool enabled;
         bool forced;
+        int frames_sent;
+        int frames_dropped;
+        int send_queue;
+        int quality;
+        int scale;
     } status_data;
 
     status_data.id = monitor->Id();
@@ -3643,7 +3787,12 @@ void MonitorStream::processCommand( const CmdMsg *msg )
     //status_data.enabled = monitor->shared_data->active;
     status_data.enabled = monitor->trigger_data->trigger_state!=Monitor::TRIGGER_OFF;
     status_data.forced = monitor->trigger_data->trigger_state==Monitor::TRIGGER_ON;
-    Debug( 2, "L:%d, D:%d, P:%d, R:%d, d:%.3f, Z:%d, E:%d F:%d", 
+    status_data.frames_sent = frames_sent;
+    status_data.frames_dropped = frames_dropped;
+    status_data.send_queue = send_queue;
+    status_data.quality = adapt_quality;
+    status_data.scale = adapt_scale;
+    Debug( 2, "L:%d, D:%d, P:%d, R:%d, d:%.3f, Z:%d, E:%d F:%d, S:%d, Dr:%d, Q:%d, JQ:%d, Sc:%d", 
         status_data.buffer_level,
         status_data.delayed,
         status_data.paused,
@@ -3651,7 +3800,12 @@ void MonitorStream::processCommand( const CmdMsg *msg )
         status_data.delay,
         status_data.zoom,
         status_data.enabled,
-        status_data.forced
+        status_data.forced,
+        status_data.frames_sent,
+        status_data.frames_dropped,
+        status_data.send_queue,
+        status_data.quality,
+        status_data.scale
     );
 
     DataMsg status_msg;
@@ -3670,7 +3824,39 @@ void MonitorStream::processCommand( const CmdMsg *msg )
     updateFrameRate( monitor->GetFPS() );
 }
 
+bool MonitorStream::sendFrame( SwapImage *swap_image )
+{
+    if ( swap_image->buffer )
+        return( sendFrame( swap_image->buffer, swap_image->buffer_size, &swap_image->timestamp ) );
+    // Frames discarded from the replay buffer have nothing to send, which is not a reason to stop
+    if ( !swap_image->valid || !swap_image->file_name[0] )
+    {
+        Debug( 2, "No stored frame to send" );
+        return( true );
+    }
+    return( sendFrame( swap_image->file_name, &swap_image->timestamp ) );
+}
+
 bool MonitorStream::sendFrame( const char *filepath, struct timeval *timestamp )
+{
+    int img_buffer_size = 0;
+    static unsigned char img_buffer[ZM_MAX_IMAGE_SIZE];
+
+    FILE *fdj = NULL;
+    if ( (fdj = fopen( filepath, "r" )) )
+    {
+        img_buffer_size = fread( img_buffer, 1, sizeof(img_buffer), fdj );
+        fclose( fdj );
+    }
+    else
+    {
+        Error( "Can't open %s: %s", filepath, strerror(errno) );
+        return( false );
+    }
+    return( sendFrame( img_buffer, img_buffer_size, timestamp ) );
+}
+
+bool MonitorStream::sendFrame( const uint8_t *jpeg_buffer, int jpeg_buffer_size, struct timeval *timestamp )
 {
     bool send_raw = ((scale>=ZM_SCALE_BASE)&&(zoom==ZM_SCALE_BASE));
 
@@ -3678,38 +3864,34 @@ bool MonitorStream::sendFrame( const char *filepath, struct timeval *timestamp )
         send_raw = false;
     if ( !config.timestamp_on_capture && timestamp )
         send_raw = false;
+    // Stored frames have to be re-encoded if the stream has been degraded
+    if ( adapt_quality < config.jpeg_stream_quality || adapt_scale != ZM_SCALE_BASE )
+        send_raw = false;
 
     if ( !send_raw )
     {
-        Image temp_image( filepath );
+        Image temp_image;
+        if ( !temp_image.DecodeJpeg( jpeg_buffer, jpeg_buffer_size, ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB ) )
+        {
+            Error( "Unable to decode stored stream frame" );
+            return( true );
+        }
 
         return( sendFrame( &temp_image, timestamp ) );
     }
     else
     {
-        int img_buffer_size = 0;
-        static unsigned char img_buffer[ZM_MAX_IMAGE_SIZE];
-
-        FILE *fdj = NULL;
-        if ( (fdj = fopen( filepath, "r" )) )
-        {
-            img_buffer_size = fread( img_buffer, 1, sizeof(img_buffer), fdj );
-            fclose( fdj );
-        }
-        else
-        {
-            Error( "Can't open %s: %s", filepath, strerror(errno) );
-            return( false );
-        }
+        if ( !checkSendQueue() )
+            return( true );
 
         // Calculate how long it takes to actually send the frame
         struct timeval frameStartTime;
         gettimeofday( &frameStartTime, NULL );
         
         fprintf( stdout, "--ZoneMinderFrame\r\n" );
-        fprintf( stdout, "Content-Length: %d\r\n", img_buffer_size );
+        fprintf( stdout, "Content-Length: %d\r\n", jpeg_buffer_size );
         fprintf( stdout, "Content-Type: image/jpeg\r\n\r\n" );
-        if ( fwrite( img_buffer, img_buffer_size, 1, stdout ) != 1 )
+        if ( fwrite( jpeg_buffer, jpeg_buffer_size, 1, stdout ) != 1 )
         {
             if ( !zm_terminate )
                 Error( "Unable to send stream frame: %s", strerror(errno) );
@@ -3721,12 +3903,9 @@ bool MonitorStream::sendFrame( const char *filepath, struct timeval *timestamp )
         struct timeval frameEndTime;
         gettimeofday( &frameEndTime, NULL );
 
-        int frameSendTime = tvDiffMsec( frameStartTime, frameEndTime );
-        if ( frameSendTime > 1000/maxfps )
-        {
-            maxfps /= 2;
-            Error( "Frame send time %d msec too slow, throttling maxfps to %.2f", frameSendTime, maxfps );
-        }
+        last_frame_size = jpeg_buffer_size;
+        frames_sent++;
+        adaptStream( tvDiffMsec( frameStartTime, frameEndTime ) );
 
         last_frame_sent = TV_2_FLOAT( now );
 
@@ -3737,6 +3916,15 @@ bool MonitorStream::sendFrame( const char *filepath, struct timeval *timestamp )
 
 bool MonitorStream::sendFrame( Image *image, struct timeval *timestamp )
 {
+#if HAVE_LIBAVCODEC
+    if ( type != STREAM_MPEG )
+#endif // HAVE_LIBAVCODEC
+    {
+        // No point preparing and encoding a frame the connection has no room for
+        if ( !checkSendQueue() )
+            return( true );
+    }
+
     Image *send_image = prepareImage( image );
     if ( !config.timestamp_on_capture && timestamp )
         monitor->TimestampImage( send_image, timestamp );
@@ -3773,7 +3961,7 @@ bool MonitorStream::sendFrame( Image *image, struct timeval *timestamp )
         switch( type )
         {
             case STREAM_JPEG :
-                send_image->EncodeJpeg( img_buffer, &img_buffer_size );
+                send_image->EncodeJpeg( img_buffer, &img_buffer_size, adapt_quality );
                 fprintf( stdout, "Content-Type: image/jpeg\r\n" );
                 break;
             case STREAM_RAW :
@@ -3804,12 +3992,9 @@ bool MonitorStream::sendFrame( Image *image, struct timeval *timestamp )
         struct timeval frameEndTime;
         gettimeofday( &frameEndTime, NULL );
 
-        int frameSendTime = tvDiffMsec( frameStartTime, frameEndTime );
-        if ( frameSendTime > 1000/maxfps )
-        {
-            maxfps /= 1.5;
-            Error( "Frame send time %d msec too slow, throttling maxfps to %.2f", frameSendTime, maxfps );
-        }
+        last_frame_size = img_buffer_size;
+        frames_sent++;
+        adaptStream( tvDiffMsec( frameStartTime, frameEndTime ) );
     }
     last_frame_sent = TV_2_FLOAT( now );
     return( true );
@@ -3845,38 +4030,47 @@ void MonitorStream::runStream()
     temp_read_index = temp_image_buffer_count;
     temp_write_index = temp_image_buffer_count;
 
+    temp_image_memory = 0;
+
     char swap_path[PATH_MAX] = "";
     bool buffered_playback = false;
 
     if ( connkey && playback_buffer > 0 )
     {
-        Debug( 2, "Checking swap image location" );
-        Debug( 3, "Checking swap image path" );
-        strncpy( swap_path, config.path_swap, sizeof(swap_path) );
-        if ( checkSwapPath( swap_path, false ) )
+        buffered_playback = true;
+
+        // Frames are kept in memory, the swap path is only needed for any that don't fit
+        if ( config.stream_replay_spill )
         {
-            snprintf( &(swap_path[strlen(swap_path)]), sizeof(swap_path)-strlen(swap_path), "/zmswap-m%d", monitor->Id() );
-            if ( checkSwapPath( swap_path, true ) )
+            bool swap_valid = false;
+
+            Debug( 2, "Checking swap image location" );
+            Debug( 3, "Checking swap image path" );
+            strncpy( swap_path, config.path_swap, sizeof(swap_path) );
+            if ( checkSwapPath( swap_path, false ) )
             {
-                snprintf( &(swap_path[strlen(swap_path)]), sizeof(swap_path)-strlen(swap_path), "/zmswap-q%06d", connkey );
+                snprintf( &(swap_path[strlen(swap_path)]), sizeof(swap_path)-strlen(swap_path), "/zmswap-m%d", monitor->Id() );
                 if ( checkSwapPath( swap_path, true ) )
                 {
-                    buffered_playback = true;
+                    snprintf( &(swap_path[strlen(swap_path)]), sizeof(swap_path)-strlen(swap_path), "/zmswap-q%06d", connkey );
+                    if ( checkSwapPath( swap_path, true ) )
+                    {
+                        swap_valid = true;
+                    }
                 }
             }
-        }
 
-        if ( !buffered_playback )
-        {
-            Error( "Unable to validate swap image path, disabling buffered playback" );
-        }
-        else
-        {
-            Debug( 2, "Assigning temporary buffer" );
-            temp_image_buffer = new SwapImage[temp_image_buffer_count];
-            memset( temp_image_buffer, 0, sizeof(*temp_image_buffer)*temp_image_buffer_count );
-            Debug( 2, "Assigned temporary buffer" );
+            if ( !swap_valid )
+            {
+                Error( "Unable to validate swap image path, buffered frames will only be held in memory" );
+                swap_path[0] = '\0';
+            }
         }
+
+        Debug( 2, "Assigning temporary buffer" );
+        temp_image_buffer = new SwapImage[temp_image_buffer_count];
+        memset( temp_image_buffer, 0, sizeof(*temp_image_buffer)*temp_image_buffer_count );
+        Debug( 2, "Assigned temporary buffer" );
     }
 
     float max_secs_since_last_sent_frame = 10.0; //should be > keep alive amount (5 secs)
@@ -3939,7 +4133,7 @@ void MonitorStream::runStream()
                             {
                                 Debug( 2, "Sending delayed frame %d", temp_index );
                                 // Send the next frame
-                                if ( !sendFrame( temp_image_buffer[temp_index].file_name, &temp_image_buffer[temp_index].timestamp ) )
+                                if ( !sendFrame( &temp_image_buffer[temp_index] ) )
                                     zm_terminate = true;
                                 memcpy( &last_frame_timestamp, &(swap_image->timestamp), sizeof(last_frame_timestamp) );
                                 //frame_sent = true;
@@ -3950,15 +4144,24 @@ void MonitorStream::runStream()
                 }
                 else if ( step != 0 )
                 {
-                    temp_read_index = MOD_ADD( temp_read_index, (step>0?1:-1), temp_image_buffer_count );
+                    int temp_index = MOD_ADD( temp_read_index, (step>0?1:-1), temp_image_buffer_count );
 
-                    SwapImage *swap_image = &temp_image_buffer[temp_read_index];
+                    SwapImage *swap_image = &temp_image_buffer[temp_index];
 
-                    // Send the next frame
-                    if ( !sendFrame( temp_image_buffer[temp_read_index].file_name, &temp_image_buffer[temp_read_index].timestamp ) )
-                        zm_terminate = true;
-                    memcpy( &last_frame_timestamp, &(swap_image->timestamp), sizeof(last_frame_timestamp) );
-                    //frame_sent = true;
+                    // Don't step on to frames that have been discarded from the replay buffer
+                    if ( swap_image->valid )
+                    {
+                        temp_read_index = temp_index;
+                        // Send the next frame
+                        if ( !sendFrame( swap_image ) )
+                            zm_terminate = true;
+                        memcpy( &last_frame_timestamp, &(swap_image->timestamp), sizeof(last_frame_timestamp) );
+                        //frame_sent = true;
+                    }
+                    else
+                    {
+                        Debug( 2, "Replay frame %d has been discarded, not stepping", temp_index );
+                    }
                     step = 0;
                 }
                 else
@@ -3966,12 +4169,12 @@ void MonitorStream::runStream()
                     int temp_index = MOD_ADD( temp_read_index, 0, temp_image_buffer_count );
 
                      double actual_delta_time = TV_2_FLOAT( now ) - last_frame_sent;
-                     if ( got_command || actual_delta_time > 5 )
+                     if ( (got_command || actual_delta_time > 5) && temp_image_buffer[temp_index].valid )
                      {
                         // Send keepalive
                         Debug( 2, "Sending keepalive frame %d", temp_index );
                         // Send the next frame
-                        if ( !sendFrame( temp_image_buffer[temp_index].file_name, &temp_image_buffer[temp_index].timestamp ) )
+                        if ( !sendFrame( &temp_image_buffer[temp_index] ) )
                             zm_terminate = true;
                         //frame_sent = true;
                     }
@@ -4016,13 +4219,8 @@ void MonitorStream::runStream()
                     {
                         int temp_index = temp_write_index%temp_image_buffer_count;
                         Debug( 2, "Storing frame %d", temp_index );
-                        if ( !temp_image_buffer[temp_index].valid )
-                        {
-                            snprintf( temp_image_buffer[temp_index].file_name, sizeof(temp_image_buffer[0].file_name), "%s/zmswap-i%05d.jpg", swap_path, temp_index );
-                            temp_image_buffer[temp_index].valid = true;
-                        }
                         memcpy( &(temp_image_buffer[temp_index].timestamp), monitor->image_buffer[index].timestamp, sizeof(temp_image_buffer[0].timestamp) );
-                        monitor->image_buffer[index].image->WriteJpeg( temp_image_buffer[temp_index].file_name, config.jpeg_file_quality );
+                        storeSwapImage( temp_index, monitor->image_buffer[index].image, swap_path );
                         temp_write_index = MOD_ADD( temp_write_index, 1, temp_image_buffer_count );
                         if ( temp_write_index == temp_read_index )
                         {
@@ -4062,6 +4260,13 @@ void MonitorStream::runStream()
         }
     }
     if ( buffered_playback )
+    {
+        for ( int i = 0; i < temp_image_buffer_count; i++ )
+            freeSwapImage( &temp_image_buffer[i] );
+        delete[] temp_image_buffer;
+        temp_image_buffer = 0;
+    }
+    if ( buffered_playback && swap_path[0] )
     {
         char swap_path[PATH_MAX] = "";
 
@@ -4128,8 +4333,7 @@ void Monitor::SingleImage( int scale)
 
     if ( scale != ZM_SCALE_BASE )
     {
-        scaled_image.Assign( *snap_image );
-        scaled_image.Scale( scale );
+        scaled_image.Scale( ImageView( *snap_image ), scale );
         snap_image = &scaled_image;
     }
     if ( !config.timestamp_on_capture )
@@ -4152,8 +4356,7 @@ void Monitor::SingleImageRaw( int scale)
 
     if ( scale != ZM_SCALE_BASE )
     {
-        scaled_image.Assign( *snap_image );
-        scaled_image.Scale( scale );
+        scaled_image.Scale( ImageView( *snap_image ), scale );
         snap_image = &scaled_image;
     }
     if ( !config.timestamp_on_capture )
@@ -4177,8 +4380,7 @@ void Monitor::SingleImageZip( int scale)
 
     if ( scale != ZM_SCALE_BASE )
     {
-        scaled_image.Assign( *snap_image );
-        scaled_image.Scale( scale );
+        scaled_image.Scale( ImageView( *snap_image ), scale );
         snap_image = &scaled_image;
     }
     if ( !config.timestamp_on_capture )
@@ -92,6 +92,8 @@ protected:
 
 	typedef enum { CLOSE_TIME, CLOSE_IDLE, CLOSE_ALARM } EventCloseMode;
 
+	enum { SIGNAL_CHECK_REFRESH=1000 };	// Signal checks made before different points are sampled
+
 	/* sizeof(SharedData) expected to be 336 bytes on 32bit and 64bit */
 	typedef struct
 	{
@@ -224,6 +226,7 @@ protected:
 	char			label_format[64];	    // The format of the timestamp on the images
 	Coord			label_coord;		    // The coordinates of the timestamp on the images
 	int				image_buffer_count;     // Size of circular image buffer, at least twice the size of the pre_event_count
+	int				capture_buffer_reserve; // Slots added to the image buffer for the camera to capture into ahead of the current image
 	int				warmup_count;		    // How many images to process before looking for events
 	int				pre_event_count;	    // How many images to hold and prepend to an alarm event
 	int				post_event_count;	    // How many unalarmed images must occur before the alarm state is reset
@@ -238,6 +241,11 @@ protected:
 	int				alarm_ref_blend_perc;		    // Percentage of new image going into reference image during alarm.
 	bool			track_motion;		    // Whether this monitor tries to track detected motion 
     Rgb             signal_check_colour;    // The colour that the camera will emit when no video signal detected
+    uint8_t         signal_check_pixel[4];  // The signal check colour as it is laid out in captured images
+    uint8_t         signal_check_mask[4];   // The bytes of the signal check pixel that are compared
+    unsigned int    signal_check_colours;   // The colours the signal check pixel is laid out for
+    int             signal_check_refresh;   // How many more checks sample the same points
+    std::vector<unsigned int> signal_check_indexes; // The points sampled when checking for signal
 
 	double			fps;
 	Image			delta_image;
@@ -424,6 +432,8 @@ protected:
         bool            valid;
         struct timeval  timestamp;
         char            file_name[PATH_MAX];
+        uint8_t         *buffer;            // Encoded frame when held in memory, otherwise read from file_name
+        int             buffer_size;
     } SwapImage;
 
 private:
@@ -431,6 +441,7 @@ private:
     int temp_image_buffer_count;
     int temp_read_index;
     int temp_write_index;
+    size_t temp_image_memory;
 
 protected:
     time_t ttl;
@@ -444,7 +455,11 @@ protected:
 protected:
     bool checkSwapPath( const char *path, bool create_path );
 
+    bool storeSwapImage( int temp_index, Image *image, const char *swap_path );
+    void freeSwapImage( SwapImage *swap_image );
+    bool sendFrame( SwapImage *swap_image );
     bool sendFrame( const char *filepath, struct timeval *timestamp );
+    bool sendFrame( const uint8_t *jpeg_buffer, int jpeg_buffer_size, struct timeval *timestamp );
     bool sendFrame( Image *image, struct timeval *timestamp );
     void processCommand( const CmdMsg *msg );
 
@@ -123,7 +123,11 @@ void VideoStream::SetupCodec( int colours, int subpixelorder, int width, int hei
 	    break;
 	  }
 	  case ZM_COLOUR_GRAY8:
-	    pf = PIX_FMT_GRAY8;
+	    if(subpixelorder == ZM_SUBPIX_ORDER_YUV420P) {
+	      pf = PIX_FMT_YUV420P;
+	    } else {
+	      pf = PIX_FMT_GRAY8;
+	    }
 	    break;
 	  default:
 	    Panic("Unexpected colours: %d",colours);
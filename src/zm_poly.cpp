@@ -21,6 +21,74 @@
 #include "zm_poly.h"
 
 #include <math.h>
+#include <string.h>
+#include <algorithm>
+
+/* Sorts the runs and merges those that touch or overlap, dropping anything outside limits */
+void SpanList::Build( std::vector<Run> &runs, const Box *limits )
+{
+	rows.clear();
+	spans.clear();
+	pixels = 0;
+	lo_y = 0;
+	hi_y = -1;
+
+	if ( limits )
+	{
+		std::vector<Run>::iterator clipped = runs.begin();
+		for ( std::vector<Run>::iterator run = runs.begin(); run != runs.end(); run++ )
+		{
+			if ( run->y < limits->LoY() || run->y > limits->HiY() )
+				continue;
+			run->lo_x = std::max( run->lo_x, limits->LoX() );
+			run->hi_x = std::min( run->hi_x, limits->HiX() );
+			if ( run->lo_x <= run->hi_x )
+				*clipped++ = *run;
+		}
+		runs.erase( clipped, runs.end() );
+	}
+	if ( runs.empty() )
+		return;
+
+	std::sort( runs.begin(), runs.end() );
+	lo_y = runs.front().y;
+	hi_y = runs.back().y;
+	rows.resize( (hi_y-lo_y)+2 );
+
+	int y = lo_y;
+	rows[0] = 0;
+	for ( std::vector<Run>::const_iterator run = runs.begin(); run != runs.end(); run++ )
+	{
+		if ( run->lo_x > run->hi_x )
+			continue;
+		while ( y < run->y )
+			rows[(++y)-lo_y] = spans.size();
+		if ( spans.size() > rows[y-lo_y] && run->lo_x <= spans.back().hi_x+1 )
+		{
+			if ( run->hi_x > spans.back().hi_x )
+				spans.back().hi_x = run->hi_x;
+			continue;
+		}
+		Span span = { run->lo_x, run->hi_x };
+		spans.push_back( span );
+	}
+	rows[(hi_y-lo_y)+1] = spans.size();
+
+	for ( std::vector<Span>::const_iterator span = spans.begin(); span != spans.end(); span++ )
+		pixels += (span->hi_x-span->lo_x)+1;
+}
+
+void SpanList::GetRuns( std::vector<Run> &runs ) const
+{
+	for ( int y = lo_y; y <= hi_y; y++ )
+	{
+		for ( const Span *span = Begin( y ); span != End( y ); span++ )
+		{
+			Run run = { y, span->lo_x, span->hi_x };
+			runs.push_back( run );
+		}
+	}
+}
 
 void Polygon::calcArea()
 {
@@ -73,9 +141,10 @@ Polygon::Polygon( int p_n_coords, const Coord *p_coords ) : n_coords( p_n_coords
 	extent = Box( min_x, min_y, max_x, max_y );
 	calcArea();
 	calcCentre();
+	calcSpans();
 }
 
-Polygon::Polygon( const Polygon &p_polygon ) : n_coords( p_polygon.n_coords ), extent( p_polygon.extent ), area( p_polygon.area ), centre( p_polygon.centre )
+Polygon::Polygon( const Polygon &p_polygon ) : n_coords( p_polygon.n_coords ), extent( p_polygon.extent ), area( p_polygon.area ), centre( p_polygon.centre ), fill_spans( p_polygon.fill_spans ), outline_spans( p_polygon.outline_spans )
 {
 	coords = new Coord[n_coords];
 	for( int i = 0; i < n_coords; i++ )
@@ -99,9 +168,142 @@ Polygon &Polygon::operator=( const Polygon &p_polygon )
 	extent = p_polygon.extent;
 	area = p_polygon.area;
 	centre = p_polygon.centre;
+	fill_spans = p_polygon.fill_spans;
+	outline_spans = p_polygon.outline_spans;
 	return( *this );
 }
 
+/* Rasterises the polygon once, so that it can be filled, outlined or used as a mask as often as needed */
+void Polygon::calcSpans()
+{
+	std::vector<SpanList::Run> runs;
+
+	/* The inside, scanned a line at a time with an edge table */
+	int n_global_edges = 0;
+	std::vector<Edge> global_edges( n_coords );
+	for ( int j = 0, i = n_coords-1; j < n_coords; i = j++ )
+	{
+		const Coord &p1 = coords[i];
+		const Coord &p2 = coords[j];
+
+		int x1 = p1.X();
+		int x2 = p2.X();
+		int y1 = p1.Y();
+		int y2 = p2.Y();
+
+		if ( y1 == y2 )
+			continue;
+
+		double dx = x2 - x1;
+		double dy = y2 - y1;
+
+		global_edges[n_global_edges].min_y = y1<y2?y1:y2;
+		global_edges[n_global_edges].max_y = y1<y2?y2:y1;
+		global_edges[n_global_edges].min_x = y1<y2?x1:x2;
+		global_edges[n_global_edges]._1_m = dx/dy;
+		n_global_edges++;
+	}
+
+	if ( n_global_edges )
+	{
+		qsort( &global_edges[0], n_global_edges, sizeof(global_edges[0]), Edge::CompareYX );
+
+		int n_active_edges = 0;
+		std::vector<Edge> active_edges( n_global_edges );
+		int y = global_edges[0].min_y;
+		do
+		{
+			for ( int i = 0; i < n_global_edges; i++ )
+			{
+				if ( global_edges[i].min_y == y )
+				{
+					active_edges[n_active_edges++] = global_edges[i];
+					if ( i < (n_global_edges-1) )
+					{
+						memmove( &global_edges[i], &global_edges[i+1], sizeof(global_edges[0])*(n_global_edges-i-1) );
+						i--;
+					}
+					n_global_edges--;
+				}
+				else
+				{
+					break;
+				}
+			}
+			qsort( &active_edges[0], n_active_edges, sizeof(active_edges[0]), Edge::CompareX );
+			for ( int i = 0; i < (n_active_edges-1); i += 2 )
+			{
+				SpanList::Run run = { y, int(round(active_edges[i].min_x)), int(round(active_edges[i+1].min_x)) };
+				if ( run.lo_x <= run.hi_x )
+					runs.push_back( run );
+			}
+			y++;
+			for ( int i = n_active_edges-1; i >= 0; i-- )
+			{
+				if ( y >= active_edges[i].max_y ) // Or >= as per sheets
+				{
+					if ( i < (n_active_edges-1) )
+					{
+						memmove( &active_edges[i], &active_edges[i+1], sizeof(active_edges[0])*(n_active_edges-i-1) );
+					}
+					n_active_edges--;
+				}
+				else
+				{
+					active_edges[i].min_x += active_edges[i]._1_m;
+				}
+			}
+		} while ( n_global_edges || n_active_edges );
+	}
+	fill_spans.Build( runs );
+
+	/* The edges, stepping along whichever axis each one is longer in */
+	runs.clear();
+	for ( int j = 0, i = n_coords-1; j < n_coords; i = j++ )
+	{
+		const Coord &p1 = coords[i];
+		const Coord &p2 = coords[j];
+
+		int x1 = p1.X();
+		int x2 = p2.X();
+		int y1 = p1.Y();
+		int y2 = p2.Y();
+
+		double dx = x2 - x1;
+		double dy = y2 - y1;
+
+		if ( fabs(dx) <= fabs(dy) )
+		{
+			if ( y1 == y2 )
+				continue;
+			double grad = dx/dy;
+
+			double x;
+			int y, yinc = (y1<y2)?1:-1;
+			grad *= yinc;
+			for ( x = x1, y = y1; y != y2; y += yinc, x += grad )
+			{
+				SpanList::Run run = { y, int(round(x)), int(round(x)) };
+				runs.push_back( run );
+			}
+		}
+		else
+		{
+			double grad = dy/dx;
+
+			double y;
+			int x, xinc = (x1<x2)?1:-1;
+			grad *= xinc;
+			for ( y = y1, x = x1; x != x2; x += xinc, y += grad )
+			{
+				SpanList::Run run = { int(round(y)), x, x };
+				runs.push_back( run );
+			}
+		}
+	}
+	outline_spans.Build( runs );
+}
+
 bool Polygon::isInside( const Coord &coord ) const
 {
 	bool inside = false;
@@ -25,6 +25,57 @@
 #include "zm_box.h"
 
 #include <math.h>
+#include <vector>
+
+//
+// The pixels covered by a shape, held as runs of pixels along each of
+// its rows so that it can be drawn or masked with without an image.
+//
+class SpanList
+{
+public:
+	struct Span
+	{
+		int lo_x;
+		int hi_x;	// Inclusive
+	};
+
+	struct Run
+	{
+		int y;
+		int lo_x;
+		int hi_x;
+
+		inline bool operator<( const Run &run ) const
+		{
+			return( y < run.y || (y == run.y && lo_x < run.lo_x) );
+		}
+	};
+
+protected:
+	int lo_y;
+	int hi_y;
+	std::vector<unsigned int> rows;	// Index of the first span of each row, and of the end of the last
+	std::vector<Span> spans;
+	unsigned int pixels;
+
+public:
+	inline SpanList() : lo_y( 0 ), hi_y( -1 ), pixels( 0 )
+	{
+	}
+
+	void Build( std::vector<Run> &runs, const Box *limits=0 );
+	void GetRuns( std::vector<Run> &runs ) const;
+
+	inline bool Empty() const { return( hi_y < lo_y ); }
+	inline int LoY() const { return( lo_y ); }
+	inline int HiY() const { return( hi_y ); }
+	inline unsigned int Pixels() const { return( pixels ); }
+
+	// Spans of a row from LoY() to HiY(), in order and neither touching nor overlapping
+	inline const Span *Begin( int y ) const { return( &spans[0] + rows[y-lo_y] ); }
+	inline const Span *End( int y ) const { return( &spans[0] + rows[y-lo_y+1] ); }
+};
 
 //
 // Class used for storing a box, which is defined as a region
@@ -81,11 +132,14 @@ protected:
 	Coord centre;
 	Edge *edges;
 	Slice *slices;
+	SpanList fill_spans;
+	SpanList outline_spans;
 
 protected:
 	void initialiseEdges();
 	void calcArea();
 	void calcCentre();
+	void calcSpans();
 
 public:
 	inline Polygon() : n_coords( 0 ), coords( 0 ), area( 0 )
@@ -119,6 +173,8 @@ public:
 	{
 		return( centre );
 	}
+	inline const SpanList &FillSpans() const { return( fill_spans ); }
+	inline const SpanList &OutlineSpans() const { return( outline_spans ); }
 	bool isInside( const Coord &coord ) const;
 };
 
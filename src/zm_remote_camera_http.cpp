@@ -20,12 +20,16 @@
 #include "zm_remote_camera_http.h"
 
 #include "zm_mem_utils.h"
+#include "zm_http_capture.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <errno.h>
 #include <netdb.h>
 
+HttpCaptureThread *RemoteCameraHttp::capture_thread = NULL;
+int RemoteCameraHttp::shared_cameras = 0;
+
 RemoteCameraHttp::RemoteCameraHttp( int p_id, const std::string &p_method, const std::string &p_host, const std::string &p_port, const std::string &p_path, int p_width, int p_height, int p_colours, int p_brightness, int p_contrast, int p_hue, int p_colour, bool p_capture ) :
     RemoteCamera( p_id, "http", p_host, p_port, p_path, p_width, p_height, p_colours, p_brightness, p_contrast, p_hue, p_colour, p_capture )
 {
@@ -40,6 +44,9 @@ RemoteCameraHttp::RemoteCameraHttp( int p_id, const std::string &p_method, const
         method = REGEXP;
     else
         Fatal( "Unrecognised method '%s' when creating HTTP camera %d", p_method.c_str(), id );
+    // Only the simple parser can pick up where it left off when a shared socket runs dry
+    shared = config.http_shared_capture && method == SIMPLE;
+    report[0] = '\0';
     if ( capture )
     {
         Initialise();
@@ -84,6 +91,37 @@ void RemoteCameraHttp::Initialise()
     mode = SINGLE_IMAGE;
     format = UNDEF;
     state = HEADER;
+    scan_offset = 0;
+
+    if ( shared )
+    {
+        if ( !capture_thread )
+        {
+            Debug( 3, "Starting HTTP capture thread" );
+            capture_thread = new HttpCaptureThread();
+            capture_thread->start();
+        }
+        capture_thread->addCamera( this );
+        shared_cameras++;
+    }
+}
+
+void RemoteCameraHttp::Terminate()
+{
+    if ( shared )
+    {
+        capture_thread->removeCamera( this );
+        if ( --shared_cameras == 0 )
+        {
+            Debug( 3, "Stopping HTTP capture thread" );
+            capture_thread->stop();
+            capture_thread->join();
+            delete capture_thread;
+            capture_thread = NULL;
+        }
+        return;
+    }
+    Disconnect();
 }
 
 int RemoteCameraHttp::Connect()
@@ -142,59 +180,44 @@ int RemoteCameraHttp::SendRequest()
     return( 0 );
 }
 
+// Reads whatever has arrived, or exactly bytes_expected if given, straight into the end of the buffer
 int RemoteCameraHttp::ReadData( Buffer &buffer, int bytes_expected )
 {
-    fd_set rfds;
-    FD_ZERO(&rfds);
-    FD_SET(sd, &rfds);
-
-    struct timeval temp_timeout = timeout;
-
-    int n_found = select( sd+1, &rfds, NULL, NULL, &temp_timeout );
-    if( n_found == 0 )
-    {
-        Warning( "Select timed out" );
-        Disconnect();
-        return( 0 );
-    }
-    else if ( n_found < 0)
+    // A shared socket is non-blocking and the capture thread has already waited for it
+    if ( !shared )
     {
-        Error( "Select error: %s", strerror(errno) );
-        return( -1 );
-    }
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(sd, &rfds);
 
-    int total_bytes_to_read = 0;
+        struct timeval temp_timeout = timeout;
 
-    if ( bytes_expected )
-    {
-        total_bytes_to_read = bytes_expected;
-    }
-    else
-    {
-        if ( ioctl( sd, FIONREAD, &total_bytes_to_read ) < 0 )
+        int n_found = select( sd+1, &rfds, NULL, NULL, &temp_timeout );
+        if( n_found == 0 )
         {
-            Error( "Can't ioctl(): %s", strerror(errno) );
-            return( -1 );
-        }
-
-        if ( total_bytes_to_read == 0 )
-        {
-            Debug( 3, "Socket closed" );
+            Warning( "Select timed out" );
             Disconnect();
             return( 0 );
         }
+        else if ( n_found < 0)
+        {
+            Error( "Select error: %s", strerror(errno) );
+            return( -1 );
+        }
     }
-    Debug( 3, "Expecting %d bytes", total_bytes_to_read );
 
     int total_bytes_read = 0;
     do
     {
-        static unsigned char temp_buffer[ZM_NETWORK_BUFSIZ];
-        int bytes_to_read = (unsigned int)total_bytes_to_read>(unsigned int)sizeof(temp_buffer)?sizeof(temp_buffer):total_bytes_to_read;
-        int bytes_read = read( sd, temp_buffer, bytes_to_read );
+        int bytes_to_read = bytes_expected ? bytes_expected-total_bytes_read : ZM_NETWORK_BUFSIZ;
+        int bytes_read = read( sd, buffer.space( bytes_to_read ), bytes_to_read );
 
         if ( bytes_read < 0)
         {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN && shared )
+                return( total_bytes_read?total_bytes_read:READ_PENDING );
             Error( "Read error: %s", strerror(errno) );
             return( -1 );
         }
@@ -204,17 +227,11 @@ int RemoteCameraHttp::ReadData( Buffer &buffer, int bytes_expected )
             Disconnect();
             return( 0 );
         }
-        else if ( bytes_read < bytes_to_read )
-        {
-            Error( "Incomplete read, expected %d, got %d", bytes_to_read, bytes_read );
-            return( -1 );
-        }
         Debug( 3, "Read %d bytes", bytes_read );
-        buffer.append( temp_buffer, bytes_read );
+        buffer.grow( bytes_read );
         total_bytes_read += bytes_read;
-        total_bytes_to_read -= bytes_read;
     }
-    while ( total_bytes_to_read );
+    while ( total_bytes_read < bytes_expected );
 
     return( total_bytes_read );
 }
@@ -540,532 +557,364 @@ int RemoteCameraHttp::GetResponse()
         {
             Warning( "Unable to use netcam regexps as not compiled with libpcre" );
         }
-        static const char *http_match = "HTTP/";
-        static const char *connection_match = "Connection:";
-        static const char *content_length_match = "Content-length:";
-        static const char *content_type_match = "Content-type:";
-        static const char *boundary_match = "boundary=";
-        static int http_match_len = 0;
-        static int connection_match_len = 0;
-        static int content_length_match_len = 0;
-        static int content_type_match_len = 0;
-        static int boundary_match_len = 0;
+        return( ParseResponse() );
+    }
+    return( 0 );
+}
+
+// Returns the next complete line in the buffer, with its line ending removed,
+// or 0 if more data is needed. Only data not yet searched is looked at again.
+char *RemoteCameraHttp::GetLine()
+{
+    unsigned char *lf = (unsigned char *)memchr( buffer.head()+scan_offset, '\n', buffer.size()-scan_offset );
+    if ( !lf )
+    {
+        scan_offset = buffer.size();
+        return( 0 );
+    }
+    char *line = (char *)buffer.head();
+    int line_len = lf-buffer.head();
+    scan_offset = 0;
+    // Consuming only moves the head, so the line stays put until more is read
+    buffer.consume( line_len+1 );
+    if ( line_len && line[line_len-1] == '\r' )
+        line_len--;
+    line[line_len] = '\0';
+    return( line );
+}
 
-        if ( !http_match_len )
-            http_match_len = strlen( http_match );
-        if ( !connection_match_len )
-            connection_match_len = strlen( connection_match );
-        if ( !content_length_match_len )
-            content_length_match_len = strlen( content_length_match );
-        if ( !content_type_match_len )
-            content_type_match_len = strlen( content_type_match );
-        if ( !boundary_match_len )
-            boundary_match_len = strlen( boundary_match );
+// Reads more of the response, giving the same results as ReadData
+int RemoteCameraHttp::ReadMore( const char *what )
+{
+    if ( scan_offset > MAX_HEADER_LINE )
+    {
+        Error( "No end of line found in %d bytes of %s", scan_offset, what );
+        return( -1 );
+    }
+    int buffer_len = ReadData( buffer );
+    if ( buffer_len == 0 )
+    {
+        Error( "Connection dropped by remote end" );
+    }
+    else if ( buffer_len < 0 && buffer_len != READ_PENDING )
+    {
+        Error( "Unable to read %s", what );
+    }
+    return( buffer_len );
+}
 
-        static int n_headers;
-        //static char *headers[32];
+// Matches a header line against a header name, returning the value if it matches
+static const char *headerValue( const char *line, const char *name, int name_len )
+{
+    if ( strncasecmp( line, name, name_len ) != 0 )
+        return( 0 );
+    line += name_len;
+    return( line + strspn( line, " \t" ) );
+}
 
-        static int n_subheaders;
-        //static char *subheaders[32];
+void RemoteCameraHttp::SetContentType( const char *value )
+{
+    int type_len = strcspn( value, "; " );
+    if ( type_len >= (int)sizeof(content_type) )
+        type_len = sizeof(content_type)-1;
+    strncpy( content_type, value, type_len );
+    content_type[type_len] = '\0';
+    Debug( 3, "Got content type '%s'", content_type );
+
+    const char *boundary = strcasestr( value+type_len, "boundary=" );
+    if ( boundary )
+    {
+        boundary += 9;
+        boundary += strspn( boundary, "\"-" );
+        int boundary_len = strcspn( boundary, "\"; " );
+        if ( boundary_len > (int)sizeof(content_boundary)-3 )
+            boundary_len = sizeof(content_boundary)-3;
+        content_boundary_len = snprintf( content_boundary, sizeof(content_boundary), "--%.*s", boundary_len, boundary );
+        Debug( 3, "Got content boundary '%s'", content_boundary );
+    }
+}
 
-        static char *http_header;
-        static char *connection_header;
-        static char *content_length_header;
-        static char *content_type_header;
-        static char *boundary_header;
-        static char subcontent_length_header[32];
-        static char subcontent_type_header[64];
-    
-        static char http_version[16];
-        static char status_code[16];
-        static char status_mesg[256];
-        static char connection_type[32];
-        static int content_length;
-        static char content_type[32];
-        static char content_boundary[64];
-        static int content_boundary_len;
+//
+// Parses the response a line at a time as it arrives. Headers are dealt with
+// as each line completes, so nothing is searched more than once however the
+// data is split up, and image data is read straight into the buffer in one go
+// when the camera says how long it is.
+//
+int RemoteCameraHttp::ParseResponse()
+{
+    static const char content_length_match[] = "Content-length:";
+    static const char content_type_match[] = "Content-type:";
+    static const char connection_match[] = "Connection:";
 
-        while ( true )
+    while ( true )
+    {
+        switch( state )
         {
-            switch( state )
+            case HEADER :
             {
-                case HEADER :
+                got_status = false;
+                content_length = 0;
+                content_type[0] = '\0';
+                content_boundary[0] = '\0';
+                content_boundary_len = 0;
+                scan_offset = 0;
+                state = HEADERCONT;
+                if ( !buffer.size() )
                 {
-                    n_headers = 0;
-                    http_header = 0;
-                    connection_header = 0;
-                    content_length_header = 0;
-                    content_type_header = 0;
-
-                    http_version[0] = '\0';
-                    status_code [0]= '\0';
-                    status_mesg [0]= '\0';
-                    connection_type [0]= '\0';
-                    content_length = 0;
-                    content_type[0] = '\0';
-                    content_boundary[0] = '\0';
-                    content_boundary_len = 0;
+                    int buffer_len = ReadMore( "header" );
+                    if ( buffer_len <= 0 )
+                        return( buffer_len );
                 }
-                case HEADERCONT :
+            }
+            case HEADERCONT :
+            {
+                char *line;
+                while ( (line = GetLine()) )
                 {
-                    int buffer_len = ReadData( buffer );
-                    if ( buffer_len == 0 )
-                    {
-                        Error( "Connection dropped by remote end" );
-                        return( 0 );
-                    }
-                    else if ( buffer_len < 0 )
-                    {
-                        Error( "Unable to read header" );
-                        return( -1 );
-                    }
-
-                    char *crlf = 0;
-                    char *header_ptr = (char *)buffer;
-                    int header_len = buffer.size();
-                    bool all_headers = false;
-
-                    while( true )
-                    {
-                        int crlf_len = memspn( header_ptr, "\r\n", header_len );
-                        if ( n_headers )
-                        {
-                            if ( (crlf_len == 2 && !strncmp( header_ptr, "\n\n", crlf_len )) || (crlf_len == 4 && !strncmp( header_ptr, "\r\n\r\n", crlf_len )) )
-                            {
-                                *header_ptr = '\0';
-                                header_ptr += crlf_len;
-                                header_len -= buffer.consume( header_ptr-(char *)buffer );
-                                all_headers = true;
-                                break;
-                            }
-                        }
-                        if ( crlf_len )
-                        {
-                            if ( header_len == crlf_len )
-                            {
-                                break;
-                            }
-                            else
-                            {
-                                *header_ptr = '\0';
-                                header_ptr += crlf_len;
-                                header_len -= buffer.consume( header_ptr-(char *)buffer );
-                            }
-                        }
-
-                        Debug( 6, "%s", header_ptr );
-                        if ( (crlf = mempbrk( header_ptr, "\r\n", header_len )) )
-                        {
-                            //headers[n_headers++] = header_ptr;
-                            n_headers++;
-
-                            if ( !http_header && (strncasecmp( header_ptr, http_match, http_match_len ) == 0) )
-                            {
-                                http_header = header_ptr+http_match_len;
-                                Debug( 6, "Got http header '%s'", header_ptr );
-                            }
-                            else if ( !connection_header && (strncasecmp( header_ptr, connection_match, connection_match_len) == 0) )
-                            {
-                                connection_header = header_ptr+connection_match_len;
-                                Debug( 6, "Got connection header '%s'", header_ptr );
-                            }
-                            else if ( !content_length_header && (strncasecmp( header_ptr, content_length_match, content_length_match_len) == 0) )
-                            {
-                                content_length_header = header_ptr+content_length_match_len;
-                                Debug( 6, "Got content length header '%s'", header_ptr );
-                            }
-                            else if ( !content_type_header && (strncasecmp( header_ptr, content_type_match, content_type_match_len) == 0) )
-                            {
-                                content_type_header = header_ptr+content_type_match_len;
-                                Debug( 6, "Got content type header '%s'", header_ptr );
-                            }
-                            else
-                            {
-                                Debug( 6, "Got ignored header '%s'", header_ptr );
-                            }
-                            header_ptr = crlf;
-                            header_len -= buffer.consume( header_ptr-(char *)buffer );
-                        }
-                        else
-                        {
-                            // No end of line found
-                            break;
-                        }
-                    }
-
-                    if ( all_headers )
+                    Debug( 6, "Got header '%s'", line );
+                    if ( !got_status )
                     {
-                        char *start_ptr, *end_ptr;
-
-                        if ( !http_header )
+                        const char *version = headerValue( line, "HTTP/", 5 );
+                        if ( !version )
                         {
-                            Error( "Unable to extract HTTP status from header" );
+                            Error( "Unable to extract HTTP status from header '%s'", line );
                             return( -1 );
                         }
-
-                        start_ptr = http_header;
-                        end_ptr = start_ptr+strspn( start_ptr, "10." );
-
-                        memset( http_version, 0, sizeof(http_version) );
-                        strncpy( http_version, start_ptr, end_ptr-start_ptr );
-
-                        start_ptr = end_ptr;
-                        start_ptr += strspn( start_ptr, " " );
-                        end_ptr = start_ptr+strspn( start_ptr, "0123456789" );
-
-                        memset( status_code, 0, sizeof(status_code) );
-                        strncpy( status_code, start_ptr, end_ptr-start_ptr );
-                        int status = atoi( status_code );
-
-                        start_ptr = end_ptr;
-                        start_ptr += strspn( start_ptr, " " );
-                        strcpy( status_mesg, start_ptr );
-
+                        const char *status_ptr = version + strcspn( version, " " );
+                        int status = atoi( status_ptr );
+                        const char *status_mesg = status_ptr + strspn( status_ptr, " 0123456789" );
                         if ( status < 200 || status > 299 )
                         {
-                            Error( "Invalid response status %s: %s", status_code, status_mesg );
-                            return( -1 );
-                        }
-                        Debug( 3, "Got status '%d' (%s), http version %s", status, status_mesg, http_version );
-
-                        if ( connection_header )
-                        {
-                            memset( connection_type, 0, sizeof(connection_type) );
-                            start_ptr = connection_header + strspn( connection_header, " " );
-                            strcpy( connection_type, start_ptr );
-                            Debug( 3, "Got connection '%s'", connection_type );
-                        }
-                        if ( content_length_header )
-                        {
-                            start_ptr = content_length_header + strspn( content_length_header, " " );
-                            content_length = atoi( start_ptr );
-                            Debug( 3, "Got content length '%d'", content_length );
-                        }
-                        if ( content_type_header )
-                        {
-                            memset( content_type, 0, sizeof(content_type) );
-                            start_ptr = content_type_header + strspn( content_type_header, " " );
-                            if ( (end_ptr = strchr( start_ptr, ';' )) )
-                            {
-                                strncpy( content_type, start_ptr, end_ptr-start_ptr );
-                                Debug( 3, "Got content type '%s'", content_type );
-
-                                start_ptr = end_ptr + strspn( end_ptr, "; " );
-
-                                if ( strncasecmp( start_ptr, boundary_match, boundary_match_len ) == 0 )
-                                {
-                                    start_ptr += boundary_match_len;
-                                    start_ptr += strspn( start_ptr, "-" );
-                                    content_boundary_len = sprintf( content_boundary, "--%s", start_ptr );
-                                    Debug( 3, "Got content boundary '%s'", content_boundary );
-                                }
-                                else
-                                {
-                                    Error( "No content boundary found in header '%s'", content_type_header );
-                                }
-                            }
-                            else
-                            {
-                                strcpy( content_type, start_ptr );
-                                Debug( 3, "Got content type '%s'", content_type );
-                            }
-                        }
-
-                        if ( !strcasecmp( content_type, "image/jpeg" ) || !strcasecmp( content_type, "image/jpg" ) )
-                        {
-                            // Single image
-                            mode = SINGLE_IMAGE;
-                            format = JPEG;
-                            state = CONTENT;
-                        }
-                        else if ( !strcasecmp( content_type, "image/x-rgb" ) )
-                        {
-                            // Single image
-                            mode = SINGLE_IMAGE;
-                            format = X_RGB;
-                            state = CONTENT;
-                        }
-                        else if ( !strcasecmp( content_type, "image/x-rgbz" ) )
-                        {
-                            // Single image
-                            mode = SINGLE_IMAGE;
-                            format = X_RGBZ;
-                            state = CONTENT;
-                        }
-                        else if ( !strcasecmp( content_type, "multipart/x-mixed-replace" ) )
-                        {
-                            // Image stream, so start processing
-                            if ( !content_boundary[0] )
-                            {
-                                Error( "No content boundary found in header '%s'", content_type_header );
-                                return( -1 );
-                            }
-                            mode = MULTI_IMAGE;
-                            state = SUBHEADER;
-                        }
-                        //else if ( !strcasecmp( content_type, "video/mpeg" ) || !strcasecmp( content_type, "video/mpg" ) )
-                        //{
-                            //// MPEG stream, coming soon!
-                        //}
-                        else
-                        {
-                            Error( "Unrecognised content type '%s'", content_type );
+                            Error( "Invalid response status %d: %s", status, status_mesg );
                             return( -1 );
                         }
+                        Debug( 3, "Got status '%d' (%s), http version %.*s", status, status_mesg, (int)(status_ptr-version), version );
+                        got_status = true;
                     }
-                    else
+                    else if ( !line[0] )
                     {
-                        Debug( 3, "Unable to extract entire header from stream, continuing" );
-                        state = HEADERCONT;
-                        //return( -1 );
+                        break;
+                    }
+                    else if ( const char *value = headerValue( line, content_length_match, sizeof(content_length_match)-1 ) )
+                    {
+                        content_length = atoi( value );
+                        Debug( 3, "Got content length '%d'", content_length );
+                    }
+                    else if ( const char *value = headerValue( line, content_type_match, sizeof(content_type_match)-1 ) )
+                    {
+                        SetContentType( value );
                     }
+                    else if ( const char *value = headerValue( line, connection_match, sizeof(connection_match)-1 ) )
+                    {
+                        Debug( 3, "Got connection '%s'", value );
+                    }
+                }
+                if ( !line )
+                {
+                    Debug( 3, "Unable to extract entire header from stream, continuing" );
+                    int buffer_len = ReadMore( "header" );
+                    if ( buffer_len <= 0 )
+                        return( buffer_len );
                     break;
                 }
-                case SUBHEADER :
+
+                if ( !strcasecmp( content_type, "image/jpeg" ) || !strcasecmp( content_type, "image/jpg" ) )
                 {
-                    n_subheaders = 0;
-                    boundary_header = 0;
-                    subcontent_length_header[0] = '\0';
-                    subcontent_type_header[0] = '\0';
-                    content_length = 0;
-                    content_type[0] = '\0';
+                    // Single image
+                    mode = SINGLE_IMAGE;
+                    format = JPEG;
+                    state = CONTENT;
                 }
-                case SUBHEADERCONT :
+                else if ( !strcasecmp( content_type, "image/x-rgb" ) )
                 {
-                    char *crlf = 0;
-                    char *subheader_ptr = (char *)buffer;
-                    int subheader_len = buffer.size();
-                    bool all_headers = false;
-
-                    while( true )
+                    // Single image
+                    mode = SINGLE_IMAGE;
+                    format = X_RGB;
+                    state = CONTENT;
+                }
+                else if ( !strcasecmp( content_type, "image/x-rgbz" ) )
+                {
+                    // Single image
+                    mode = SINGLE_IMAGE;
+                    format = X_RGBZ;
+                    state = CONTENT;
+                }
+                else if ( !strcasecmp( content_type, "multipart/x-mixed-replace" ) )
+                {
+                    // Image stream, so start processing
+                    if ( !content_boundary[0] )
                     {
-                        int crlf_len = memspn( subheader_ptr, "\r\n", subheader_len );
-                        if ( n_subheaders )
-                        {
-                            if ( (crlf_len == 2 && !strncmp( subheader_ptr, "\n\n", crlf_len )) || (crlf_len == 4 && !strncmp( subheader_ptr, "\r\n\r\n", crlf_len )) )
-                            {
-                                *subheader_ptr = '\0';
-                                subheader_ptr += crlf_len;
-                                subheader_len -= buffer.consume( subheader_ptr-(char *)buffer );
-                                all_headers = true;
-                                break;
-                            }
-                        }
-                        if ( crlf_len )
-                        {
-                            if ( subheader_len == crlf_len )
-                            {
-                                break;
-                            }
-                            else
-                            {
-                                *subheader_ptr = '\0';
-                                subheader_ptr += crlf_len;
-                                subheader_len -= buffer.consume( subheader_ptr-(char *)buffer );
-                            }
-                        }
-
-                        Debug( 6, "%d: %s", subheader_len, subheader_ptr );
-
-                        if ( (crlf = mempbrk( subheader_ptr, "\r\n", subheader_len )) )
-                        {
-                            //subheaders[n_subheaders++] = subheader_ptr;
-                            n_subheaders++;
-
-                            if ( !boundary_header && (strncasecmp( subheader_ptr, content_boundary, content_boundary_len ) == 0) )
-                            {
-                                boundary_header = subheader_ptr;
-                                Debug( 4, "Got boundary subheader '%s'", subheader_ptr );
-                            }
-                            else if ( !subcontent_length_header[0] && (strncasecmp( subheader_ptr, content_length_match, content_length_match_len) == 0) )
-                            {
-                                strncpy( subcontent_length_header, subheader_ptr+content_length_match_len, sizeof(subcontent_length_header) );
-                                *(subcontent_length_header+strcspn( subcontent_length_header, "\r\n" )) = '\0';
-                                Debug( 4, "Got content length subheader '%s'", subcontent_length_header );
-                            }
-                            else if ( !subcontent_type_header[0] && (strncasecmp( subheader_ptr, content_type_match, content_type_match_len) == 0) )
-                            {
-                                strncpy( subcontent_type_header, subheader_ptr+content_type_match_len, sizeof(subcontent_type_header) );
-                                *(subcontent_type_header+strcspn( subcontent_type_header, "\r\n" )) = '\0';
-                                Debug( 4, "Got content type subheader '%s'", subcontent_type_header );
-                            }
-                            else
-                            {
-                                Debug( 6, "Got ignored subheader '%s' found", subheader_ptr );
-                            }
-                            subheader_ptr = crlf;
-                            subheader_len -= buffer.consume( subheader_ptr-(char *)buffer );
-                        }
-                        else
+                        Error( "No content boundary found in content type '%s'", content_type );
+                        return( -1 );
+                    }
+                    mode = MULTI_IMAGE;
+                    state = SUBHEADER;
+                }
+                else
+                {
+                    Error( "Unrecognised content type '%s'", content_type );
+                    return( -1 );
+                }
+                break;
+            }
+            case SUBHEADER :
+            {
+                got_boundary = false;
+                content_length = 0;
+                content_type[0] = '\0';
+                scan_offset = 0;
+                state = SUBHEADERCONT;
+            }
+            case SUBHEADERCONT :
+            {
+                char *line;
+                while ( (line = GetLine()) )
+                {
+                    Debug( 6, "Got subheader '%s'", line );
+                    if ( !got_boundary )
+                    {
+                        // Anything before the boundary, normally just the end of the last image's line, is ignored
+                        if ( strncmp( line, content_boundary, content_boundary_len ) == 0 || strncmp( line, content_boundary+2, content_boundary_len-2 ) == 0 )
                         {
-                            // No line end found
-                            break;
+                            Debug( 4, "Got boundary subheader '%s'", line );
+                            got_boundary = true;
                         }
                     }
-                    
-                    if ( all_headers && boundary_header )
+                    else if ( !line[0] )
                     {
-                        char *start_ptr/*, *end_ptr*/;
-
-                        Debug( 3, "Got boundary '%s'", boundary_header );
+                        break;
+                    }
+                    else if ( const char *value = headerValue( line, content_length_match, sizeof(content_length_match)-1 ) )
+                    {
+                        content_length = atoi( value );
+                        Debug( 3, "Got subcontent length '%d'", content_length );
+                    }
+                    else if ( const char *value = headerValue( line, content_type_match, sizeof(content_type_match)-1 ) )
+                    {
+                        SetContentType( value );
+                    }
+                }
+                if ( !line )
+                {
+                    Debug( 3, "Unable to extract subheader from stream, retrying" );
+                    int buffer_len = ReadMore( "subheader" );
+                    if ( buffer_len <= 0 )
+                        return( buffer_len );
+                    break;
+                }
+                scan_offset = 0;
+                state = CONTENT;
+                break;
+            }
+            case CONTENT :
+            {
+                if ( !strcasecmp( content_type, "image/jpeg" ) || !strcasecmp( content_type, "image/jpg" ) )
+                {
+                    format = JPEG;
+                }
+                else if ( !strcasecmp( content_type, "image/x-rgb" ) )
+                {
+                    format = X_RGB;
+                }
+                else if ( !strcasecmp( content_type, "image/x-rgbz" ) )
+                {
+                    format = X_RGBZ;
+                }
+                else
+                {
+                    Error( "Found unsupported content type '%s'", content_type );
+                    return( -1 );
+                }
 
-                        if ( subcontent_length_header[0] )
+                if ( content_length )
+                {
+                    // Read the rest of the image in one go, or as much as has arrived on a shared socket
+                    while ( (int)buffer.size() < content_length )
+                    {
+                        int buffer_len = ReadData( buffer, content_length-buffer.size() );
+                        if ( buffer_len == READ_PENDING )
                         {
-                            start_ptr = subcontent_length_header + strspn( subcontent_length_header, " " );
-                            content_length = atoi( start_ptr );
-                            Debug( 3, "Got subcontent length '%d'", content_length );
+                            return( READ_PENDING );
                         }
-                        if ( subcontent_type_header[0] )
-                        {
-                            memset( content_type, 0, sizeof(content_type) );
-                            start_ptr = subcontent_type_header + strspn( subcontent_type_header, " " );
-                            strcpy( content_type, start_ptr );
-                            Debug( 3, "Got subcontent type '%s'", content_type );
-                        }
-                        state = CONTENT;
-                    }
-                    else
-                    {
-                        Debug( 3, "Unable to extract subheader from stream, retrying" );
-                        int buffer_len = ReadData( buffer );
-                        if ( buffer_len == 0 )
+                        else if ( buffer_len == 0 )
                         {
                             Error( "Connection dropped by remote end" );
                             return( 0 );
                         }
                         else if ( buffer_len < 0 )
                         {
-                            Error( "Unable to read subheader" );
+                            Error( "Unable to read content" );
                             return( -1 );
                         }
-                        state = SUBHEADERCONT;
                     }
-                    break;
+                    Debug( 3, "Got end of image by length, content-length = %d", content_length );
                 }
-                case CONTENT :
+                else
                 {
-                    if ( !strcasecmp( content_type, "image/jpeg" ) || !strcasecmp( content_type, "image/jpg" ) )
-                    {
-                        format = JPEG;
-                    }
-                    else if ( !strcasecmp( content_type, "image/x-rgb" ) )
-                    {
-                        format = X_RGB;
-                    }
-                    else if ( !strcasecmp( content_type, "image/x-rgbz" ) )
-                    {
-                        format = X_RGBZ;
-                    }
-                    else
-                    {
-                        Error( "Found unsupported content type '%s'", content_type );
-                        return( -1 );
-                    }
-
-                    if ( format == JPEG && buffer.size() >= 2 )
+                    while ( !content_length )
                     {
-                        if ( buffer[0] != 0xff || buffer[1] != 0xd8 )
+                        if ( mode == MULTI_IMAGE )
                         {
-                            Error( "Found bogus jpeg header '%02x%02x'", buffer[0], buffer[1] );
-                            return( -1 );
+                            // Only search what hasn't been already, allowing for the pattern being split
+                            int search_start = scan_offset > 3 ? scan_offset-3 : 0;
+                            if ( unsigned char *end_ptr = (unsigned char *)memstr( (char *)buffer+search_start, "\r\n--", buffer.size()-search_start ) )
+                            {
+                                content_length = end_ptr - buffer.head();
+                                Debug( 3, "Got end of image by pattern (crlf--), content-length = %d", content_length );
+                                break;
+                            }
+                            scan_offset = buffer.size();
                         }
-                    }
-
-                    if ( content_length )
-                    {
-                        while ( (long)buffer.size() < content_length )
+                        int buffer_len = ReadData( buffer );
+                        if ( buffer_len == READ_PENDING )
                         {
-                            //int buffer_len = ReadData( buffer, content_length-buffer.size() );
-                            int buffer_len = ReadData( buffer );
-                            if ( buffer_len == 0 )
+                            return( READ_PENDING );
+                        }
+                        else if ( buffer_len == 0 )
+                        {
+                            if ( mode == MULTI_IMAGE )
                             {
                                 Error( "Connection dropped by remote end" );
                                 return( 0 );
                             }
-                            else if ( buffer_len < 0 )
+                            content_length = buffer.size();
+                            Debug( 3, "Got end of image by closure, content-length = %d", content_length );
+                            while ( content_length && (buffer[content_length-1] == '\r' || buffer[content_length-1] == '\n') )
+                                content_length--;
+                            if ( content_length != (int)buffer.size() )
                             {
-                                Error( "Unable to read content" );
-                                return( -1 );
+                                Debug( 3, "Trimmed end of image, new content-length = %d", content_length );
                             }
                         }
-                        Debug( 3, "Got end of image by length, content-length = %d", content_length );
-                    }
-                    else
-                    {
-                        int content_pos = 0;
-                        while ( !content_length )
+                        else if ( buffer_len < 0 )
                         {
-                            int buffer_len = ReadData( buffer );
-                            if ( buffer_len == 0 )
-                            {
-                                if ( mode == MULTI_IMAGE )
-                                {
-                                    Error( "Connection dropped by remote end" );
-                                    return( 0 );
-                                }
-                            }
-                            else if ( buffer_len < 0 )
-                            {
-                                Error( "Unable to read content" );
-                                return( -1 );
-                            }
-                            int buffer_size = buffer.size();
-                            if ( buffer_len )
-                            {
-                                if ( mode == MULTI_IMAGE )
-                                {
-                                    while ( char *start_ptr = (char *)memstr( (char *)buffer+content_pos, "\r\n--", buffer_size-content_pos ) )
-                                    {
-                                        content_length = start_ptr - (char *)buffer;
-                                        Debug( 3, "Got end of image by pattern (crlf--), content-length = %d", content_length );
-                                        break;
-                                    }
-                                }
-                            }
-                            else
-                            {
-                                content_length = buffer_size;
-                                Debug( 3, "Got end of image by closure, content-length = %d", content_length );
-                                if ( mode == SINGLE_IMAGE )
-                                {
-                                    char *end_ptr = (char *)buffer+buffer_size;
-
-                                    while( *end_ptr == '\r' || *end_ptr == '\n' )
-                                    {
-                                        content_length--;
-                                        end_ptr--;
-                                    }
-
-                                    if ( end_ptr != ((char *)buffer+buffer_size) )
-                                    {
-                                        Debug( 3, "Trimmed end of image, new content-length = %d", content_length );
-                                    }
-                                }
-                            }
+                            Error( "Unable to read content" );
+                            return( -1 );
                         }
                     }
-                    if ( mode == SINGLE_IMAGE )
-                    {
-                        state = HEADER;
-                        Disconnect();
-                    }
-                    else
-                    {
-                        state = SUBHEADER;
-                    }
+                }
+                scan_offset = 0;
+                if ( mode == SINGLE_IMAGE )
+                {
+                    state = HEADER;
+                    Disconnect();
+                }
+                else
+                {
+                    state = SUBHEADER;
+                }
 
-                    if ( format == JPEG && buffer.size() >= 2 )
+                if ( format == JPEG && buffer.size() >= 2 )
+                {
+                    if ( buffer[0] != 0xff || buffer[1] != 0xd8 )
                     {
-                        if ( buffer[0] != 0xff || buffer[1] != 0xd8 )
-                        {
-                            Error( "Found bogus jpeg header '%02x%02x'", buffer[0], buffer[1] );
-                            return( -1 );
-                        }
+                        Error( "Found bogus jpeg header '%02x%02x'", buffer[0], buffer[1] );
+                        return( -1 );
                     }
-
-                    Debug( 3, "Returning %d (%d) bytes of captured content", content_length, buffer.size() );
-                    return( content_length );
                 }
+
+                Debug( 3, "Returning %d (%d) bytes of captured content", content_length, buffer.size() );
+                return( content_length );
             }
         }
     }
@@ -1074,6 +923,8 @@ int RemoteCameraHttp::GetResponse()
 
 int RemoteCameraHttp::PreCapture()
 {
+    if ( shared )
+        return( 0 );
     if ( sd < 0 )
     {
         Connect();
@@ -1099,7 +950,14 @@ int RemoteCameraHttp::PreCapture()
 
 int RemoteCameraHttp::Capture( Image &image )
 {
-    int content_length = GetResponse();
+    // Images from the shared capture thread have already been taken off the connection
+    int content_length;
+    int image_format = format;
+    if ( shared )
+        content_length = capture_thread->getFrame( this, frame, image_format );
+    else
+        content_length = GetResponse();
+    Buffer &data = shared?frame:buffer;
     if ( content_length == 0 )
     {
         Warning( "Unable to capture image, retrying" );
@@ -1108,17 +966,19 @@ int RemoteCameraHttp::Capture( Image &image )
     if ( content_length < 0 )
     {
         Error( "Unable to get response" );
-        Disconnect();
+        if ( !shared )
+            Disconnect();
         return( -1 );
     }
-    switch( format )
+    switch( image_format )
     {
         case JPEG :
         {
-            if ( !image.DecodeJpeg( buffer.extract( content_length ), content_length, colours, subpixelorder ) )
+            if ( !image.DecodeJpeg( data.extract( content_length ), content_length, colours, subpixelorder ) )
             {
                 Error( "Unable to decode jpeg" );
-                Disconnect();
+                if ( !shared )
+                    Disconnect();
                 return( -1 );
             }
             break;
@@ -1128,27 +988,30 @@ int RemoteCameraHttp::Capture( Image &image )
             if ( content_length != (long)image.Size() )
             {
                 Error( "Image length mismatch, expected %d bytes, content length was %d", image.Size(), content_length );
-                Disconnect();
+                if ( !shared )
+                    Disconnect();
                 return( -1 );
             }
-            image.Assign( width, height, colours, subpixelorder, buffer, imagesize );
+            image.Assign( width, height, colours, subpixelorder, data, imagesize );
             break;
         }
         case X_RGBZ :
         {
-            if ( !image.Unzip( buffer.extract( content_length ), content_length ) )
+            if ( !image.Unzip( data.extract( content_length ), content_length ) )
             {
                 Error( "Unable to unzip RGB image" );
-                Disconnect();
+                if ( !shared )
+                    Disconnect();
                 return( -1 );
             }
-            image.Assign( width, height, colours, subpixelorder, buffer, imagesize );
+            image.Assign( width, height, colours, subpixelorder, data, imagesize );
             break;
         }
         default :
         {
             Error( "Unexpected image format encountered" );
-            Disconnect();
+            if ( !shared )
+                Disconnect();
             return( -1 );
         }
     }
@@ -1159,3 +1022,11 @@ int RemoteCameraHttp::PostCapture()
 {
     return( 0 );
 }
+
+const char *RemoteCameraHttp::CaptureReport()
+{
+    if ( !shared )
+        return( NULL );
+    capture_thread->getReport( this, report, sizeof(report) );
+    return( report );
+}
@@ -26,12 +26,16 @@
 #include "zm_regexp.h"
 #include "zm_utils.h"
 
+class HttpCaptureThread;
+
 //
 // Class representing 'http' cameras, i.e. those which are
 // accessed over a network connection using http
 //
 class RemoteCameraHttp : public RemoteCamera
 {
+friend class HttpCaptureThread;
+
 protected:
 	std::string request;
 	struct timeval timeout;
@@ -43,13 +47,37 @@ protected:
 	enum { UNDEF, JPEG, X_RGB, X_RGBZ } format;
 	enum { HEADER, HEADERCONT, SUBHEADER, SUBHEADERCONT, CONTENT } state;
     enum { SIMPLE, REGEXP } method;
+    enum { MAX_HEADER_LINE=8192 };
+    enum { READ_PENDING=-2 };   // Returned when a shared socket has nothing more to read yet
+
+    // Progress through the response, for the simple method
+    unsigned int scan_offset;   // Bytes at the start of the buffer already searched
+    bool got_status;
+    bool got_boundary;
+    int content_length;
+    char content_type[32];
+    char content_boundary[64];
+    int content_boundary_len;
+
+    // Images received by the shared capture thread, if used
+    static HttpCaptureThread *capture_thread;
+    static int shared_cameras;
+    bool shared;
+    Buffer frame;
+    char report[128];
+
+protected:
+    char *GetLine();
+    int ReadMore( const char *what );
+    void SetContentType( const char *value );
+    int ParseResponse();
 
 public:
 	RemoteCameraHttp( int p_id, const std::string &method, const std::string &host, const std::string &port, const std::string &path, int p_width, int p_height, int p_colours, int p_brightness, int p_contrast, int p_hue, int p_colour, bool p_capture );
 	~RemoteCameraHttp();
 
 	void Initialise();
-	void Terminate() { Disconnect(); }
+	void Terminate();
 	int Connect();
 	int Disconnect();
 	int SendRequest();
@@ -58,6 +86,7 @@ public:
 	int PreCapture();
 	int Capture( Image &image );
 	int PostCapture();
+	const char *CaptureReport();
 };
 
 #endif // ZM_REMOTE_CAMERA_HTTP_H
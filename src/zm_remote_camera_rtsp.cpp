@@ -182,6 +182,8 @@ int RemoteCameraRtsp::PrimeCapture()
     if ( mCodec == NULL )
         Panic( "Unable to locate codec %d decoder", mCodecContext->codec_id );
 
+    SetDecoderThreads( mCodecContext );
+
     // Open codec
 #if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(53, 7, 0)
     if ( avcodec_open( mCodecContext, mCodec ) < 0 )
@@ -292,6 +294,7 @@ int RemoteCameraRtsp::Capture( Image &image )
 	    {
 		packet.data = buffer.head();
 		packet.size = buffer.size();
+		mDecodeTimer.PacketSent( mCodecContext );
 		int len = avcodec_decode_video2( mCodecContext, mRawFrame, &frameComplete, &packet );
 		if ( len < 0 )
 		{
@@ -309,7 +312,8 @@ int RemoteCameraRtsp::Capture( Image &image )
 	    }
             if ( frameComplete ) {
 	       
-		Debug( 3, "Got frame %d", frameCount );
+		double latency = mDecodeTimer.FrameReceived( mRawFrame );
+		Debug( 3, "Got frame %d, %.1f ms after its packet", frameCount, latency );
 			    
 		avpicture_fill( (AVPicture *)mFrame, directbuffer, imagePixFormat, width, height);
 			
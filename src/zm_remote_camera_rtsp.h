@@ -59,6 +59,7 @@ protected:
     AVFrame             *mRawFrame; 
     AVFrame             *mFrame;
     PixelFormat         imagePixFormat;
+    DecodeTimer         mDecodeTimer;
 #endif // HAVE_LIBAVFORMAT
 
 #if HAVE_LIBSWSCALE
@@ -78,6 +79,9 @@ public:
 	int PreCapture();
 	int Capture( Image &image );
 	int PostCapture();
+#if HAVE_LIBAVFORMAT
+	const char *CaptureReport() { return( mCodecContext?mDecodeTimer.Report( mCodecContext ):NULL ); }
+#endif // HAVE_LIBAVFORMAT
 };
 
 #endif // ZM_REMOTE_CAMERA_RTSP_H
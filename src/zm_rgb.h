@@ -109,6 +109,9 @@ typedef uint32_t Rgb;	// RGB colour type
 #define ZM_SUBPIX_ORDER_RGBA 8
 #define ZM_SUBPIX_ORDER_ABGR 9
 #define ZM_SUBPIX_ORDER_ARGB 10
+/* Grayscale (luma) plane followed by the quarter size U and V chroma planes, as I420. */
+/* Used with ZM_COLOUR_GRAY8 so everything except the JPEG encoder only sees the luma plane */
+#define ZM_SUBPIX_ORDER_YUV420P 11
 
 /* A macro to use default subpixel order for a specified colour. */
 /* for grayscale it will use NONE, for 3 colours it will use R,G,B, for 4 colours it will use R,G,B,A */
@@ -26,6 +26,20 @@
 #include "zm_rtsp.h"
 
 #include <arpa/inet.h>
+#include <sys/socket.h>
+
+// Picks the running count of packets the kernel has had to drop out of a message's control data
+static uint32_t kernelDropCount( struct msghdr &header, uint32_t count )
+{
+#ifdef SO_RXQ_OVFL
+    for ( struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg) )
+    {
+        if ( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL )
+            memcpy( &count, CMSG_DATA(cmsg), sizeof(count) );
+    }
+#endif // SO_RXQ_OVFL
+    return( count );
+}
 
 RtpDataThread::RtpDataThread( RtspThread &rtspThread, RtpSource &rtpSource ) : mRtspThread( rtspThread ), mRtpSource( rtpSource ), mStop( false )
 {
@@ -75,10 +89,48 @@ int RtpDataThread::run()
         Fatal( "Failed to bind RTP server" );
     Debug( 3, "Bound to %s:%d",  mRtpSource.getLocalHost().c_str(), mRtpSource.getLocalDataPort() );
 
+    if ( config.rtp_recv_buffer_size > 0 )
+    {
+        int recvBufferSize = 0;
+        rtpDataSocket.setRecvBufferSize( config.rtp_recv_buffer_size );
+        // Linux reports double what was asked for, to allow for its own overheads
+        if ( rtpDataSocket.getRecvBufferSize( recvBufferSize ) && (recvBufferSize/2) < config.rtp_recv_buffer_size )
+            Info( "RTP receive buffer limited to %d bytes, net.core.rmem_max may need raising", recvBufferSize/2 );
+    }
+#ifdef SO_RXQ_OVFL
+    int rxqOverflow = 1;
+    if ( setsockopt( rtpDataSocket.getReadDesc(), SOL_SOCKET, SO_RXQ_OVFL, &rxqOverflow, sizeof(rxqOverflow) ) < 0 )
+        Debug( 2, "Unable to count kernel packet drops: %s", strerror(errno) );
+#endif // SO_RXQ_OVFL
+
     Select select( 3 );
     select.addReader( &rtpDataSocket );
 
-    unsigned char buffer[ZM_NETWORK_BUFSIZ];
+    unsigned char *packets = new unsigned char[RECV_BATCH*ZM_NETWORK_BUFSIZ];
+#ifdef MSG_WAITFORONE
+    bool batched = true;
+    struct mmsghdr messages[RECV_BATCH];
+    struct iovec vectors[RECV_BATCH];
+    union { struct cmsghdr align; char buffer[CMSG_SPACE(sizeof(uint32_t))]; } controls[RECV_BATCH];
+    for ( int i = 0; i < RECV_BATCH; i++ )
+    {
+        vectors[i].iov_base = packets+(i*ZM_NETWORK_BUFSIZ);
+        vectors[i].iov_len = ZM_NETWORK_BUFSIZ;
+        memset( &messages[i], 0, sizeof(messages[i]) );
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_control = controls[i].buffer;
+    }
+#endif // MSG_WAITFORONE
+
+    uint32_t kernelDrops = 0;
+    uint32_t reportedKernelDrops = 0;
+    uint32_t reportedGaps = 0;
+    uint32_t reportedReordered = 0;
+    uint32_t reportedLate = 0;
+    uint32_t reportedRecovered = 0;
+    uint32_t reportedDiscarded = 0;
+    time_t lastReport = time( 0 );
     while ( !mStop && select.wait() >= 0 )
     {
          if ( mStop )
@@ -94,16 +146,49 @@ int RtpDataThread::run()
          {
              if ( UdpInetServer *socket = dynamic_cast<UdpInetServer *>(*iter) )
              {
-                 int nBytes = socket->recv( buffer, sizeof(buffer) );
-                 Debug( 4, "Got %d bytes on sd %d", nBytes, socket->getReadDesc() );
-                 if ( nBytes )
+#ifdef MSG_WAITFORONE
+                 if ( batched )
                  {
-                      recvPacket( buffer, nBytes );
+                     for ( int i = 0; i < RECV_BATCH; i++ )
+                         messages[i].msg_hdr.msg_controllen = sizeof(controls[i].buffer);
+                     // The socket is readable so this takes whatever has queued up, to the batch size, without blocking
+                     int nPackets = recvmmsg( socket->getReadDesc(), messages, RECV_BATCH, MSG_DONTWAIT, NULL );
+                     if ( nPackets < 0 )
+                     {
+                         if ( errno == ENOSYS )
+                         {
+                             Debug( 2, "Batched receive not supported, receiving packets singly" );
+                             batched = false;
+                         }
+                         else if ( errno != EAGAIN && errno != EINTR )
+                         {
+                             Error( "Unable to receive RTP packets: %s", strerror(errno) );
+                             mStop = true;
+                             break;
+                         }
+                     }
+                     Debug( 4, "Got %d packets on sd %d", nPackets, socket->getReadDesc() );
+                     for ( int i = 0; i < nPackets; i++ )
+                     {
+                         kernelDrops = kernelDropCount( messages[i].msg_hdr, kernelDrops );
+                         if ( messages[i].msg_len )
+                             recvPacket( packets+(i*ZM_NETWORK_BUFSIZ), messages[i].msg_len );
+                     }
                  }
-                 else
+                 if ( !batched )
+#endif // MSG_WAITFORONE
                  {
-                    mStop = true;
-                    break;
+                     int nBytes = socket->recv( packets, ZM_NETWORK_BUFSIZ );
+                     Debug( 4, "Got %d bytes on sd %d", nBytes, socket->getReadDesc() );
+                     if ( nBytes )
+                     {
+                          recvPacket( packets, nBytes );
+                     }
+                     else
+                     {
+                        mStop = true;
+                        break;
+                     }
                  }
              }
              else
@@ -111,7 +196,29 @@ int RtpDataThread::run()
                  Panic( "Barfed" );
              }
          }
+
+         time_t now = time( 0 );
+         if ( now-lastReport >= STATS_INTERVAL )
+         {
+             uint32_t gaps = mRtpSource.getSequenceGaps();
+             uint32_t reordered = mRtpSource.getReorderedPackets();
+             uint32_t late = mRtpSource.getLatePackets();
+             uint32_t recovered = mRtpSource.getRecoveredFrames();
+             uint32_t discarded = mRtpSource.getDiscardedFrames();
+             if ( kernelDrops != reportedKernelDrops || gaps != reportedGaps )
+                 Warning( "RTP source %x lost %u packets in the last %d seconds, %u of them dropped by the kernel's receive queue", mRtpSource.getSsrc(), gaps-reportedGaps, (int)(now-lastReport), kernelDrops-reportedKernelDrops );
+             if ( reordered != reportedReordered || late != reportedLate || discarded != reportedDiscarded )
+                 Info( "RTP source %x reordered %u packets in the last %d seconds, recovering %u frames, %u packets too late, %u frames discarded", mRtpSource.getSsrc(), reordered-reportedReordered, (int)(now-lastReport), recovered-reportedRecovered, late-reportedLate, discarded-reportedDiscarded );
+             reportedKernelDrops = kernelDrops;
+             reportedGaps = gaps;
+             reportedReordered = reordered;
+             reportedLate = late;
+             reportedRecovered = recovered;
+             reportedDiscarded = discarded;
+             lastReport = now;
+         }
     }
+    delete[] packets;
     rtpDataSocket.close();
     mRtspThread.stop();
     return( 0 );
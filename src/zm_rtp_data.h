@@ -46,6 +46,10 @@ class RtpDataThread : public Thread
 {
 friend class RtspThread;
 
+public:
+    enum { RECV_BATCH=16 };         // Packets read from the socket at once
+    enum { STATS_INTERVAL=60 };     // Seconds between packet loss reports
+
 private:
     RtspThread &mRtspThread;
     RtpSource &mRtpSource;
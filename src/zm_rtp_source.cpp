@@ -35,16 +35,34 @@
 RtpSource::RtpSource( int id, const std::string &localHost, int localPortBase, const std::string &remoteHost, int remotePortBase, uint32_t ssrc, uint16_t seq, uint32_t rtpClock, uint32_t rtpTime, _AVCODECID codecId ) :
     mId( id ),
     mSsrc( ssrc ),
+    mSequenceGaps( 0 ),
+    mHeldPackets( 0 ),
+    mNextSeq( seq ),
+    mReorderedPackets( 0 ),
+    mLatePackets( 0 ),
+    mRecoveredFrames( 0 ),
+    mDiscardedFrames( 0 ),
+    mFrameReordered( false ),
     mLocalHost( localHost ),
     mRemoteHost( remoteHost ),
     mRtpClock( rtpClock ),
     mCodecId( codecId ),
-    mFrame( 65536 ),
+    mFrameHead( 0 ),
+    mFrameTail( 0 ),
+    mFrameCondition( mFrameMutex ),
     mFrameCount( 0 ),
-    mFrameGood( true ),
-    mFrameReady( false ),
-    mFrameProcessed( false )
+    mDroppedFrames( 0 ),
+    mFrameGood( true )
 {
+    for ( unsigned int i = 0; i < FRAME_POOL_SIZE; i++ )
+        mFrames[i].expand( 65536 );
+
+    mReorderDepth = config.rtp_reorder_packets;
+    if ( mReorderDepth >= REORDER_SLOTS )
+        mReorderDepth = REORDER_SLOTS-1;
+    for ( int i = 0; i < REORDER_SLOTS; i++ )
+        mReorderSlots[i].held = false;
+
     char hostname[256] = "";
     gethostname( hostname, sizeof(hostname) );
 
@@ -131,6 +149,7 @@ bool RtpSource::updateSeq( uint16_t seq )
         else
         {
             Warning( "Packet in sequence, gap %d", uDelta );
+            mSequenceGaps += uDelta-1;
         }
 
         // in order, with permissible gap
@@ -261,7 +280,7 @@ void RtpSource::updateRtcpStats()
     Debug( 5, "Lost fraction = %d", mLostFraction );
 }
 
-bool RtpSource::handlePacket( const unsigned char *packet, size_t packetLen )
+bool RtpSource::processPacket( const unsigned char *packet, size_t packetLen )
 {
     const RtpDataHeader *rtpHeader;
     rtpHeader = (RtpDataHeader *)packet;
@@ -269,6 +288,7 @@ bool RtpSource::handlePacket( const unsigned char *packet, size_t packetLen )
     // No need to check for nal type as non fragmented packets already have 001 start sequence appended
     bool h264FragmentEnd = (mCodecId == CODEC_ID_H264) && (packet[rtpHeaderSize+1] & 0x40);
     bool thisM = rtpHeader->m || h264FragmentEnd;
+    Buffer &frame = mFrames[mFrameHead%FRAME_POOL_SIZE];
 
     if ( updateSeq( ntohs(rtpHeader->seqN) ) )
     {
@@ -301,9 +321,9 @@ bool RtpSource::handlePacket( const unsigned char *packet, size_t packetLen )
                         if ( packet[rtpHeaderSize+1] & 0x80 )
                         {
                             // Now we will form new header of frame
-                            mFrame.append( "\x0\x0\x1\x0", 4 );
+                            frame.append( "\x0\x0\x1\x0", 4 );
                             // Reconstruct NAL header from FU headers
-                            *(mFrame+3) = (packet[rtpHeaderSize+1] & 0x1f) |
+                            *(frame+3) = (packet[rtpHeaderSize+1] & 0x1f) |
                                           (packet[rtpHeaderSize] & 0xe0);
                         }
                     
@@ -313,77 +333,206 @@ bool RtpSource::handlePacket( const unsigned char *packet, size_t packetLen )
                 }
                 
                 // Append NAL frame start code
-                if ( !mFrame.size() )
-                    mFrame.append( "\x0\x0\x1", 3 );
+                if ( !frame.size() )
+                    frame.append( "\x0\x0\x1", 3 );
             }
-            mFrame.append( packet+rtpHeaderSize+extraHeader, packetLen-rtpHeaderSize-extraHeader ); 
+            frame.append( packet+rtpHeaderSize+extraHeader, packetLen-rtpHeaderSize-extraHeader ); 
         }
 
-        Hexdump( 4, mFrame.head(), 16 );
+        Hexdump( 4, frame.head(), 16 );
 
         if ( thisM )
         {
             if ( mFrameGood )
             {
-                Debug( 2, "Got new frame %d, %d bytes", mFrameCount, mFrame.size() );
+                Debug( 2, "Got new frame %d, %d bytes", mFrameCount, frame.size() );
+                if ( mFrameReordered )
+                    mRecoveredFrames++;
 
-                mFrameProcessed.setValueImmediate( false );
-                mFrameReady.updateValueSignal( true );
-                if ( !mFrameProcessed.getValueImmediate() )
+                // The decoder may still have every other buffer, if so this frame is lost rather than waiting for it
+                if ( mFrameHead+1-mFrameTail < FRAME_POOL_SIZE )
                 {
-                    for ( int count = 0; !mFrameProcessed.getUpdatedValue( 1 ); count++ )
-                        if( count > 1 )
-                            return( false );
+                    __sync_synchronize();
+                    mFrameHead++;
+                    mFrameMutex.lock();
+                    mFrameCondition.signal();
+                    mFrameMutex.unlock();
+                }
+                else
+                {
+                    if ( !(mDroppedFrames++%DROP_REPORT_INTERVAL) )
+                        Warning( "Decoder not keeping up, dropped frame %d, %d frames dropped in total", mFrameCount, mDroppedFrames );
                 }
                 mFrameCount++;
             }
             else
             {
-                Warning( "Discarding incomplete frame %d, %d bytes", mFrameCount, mFrame.size() );
+                Warning( "Discarding incomplete frame %d, %d bytes", mFrameCount, frame.size() );
+                mDiscardedFrames++;
             }
-            mFrame.clear();
+            mFrames[mFrameHead%FRAME_POOL_SIZE].clear();
         }
     }
     else
     {
-        if ( mFrame.size() )
+        if ( frame.size() )
         {
-            Warning( "Discarding partial frame %d, %d bytes", mFrameCount, mFrame.size() );
+            Warning( "Discarding partial frame %d, %d bytes", mFrameCount, frame.size() );
         }
         else
         {
             Warning( "Discarding frame %d", mFrameCount );
         }
         mFrameGood = false;
-        mFrame.clear();
+        frame.clear();
     }
     if ( thisM )
     {
         mFrameGood = true;
+        mFrameReordered = false;
         prevM = true;
     }
     else
 		prevM = false;
 
+    return( true );
+}
+
+// Handles the held packets that now follow on in sequence
+void RtpSource::releasePackets()
+{
+    while ( mHeldPackets )
+    {
+        HeldPacket &slot = mReorderSlots[mNextSeq%REORDER_SLOTS];
+        if ( !slot.held )
+            break;
+        slot.held = false;
+        mHeldPackets--;
+        mNextSeq++;
+        processPacket( slot.packet.head(), slot.packet.size() );
+    }
+    if ( mHeldPackets )
+        mHoldStart = tvNow();
+}
+
+// Gives up waiting for the packets before the first one held
+void RtpSource::skipMissingPackets()
+{
+    int skipped = 0;
+    while ( !mReorderSlots[mNextSeq%REORDER_SLOTS].held )
+    {
+        mNextSeq++;
+        skipped++;
+    }
+    Debug( 3, "Gave up waiting for %d packets, next is %d", skipped, mNextSeq );
+    if ( skipped )
+    {
+        // The frame in progress is missing packets, so drop it rather than pass it on
+        mFrameGood = false;
+        mFrameReordered = false;
+    }
+    releasePackets();
+}
+
+// Gives up on the held packets that have been waiting too long
+void RtpSource::expireHeldPackets()
+{
+    while ( mHeldPackets && tvDiffMsec( mHoldStart ) >= config.rtp_reorder_delay )
+        skipMissingPackets();
+}
+
+bool RtpSource::handlePacket( const unsigned char *packet, size_t packetLen )
+{
+    const RtpDataHeader *rtpHeader = (RtpDataHeader *)packet;
+    uint16_t seq = ntohs(rtpHeader->seqN);
+
     updateJitter( rtpHeader );
 
+    // Until the source is validated sequence numbers can't be relied upon
+    if ( !mReorderDepth || mProbation )
+    {
+        mNextSeq = seq+1;
+        return( processPacket( packet, packetLen ) );
+    }
+
+    // Check on every packet, not just out of order ones, so a gap can't hold things up indefinitely
+    expireHeldPackets();
+
+    int16_t delta = seq-mNextSeq;
+    if ( delta < 0 && delta > -MAX_MISORDER )
+    {
+        // Either a duplicate or too late, the packets after it have already gone
+        mLatePackets++;
+        Debug( 3, "Discarding late packet %d, expecting %d", seq, mNextSeq );
+        return( false );
+    }
+    if ( delta < 0 || delta >= REORDER_SLOTS )
+    {
+        // A jump this big isn't reordering, let the sequence checks deal with it
+        Debug( 3, "Packet %d too far from %d to reorder", seq, mNextSeq );
+        for ( int i = 0; mHeldPackets && i < REORDER_SLOTS; i++ )
+            skipMissingPackets();
+        mNextSeq = seq+1;
+        return( processPacket( packet, packetLen ) );
+    }
+
+    if ( delta == 0 )
+    {
+        if ( mHeldPackets )
+        {
+            // Filled a gap that would otherwise have lost the frame
+            mReorderedPackets++;
+            mFrameReordered = true;
+        }
+        mNextSeq++;
+        bool result = processPacket( packet, packetLen );
+        releasePackets();
+        return( result );
+    }
+
+    HeldPacket &slot = mReorderSlots[seq%REORDER_SLOTS];
+    if ( slot.held )
+    {
+        Debug( 3, "Discarding duplicate packet %d", seq );
+        return( false );
+    }
+    slot.packet.assign( packet, packetLen );
+    slot.held = true;
+    if ( !mHeldPackets++ )
+        mHoldStart = tvNow();
+    Debug( 4, "Holding packet %d, expecting %d, %d held", seq, mNextSeq, mHeldPackets );
+
+    // Don't wait for ever, or for more packets than allowed
+    while ( mHeldPackets && (mHeldPackets > mReorderDepth || delta > mReorderDepth || tvDiffMsec( mHoldStart ) >= config.rtp_reorder_delay) )
+    {
+        skipMissingPackets();
+        delta = seq-mNextSeq;
+    }
     return( true );
 }
 
 bool RtpSource::getFrame( Buffer &buffer )
 {
     Debug( 3, "Getting frame" );
-    if ( !mFrameReady.getValueImmediate() )
+    mFrameMutex.lock();
+    // Allow for a couple of spurious returns
+    for ( int count = 0; mFrameTail == mFrameHead; count++ )
     {
-        // Allow for a couple of spurious returns
-        for ( int count = 0; !mFrameReady.getUpdatedValue( 1 ); count++ )
-            if ( count > 1 )
-                return( false );
+        if ( count > 1 )
+        {
+            mFrameMutex.unlock();
+            return( false );
+        }
+        mFrameCondition.wait( 1 );
     }
-    buffer = mFrame;
-    mFrameReady.setValueImmediate( false );
-    mFrameProcessed.updateValueSignal( true );
-    Debug( 3, "Copied %d bytes", buffer.size() );
+    mFrameMutex.unlock();
+    __sync_synchronize();
+
+    // The caller's buffer takes the frame's place in the pool
+    buffer.swap( mFrames[mFrameTail%FRAME_POOL_SIZE] );
+    __sync_synchronize();
+    mFrameTail++;
+    Debug( 3, "Got %d bytes", buffer.size() );
     return( true );
 }
 
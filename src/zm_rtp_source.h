@@ -47,6 +47,9 @@ private:
     static const int MAX_DROPOUT = 3000;
     static const int MAX_MISORDER = 100;
     static const int MIN_SEQUENTIAL = 2;
+    static const unsigned int FRAME_POOL_SIZE = 4;      // Frame buffers shared between receiver and decoder
+    static const unsigned int DROP_REPORT_INTERVAL = 100;
+    static const int REORDER_SLOTS = 256;               // Most packets that can be held for reordering
 
 private:
     // Identity
@@ -65,6 +68,25 @@ private:
     uint32_t mReceivedPrior;      // packet received at last interval
     uint32_t mTransit;            // relative trans time for prev pkt
     uint32_t mJitter;             // estimated jitter
+    uint32_t mSequenceGaps;       // packets skipped over in the sequence
+
+    // Packets that arrive ahead of their turn are held here, by sequence number,
+    // for a short while in case the ones before them turn up late
+    struct HeldPacket
+    {
+        Buffer packet;
+        bool held;
+    };
+    HeldPacket mReorderSlots[REORDER_SLOTS];
+    int mReorderDepth;            // most packets to hold
+    int mHeldPackets;
+    uint16_t mNextSeq;            // next packet due to be handled
+    struct timeval mHoldStart;    // when the oldest held packet arrived
+    uint32_t mReorderedPackets;
+    uint32_t mLatePackets;
+    uint32_t mRecoveredFrames;
+    uint32_t mDiscardedFrames;
+    bool mFrameReordered;
     
     // Ports/Channels
     std::string mLocalHost;
@@ -92,15 +114,26 @@ private:
 
     _AVCODECID mCodecId;
 
-    Buffer mFrame;
+    // Frames are assembled by the receiving thread in the head buffer of the pool
+    // and passed to the decoding thread by advancing the head. Each index is only
+    // changed by one thread so no lock is needed, the mutex is just for waking the
+    // decoder when it has run out of frames.
+    Buffer mFrames[FRAME_POOL_SIZE];
+    volatile unsigned int mFrameHead;   // Frame being assembled
+    volatile unsigned int mFrameTail;   // Next frame for the decoder
+    Mutex mFrameMutex;
+    Condition mFrameCondition;
     int mFrameCount;
+    uint32_t mDroppedFrames;
     bool mFrameGood;
     bool prevM;
-    ThreadData<bool> mFrameReady;
-    ThreadData<bool> mFrameProcessed;
 
 private:
     void init( uint16_t seq );
+    bool processPacket( const unsigned char *packet, size_t packetLen );
+    void releasePackets();
+    void skipMissingPackets();
+    void expireHeldPackets();
 
 public:
     RtpSource( int id, const std::string &localHost, int localPortBase, const std::string &remoteHost, int remotePortBase, uint32_t ssrc, uint16_t seq, uint32_t rtpClock, uint32_t rtpTime, _AVCODECID codecId );
@@ -173,6 +206,36 @@ public:
         return( mLostPackets );
     }
 
+    uint32_t getSequenceGaps() const
+    {
+        return( mSequenceGaps );
+    }
+
+    uint32_t getReorderedPackets() const
+    {
+        return( mReorderedPackets );
+    }
+
+    uint32_t getLatePackets() const
+    {
+        return( mLatePackets );
+    }
+
+    uint32_t getRecoveredFrames() const
+    {
+        return( mRecoveredFrames );
+    }
+
+    uint32_t getDiscardedFrames() const
+    {
+        return( mDiscardedFrames );
+    }
+
+    uint32_t getDroppedFrames() const
+    {
+        return( mDroppedFrames );
+    }
+
     uint8_t getLostFraction() const
     {
         return( mLostFraction );
@@ -18,6 +18,8 @@
 //
 
 #include <sys/un.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 
 #include "zm.h"
 #include "zm_mpeg.h"
@@ -159,12 +161,16 @@ Image *StreamBase::prepareImage( Image *image )
             Debug( 3, "Magnifying by %d", mag );
             if ( !image_copied )
             {
+                // Scale straight from the original rather than from a copy of it
 	            static Image copy_image;
-                copy_image.Assign( *image );
+                copy_image.Scale( ImageView( *image ), mag );
                 image = &copy_image;
                 image_copied = true;
             }
-            image->Scale( mag );
+            else
+            {
+                image->Scale( mag );
+            }
         }
     }
 
@@ -222,20 +228,117 @@ Image *StreamBase::prepareImage( Image *image )
         if ( !image_copied )
         {
 	        static Image copy_image;
-            copy_image.Assign( *image );
+            if ( last_crop.LoX() >= 0 && last_crop.LoY() >= 0 && last_crop.LoX() <= last_crop.HiX() && last_crop.LoY() <= last_crop.HiY()
+                && last_crop.HiX() < (int)image->Width() && last_crop.HiY() < (int)image->Height() )
+            {
+                // Only copy the part of the original being kept
+                copy_image.Assign( ImageView( *image, last_crop ) );
+            }
+            else
+            {
+                // Let the crop report what is wrong with it
+                copy_image.Assign( *image );
+                copy_image.Crop( last_crop );
+            }
             image = &copy_image;
             image_copied = true;
         }
-        image->Crop( last_crop );
+        else
+        {
+            image->Crop( last_crop );
+        }
     }
     last_scale = scale;
     last_zoom = zoom;
     last_x = x;
     last_y = y;
 
+    if ( adapt_scale != ZM_SCALE_BASE )
+    {
+        Debug( 3, "Congestion scaling by %d", adapt_scale );
+        if ( !image_copied )
+        {
+	        static Image copy_image;
+            copy_image.Scale( ImageView( *image ), adapt_scale );
+            image = &copy_image;
+            image_copied = true;
+        }
+        else
+        {
+            image->Scale( adapt_scale );
+        }
+    }
+
     return( image );
 }
 
+// Bytes written to the stream output but not yet sent, or -1 if not known
+int StreamBase::sendQueueDepth() const
+{
+    int queued = 0;
+    int fd = fileno( stdout );
+    // Sockets report their unsent data, pipes to the web server what has not been read yet
+    if ( ioctl( fd, SIOCOUTQ, &queued ) < 0 && ioctl( fd, FIONREAD, &queued ) < 0 )
+        return( -1 );
+    return( queued );
+}
+
+// Returns false if the connection is still busy with earlier frames and
+// this one should be dropped rather than queued up behind them
+bool StreamBase::checkSendQueue()
+{
+    send_queue = sendQueueDepth();
+    if ( last_frame_size && send_queue > last_frame_size )
+    {
+        frames_dropped++;
+        Debug( 2, "Dropping frame, %d bytes still queued, %d dropped so far", send_queue, frames_dropped );
+        adaptStream( -1 );
+        return( false );
+    }
+    return( true );
+}
+
+// Steps the quality, and then the size, of the frames down while the
+// connection can't keep up and back up again once it has recovered.
+// A negative send time means a frame had to be dropped.
+void StreamBase::adaptStream( int frame_send_time )
+{
+    double fps = (effective_fps > 0.0 && effective_fps < maxfps)?effective_fps:maxfps;
+    int frame_interval = (int)(1000/fps);
+    if ( frame_send_time < 0 || frame_send_time > frame_interval )
+    {
+        adapt_good_frames = 0;
+        if ( adapt_quality > MIN_ADAPT_QUALITY )
+        {
+            adapt_quality -= ADAPT_QUALITY_STEP;
+            if ( adapt_quality < MIN_ADAPT_QUALITY )
+                adapt_quality = MIN_ADAPT_QUALITY;
+            Debug( 1, "Stream congested, reducing quality to %d", adapt_quality );
+        }
+        else if ( adapt_scale > MIN_ADAPT_SCALE )
+        {
+            adapt_scale -= ADAPT_SCALE_STEP;
+            Debug( 1, "Stream congested, reducing scale to %d%%", (adapt_scale*100)/ZM_SCALE_BASE );
+        }
+    }
+    else if ( ++adapt_good_frames >= ADAPT_RECOVER_FRAMES )
+    {
+        adapt_good_frames = 0;
+        if ( adapt_scale < ZM_SCALE_BASE )
+        {
+            adapt_scale += ADAPT_SCALE_STEP;
+            Debug( 1, "Stream recovered, increasing scale to %d%%", (adapt_scale*100)/ZM_SCALE_BASE );
+        }
+        else if ( adapt_quality < config.jpeg_stream_quality )
+        {
+            adapt_quality += ADAPT_QUALITY_STEP;
+            if ( adapt_quality > config.jpeg_stream_quality )
+                adapt_quality = config.jpeg_stream_quality;
+            Debug( 1, "Stream recovered, increasing quality to %d", adapt_quality );
+        }
+    }
+}
+
 bool StreamBase::sendTextFrame( const char *frame_text )
 {
     Debug( 2, "Sending text frame '%s'", frame_text );
@@ -45,6 +45,11 @@ protected:
     enum { DEFAULT_MAXFPS=10 };
     enum { DEFAULT_BITRATE=100000 };
 
+    // Limits and steps used when adapting live streams to a congested connection
+    enum { MIN_ADAPT_QUALITY=20, ADAPT_QUALITY_STEP=10 };
+    enum { MIN_ADAPT_SCALE=ZM_SCALE_BASE/4, ADAPT_SCALE_STEP=ZM_SCALE_BASE/4 };
+    enum { ADAPT_RECOVER_FRAMES=25 };
+
 protected:
     typedef struct {
         int msg_type;
@@ -92,6 +97,14 @@ protected:
     double last_frame_sent;
     struct timeval last_frame_timestamp;
 
+    int adapt_quality;
+    int adapt_scale;
+    int adapt_good_frames;
+    int last_frame_size;
+    int send_queue;
+    int frames_sent;
+    int frames_dropped;
+
 #if HAVE_LIBAVCODEC     
     VideoStream *vid_stream;
 #endif // HAVE_LIBAVCODEC     
@@ -103,6 +116,9 @@ protected:
     bool checkInitialised();
     void updateFrameRate( double fps );
     Image *prepareImage( Image *image );
+    int sendQueueDepth() const;
+    bool checkSendQueue();
+    void adaptStream( int frame_send_time );
     bool sendTextFrame( const char *text );
     bool checkCommandQueue();
     virtual void processCommand( const CmdMsg *msg )=0;
@@ -136,6 +152,14 @@ public:
         effective_fps = 0.0;
         frame_mod = 1;
 
+        adapt_quality = config.jpeg_stream_quality;
+        adapt_scale = ZM_SCALE_BASE;
+        adapt_good_frames = 0;
+        last_frame_size = 0;
+        send_queue = 0;
+        frames_sent = 0;
+        frames_dropped = 0;
+
 #if HAVE_LIBAVCODEC     
         vid_stream = 0;
 #endif // HAVE_LIBAVCODEC     
@@ -62,10 +62,12 @@ void Zone::Setup( Monitor *p_monitor, int p_id, const char *p_label, ZoneType p_
 
 	overload_count = 0;
 
-	pg_image = new Image( monitor->Width(), monitor->Height(), 1, ZM_SUBPIX_ORDER_NONE);
-	pg_image->Clear();
-	pg_image->Fill( 0xff, polygon );
-	pg_image->Outline( 0xff, polygon );
+	/* The pixels of the zone are those inside the polygon and on its outline, clipped to the image */
+	std::vector<SpanList::Run> runs;
+	polygon.FillSpans().GetRuns( runs );
+	polygon.OutlineSpans().GetRuns( runs );
+	Box limits( monitor->Width(), monitor->Height() );
+	spans.Build( runs, &limits );
 
 	ranges = new Range[monitor->Height()];
 	for ( unsigned int y = 0; y < monitor->Height(); y++)
@@ -73,20 +75,10 @@ void Zone::Setup( Monitor *p_monitor, int p_id, const char *p_label, ZoneType p_
 		ranges[y].lo_x = -1;
 		ranges[y].hi_x = 0;
 		ranges[y].off_x = 0;
-		const uint8_t *ppoly = pg_image->Buffer( 0, y );
-		for ( unsigned int x = 0; x < monitor->Width(); x++, ppoly++ )
+		if ( (int)y >= spans.LoY() && (int)y <= spans.HiY() && spans.Begin( y ) != spans.End( y ) )
 		{
-			if ( *ppoly )
-			{
-				if ( ranges[y].lo_x == -1 )
-				{
-					ranges[y].lo_x = x;
-				}
-				if ( (unsigned int)ranges[y].hi_x < x )
-				{
-					ranges[y].hi_x = x;
-				}
-			}
+			ranges[y].lo_x = spans.Begin( y )->lo_x;
+			ranges[y].hi_x = (spans.End( y )-1)->hi_x;
 		}
 	}
 	
@@ -97,15 +89,16 @@ void Zone::Setup( Monitor *p_monitor, int p_id, const char *p_label, ZoneType p_
 		{
 			snprintf( diag_path, sizeof(diag_path), "%s/%s/diag-%d-poly.jpg", config.dir_events, monitor->Name(), id);
 		}
-		pg_image->WriteJpeg( diag_path );
+		Image pg_image( monitor->Width(), monitor->Height(), 1, ZM_SUBPIX_ORDER_NONE );
+		pg_image.Clear();
+		pg_image.Fill( 0xff, spans );
+		pg_image.WriteJpeg( diag_path );
 	}
 }
 
 Zone::~Zone()
 {
 	delete[] label;
-	delete image;
-	delete pg_image;
 	delete[] ranges;
 }
 
@@ -143,8 +136,9 @@ void Zone::SetScore(unsigned int nScore)
 
 void Zone::SetAlarmImage(const Image* srcImage)
 {
-    delete image;
-    image = new Image(*srcImage);
+    alarm_image.Assign( *srcImage );
+    image = &alarm_image;
+    image_origin = polygon.Extent().Lo();
 }
 
 int Zone::GetOverloadCount()
@@ -177,13 +171,12 @@ bool Zone::CheckAlarms( const Image *delta_image )
 		return( false );
 	}
 
-	delete image;
-	// Get the difference image
-	Image *diff_image = image = new Image( *delta_image );
-	int diff_width = diff_image->Width();
-	uint8_t* diff_buff = (uint8_t*)diff_image->Buffer();
+	image = 0;
+	// Get the difference image, copied into the zone's own image as it gets changed below
+	diff_image.Assign( *delta_image );
+	int diff_width = diff_image.Width();
+	uint8_t* diff_buff = (uint8_t*)diff_image.Buffer();
 	uint8_t* pdiff;
-	const uint8_t* ppoly;
 
 	unsigned int pixel_diff_count = 0;
 
@@ -204,12 +197,7 @@ bool Zone::CheckAlarms( const Image *delta_image )
 	
 	
 	Debug( 5, "Checking for alarmed pixels" );
-	/* if(config.cpu_extensions && sseversion >= 20) {
-		sse2_alarmedpixels(diff_image, pg_image, &alarm_pixels, &pixel_diff_count);
-	} else {
-		std_alarmedpixels(diff_image, pg_image, &alarm_pixels, &pixel_diff_count);
-	} */
-	std_alarmedpixels(diff_image, pg_image, &alarm_pixels, &pixel_diff_count);
+	std_alarmedpixels(&diff_image, &alarm_pixels, &pixel_diff_count);
 	
 	if ( config.record_diag_images )
 	{
@@ -218,7 +206,7 @@ bool Zone::CheckAlarms( const Image *delta_image )
 		{
 			snprintf( diag_path, sizeof(diag_path), "%s/%s/diag-%d-%d.jpg", config.dir_events, monitor->Name(), id, 1 );
 		}
-		diff_image->WriteJpeg( diag_path );
+		diff_image.WriteJpeg( diag_path );
 	}
 	
 	if ( pixel_diff_count && alarm_pixels )
@@ -263,7 +251,7 @@ bool Zone::CheckAlarms( const Image *delta_image )
 				int lo_x = ranges[y].lo_x;
 				int hi_x = ranges[y].hi_x;
 
-				pdiff = (uint8_t*)diff_image->Buffer( lo_x, y );
+				pdiff = (uint8_t*)diff_image.Buffer( lo_x, y );
 
 				for ( int x = lo_x; x <= hi_x; x++, pdiff++ )
 				{
@@ -315,7 +303,7 @@ bool Zone::CheckAlarms( const Image *delta_image )
 			{
 				snprintf( diag_path, sizeof(diag_path), "%s/%d/diag-%d-%d.jpg", config.dir_events, monitor->Id(), id, 2 );
 			}
-			diff_image->WriteJpeg( diag_path );
+			diff_image.WriteJpeg( diag_path );
 		}
 		
 		Debug( 5, "Got %d filtered pixels, need %d -> %d", alarm_filter_pixels, min_filter_pixels, max_filter_pixels );
@@ -354,7 +342,7 @@ bool Zone::CheckAlarms( const Image *delta_image )
 				int lo_x = ranges[y].lo_x;
 				int hi_x = ranges[y].hi_x;
 
-				pdiff = (uint8_t*)diff_image->Buffer( lo_x, y );
+				pdiff = (uint8_t*)diff_image.Buffer( lo_x, y );
 				for ( int x = lo_x; x <= hi_x; x++, pdiff++ )
 				{
 					if ( *pdiff == WHITE )
@@ -556,7 +544,7 @@ bool Zone::CheckAlarms( const Image *delta_image )
 				{
 					snprintf( diag_path, sizeof(diag_path), "%s/%d/diag-%d-%d.jpg", config.dir_events, monitor->Id(), id, 3 );
 				}
-				diff_image->WriteJpeg( diag_path );
+				diff_image.WriteJpeg( diag_path );
 			}
 
 			if ( !alarm_blobs )
@@ -615,7 +603,7 @@ bool Zone::CheckAlarms( const Image *delta_image )
 				{
 					snprintf( diag_path, sizeof(diag_path), "%s/%d/diag-%d-%d.jpg", config.dir_events, monitor->Id(), id, 4 );
 				}
-				diff_image->WriteJpeg( diag_path );
+				diff_image.WriteJpeg( diag_path );
 			}
 			Debug( 5, "Got %d blob pixels, %d blobs, need %d -> %d, %d -> %d", alarm_blob_pixels, alarm_blobs, min_blob_pixels, max_blob_pixels, min_blobs, max_blobs );           
             
@@ -727,59 +715,37 @@ bool Zone::CheckAlarms( const Image *delta_image )
 			{
 				pdiff = diff_buff + ((diff_width * y) + lo_x);
 
-				int lo_x2 = ranges[y].lo_x;
-				int hi_x2 = ranges[y].hi_x;
-
-				int lo_gap = lo_x2-lo_x;
-				if ( lo_gap > 0 )
-				{
-					if ( lo_gap == 1 )
-					{
-						*pdiff++ = BLACK;
-					}
-					else
-					{
-						memset( pdiff, BLACK, lo_gap );
-						pdiff += lo_gap;
-					}
-				}
-
-				ppoly = pg_image->Buffer( lo_x2, y );
-				for ( int x = lo_x2; x <= hi_x2; x++, pdiff++, ppoly++ )
+				/* Black out the gaps between the zone's spans, and either side of them */
+				int x = lo_x;
+				if ( (int)y >= spans.LoY() && (int)y <= spans.HiY() )
 				{
-					if ( !*ppoly )
+					for ( const SpanList::Span *span = spans.Begin( y ); span != spans.End( y ); span++ )
 					{
-						*pdiff = BLACK;
+						int gap = span->lo_x-x;
+						if ( gap > 0 )
+						{
+							memset( pdiff, BLACK, gap );
+						}
+						pdiff += (span->hi_x+1)-x;
+						x = span->hi_x+1;
 					}
 				}
 
-				int hi_gap = hi_x-hi_x2;
+				int hi_gap = ((int)hi_x+1)-x;
 				if ( hi_gap > 0 )
 				{
-					if ( hi_gap == 1 )
-					{
-						*pdiff = BLACK;
-					}
-					else
-					{
-						memset( pdiff, BLACK, hi_gap );
-					}
+					memset( pdiff, BLACK, hi_gap );
 				}
 			}
 			
+			/* Only the blobs are left, so there are no edges outside the box around them */
 			if( monitor->Colours() == ZM_COLOUR_GRAY8 ) {
-				image = diff_image->HighlightEdges( alarm_rgb, ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB, &polygon.Extent() );
+				diff_image.HighlightEdges( alarm_rgb, ZM_COLOUR_RGB24, ZM_SUBPIX_ORDER_RGB, &alarm_image, &alarm_box );
 			} else {
-				image = diff_image->HighlightEdges( alarm_rgb, monitor->Colours(), monitor->SubpixelOrder(), &polygon.Extent() );
+				diff_image.HighlightEdges( alarm_rgb, monitor->Colours(), monitor->SubpixelOrder(), &alarm_image, &alarm_box );
 			}
-			
-			// Only need to delete this when 'image' becomes detached and points somewhere else
-			delete diff_image;
-		}
-		else
-		{
-			delete image;
-			image = 0;
+			image = &alarm_image;
+			image_origin = alarm_box.Lo();
 		}
 
 		Debug( 1, "%s: Pixel Diff: %d, Alarm Pixels: %d, Filter Pixels: %d, Blob Pixels: %d, Blobs: %d, Score: %d", Label(), pixel_diff, alarm_pixels, alarm_filter_pixels, alarm_blob_pixels, alarm_blobs, score );
@@ -1034,42 +1000,47 @@ bool Zone::DumpSettings( char *output, bool /*verbose*/ )
 	return( true );
 }
 
-void Zone::std_alarmedpixels(Image* pdiff_image, const Image* ppoly_image, unsigned int* pixel_count, unsigned int* pixel_sum) {
+void Zone::std_alarmedpixels(Image* pdiff_image, unsigned int* pixel_count, unsigned int* pixel_sum) {
 	uint32_t pixelsalarmed = 0;
 	uint32_t pixelsdifference = 0;
 	uint8_t *pdiff;
-	const uint8_t *ppoly;
 	uint8_t calc_max_pixel_threshold = 255;
-	unsigned int lo_y;
-	unsigned int hi_y;
-	unsigned int lo_x;
-	unsigned int hi_x;
 	
 	if(max_pixel_threshold)
 		calc_max_pixel_threshold = max_pixel_threshold;
 	
-	lo_y = polygon.LoY();
-	hi_y = polygon.HiY();
-	for ( unsigned int y = lo_y; y <= hi_y; y++ )
+	for ( int y = spans.LoY(); y <= spans.HiY(); y++ )
 	{
-		lo_x = ranges[y].lo_x;
-		hi_x = ranges[y].hi_x;
+		const SpanList::Span *span = spans.Begin( y );
+		const SpanList::Span *end = spans.End( y );
+		if ( span == end )
+			continue;
 		
-		Debug( 7, "Checking line %d from %d -> %d", y, lo_x, hi_x );
-		pdiff = (uint8_t*)pdiff_image->Buffer( lo_x, y );
-		ppoly = ppoly_image->Buffer( lo_x, y );
+		Debug( 7, "Checking line %d from %d -> %d", y, span->lo_x, (end-1)->hi_x );
+		pdiff = (uint8_t*)pdiff_image->Buffer( span->lo_x, y );
+		int x = span->lo_x;
 	
-		for ( unsigned int x = lo_x; x <= hi_x; x++, pdiff++, ppoly++ )
+		for ( ; span != end; span++ )
 		{
-			if ( *ppoly && (*pdiff > min_pixel_threshold) && (*pdiff <= calc_max_pixel_threshold) )
+			/* Pixels between the spans are outside the zone */
+			int gap = span->lo_x-x;
+			if ( gap > 0 )
 			{
-				pixelsalarmed++;
-				pixelsdifference += *pdiff;
-				*pdiff = WHITE;
+				memset( pdiff, BLACK, gap );
+				pdiff += gap;
 			}
-			else
+			for ( x = span->lo_x; x <= span->hi_x; x++, pdiff++ )
 			{
-				*pdiff = BLACK;
+				if ( (*pdiff > min_pixel_threshold) && (*pdiff <= calc_max_pixel_threshold) )
+				{
+					pixelsalarmed++;
+					pixelsdifference += *pdiff;
+					*pdiff = WHITE;
+				}
+				else
+				{
+					*pdiff = BLACK;
+				}
 			}
 		}
 	}
@@ -86,15 +86,18 @@ protected:
 	Box				alarm_box;
 	Coord			alarm_centre;
 	unsigned int	score;
-	Image			*pg_image;
+	SpanList		spans;
 	Range			*ranges;
-	Image			*image;
+	Image			diff_image;		// Kept from frame to frame so its buffer is reused
+	Image			alarm_image;
+	Image			*image;			// The alarm image, if there is one
+	Coord			image_origin;	// Where the alarm image goes on the frame
 
     int             overload_count;
 
 protected:
 	void Setup( Monitor *p_monitor, int p_id, const char *p_label, ZoneType p_type, const Polygon &p_polygon, const Rgb p_alarm_rgb, CheckMethod p_check_method, int p_min_pixel_threshold, int p_max_pixel_threshold, int p_min_alarm_pixels, int p_max_alarm_pixels, const Coord &p_filter_box, int p_min_filter_pixels, int p_max_filter_pixels, int p_min_blob_pixels, int p_max_blob_pixels, int p_min_blobs, int p_max_blobs, int p_overload_frames );
-	void std_alarmedpixels(Image* pdiff_image, const Image* ppoly_image, unsigned int* pixel_count, unsigned int* pixel_sum);
+	void std_alarmedpixels(Image* pdiff_image, unsigned int* pixel_count, unsigned int* pixel_sum);
 	
 public:
 	Zone( Monitor *p_monitor, int p_id, const char *p_label, ZoneType p_type, const Polygon &p_polygon, const Rgb p_alarm_rgb, CheckMethod p_check_method, int p_min_pixel_threshold=15, int p_max_pixel_threshold=0, int p_min_alarm_pixels=50, int p_max_alarm_pixels=75000, const Coord &p_filter_box=Coord( 3, 3 ), int p_min_filter_pixels=50, int p_max_filter_pixels=50000, int p_min_blob_pixels=10, int p_max_blob_pixels=0, int p_min_blobs=0, int p_max_blobs=0, int p_overload_frames=0 )
@@ -122,6 +125,7 @@ public:
 	inline bool IsPreclusive() const { return( type == PRECLUSIVE ); }
 	inline bool IsInactive() const { return( type == INACTIVE ); }
 	inline const Image *AlarmImage() const { return( image ); }
+	inline const Coord &AlarmImageOrigin() const { return( image_origin ); }
 	inline const Polygon &GetPolygon() const { return( polygon ); }
 	inline bool Alarmed() const { return( alarmed ); }
 	inline void SetAlarm() { alarmed = true; }
@@ -156,7 +160,7 @@ public:
     	void SetScore(unsigned int nScore);
     	void SetAlarmImage(const Image* srcImage);
 
-	inline const Image *getPgImage() const { return( pg_image ); }
+	inline const SpanList &getSpans() const { return( spans ); }
 	inline const Range *getRanges() const { return( ranges ); }
 
 };
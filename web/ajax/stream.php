@@ -103,8 +103,9 @@ switch ( $data['type'] )
 {
     case MSG_DATA_WATCH :
     {
-        $data =  unpack( "ltype/imonitor/istate/dfps/ilevel/irate/ddelay/izoom/Cdelayed/Cpaused/Cenabled/Cforced", $msg );
+        $data =  unpack( "ltype/imonitor/istate/dfps/ilevel/irate/ddelay/izoom/Cdelayed/Cpaused/Cenabled/Cforced/isent/idropped/iqueued/iquality/iscale", $msg );
         $data['fps'] = sprintf( "%.2f", $data['fps'] );
+        $data['scale'] = sprintf( "%.2f", $data['scale']/SCALE_BASE );
         $data['rate'] /= RATE_BASE;
         $data['delay'] = sprintf( "%.2f", $data['delay'] );
         $data['zoom'] = sprintf( "%.1f", $data['zoom']/SCALE_BASE );